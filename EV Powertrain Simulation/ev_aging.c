@@ -0,0 +1,292 @@
+#include "ev_aging.h"
+#include "ev_cycle.h"
+#include "ev_integrator.h"
+#include "ev_route.h"
+#include <math.h>
+#include <string.h>
+
+#define GAS_CONSTANT 8.314             // J/(mol·K)
+#define SOC_STEP 10.0                  // %
+#define TEMP_LOW (-30.0)               // °C
+#define TEMP_STEP 5.0                  // °C
+#define CRATE_STEP 0.25                // C
+#define DAY 86400.0                    // s
+#define MONTH_DAYS (365.25 / 12)
+#define CHARGE_STEP 60.0               // s, the charge is integrated at this step
+#define FIRST_DEPARTURE (7.5 * 3600)   // s after midnight
+#define LAST_DEPARTURE (17.5 * 3600)
+
+/// December to February is winter
+static const int season_of_month[12] = { 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 0 };
+
+typedef struct {
+    EVStressHistogram stress;
+    double distance;           // km
+    bool short_day;            // the battery ran out before the day's distance
+    long steps;
+} DayResult;
+
+typedef struct {
+    const EVAgingDuty *duty;
+    const EVSweepRunOptions *options;
+    EVCycle *cycle;            // rewound for every trip
+    EVThermal *thermal;        // soaked to ambient before every trip
+    double nominal;            // kWh
+} Engine;
+
+void ev_aging_params_default(EVAgingParams *params) {
+    /// About 10 % calendar loss after 8 years at 25 °C and half charge, and 15 % cycle loss
+    /// after 1500 full cycles at 1 C
+    params->calendar_rate = 0.0018;
+    params->calendar_activation = 50000;
+    params->calendar_soc = 1.0;
+    params->cycle_rate = 0.0027;
+    params->cycle_exponent = 0.55;
+    params->cycle_activation = 30000;
+    params->plating_activation = 25000;
+    params->cycle_crate = 0.3;
+    params->reference_temp = 25;
+}
+
+void ev_aging_duty_default(EVAgingDuty *duty) {
+    duty->years = 8;
+    duty->daily_distance = 10;
+    duty->trips = 2;
+    duty->charge_soc = 90;
+    duty->charge_power = 11;
+    duty->season_ambient[0] = 2;
+    duty->season_ambient[1] = 12;
+    duty->season_ambient[2] = 22;
+    duty->season_ambient[3] = 12;
+    duty->resim_fade = 0.01;
+}
+
+static double arrhenius(double activation, double temp, double reference) {
+    return exp(activation / GAS_CONSTANT * (1 / (reference + 273.15) - 1 / (temp + 273.15)));
+}
+
+double ev_aging_calendar_rate(const EVAgingParams *params, double soc, double temp) {
+    return params->calendar_rate * arrhenius(params->calendar_activation, temp, params->reference_temp) *
+           exp(params->calendar_soc * (soc / 100 - 0.5));
+}
+
+double ev_aging_cycle_rate(const EVAgingParams *params, double crate, double temp) {
+    double thermal = temp >= params->reference_temp
+                   ? arrhenius(params->cycle_activation, temp, params->reference_temp)
+                   : arrhenius(-params->plating_activation, temp, params->reference_temp);
+    return params->cycle_rate * thermal * exp(params->cycle_crate * (crate - 1));
+}
+
+static int bin(double value, double low, double width, int count) {
+    double b = floor((value - low) / width);
+    return b < 0 ? 0 : b >= count ? count - 1 : (int)b;
+}
+
+static double bin_centre(int b, double low, double width) {
+    return low + (b + 0.5) * width;
+}
+
+void ev_stress_clear(EVStressHistogram *stress) {
+    memset(stress, 0, sizeof(*stress));
+}
+
+void ev_stress_add_time(EVStressHistogram *stress, double soc, double temp, double seconds) {
+    stress->time[bin(soc, 0, SOC_STEP, EV_STRESS_SOC_BINS)][bin(temp, TEMP_LOW, TEMP_STEP, EV_STRESS_TEMP_BINS)] +=
+        seconds;
+}
+
+void ev_stress_add_throughput(EVStressHistogram *stress, double crate, double temp, double cycles) {
+    stress->throughput[bin(crate, 0, CRATE_STEP, EV_STRESS_CRATE_BINS)]
+                      [bin(temp, TEMP_LOW, TEMP_STEP, EV_STRESS_TEMP_BINS)] += cycles;
+}
+
+static double stress_cycles(const EVStressHistogram *stress) {
+    double cycles = 0;
+    for (int c = 0; c < EV_STRESS_CRATE_BINS; c++) {
+        for (int t = 0; t < EV_STRESS_TEMP_BINS; t++) cycles += stress->throughput[c][t];
+    }
+    return cycles;
+}
+
+void ev_aging_advance(const EVAgingParams *params, EVAgingState *state, const EVStressHistogram *day, double days) {
+    double time = 0, calendar = 0;
+    for (int s = 0; s < EV_STRESS_SOC_BINS; s++) {
+        for (int t = 0; t < EV_STRESS_TEMP_BINS; t++) {
+            double seconds = day->time[s][t];
+            if (seconds <= 0) continue;
+            time += seconds;
+            calendar += seconds * ev_aging_calendar_rate(params, bin_centre(s, 0, SOC_STEP),
+                                                         bin_centre(t, TEMP_LOW, TEMP_STEP));
+        }
+    }
+    if (time > 0 && calendar > 0) {
+        double k = calendar / time;    // per √day over the day's mix of operating points
+        double equivalent = state->calendar_loss / k;
+        state->calendar_loss = k * sqrt(equivalent * equivalent + days);
+    }
+    double cycles = 0, cycling = 0;
+    for (int c = 0; c < EV_STRESS_CRATE_BINS; c++) {
+        for (int t = 0; t < EV_STRESS_TEMP_BINS; t++) {
+            double n = day->throughput[c][t];
+            if (n <= 0) continue;
+            cycles += n;
+            cycling += n * ev_aging_cycle_rate(params, bin_centre(c, 0, CRATE_STEP), bin_centre(t, TEMP_LOW, TEMP_STEP));
+        }
+    }
+    if (cycles > 0 && cycling > 0) {
+        double k = cycling / cycles;
+        double z = params->cycle_exponent;
+        double equivalent = pow(state->cycle_loss / k, 1 / z);
+        state->cycle_loss = k * pow(equivalent + cycles * days, z);
+    }
+}
+
+/// Drives until distance (km) more is covered, the battery is empty or the options' time cap
+/// passes, recording every step. Returns the time taken (s)
+static double drive_trip(Engine *engine, EVSimulation *sim, double distance, DayResult *result) {
+    const EVSweepRunOptions *options = engine->options;
+    EVCycle *cycle = engine->cycle;
+    if (cycle && !ev_cycle_rewind(cycle)) return 0;
+    EVIntegrator integrator;
+    ev_integrator_init(&integrator, options->solver);
+    integrator.rtol = options->rtol;
+    bool adaptive = ev_solver_is_adaptive(options->solver);
+    EVInput input = { 0 };
+    double start = sim->distance, t = 0;
+    while (sim->distance - start < distance && sim->soc > 0 && t < options->max_time) {
+        double h = options->dt;
+        if (cycle) {
+            if (!ev_cycle_driver_input(cycle, sim, t, &input)) break;
+        } else {
+            input.acceleration = ev_profile_accel(&options->profile, t) * sim->vehicle.aggressiveness;
+            if (adaptive) h = ev_profile_next_change(&options->profile, t) - t;
+        }
+        if (adaptive && t + h > options->max_time) h = options->max_time - t;
+        double energy = sim->energy_consumed;
+        double taken = ev_integrator_advance(&integrator, sim, &input, h);
+        double drawn = sim->energy_consumed - energy;     // kWh, negative while regenerating
+        ev_stress_add_time(&result->stress, sim->soc, sim->battery_temp, taken);
+        ev_stress_add_throughput(&result->stress, fabs(drawn) * 3600 / taken / sim->battery_capacity,
+                                 sim->battery_temp, fabs(drawn) / (2 * engine->nominal));
+        t += taken;
+        result->steps++;
+    }
+    result->distance += sim->distance - start;
+    return t;
+}
+
+static void set_soc(EVSimulation *sim, double soc) {
+    sim->energy_consumed = (1 - soc / 100) * sim->battery_capacity;
+    sim->soc = soc;
+}
+
+/// One day at full resolution: parked at ambient until each departure, the trips, then a
+/// constant-power charge back to the target and parked again until midnight
+static void simulate_day(Engine *engine, const EVSimulation *base, double capacity, double ambient,
+                         DayResult *result) {
+    const EVAgingDuty *duty = engine->duty;
+    memset(result, 0, sizeof(*result));
+    EVSimulation sim = *base;
+    sim.battery_capacity = capacity;
+    sim.vehicle.air_density = ev_air_density(0, ambient);
+    sim.pack = NULL;
+    sim.thermal = engine->thermal;
+    if (engine->thermal) engine->thermal->params.ambient_temp = ambient;
+    ev_sim_reset(&sim);
+    sim.is_running = true;
+    set_soc(&sim, duty->charge_soc);
+    double clock = 0;          // s since midnight
+    double trip = duty->daily_distance / duty->trips;
+    for (int j = 0; j < duty->trips && sim.soc > 0; j++) {
+        double departure = duty->trips == 1 ? FIRST_DEPARTURE
+                         : FIRST_DEPARTURE + (LAST_DEPARTURE - FIRST_DEPARTURE) * j / (duty->trips - 1);
+        if (departure > clock) {
+            ev_stress_add_time(&result->stress, sim.soc, ambient, departure - clock);
+            clock = departure;
+        }
+        /// Soaked to ambient, within the scalar model's range
+        sim.battery_temp = ambient < 10 ? 10 : ambient > 70 ? 70 : ambient;
+        if (engine->thermal) ev_thermal_reset(engine->thermal, NULL);
+        sim.vehicle_speed = 0;
+        clock += drive_trip(engine, &sim, trip, result);
+    }
+    result->short_day = result->distance < duty->daily_distance - 1e-6;
+    double crate = duty->charge_power / capacity;
+    while (sim.soc < duty->charge_soc && duty->charge_power > 0) {
+        double energy = (duty->charge_soc - sim.soc) / 100 * capacity;
+        double seconds = fmin(CHARGE_STEP, energy / duty->charge_power * 3600);
+        double charged = duty->charge_power * seconds / 3600;
+        ev_stress_add_time(&result->stress, sim.soc, ambient, seconds);
+        ev_stress_add_throughput(&result->stress, crate, ambient, charged / (2 * engine->nominal));
+        set_soc(&sim, seconds < CHARGE_STEP ? duty->charge_soc : sim.soc + charged / capacity * 100);
+        clock += seconds;
+    }
+    if (clock < DAY) ev_stress_add_time(&result->stress, sim.soc, ambient, DAY - clock);
+}
+
+int ev_aging_run(const EVAgingParams *params, const EVAgingDuty *duty, const EVSimulation *base,
+                 const EVSweepRunOptions *options, EVAgingCallback callback, void *user_data,
+                 EVAgingSummary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    if (options->pack_series > 0 || duty->trips < 1 || base->battery_capacity <= 0) return -1;
+    Engine engine = { .duty = duty, .options = options, .nominal = base->battery_capacity };
+    if (options->cycle_name || options->cycle_path) {
+        engine.cycle = options->cycle_path ? ev_cycle_open_csv(options->cycle_path)
+                                           : ev_cycle_open_builtin(options->cycle_name);
+        if (!engine.cycle) return -1;
+        ev_cycle_set_repeat(engine.cycle, true);
+    }
+    if (options->thermal) {
+        EVThermalParams thermal_params;
+        ev_thermal_params_default(&thermal_params);
+        thermal_params.coolant_flow = options->coolant_flow;
+        if (!(engine.thermal = ev_thermal_new(&thermal_params, NULL))) {
+            ev_cycle_close(engine.cycle);
+            return -1;
+        }
+    }
+    DayResult days[EV_SEASONS];
+    EVAgingState state = { 0, 0 };
+    double capacity = engine.nominal, simulated_at = 0, cycles = 0;
+    bool simulate = true;
+    int months = (int)(duty->years * 12 + 0.5);
+    for (int m = 0; m < months; m++) {
+        bool resimulated = simulate;
+        if (simulate) {
+            for (int s = 0; s < EV_SEASONS; s++) {
+                simulate_day(&engine, base, capacity, duty->season_ambient[s], &days[s]);
+                summary->steps += days[s].steps;
+            }
+            simulated_at = capacity;
+            summary->simulations++;
+            simulate = false;
+        }
+        const DayResult *day = &days[season_of_month[m % 12]];
+        ev_aging_advance(params, &state, &day->stress, MONTH_DAYS);
+        cycles += stress_cycles(&day->stress) * MONTH_DAYS;
+        if (day->short_day) summary->short_days += MONTH_DAYS;
+        double soh = 1 - state.calendar_loss - state.cycle_loss;
+        capacity = engine.nominal * (soh > 0 ? soh : 0);
+        if (callback) {
+            EVAgingStep step = {
+                .month = m + 1,
+                .years = (m + 1) / 12.0,
+                .state = state,
+                .soh = soh,
+                .capacity = capacity,
+                .equivalent_cycles = cycles,
+                .resimulated = resimulated
+            };
+            callback(&step, user_data);
+        }
+        if ((simulated_at - capacity) / engine.nominal >= duty->resim_fade) simulate = true;
+    }
+    summary->state = state;
+    summary->soh = 1 - state.calendar_loss - state.cycle_loss;
+    summary->capacity = capacity;
+    summary->equivalent_cycles = cycles;
+    summary->months = months;
+    ev_thermal_free(engine.thermal);
+    ev_cycle_close(engine.cycle);
+    return 0;
+}
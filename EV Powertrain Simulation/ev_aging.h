@@ -0,0 +1,105 @@
+#ifndef EV_AGING_H
+#define EV_AGING_H
+
+#include <stdbool.h>
+#include "ev_sim.h"
+#include "ev_sweep.h"
+
+#define EV_STRESS_SOC_BINS 10          // 10 % wide
+#define EV_STRESS_TEMP_BINS 21         // 5 °C wide from -30 °C to 75 °C, the ends open
+#define EV_STRESS_CRATE_BINS 16        // 0.25 C wide up to 4 C, the last open
+#define EV_SEASONS 4                   // winter, spring, summer, autumn
+
+/// Semi-empirical fade laws: calendar loss grows with √time, cycle loss with equivalent full
+/// cycles (EFC, throughput over twice the nominal capacity) to cycle_exponent. Both rates are
+/// Arrhenius in temperature; calendar loss speeds up with SOC, cycle loss with C-rate and, below
+/// the reference temperature, with lithium plating
+typedef struct {
+    double calendar_rate;      // loss per √day at the reference temperature and 50 % SOC
+    double calendar_activation;// J/mol
+    double calendar_soc;       // exponent per unit SOC about 50 %
+    double cycle_rate;         // loss per EFC^cycle_exponent at the reference temperature and 1 C
+    double cycle_exponent;
+    double cycle_activation;   // J/mol, above the reference temperature
+    double plating_activation; // J/mol, below it
+    double cycle_crate;        // exponent per C above 1 C
+    double reference_temp;     // °C
+} EVAgingParams;
+
+/// Time and throughput by operating point over one day
+typedef struct {
+    double time[EV_STRESS_SOC_BINS][EV_STRESS_TEMP_BINS];          // s at each SOC and temperature
+    double throughput[EV_STRESS_CRATE_BINS][EV_STRESS_TEMP_BINS];  // EFC at each C-rate and temperature
+} EVStressHistogram;
+
+/// Capacity lost so far, shares of the nominal capacity
+typedef struct {
+    double calendar_loss;
+    double cycle_loss;
+} EVAgingState;
+
+/// What a day of use looks like
+typedef struct {
+    double years;              // horizon
+    double daily_distance;     // km, split evenly over the trips
+    int trips;                 // per day, leaving evenly from 07:30 to 17:30
+    double charge_soc;         // %, charged back to after the last trip and held overnight
+    double charge_power;       // kW into the battery
+    double season_ambient[EV_SEASONS];   // °C, parked battery and air (density) temperature
+    double resim_fade;         // share of nominal capacity lost since the representative days
+                               // were last simulated that has them simulated again
+} EVAgingDuty;
+
+/// One aging step of the engine, a calendar month
+typedef struct {
+    int month;                 // from 1
+    double years;
+    EVAgingState state;
+    double soh;                // 0.0 to 1.0
+    double capacity;           // kWh
+    double equivalent_cycles;  // EFC so far
+    bool resimulated;          // the representative days were simulated at this capacity
+} EVAgingStep;
+
+typedef struct {
+    EVAgingState state;
+    double soh;
+    double capacity;           // kWh at the horizon, what battery_capacity was last set to
+    double equivalent_cycles;
+    int months;
+    int simulations;           // times the representative days were simulated
+    long steps;                // physics steps over every simulated day
+    double short_days;         // days whose distance the battery could not cover
+} EVAgingSummary;
+
+/// Called once per month, in order
+typedef void (*EVAgingCallback)(const EVAgingStep *step, void *user_data);
+
+void ev_aging_params_default(EVAgingParams *params);
+void ev_aging_duty_default(EVAgingDuty *duty);
+
+/// Loss per √day (calendar) or per EFC^cycle_exponent (cycle) at one operating point
+double ev_aging_calendar_rate(const EVAgingParams *params, double soc, double temp);
+double ev_aging_cycle_rate(const EVAgingParams *params, double crate, double temp);
+
+void ev_stress_clear(EVStressHistogram *stress);
+/// soc in %, temp in °C
+void ev_stress_add_time(EVStressHistogram *stress, double soc, double temp, double seconds);
+void ev_stress_add_throughput(EVStressHistogram *stress, double crate, double temp, double cycles);
+
+/// Integrates the fade laws over days repeating the daily stress. The laws are solved in
+/// equivalent time (and throughput): the time at this stress that would have caused the loss so
+/// far, plus days. That is exact for stress held constant, so a month is a single step
+void ev_aging_advance(const EVAgingParams *params, EVAgingState *state, const EVStressHistogram *day, double days);
+
+/// Multi-rate engine. Simulates one representative day per season at full resolution with
+/// the options' solver, cycle or profile, collecting stress histograms from soc, battery_temp
+/// and battery power, then ages month by month from those histograms. Each time the capacity
+/// fades by duty->resim_fade more, battery_capacity is cut to it and the days are simulated
+/// again, since a smaller battery swings SOC further and runs at higher C-rates.
+/// options->pack_series must be 0. Returns 0 on success
+int ev_aging_run(const EVAgingParams *params, const EVAgingDuty *duty, const EVSimulation *base,
+                 const EVSweepRunOptions *options, EVAgingCallback callback, void *user_data,
+                 EVAgingSummary *summary);
+
+#endif
@@ -0,0 +1,297 @@
+#include "ev_battery.h"
+#include "ev_sim.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define PACK_ARRAYS 12
+#define PACK_LANES 8               // arrays padded to whole cache lines of doubles
+
+/// NMC-like OCV at 25 °C (V), every 5 % SOC
+static const double ocv_25c[EV_OCV_SOC_POINTS] = {
+    3.000, 3.300, 3.420, 3.500, 3.550, 3.580, 3.610, 3.630, 3.650, 3.675, 3.710,
+    3.750, 3.790, 3.830, 3.870, 3.910, 3.950, 4.000, 4.050, 4.110, 4.200
+};
+
+/// Entropic coefficient dOCV/dT (mV/K) at the same SOC points
+static const double ocv_entropic[EV_OCV_SOC_POINTS] = {
+    0.30, 0.25, 0.15, 0.05, -0.05, -0.10, -0.15, -0.15, -0.10, -0.05, 0.00,
+    0.02, 0.05, 0.05, 0.05, 0.03, 0.00, -0.02, -0.05, -0.05, -0.05
+};
+
+/// R0 relative to 25 °C at -20, 0, 20, 40 and 60 °C
+static const double r0_temp_factor[EV_OCV_TEMP_POINTS] = { 3.0, 1.7, 1.05, 0.85, 0.75 };
+
+static void *aligned_block(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, EV_PACK_ALIGN);
+#else
+    return aligned_alloc(EV_PACK_ALIGN, size);
+#endif
+}
+
+static void aligned_block_free(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static inline double clamp_d(double v, double lo, double hi) {
+    v = v > lo ? v : lo;
+    return v < hi ? v : hi;
+}
+
+void ev_pack_params_default(EVPackParams *params, int series, int parallel, double pack_kwh) {
+    double ah = pack_kwh * 1000 / (series * parallel * EV_CELL_NOMINAL_VOLTAGE);
+    params->series = series;
+    params->parallel = parallel;
+    params->capacity_ah = ah;
+    /// Impedances and thermal mass scale with cell size; 42 Ah gives ~0.8 mΩ ohmic
+    params->r0 = 0.035 / ah;
+    params->r1 = 0.015 / ah;
+    params->c1 = 15 / params->r1;          // τ1 = 15 s
+    params->r2 = 0.020 / ah;
+    params->c2 = 400 / params->r2;         // τ2 = 400 s
+    params->thermal_mass = 20 * ah;
+    params->cooling = 0.012 * ah;
+    params->coolant_temp = 25;
+    params->capacity_spread = 0.02;
+    params->resistance_spread = 0.05;
+    params->soc_spread = 0.005;
+    params->temp_spread = 0.5;
+    params->seed = 1;
+}
+
+bool ev_pack_parse_layout(const char *text, int *series, int *parallel) {
+    char sep[2];
+    int s, p, used = 0;
+    if (sscanf(text, "%d%1[sx]%d%n", &s, sep, &p, &used) < 3 || used == 0) return false;
+    /// Only an optional 'p' may follow, so "96s4pp" and "96s4p-x" are rejected
+    if (text[used] == 'p') used++;
+    if (text[used] != '\0') return false;
+    if (s < 1 || p < 1 || s > EV_PACK_MAX_SERIES || p > EV_PACK_MAX_PARALLEL) return false;
+    *series = s;
+    *parallel = p;
+    return true;
+}
+
+/// Box-Muller from the shared splitmix64 stream
+static double gaussian(uint64_t *state) {
+    double u1 = ev_random_uniform(state), u2 = ev_random_uniform(state);
+    return sqrt(-2 * log(u1 > 0 ? u1 : 1e-300)) * cos(2 * M_PI * u2);
+}
+
+static size_t padded_cells(const EVPack *pack) {
+    return (size_t)(pack->cells + PACK_LANES - 1) / PACK_LANES * PACK_LANES;
+}
+
+EVPack *ev_pack_new(const EVPackParams *params) {
+    if (params->series < 1 || params->parallel < 1 || params->capacity_ah <= 0 || params->r0 <= 0 ||
+        (long)params->series * params->parallel > INT_MAX / PACK_ARRAYS) {
+        return NULL;
+    }
+    EVPack *pack = calloc(1, sizeof(EVPack));
+    if (!pack) return NULL;
+    pack->params = *params;
+    pack->cells = params->series * params->parallel;
+    size_t padded = padded_cells(pack);
+    double *block = aligned_block(padded * PACK_ARRAYS * sizeof(double));
+    if (!block) {
+        free(pack);
+        return NULL;
+    }
+    memset(block, 0, padded * PACK_ARRAYS * sizeof(double));
+    double **arrays[PACK_ARRAYS] = {
+        &pack->soc, &pack->v1, &pack->v2, &pack->temp, &pack->current, &pack->sink, &pack->inv_charge,
+        &pack->r0, &pack->reset_soc, &pack->reset_temp, &pack->emf, &pack->conductance
+    };
+    for (int a = 0; a < PACK_ARRAYS; a++) *arrays[a] = block + padded * a;
+    for (int t = 0; t < EV_OCV_TEMP_POINTS; t++) {
+        double delta = EV_OCV_TEMP_MIN + t * EV_OCV_TEMP_STEP - 25;
+        for (int s = 0; s < EV_OCV_SOC_POINTS; s++) {
+            pack->ocv[t][s] = ocv_25c[s] + ocv_entropic[s] * 1e-3 * delta;
+        }
+    }
+    uint64_t state = params->seed;
+    for (int k = 0; k < pack->cells; k++) {
+        double capacity = params->capacity_ah * fmax(1 + params->capacity_spread * gaussian(&state), 0.5);
+        pack->inv_charge[k] = 1 / (capacity * 3600);
+        pack->r0[k] = params->r0 * fmax(1 + params->resistance_spread * gaussian(&state), 0.5);
+        pack->reset_soc[k] = clamp_d(1 - fabs(params->soc_spread * gaussian(&state)), 0, 1);
+        pack->reset_temp[k] = params->coolant_temp + params->temp_spread * gaussian(&state);
+    }
+    ev_pack_reset(pack);
+    return pack;
+}
+
+EVPack *ev_pack_clone(const EVPack *src) {
+    EVPack *pack = ev_pack_new(&src->params);
+    if (pack) ev_pack_copy_state(pack, src);
+    return pack;
+}
+
+bool ev_pack_copy_state(EVPack *dst, const EVPack *src) {
+    if (dst->params.series != src->params.series || dst->params.parallel != src->params.parallel) return false;
+    if (dst == src) return true;
+    memcpy(dst->soc, src->soc, padded_cells(src) * PACK_ARRAYS * sizeof(double));
+    dst->current_total = src->current_total;
+    dst->terminal_voltage = src->terminal_voltage;
+    dst->open_voltage = src->open_voltage;
+    dst->resistance = src->resistance;
+    dst->soc_mean = src->soc_mean;
+    dst->soc_min = src->soc_min;
+    dst->soc_max = src->soc_max;
+    dst->temp_mean = src->temp_mean;
+    dst->temp_min = src->temp_min;
+    dst->temp_max = src->temp_max;
+    dst->heat = src->heat;
+    return true;
+}
+
+void ev_pack_free(EVPack *pack) {
+    if (!pack) return;
+    aligned_block_free(pack->soc);
+    free(pack);
+}
+
+static inline double cell_ocv(const EVPack *pack, double soc, double temp) {
+    double x = clamp_d(soc * (EV_OCV_SOC_POINTS - 1), 0, EV_OCV_SOC_POINTS - 1);
+    double y = clamp_d((temp - EV_OCV_TEMP_MIN) / EV_OCV_TEMP_STEP, 0, EV_OCV_TEMP_POINTS - 1);
+    int i = (int)clamp_d(x, 0, EV_OCV_SOC_POINTS - 2);
+    int j = (int)clamp_d(y, 0, EV_OCV_TEMP_POINTS - 2);
+    double fx = x - i, fy = y - j;
+    const double *low = pack->ocv[j] + i;
+    const double *high = pack->ocv[j + 1] + i;
+    double a = low[0] + (low[1] - low[0]) * fx;
+    double b = high[0] + (high[1] - high[0]) * fx;
+    return a + (b - a) * fy;
+}
+
+static inline double resistance_factor(double temp) {
+    double y = clamp_d((temp - EV_OCV_TEMP_MIN) / EV_OCV_TEMP_STEP, 0, EV_OCV_TEMP_POINTS - 1);
+    int j = (int)clamp_d(y, 0, EV_OCV_TEMP_POINTS - 2);
+    return r0_temp_factor[j] + (r0_temp_factor[j + 1] - r0_temp_factor[j]) * (y - j);
+}
+
+double ev_pack_cell_ocv(const EVPack *pack, double soc, double temp) {
+    return cell_ocv(pack, soc, temp);
+}
+
+/// Cell EMFs and conductances, then the parallel split: every cell of a group sees the group
+/// voltage, and the group currents sum to the pack current
+static void solve_groups(EVPack *pack, double current) {
+    int n = pack->cells, parallel = pack->params.parallel;
+    const double *restrict soc = pack->soc;
+    const double *restrict v1 = pack->v1;
+    const double *restrict v2 = pack->v2;
+    const double *restrict temp = pack->temp;
+    const double *restrict r0 = pack->r0;
+    double *restrict emf = pack->emf;
+    double *restrict conductance = pack->conductance;
+    double *restrict cell_current = pack->current;
+    for (int k = 0; k < n; k++) {
+        emf[k] = cell_ocv(pack, soc[k], temp[k]) - v1[k] - v2[k];
+        conductance[k] = 1 / (r0[k] * resistance_factor(temp[k]));
+    }
+    double terminal = 0, open = 0, resistance = 0;
+    for (int g = 0; g < n; g += parallel) {
+        double sum_g = 0, sum_eg = 0;
+        for (int k = g; k < g + parallel; k++) {
+            sum_g += conductance[k];
+            sum_eg += emf[k] * conductance[k];
+        }
+        double voltage = (sum_eg - current) / sum_g;
+        for (int k = g; k < g + parallel; k++) cell_current[k] = (emf[k] - voltage) * conductance[k];
+        terminal += voltage;
+        open += sum_eg / sum_g;
+        resistance += 1 / sum_g;
+    }
+    pack->current_total = current;
+    pack->terminal_voltage = terminal;
+    pack->open_voltage = open;
+    pack->resistance = resistance;
+}
+
+static void summarize(EVPack *pack) {
+    double soc_sum = 0, soc_min = INFINITY, soc_max = -INFINITY;
+    double temp_sum = 0, temp_min = INFINITY, temp_max = -INFINITY;
+    for (int k = 0; k < pack->cells; k++) {
+        double s = pack->soc[k], t = pack->temp[k];
+        soc_sum += s;
+        temp_sum += t;
+        soc_min = s < soc_min ? s : soc_min;
+        soc_max = s > soc_max ? s : soc_max;
+        temp_min = t < temp_min ? t : temp_min;
+        temp_max = t > temp_max ? t : temp_max;
+    }
+    pack->soc_mean = soc_sum / pack->cells;
+    pack->soc_min = soc_min;
+    pack->soc_max = soc_max;
+    pack->temp_mean = temp_sum / pack->cells;
+    pack->temp_min = temp_min;
+    pack->temp_max = temp_max;
+}
+
+void ev_pack_reset(EVPack *pack) {
+    memcpy(pack->soc, pack->reset_soc, sizeof(double) * pack->cells);
+    memcpy(pack->temp, pack->reset_temp, sizeof(double) * pack->cells);
+    memset(pack->v1, 0, sizeof(double) * pack->cells);
+    memset(pack->v2, 0, sizeof(double) * pack->cells);
+    for (int k = 0; k < pack->cells; k++) pack->sink[k] = pack->params.coolant_temp;
+    pack->heat = 0;
+    solve_groups(pack, 0);
+    summarize(pack);
+}
+
+double ev_pack_current_for_power(const EVPack *pack, double power) {
+    /// P = I (E - R I), the smaller root
+    double e = pack->open_voltage, r = pack->resistance, p = power * 1000;
+    double disc = e * e - 4 * r * p;
+    if (disc <= 0) return e / (2 * r);
+    return (e - sqrt(disc)) / (2 * r);
+}
+
+void ev_pack_step(EVPack *pack, double current, double dt) {
+    const EVPackParams *params = &pack->params;
+    if (dt != pack->decay_dt) {
+        pack->decay_dt = dt;
+        pack->decay1 = exp(-dt / (params->r1 * params->c1));
+        pack->decay2 = exp(-dt / (params->r2 * params->c2));
+    }
+    solve_groups(pack, current);
+    int n = pack->cells;
+    double *restrict soc = pack->soc;
+    double *restrict v1 = pack->v1;
+    double *restrict v2 = pack->v2;
+    double *restrict temp = pack->temp;
+    const double *restrict cell_current = pack->current;
+    const double *restrict inv_charge = pack->inv_charge;
+    const double *restrict conductance = pack->conductance;
+    double d1 = pack->decay1, d2 = pack->decay2;
+    double g1 = params->r1 * (1 - d1), g2 = params->r2 * (1 - d2);
+    double inv_r1 = 1 / params->r1, inv_r2 = 1 / params->r2;
+    const double *restrict sink = pack->sink;
+    double cooling = params->cooling;
+    double heat_k = dt / params->thermal_mass;
+    double heat = 0;
+    /// Exact RC update for a current held over dt; heat is I²R0 plus the branch losses
+    for (int k = 0; k < n; k++) {
+        double i = cell_current[k];
+        double q = i * i / conductance[k] + v1[k] * v1[k] * inv_r1 + v2[k] * v2[k] * inv_r2;
+        heat += q;
+        v1[k] = v1[k] * d1 + g1 * i;
+        v2[k] = v2[k] * d2 + g2 * i;
+        soc[k] = clamp_d(soc[k] - i * dt * inv_charge[k], 0, 1);
+        temp[k] += (q - cooling * (temp[k] - sink[k])) * heat_k;
+    }
+    pack->heat = heat;
+    summarize(pack);
+}
@@ -0,0 +1,103 @@
+#ifndef EV_BATTERY_H
+#define EV_BATTERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EV_PACK_ALIGN 64
+#define EV_PACK_MAX_SERIES 1000        // layouts accepted from the command line and from files
+#define EV_PACK_MAX_PARALLEL 100
+#define EV_CELL_NOMINAL_VOLTAGE 3.7    // V
+#define EV_CELL_MAX_VOLTAGE 4.2        // V, OCV at full charge
+#define EV_OCV_SOC_POINTS 21           // every 5 % SOC
+#define EV_OCV_TEMP_POINTS 5           // -20 to 60 °C in 20 °C steps
+#define EV_OCV_TEMP_MIN -20.0          // °C
+#define EV_OCV_TEMP_STEP 20.0          // °C
+
+/// Second-order Thevenin cell (R0 plus two RC branches) and how cells are wired and spread
+typedef struct {
+    int series;                // cell groups in series
+    int parallel;              // cells per group
+    double capacity_ah;        // Ah per cell
+    double r0;                 // Ω at 25 °C, ohmic
+    double r1;                 // Ω, charge-transfer branch
+    double c1;                 // F
+    double r2;                 // Ω, diffusion branch
+    double c2;                 // F
+    double thermal_mass;       // J/K per cell
+    double cooling;            // W/K per cell to its sink (the coolant, or a thermal network node)
+    double coolant_temp;       // °C
+    double capacity_spread;    // 1σ, share of capacity_ah
+    double resistance_spread;  // 1σ, share of r0
+    double soc_spread;         // 1σ below full charge at reset, 0.0 to 1.0
+    double temp_spread;        // °C, 1σ around coolant_temp at reset
+    uint64_t seed;
+} EVPackParams;
+
+/// series x parallel cells, per-cell state in aligned arrays ordered group by group, so one
+/// pass over the arrays updates the whole pack
+typedef struct {
+    EVPackParams params;
+    int cells;
+    /// Per-cell state
+    double *soc;               // 0.0 to 1.0
+    double *v1;                // V across the first RC branch
+    double *v2;                // V across the second RC branch
+    double *temp;              // °C
+    double *current;           // A, discharge positive
+    double *sink;              // °C, what each cell is cooled toward; coolant_temp unless a
+                               // thermal network writes its module temperatures here
+    /// Per-cell parameters, drawn once from the spreads
+    double *inv_charge;        // 1/(A·s)
+    double *r0;                // Ω at 25 °C
+    double *reset_soc;
+    double *reset_temp;        // °C
+    /// Scratch for the group solve
+    double *emf;               // V, OCV minus the RC branch voltages
+    double *conductance;       // S, 1/R0 at the cell temperature
+    /// OCV(SOC, T) in V, [temperature][soc]
+    double ocv[EV_OCV_TEMP_POINTS][EV_OCV_SOC_POINTS];
+    /// Pack outputs of the last step
+    double current_total;      // A
+    double terminal_voltage;   // V
+    double open_voltage;       // V, series sum of the group EMFs
+    double resistance;         // Ω, series sum of the group resistances
+    double soc_mean;
+    double soc_min;
+    double soc_max;
+    double temp_mean;          // °C
+    double temp_min;           // °C
+    double temp_max;           // °C
+    double heat;               // W dissipated by all cells
+    /// RC decay factors, recomputed when dt changes
+    double decay_dt;           // s
+    double decay1;
+    double decay2;
+} EVPack;
+
+/// Typical NMC traction cells sized so the pack stores pack_kwh at nominal voltage
+void ev_pack_params_default(EVPackParams *params, int series, int parallel, double pack_kwh);
+/// "96s4p" or "96x4"
+bool ev_pack_parse_layout(const char *text, int *series, int *parallel);
+
+EVPack *ev_pack_new(const EVPackParams *params);
+void ev_pack_free(EVPack *pack);
+/// Back to the per-cell SOC and temperature drawn at creation, RC branches relaxed
+void ev_pack_reset(EVPack *pack);
+/// New pack with src's parameters, cells and state
+EVPack *ev_pack_clone(const EVPack *src);
+/// Every cell and the pack outputs from src; false unless both have the same layout
+bool ev_pack_copy_state(EVPack *dst, const EVPack *src);
+
+/// Open-circuit voltage of one cell, bilinear in SOC and temperature
+double ev_pack_cell_ocv(const EVPack *pack, double soc, double temp);
+
+/// Pack current (A) that delivers power (kW) at the terminals, from the last step's EMF and
+/// resistance; demands above the pack's maximum power get the maximum-power current
+double ev_pack_current_for_power(const EVPack *pack, double power);
+
+/// Advances every cell by dt with the pack carrying current (A, discharge positive). Cells in
+/// a group share their terminal voltage, so the group current splits by EMF and resistance
+void ev_pack_step(EVPack *pack, double current, double dt);
+
+#endif
@@ -0,0 +1,478 @@
+#include "ev_bench.h"
+#include "ev_integrator.h"
+#include "ev_render.h"
+#include <cairo.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_DT 0.01                  // s, the headless default step
+#define BENCH_RUN_TIME 3600.0          // s of simulated time per long run
+#define BENCH_SAMPLE_PERIOD 0.2        // s between waveform samples, as in the GUI
+
+/// Waveform history sizes drawn into the offscreen surface: the GUI's default WAVE_POINTS
+/// view, then 10x steps up to a view spanning most of an 11 h session
+static const long draw_points[] = { 200, 2000, 20000, 200000 };
+
+/// Runs the benchmarked operation iterations times
+typedef void (*BenchBody)(void *ctx, long iterations);
+
+typedef struct {
+    EVSimulation sim;
+    EVIntegrator integrator;
+    EVInput input;
+    long steps;
+} StepBench;
+
+typedef struct {
+    EVSimulation sim;
+} RunBench;
+
+typedef struct {
+    cairo_t *cr;
+    EVWaveView view;
+    int width;
+    int height;
+} DrawBench;
+
+/// Each frame appends a sample and draws from the retained layers, following the newest
+typedef struct {
+    cairo_t *cr;
+    EVWaveLayers layers;
+    EVWaveHistory history;
+    EVWaveView view;
+    EVSimulation sim;
+    EVInput input;
+    double time;               // s
+    int width;
+    int height;
+} ScrollBench;
+
+typedef struct {
+    EVSimulation sim;
+    EVStatusText text;
+    long updates;
+} TextBench;
+
+void ev_bench_options_init(EVBenchOptions *options) {
+    options->min_time = 0.2;
+    options->repeat = 5;
+    options->width = 800;
+    options->height = 400;
+    options->filter = NULL;
+}
+
+static double bench_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/// Seconds per iteration: the count is grown until one repetition lasts min_time, then the
+/// median of the repetitions is taken so one preempted repetition does not move the result
+static double measure(BenchBody body, void *ctx, const EVBenchOptions *options, double *spread) {
+    long iterations = 1;
+    double elapsed = 0;
+    for (;;) {
+        double start = bench_seconds();
+        body(ctx, iterations);
+        elapsed = bench_seconds() - start;
+        if (elapsed >= options->min_time * 0.25 || iterations > (1L << 40)) break;
+        iterations *= elapsed > 0 ? (long)fmin(options->min_time * 0.5 / elapsed, 64) + 2 : 64;
+    }
+    iterations = (long)(iterations * options->min_time / (elapsed > 0 ? elapsed : 1e-9)) + 1;
+    double samples[64];
+    int repeat = options->repeat < 1 ? 1 : options->repeat > 64 ? 64 : options->repeat;
+    for (int r = 0; r < repeat; r++) {
+        double start = bench_seconds();
+        body(ctx, iterations);
+        samples[r] = (bench_seconds() - start) / iterations;
+    }
+    qsort(samples, repeat, sizeof(double), compare_doubles);
+    double median = samples[repeat / 2];
+    *spread = median > 0 ? (samples[repeat - 1] - samples[0]) / median : 0;
+    return median;
+}
+
+static bool selected(const EVBenchOptions *options, const char *name) {
+    return !options->filter || strstr(name, options->filter);
+}
+
+static void add_result(EVBenchReport *report, const char *name, const char *unit, double value, double spread,
+                       bool higher_is_better, FILE *progress) {
+    if (report->count >= EV_BENCH_MAX_RESULTS) return;
+    EVBenchResult *result = &report->results[report->count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    snprintf(result->unit, sizeof(result->unit), "%s", unit);
+    result->value = value;
+    result->spread = spread;
+    result->higher_is_better = higher_is_better;
+    if (progress) fprintf(progress, "%-24s %14.3f %-10s ±%.1f %%\n", name, value, unit, spread * 100);
+}
+
+/// Steps the GUI's runner would take, with the acceleration from the default profile and a
+/// reset whenever the battery empties so the model stays in its normal operating range
+static void step_body(void *ctx, long iterations) {
+    StepBench *bench = ctx;
+    for (long i = 0; i < iterations; i++) {
+        if ((bench->steps & 1023) == 0) {
+            bench->input.acceleration = ev_profile_accel(&ev_default_profile, bench->steps * BENCH_DT);
+        }
+        ev_integrator_advance(&bench->integrator, &bench->sim, &bench->input, BENCH_DT);
+        if (bench->sim.soc <= 0) ev_sim_reset(&bench->sim);
+        bench->steps++;
+    }
+}
+
+static void run_body(void *ctx, long iterations) {
+    RunBench *bench = ctx;
+    EVRunSummary summary;
+    for (long i = 0; i < iterations; i++) {
+        ev_sim_reset(&bench->sim);
+        ev_sim_run(&bench->sim, &ev_default_profile, BENCH_DT, BENCH_RUN_TIME, false, &summary);
+    }
+}
+
+static void draw_body(void *ctx, long iterations) {
+    DrawBench *bench = ctx;
+    for (long i = 0; i < iterations; i++) {
+        ev_render_waveforms(bench->cr, &bench->view, bench->width, bench->height);
+    }
+    cairo_surface_flush(cairo_get_target(bench->cr));
+}
+
+static void text_body(void *ctx, long iterations) {
+    TextBench *bench = ctx;
+    for (long i = 0; i < iterations; i++) {
+        /// Changing values, as while driving; formatting cost depends on the digits
+        bench->sim.vehicle_speed = (bench->updates & 127) * 1.37;
+        bench->sim.distance = bench->updates * 0.001;
+        ev_status_text_format(&bench->text, &bench->sim);
+        bench->updates++;
+    }
+}
+
+static void bench_step(EVBenchReport *report, const EVBenchOptions *options, FILE *progress, const char *name,
+                       EVSolver solver, const EVMotorMap *map, EVPack *pack, EVThermal *thermal,
+                       const EVRoute *route) {
+    if (!selected(options, name)) return;
+    StepBench bench = { 0 };
+    ev_sim_init(&bench.sim);
+    bench.sim.regen_braking = true;
+    bench.sim.motor_map = map;
+    bench.sim.pack = pack;
+    bench.sim.thermal = thermal;
+    bench.sim.route = route;
+    ev_sim_reset(&bench.sim);
+    ev_integrator_init(&bench.integrator, solver);
+    double spread;
+    double seconds = measure(step_body, &bench, options, &spread);
+    add_result(report, name, "ns/step", seconds * 1e9, spread, false, progress);
+}
+
+static void bench_physics(EVBenchReport *report, const EVBenchOptions *options, FILE *progress) {
+    static const char *const solver_benches[EV_SOLVER_COUNT] = {
+        [EV_SOLVER_EULER] = "step_euler",
+        [EV_SOLVER_RK4] = "step_rk4",
+        [EV_SOLVER_RK45] = "step_rk45",
+        [EV_SOLVER_SEMI_IMPLICIT] = "step_semi_implicit"
+    };
+    for (int s = 0; s < EV_SOLVER_COUNT; s++) {
+        bench_step(report, options, progress, solver_benches[s], (EVSolver)s, NULL, NULL, NULL, NULL);
+    }
+    if (selected(options, "step_motor_map")) {
+        EVMotorMap *map = ev_motor_map_open("pmsm");
+        if (map) bench_step(report, options, progress, "step_motor_map", EV_SOLVER_EULER, map, NULL, NULL, NULL);
+        ev_motor_map_free(map);
+    }
+    EVPackParams pack_params;
+    ev_pack_params_default(&pack_params, 96, 4, 60);
+    if (selected(options, "step_pack_96s4p")) {
+        EVPack *pack = ev_pack_new(&pack_params);
+        if (pack) bench_step(report, options, progress, "step_pack_96s4p", EV_SOLVER_EULER, NULL, pack, NULL, NULL);
+        ev_pack_free(pack);
+    }
+    if (selected(options, "step_thermal")) {
+        EVThermalParams thermal_params;
+        ev_thermal_params_default(&thermal_params);
+        EVThermal *thermal = ev_thermal_new(&thermal_params, NULL);
+        if (thermal) bench_step(report, options, progress, "step_thermal", EV_SOLVER_EULER, NULL, NULL, thermal, NULL);
+        ev_thermal_free(thermal);
+    }
+    if (selected(options, "step_route")) {
+        EVRouteParams route_params;
+        ev_route_params_default(&route_params);
+        EVRoute *route = ev_route_open("delivery", &route_params);
+        if (route) bench_step(report, options, progress, "step_route", EV_SOLVER_EULER, NULL, NULL, NULL, route);
+        ev_route_free(route);
+    }
+    /// One whole run per kernel, so the per-run kernel choice is what gets measured
+    static const char *const drivetrains[] = {
+        "single", "2speed", "dual", "dual,split=rear-first", "dual,split=optimal"
+    };
+    EVMotorMap *map = NULL;
+    for (size_t d = 0; d < sizeof(drivetrains) / sizeof(drivetrains[0]); d++) {
+        RunBench bench;
+        ev_sim_init(&bench.sim);
+        if (!ev_drivetrain_parse(drivetrains[d], &bench.sim.drivetrain)) continue;
+        char name[EV_BENCH_NAME_LENGTH];
+        EVDrivetrainKernel kernel = ev_drivetrain_kernel(&bench.sim.drivetrain);
+        snprintf(name, sizeof(name), "drivetrain_%s", ev_drivetrain_kernel_name(kernel));
+        if (!selected(options, name) || (!map && !(map = ev_motor_map_open("pmsm")))) continue;
+        bench.sim.regen_braking = true;
+        bench.sim.motor_map = map;
+        double spread;
+        double seconds = measure(run_body, &bench, options, &spread);
+        add_result(report, name, "ns/step", seconds / floor(BENCH_RUN_TIME / BENCH_DT + 0.5) * 1e9, spread, false,
+                   progress);
+    }
+    ev_motor_map_free(map);
+    if (selected(options, "run_steps_per_s")) {
+        RunBench bench;
+        ev_sim_init(&bench.sim);
+        bench.sim.regen_braking = true;
+        double spread;
+        double seconds = measure(run_body, &bench, options, &spread);
+        double steps = floor(BENCH_RUN_TIME / BENCH_DT + 0.5);
+        add_result(report, "run_steps_per_s", "steps/s", steps / seconds, spread, true, progress);
+    }
+}
+
+/// Steps one sample period and appends the sample, as the GUI samples a run
+static bool append_sample(EVWaveHistory *history, EVSimulation *sim, EVInput *input, double *t) {
+    input->acceleration = ev_profile_accel(&ev_default_profile, *t);
+    ev_sim_step(sim, input, BENCH_SAMPLE_PERIOD);
+    if (sim->soc <= 0) ev_sim_reset(sim);
+    *t += BENCH_SAMPLE_PERIOD;
+    double values[EV_WAVE_CHANNELS];
+    values[EV_WAVE_VOLTAGE] = sim->battery_voltage;
+    values[EV_WAVE_CURRENT] = sim->battery_current;
+    values[EV_WAVE_SPEED] = sim->vehicle_speed;
+    values[EV_WAVE_TEMP] = sim->battery_temp;
+    return ev_wave_history_append(history, values);
+}
+
+/// A whole run's history
+static bool fill_history(EVWaveHistory *history, long samples, EVSimulation *sim) {
+    ev_sim_init(sim);
+    sim->regen_braking = true;
+    EVInput input = { 0 };
+    double t = 0;
+    for (long i = 0; i < samples; i++) {
+        if (!append_sample(history, sim, &input, &t)) return false;
+    }
+    return true;
+}
+
+static void scroll_body(void *ctx, long iterations) {
+    ScrollBench *bench = ctx;
+    for (long i = 0; i < iterations; i++) {
+        append_sample(&bench->history, &bench->sim, &bench->input, &bench->time);
+        ev_render_waveforms_retained(bench->cr, &bench->layers, &bench->view, bench->width, bench->height, 1);
+    }
+    cairo_surface_flush(cairo_get_target(bench->cr));
+}
+
+static void bench_render(EVBenchReport *report, const EVBenchOptions *options, FILE *progress) {
+    int count = sizeof(draw_points) / sizeof(draw_points[0]);
+    bool any = false;
+    for (int i = 0; i < count; i++) {
+        char name[EV_BENCH_NAME_LENGTH];
+        snprintf(name, sizeof(name), "draw_points_%ld", draw_points[i]);
+        if (selected(options, name)) any = true;
+        snprintf(name, sizeof(name), "scroll_points_%ld", draw_points[i]);
+        if (selected(options, name)) any = true;
+    }
+    if (!any) return;
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, options->width, options->height);
+    cairo_t *cr = cairo_create(surface);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS || cairo_status(cr) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Failed to create a %dx%d render surface\n", options->width, options->height);
+        cairo_destroy(cr);
+        cairo_surface_destroy(surface);
+        return;
+    }
+    EVWaveHistory history;
+    ev_wave_history_init(&history);
+    EVSimulation sim;
+    for (int i = 0; i < count; i++) {
+        char name[EV_BENCH_NAME_LENGTH];
+        snprintf(name, sizeof(name), "draw_points_%ld", draw_points[i]);
+        if (!selected(options, name)) continue;
+        /// Histories only grow, so the next size appends to the previous one's samples
+        if (!fill_history(&history, draw_points[i] - history.samples, &sim)) break;
+        DrawBench bench = {
+            .cr = cr,
+            .view = { .history = &history, .span = draw_points[i], .end = -1 },
+            .width = options->width,
+            .height = options->height
+        };
+        ev_wave_view_fit(&bench.view, &sim);
+        double spread;
+        double seconds = measure(draw_body, &bench, options, &spread);
+        add_result(report, name, "us/frame", seconds * 1e6, spread, false, progress);
+    }
+    ev_wave_history_free(&history);
+    for (int i = 0; i < count; i++) {
+        char name[EV_BENCH_NAME_LENGTH];
+        snprintf(name, sizeof(name), "scroll_points_%ld", draw_points[i]);
+        if (!selected(options, name)) continue;
+        /// Own history, grown by every frame measured
+        ScrollBench *bench = calloc(1, sizeof(*bench));
+        if (!bench) break;
+        bench->cr = cr;
+        bench->width = options->width;
+        bench->height = options->height;
+        ev_wave_layers_init(&bench->layers);
+        ev_wave_history_init(&bench->history);
+        bool filled = fill_history(&bench->history, draw_points[i], &bench->sim);
+        bench->time = draw_points[i] * BENCH_SAMPLE_PERIOD;
+        bench->view = (EVWaveView){ .history = &bench->history, .span = draw_points[i], .end = -1 };
+        ev_wave_view_fit(&bench->view, &bench->sim);
+        if (filled) {
+            double spread;
+            double seconds = measure(scroll_body, bench, options, &spread);
+            add_result(report, name, "us/frame", seconds * 1e6, spread, false, progress);
+        }
+        ev_wave_layers_free(&bench->layers);
+        ev_wave_history_free(&bench->history);
+        free(bench);
+        if (!filled) break;
+    }
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+}
+
+static void bench_labels(EVBenchReport *report, const EVBenchOptions *options, FILE *progress) {
+    if (!selected(options, "status_text")) return;
+    TextBench bench = { 0 };
+    ev_sim_init(&bench.sim);
+    double spread;
+    double seconds = measure(text_body, &bench, options, &spread);
+    add_result(report, "status_text", "ns/update", seconds * 1e9, spread, false, progress);
+}
+
+void ev_bench_run(EVBenchReport *report, const EVBenchOptions *options, FILE *progress) {
+    memset(report, 0, sizeof(*report));
+    bench_physics(report, options, progress);
+    bench_render(report, options, progress);
+    bench_labels(report, options, progress);
+}
+
+bool ev_bench_write_json(const EVBenchReport *report, FILE *out) {
+    fprintf(out, "{\n  \"format\": %d,\n  \"results\": [\n", EV_BENCH_FORMAT);
+    for (int i = 0; i < report->count; i++) {
+        const EVBenchResult *result = &report->results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.6g, \"spread\": %.4f, \"better\": \"%s\"}%s\n",
+                result->name, result->unit, result->value, result->spread,
+                result->higher_is_better ? "higher" : "lower", i + 1 < report->count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return !ferror(out);
+}
+
+/// Copies the string value of "key" found at or after text into buf; returns the position
+/// after it, NULL when the key is missing
+static const char *json_string(const char *text, const char *key, char *buf, size_t size) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    const char *p = strstr(text, pattern);
+    if (!p) return NULL;
+    p = strchr(p + strlen(pattern), '"');
+    if (!p) return NULL;
+    const char *end = strchr(++p, '"');
+    if (!end) return NULL;
+    size_t length = (size_t)(end - p) < size - 1 ? (size_t)(end - p) : size - 1;
+    memcpy(buf, p, length);
+    buf[length] = '\0';
+    return end + 1;
+}
+
+static const char *json_number(const char *text, const char *key, double *value) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    const char *p = strstr(text, pattern);
+    if (!p) return NULL;
+    p = strchr(p + strlen(pattern), ':');
+    if (!p) return NULL;
+    char *end;
+    *value = strtod(p + 1, &end);
+    return end == p + 1 ? NULL : end;
+}
+
+/// Only reads what ev_bench_write_json() writes: one object per result, keys in its order
+bool ev_bench_read_json(EVBenchReport *report, const char *path) {
+    memset(report, 0, sizeof(*report));
+    FILE *in = fopen(path, "rb");
+    if (!in) return false;
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char *text = size > 0 ? malloc(size + 1) : NULL;
+    bool ok = text && fread(text, 1, size, in) == (size_t)size;
+    fclose(in);
+    if (!ok) {
+        free(text);
+        return false;
+    }
+    text[size] = '\0';
+    double format;
+    if (!json_number(text, "format", &format) || (int)format != EV_BENCH_FORMAT) {
+        free(text);
+        return false;
+    }
+    const char *p = text;
+    while (report->count < EV_BENCH_MAX_RESULTS) {
+        EVBenchResult *result = &report->results[report->count];
+        char better[16];
+        if (!(p = json_string(p, "name", result->name, sizeof(result->name)))) break;
+        if (!(p = json_string(p, "unit", result->unit, sizeof(result->unit)))) break;
+        if (!(p = json_number(p, "value", &result->value))) break;
+        if (!(p = json_number(p, "spread", &result->spread))) break;
+        if (!(p = json_string(p, "better", better, sizeof(better)))) break;
+        result->higher_is_better = strcmp(better, "higher") == 0;
+        report->count++;
+    }
+    free(text);
+    return true;
+}
+
+static const EVBenchResult *find_result(const EVBenchReport *report, const char *name) {
+    for (int i = 0; i < report->count; i++) {
+        if (strcmp(report->results[i].name, name) == 0) return &report->results[i];
+    }
+    return NULL;
+}
+
+int ev_bench_compare(const EVBenchReport *report, const EVBenchReport *baseline, double threshold,
+                     FILE *out) {
+    int regressions = 0;
+    fprintf(out, "%-24s %14s %14s %-10s %9s\n", "benchmark", "baseline", "current", "unit", "change");
+    for (int i = 0; i < report->count; i++) {
+        const EVBenchResult *result = &report->results[i];
+        const EVBenchResult *base = find_result(baseline, result->name);
+        if (!base || base->value <= 0 || strcmp(base->unit, result->unit) != 0) {
+            fprintf(out, "%-24s %14s %14.3f %-10s %9s\n", result->name, "-", result->value, result->unit, "new");
+            continue;
+        }
+        /// Slowdown as a ratio > 1 whichever direction is better
+        double slowdown = result->higher_is_better ? base->value / result->value : result->value / base->value;
+        bool worse = slowdown > 1 + threshold;
+        regressions += worse;
+        fprintf(out, "%-24s %14.3f %14.3f %-10s %+8.1f%%%s\n", result->name, base->value, result->value,
+                result->unit, (result->value / base->value - 1) * 100, worse ? "  REGRESSION" : "");
+    }
+    for (int i = 0; i < baseline->count; i++) {
+        const EVBenchResult *base = &baseline->results[i];
+        if (!find_result(report, base->name)) {
+            fprintf(out, "%-24s %14.3f %14s %-10s %9s\n", base->name, base->value, "-", base->unit, "missing");
+        }
+    }
+    return regressions;
+}
@@ -0,0 +1,49 @@
+#ifndef EV_BENCH_H
+#define EV_BENCH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define EV_BENCH_MAX_RESULTS 32
+#define EV_BENCH_NAME_LENGTH 48
+#define EV_BENCH_FORMAT 1            // bumped when names or units change meaning
+
+typedef struct {
+    char name[EV_BENCH_NAME_LENGTH];
+    char unit[16];
+    double value;              // median over the repetitions
+    double spread;             // (max - min) / median over the repetitions
+    bool higher_is_better;
+} EVBenchResult;
+
+typedef struct {
+    EVBenchResult results[EV_BENCH_MAX_RESULTS];
+    int count;
+} EVBenchReport;
+
+typedef struct {
+    double min_time;           // s per repetition, iteration counts are calibrated to it
+    int repeat;                // repetitions, the median is reported
+    int width;                 // px, offscreen render surface
+    int height;                // px
+    const char *filter;        // substring a benchmark name must contain, NULL runs all
+} EVBenchOptions;
+
+void ev_bench_options_init(EVBenchOptions *options);
+
+/// Physics steps per solver and model, long fixed-dt runs (also one per drivetrain kernel,
+/// with the generated motor map), waveform rendering into an offscreen cairo image surface
+/// at several view sizes, and status text formatting.
+/// progress, when not NULL, gets one line per finished benchmark
+void ev_bench_run(EVBenchReport *report, const EVBenchOptions *options, FILE *progress);
+
+bool ev_bench_write_json(const EVBenchReport *report, FILE *out);
+/// Reads results written by ev_bench_write_json(); false if the file is unreadable
+bool ev_bench_read_json(EVBenchReport *report, const char *path);
+
+/// Prints every benchmark next to its baseline and returns how many got worse by more than
+/// threshold (0.25 is 25 %); benchmarks missing from either side are listed but never fail
+int ev_bench_compare(const EVBenchReport *report, const EVBenchReport *baseline, double threshold,
+                     FILE *out);
+
+#endif
@@ -0,0 +1,2073 @@
+#include "ev_cli.h"
+#include "ev_aging.h"
+#include "ev_bench.h"
+#include "ev_depot.h"
+#include "ev_sim.h"
+#include "ev_cycle.h"
+#include "ev_drivetrain.h"
+#include "ev_fleet.h"
+#include "ev_integrator.h"
+#include "ev_montecarlo.h"
+#include "ev_motor.h"
+#include "ev_perf.h"
+#include "ev_battery.h"
+#include "ev_route.h"
+#include "ev_server.h"
+#include "ev_snapshot.h"
+#include "ev_sweep.h"
+#include "ev_telemetry.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PROFILE_SEGMENTS 64
+#define MAX_PERCENTILES 32
+#define MOTOR_BENCH_BATCH 4096
+
+/// --motor-map: built once, shared read-only by every run and worker, freed on exit
+static EVMotorMap *motor_map = NULL;
+/// --route and the environment options, built once the whole command line is read
+static EVRoute *route = NULL;
+
+/// Options shared by every headless command
+typedef struct {
+    EVSimulation sim;
+    EVProfileSegment segments[MAX_PROFILE_SEGMENTS];
+    EVProfile profile;
+    double dt;                 // s
+    double duration;           // s
+    bool duration_set;
+    bool until_empty;
+    const char *cycle_name;
+    const char *cycle_path;
+    bool cycle_repeat;
+    EVSolver solver;
+    double rtol;               // RK45 relative tolerance
+    int pack_series;           // 0 keeps the constant-voltage battery
+    int pack_parallel;
+    bool thermal;              // lumped thermal network instead of the scalar battery temperature
+    double coolant_flow;       // relative to nominal; < 0 leaves the pump to the thermostat
+    const char *route_spec;    // built-in route or route file; NULL with environment_set is flat
+    EVRouteParams route_params;
+    bool environment_set;      // any of --payload, --trailer, --wind, ...
+} CommonOptions;
+
+typedef struct {
+    CommonOptions common;
+    const char *csv_path;
+    long csv_every;
+    const char *record_path;
+    bool record_compress;
+    bool perf;                 // time every step, print p50/p99 at the end
+    const char *perf_trace_path;
+    double start_time;         // s, where a run continued from a snapshot picks up
+    long start_steps;
+    double stop_distance;      // km, ends the run there (a fork point); <= 0 never
+    bool electrical;           // switching-level inverter and dq motor for the drivetrain efficiency
+} RunOptions;
+
+typedef struct {
+    CommonOptions common;
+    int count;
+    uint64_t seed;
+    const char *configs_path;
+    const char *out_path;
+    EVFleetKernel kernel;
+} FleetOptions;
+
+typedef struct {
+    CommonOptions common;
+    EVSweepSpec spec;
+    int threads;
+    const char *out_path;
+} SweepOptions;
+
+typedef struct {
+    CommonOptions common;
+    EVMonteCarloSpec spec;
+    double percentiles[MAX_PERCENTILES];   // %
+    int percentile_count;
+    int threads;
+    const char *out_path;
+    const char *samples_path;
+} MonteCarloOptions;
+
+typedef struct {
+    CommonOptions common;
+    EVAgingParams params;
+    EVAgingDuty duty;
+    const char *out_path;
+} AgingOptions;
+
+typedef struct {
+    CommonOptions common;
+    EVDepotParams params;
+    const char *out_path;
+} DepotOptions;
+
+/// Inputs a what-if branch changes after the fork; unset fields keep the snapshot's
+typedef struct {
+    char name[64];
+    bool mode_set;
+    DriveMode mode;
+    double regen;              // %, < 0 keeps
+    double power;              // kW, <= 0 keeps
+    double coolant_flow;       // relative, < -1 keeps, < 0 hands back to the thermostat
+} BranchSpec;
+
+typedef struct {
+    CommonOptions common;
+    double at_distance;        // km, end of the shared prefix
+    const char *from_path;     // snapshot to branch from instead of running the prefix
+    const char *save_path;
+    BranchSpec *branches;      // [0] is the unchanged base
+    int branch_count;
+    int branch_capacity;
+    int threads;
+    const char *out_path;
+} ForkOptions;
+
+static void print_usage(void) {
+    fprintf(stderr,
+        "Usage: evsim --headless [run] [options]\n"
+        "       evsim --headless fleet [options]\n"
+        "       evsim --headless sweep [options]\n"
+        "       evsim --headless montecarlo [options]\n"
+        "       evsim --headless aging [options]\n"
+        "       evsim --headless depot [options]\n"
+        "       evsim --headless export FILE [options]\n"
+        "       evsim --headless motor-map [options]\n"
+        "       evsim --headless bench [options]\n"
+        "       evsim --headless fork [options]\n"
+        "       evsim --headless serve [options]\n"
+        "Common options:\n"
+        "  --voltage V         battery voltage, 100-1000 V (default 400)\n"
+        "  --capacity KWH      battery capacity, 10-200 kWh (default 60)\n"
+        "  --power KW          motor power, 50-500 kW (default 150)\n"
+        "  --regen PCT         regen efficiency, 0-100 %% (0 disables regen)\n"
+        "  --mode MODE         eco, normal or sport (default normal)\n"
+        "  --profile SPEC      acceleration schedule \"secs:accel,secs:accel,...\"\n"
+        "  --cycle NAME        follow a built-in drive cycle: nedc, wltc3, udds, hwfet\n"
+        "  --cycle-file FILE   follow a streamed \"time_s,speed_kmh\" CSV trace\n"
+        "  --cycle-repeat      restart the drive cycle when it ends\n"
+        "  --dt S              fixed step (default 0.01 s)\n"
+        "  --duration S        simulated time (default 3600 s, or one pass of a cycle)\n"
+        "  --until-empty       stop early when SOC reaches 0\n"
+        "  --solver S          euler, rk4, rk45 or semi-implicit (default euler; fleet is euler only)\n"
+        "  --rtol R            rk45 relative tolerance (default 1e-6)\n"
+        "  --motor-map MAP     torque-speed efficiency map: pmsm (generated) or a CSV/binary\n"
+        "                      map file (default: flat 0.85; fleet ignores maps)\n"
+        "  --pack SxP          2RC cell-level pack, e.g. 96s4p; sized to --capacity, its\n"
+        "                      voltage replaces --voltage (not for fleet)\n"
+        "  --thermal           thermal network (modules, coolant, motor, inverter) sets the\n"
+        "                      temperatures and derating (not for fleet)\n"
+        "  --coolant-flow F    fixed pump flow, relative to nominal (default: thermostat);\n"
+        "                      implies --thermal\n"
+        "  --route ROUTE       road profile: flat, rolling, pass, delivery or a CSV file of\n"
+        "                      distance_km,elevation_m[,headwind_ms,temp_c,payload_kg]\n"
+        "                      (default: level road, not for fleet)\n"
+        "  --payload KG        cargo where the route has no payload column (default 0)\n"
+        "  --trailer KG        trailer mass (default 0)\n"
+        "  --trailer-cda M2    drag area the trailer adds, Cd x A (default 0)\n"
+        "  --wind MS           headwind where the route has none, negative for a tailwind\n"
+        "  --ambient C         air temperature where the route has none (default 15)\n"
+        "  --route-step M      route table resolution (default 10 m)\n"
+        "  --drivetrain SPEC   single, 2speed, dual or quad, then ,key=value: ratio=R or\n"
+        "                      R1:R2 (first:second, rear:front), shift=KMH, front=PCT of\n"
+        "                      the power, split=fixed|rear-first|optimal or a front PCT,\n"
+        "                      gears=PCT efficiency (default: one motor at 50 RPM per km/h\n"
+        "                      whose efficiency covers the gears; not for fleet)\n"
+        "run:\n"
+        "  --csv FILE          write state trace to FILE\n"
+        "  --every N           write every Nth step to the trace (default 100)\n"
+        "  --record FILE       record every step to a binary telemetry file\n"
+        "  --compress          XOR-delta pack the recorded columns\n"
+        "  --perf              time every step and print p50/p99 step cost\n"
+        "  --perf-trace FILE   also write the last 64k steps as Chrome trace JSON\n"
+        "  --electrical        SVPWM inverter and dq motor stepped at 128 points per PWM\n"
+        "                      period set the drivetrain efficiency (slow: use short runs)\n"
+        "export FILE [options] (binary telemetry to CSV):\n"
+        "  --every N           write every Nth row (default 1)\n"
+        "  --out FILE          output CSV (default stdout)\n"
+        "motor-map:\n"
+        "  --map MAP           pmsm or a map file to load (default pmsm)\n"
+        "  --out FILE          write the map, binary unless FILE ends in .csv\n"
+        "  --bench N           time N batched lookups (default 0)\n"
+        "bench (physics steps, long runs, offscreen waveform rendering, status text):\n"
+        "  --out FILE          results as JSON (default stdout)\n"
+        "  --baseline FILE     compare against earlier JSON results, exit 1 on a regression\n"
+        "  --threshold PCT     slowdown that counts as a regression (default 25)\n"
+        "  --min-time S        time per repetition (default 0.2)\n"
+        "  --repeat N          repetitions, the median is reported (default 5)\n"
+        "  --size WxH          render surface (default 800x400)\n"
+        "  --filter TEXT       only benchmarks whose name contains TEXT\n"
+        "fleet:\n"
+        "  --configs FILE      CSV of voltage,capacity,power,mode,regen_pct per vehicle\n"
+        "  --count N           random configurations when no --configs (default 1024)\n"
+        "  --seed N            seed for random configurations (default 1)\n"
+        "  --kernel K          auto, scalar, avx2 or avx512 (default auto)\n"
+        "  --out FILE          per-vehicle results CSV (default stdout)\n"
+        "serve (batched simulation jobs over a local socket, see ev_server.h):\n"
+        "  --socket PATH       listen on a Unix domain socket\n"
+        "  --port N            listen on 127.0.0.1:N when there is no --socket (default 7878)\n"
+        "  --threads N         worker threads (default: all CPUs)\n"
+        "  --max-inflight N    jobs per client before its socket is no longer read (default 4096)\n"
+        "  --queue N           jobs queued over all clients, likewise (default 65536)\n"
+        "  --fleet-batch N     most jobs coalesced into one fleet run, 1 never coalesces\n"
+        "                      (default 1024)\n"
+        "fork (run to a point once, then continue it under several inputs):\n"
+        "  --at-km KM          end of the shared prefix (default 40)\n"
+        "  --from FILE         branch from a saved snapshot instead of running the prefix;\n"
+        "                      the vehicle, pack, thermal network and solver come from it\n"
+        "  --save FILE         write the snapshot at the fork point\n"
+        "  --branch SPEC       inputs after the fork, e.g. mode=sport,regen=0; keys mode,\n"
+        "                      regen (PCT, 0 disables), power (KW), flow (coolant, -1 for\n"
+        "                      the thermostat); repeatable, an unchanged base always runs\n"
+        "  --branches FILE     one SPEC per line\n"
+        "  --threads N         worker threads (default: all CPUs)\n"
+        "  --out FILE          per-branch results CSV (default stdout)\n"
+        "sweep (every run is driven until the battery is empty or --duration passes,\n"
+        "       drive cycles always repeat):\n"
+        "  --method M          grid or lhs (default grid)\n"
+        "  --samples N         Latin hypercube sample count (default 256)\n"
+        "  --seed N            Latin hypercube seed (default 1)\n"
+        "  --voltage-axis A    MIN:MAX:LEVELS in V (default 100:1000:4)\n"
+        "  --capacity-axis A   MIN:MAX:LEVELS in kWh (default 10:200:4)\n"
+        "  --power-axis A      MIN:MAX:LEVELS in kW (default 50:500:4)\n"
+        "  --regen-axis A      MIN:MAX:LEVELS in %% (default 0:100:3)\n"
+        "  --modes LIST        comma separated drive modes (default eco,normal,sport)\n"
+        "  --split-axis A      MIN:MAX:LEVELS front torque share in %% for a fixed split\n"
+        "                      (dual and quad drivetrains; default: the drivetrain's)\n"
+        "  --splits LIST       comma separated split strategies: fixed, rear-first, optimal\n"
+        "                      (dual and quad drivetrains; default: the drivetrain's)\n"
+        "  --threads N         worker threads (default: all CPUs)\n"
+        "  --out FILE          streamed per-run summaries CSV (default stdout)\n"
+        "montecarlo (sampled vehicles driven like sweep runs; not with --pack or a route):\n"
+        "  --samples N         sample count (default 100000)\n"
+        "  --seed N            Philox key; a sample's inputs depend on the seed and its\n"
+        "                      index only (default 1)\n"
+        "  --mass-dist D       kg (default normal:1500:75)\n"
+        "  --drag-dist D       drag coefficient (default normal:0.3:0.015)\n"
+        "  --rolling-dist D    rolling resistance (default uniform:0.008:0.012)\n"
+        "  --regen-dist D      regen efficiency in %% (default uniform:40:60)\n"
+        "  --ambient-dist D    air temperature in C, sets the air density and the\n"
+        "                      starting battery temperature (default normal:15:10)\n"
+        "  --aggressiveness-dist D\n"
+        "                      driver: scales profile accelerations and how fast cycle\n"
+        "                      speed gaps close (default triangular:0.7:1:1.6)\n"
+        "                      D is V, fixed:V, uniform:MIN:MAX, normal:MEAN:SD or\n"
+        "                      triangular:MIN:MODE:MAX, clamped to the valid range\n"
+        "  --percentiles LIST  comma separated, in %% (default 1,5,10,25,50,75,90,95,99)\n"
+        "  --threads N         worker threads (default: all CPUs)\n"
+        "  --out FILE          percentile table CSV (default stdout)\n"
+        "  --samples-out FILE  also stream every sample's inputs and results as CSV\n"
+        "aging (representative days per season, then monthly fade; not with --pack or a route):\n"
+        "  --years Y           horizon (default 8)\n"
+        "  --daily-km KM       distance driven per day (default 10)\n"
+        "  --trips N           trips per day, leaving 07:30 to 17:30 (default 2)\n"
+        "  --charge-soc PCT    charged back to after the last trip (default 90)\n"
+        "  --charge-power KW   charging power (default 11)\n"
+        "  --seasons LIST      WINTER:SPRING:SUMMER:AUTUMN ambient in C (default 2:12:22:12)\n"
+        "  --resim-fade PCT    capacity fade that has the days simulated again at the\n"
+        "                      faded capacity (default 1)\n"
+        "  --out FILE          monthly state of health CSV (default stdout)\n"
+        "                      --duration caps each trip (default 6 h)\n"
+        "depot (event-driven shifts and charging of a fleet; not with --pack or a route):\n"
+        "  --vehicles N        fleet size (default 500)\n"
+        "  --chargers N        charge points (default 150)\n"
+        "  --charger-power KW  per charger, from the grid (default 50)\n"
+        "  --site-power KW     grid connection cap, 0 for none (default 3000)\n"
+        "  --days D            horizon (default 30)\n"
+        "  --seed N            departure times and shift distances (default 1)\n"
+        "  --departures H:H    first and last departure, hours after midnight (default 5:9)\n"
+        "  --shift-hours H     time away per shift (default 9)\n"
+        "  --shift-km KM       mean distance per shift, each vehicle within 25 %% (default 8)\n"
+        "  --depot-ambient C   air and parked battery temperature (default 15)\n"
+        "  --target-soc PCT    charged to (default 90)\n"
+        "  --cv-soc PCT        constant current up to, then tapering (default 80)\n"
+        "  --out FILE          15 minute site load CSV (default stdout)\n"
+        "                      --duration caps each shift's drive (default 6 h)\n");
+}
+
+static bool parse_profile(const char *spec, CommonOptions *opts) {
+    int count = 0;
+    const char *p = spec;
+    while (*p) {
+        if (count == MAX_PROFILE_SEGMENTS) return false;
+        char *end;
+        double duration = strtod(p, &end);
+        if (end == p || *end != ':' || duration <= 0) return false;
+        p = end + 1;
+        double accel = strtod(p, &end);
+        if (end == p) return false;
+        opts->segments[count].duration = duration;
+        opts->segments[count].acceleration = accel;
+        count++;
+        p = end;
+        if (*p == ',') p++;
+        else if (*p) return false;
+    }
+    if (count == 0) return false;
+    opts->profile.segments = opts->segments;
+    opts->profile.count = count;
+    return true;
+}
+
+static void init_common_options(CommonOptions *opts) {
+    ev_sim_init(&opts->sim);
+    opts->sim.regen_braking = true;
+    opts->profile = ev_default_profile;
+    opts->dt = 0.01;
+    opts->duration = 3600;
+    opts->duration_set = false;
+    opts->until_empty = false;
+    opts->cycle_name = NULL;
+    opts->cycle_path = NULL;
+    opts->cycle_repeat = false;
+    opts->solver = EV_SOLVER_EULER;
+    opts->rtol = 1e-6;
+    opts->pack_series = 0;
+    opts->pack_parallel = 0;
+    opts->thermal = false;
+    opts->coolant_flow = -1;
+    opts->route_spec = NULL;
+    ev_route_params_default(&opts->route_params);
+    opts->environment_set = false;
+}
+
+/// Returns the number of arguments consumed, 0 if not a common option, -1 on error
+static int parse_common_option(CommonOptions *opts, int argc, char **argv, int i) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--until-empty") == 0) {
+        opts->until_empty = true;
+        return 1;
+    }
+    if (strcmp(arg, "--cycle-repeat") == 0) {
+        opts->cycle_repeat = true;
+        return 1;
+    }
+    if (strcmp(arg, "--thermal") == 0) {
+        opts->thermal = true;
+        return 1;
+    }
+    static const char *const valued[] = {
+        "--voltage", "--capacity", "--power", "--regen", "--mode", "--profile", "--dt", "--duration",
+        "--cycle", "--cycle-file", "--solver", "--rtol", "--motor-map",
+        "--pack", "--coolant-flow", "--route", "--payload", "--trailer", "--trailer-cda", "--wind",
+        "--ambient", "--route-step", "--drivetrain"
+    };
+    bool known = false;
+    for (size_t v = 0; v < sizeof(valued) / sizeof(valued[0]); v++) {
+        if (strcmp(arg, valued[v]) == 0) known = true;
+    }
+    if (!known) return 0;
+    if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for %s\n", arg);
+        return -1;
+    }
+    const char *val = argv[i + 1];
+    if (strcmp(arg, "--voltage") == 0) {
+        opts->sim.battery_voltage = parse_input(val, 100, 1000, 400);
+    } else if (strcmp(arg, "--capacity") == 0) {
+        opts->sim.battery_capacity = parse_input(val, 10, 200, 60);
+    } else if (strcmp(arg, "--power") == 0) {
+        opts->sim.motor_power = parse_input(val, 50, 500, 150);
+    } else if (strcmp(arg, "--regen") == 0) {
+        opts->sim.regen_efficiency = parse_input(val, 0, 100, 50) / 100.0;
+        opts->sim.regen_braking = opts->sim.regen_efficiency > 0;
+    } else if (strcmp(arg, "--mode") == 0) {
+        if (!drive_mode_from_name(val, &opts->sim.drive_mode)) {
+            fprintf(stderr, "Unknown drive mode: %s\n", val);
+            return -1;
+        }
+    } else if (strcmp(arg, "--profile") == 0) {
+        if (!parse_profile(val, opts)) {
+            fprintf(stderr, "Invalid profile: %s\n", val);
+            return -1;
+        }
+    } else if (strcmp(arg, "--dt") == 0) {
+        opts->dt = parse_input(val, 1e-6, 10, 0.01);
+    } else if (strcmp(arg, "--duration") == 0) {
+        opts->duration = parse_input(val, 0, 1e9, 3600);
+        opts->duration_set = true;
+    } else if (strcmp(arg, "--cycle") == 0) {
+        EVCycle *cycle = ev_cycle_open_builtin(val);
+        if (!cycle) {
+            fprintf(stderr, "Unknown drive cycle: %s\n", val);
+            return -1;
+        }
+        ev_cycle_close(cycle);
+        opts->cycle_name = val;
+    } else if (strcmp(arg, "--cycle-file") == 0) {
+        opts->cycle_path = val;
+    } else if (strcmp(arg, "--solver") == 0) {
+        if (!ev_solver_from_name(val, &opts->solver)) {
+            fprintf(stderr, "Unknown solver: %s\n", val);
+            return -1;
+        }
+    } else if (strcmp(arg, "--rtol") == 0) {
+        opts->rtol = parse_input(val, 1e-12, 1, 1e-6);
+    } else if (strcmp(arg, "--motor-map") == 0) {
+        ev_motor_map_free(motor_map);
+        motor_map = ev_motor_map_open(val);
+        if (!motor_map) {
+            fprintf(stderr, "Failed to load motor map %s\n", val);
+            return -1;
+        }
+        opts->sim.motor_map = motor_map;
+    } else if (strcmp(arg, "--pack") == 0) {
+        if (!ev_pack_parse_layout(val, &opts->pack_series, &opts->pack_parallel)) {
+            fprintf(stderr, "Invalid pack layout: %s\n", val);
+            return -1;
+        }
+    } else if (strcmp(arg, "--coolant-flow") == 0) {
+        opts->coolant_flow = parse_input(val, 0, 4, 1);
+        opts->thermal = true;
+    } else if (strcmp(arg, "--route") == 0) {
+        opts->route_spec = val;
+    } else if (strcmp(arg, "--drivetrain") == 0) {
+        if (!ev_drivetrain_parse(val, &opts->sim.drivetrain)) {
+            fprintf(stderr, "Invalid drivetrain: %s\n", val);
+            return -1;
+        }
+    } else {
+        EVRouteParams *env = &opts->route_params;
+        if (strcmp(arg, "--payload") == 0) env->payload = parse_input(val, 0, 40000, 0);
+        else if (strcmp(arg, "--trailer") == 0) env->trailer_mass = parse_input(val, 0, 40000, 0);
+        else if (strcmp(arg, "--trailer-cda") == 0) env->trailer_drag_area = parse_input(val, 0, 20, 0);
+        else if (strcmp(arg, "--wind") == 0) env->headwind = parse_input(val, -50, 50, 0);
+        else if (strcmp(arg, "--ambient") == 0) env->temperature = parse_input(val, -50, 60, 15);
+        else env->resolution = parse_input(val, 0.1, 1000, EV_ROUTE_RESOLUTION);
+        opts->environment_set = true;
+    }
+    return 2;
+}
+
+/// Options that need the whole command line: the route table depends on every environment
+/// option, in whatever order they came
+static bool finish_common_options(CommonOptions *opts) {
+    if (!opts->route_spec && !opts->environment_set) return true;
+    const char *spec = opts->route_spec ? opts->route_spec : "flat";
+    ev_route_free(route);
+    route = ev_route_open(spec, &opts->route_params);
+    if (!route) {
+        fprintf(stderr, "Failed to load route %s\n", spec);
+        return false;
+    }
+    opts->sim.route = route;
+    return true;
+}
+
+static bool uses_cycle(const CommonOptions *opts) {
+    return opts->cycle_name || opts->cycle_path;
+}
+
+static EVCycle *open_cycle(const CommonOptions *opts) {
+    EVCycle *cycle = opts->cycle_path ? ev_cycle_open_csv(opts->cycle_path)
+                                      : ev_cycle_open_builtin(opts->cycle_name);
+    if (!cycle) {
+        fprintf(stderr, "Failed to open drive cycle %s\n", opts->cycle_path ? opts->cycle_path : opts->cycle_name);
+        return NULL;
+    }
+    ev_cycle_set_repeat(cycle, opts->cycle_repeat);
+    return cycle;
+}
+
+/// A single pass of a drive cycle ends the run by itself unless --duration says otherwise
+static long max_steps_for(const CommonOptions *opts) {
+    double duration = opts->duration;
+    if (uses_cycle(opts) && !opts->cycle_repeat && !opts->duration_set) duration = 1e9;
+    return (long)(duration / opts->dt + 0.5);
+}
+
+static bool parse_run_options(int argc, char **argv, RunOptions *opts) {
+    init_common_options(&opts->common);
+    opts->csv_path = NULL;
+    opts->csv_every = 100;
+    opts->record_path = NULL;
+    opts->record_compress = false;
+    opts->perf = false;
+    opts->perf_trace_path = NULL;
+    opts->start_time = 0;
+    opts->start_steps = 0;
+    opts->stop_distance = 0;
+    opts->electrical = false;
+    for (int i = 0; i < argc; i++) {
+        int used = parse_common_option(&opts->common, argc, argv, i);
+        if (used < 0) return false;
+        if (used > 0) {
+            i += used - 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--electrical") == 0) {
+            opts->electrical = true;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            opts->record_compress = true;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            opts->perf = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "--perf-trace") == 0) {
+            opts->perf_trace_path = argv[++i];
+            opts->perf = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "--record") == 0) {
+            opts->record_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--csv") == 0) {
+            opts->csv_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--every") == 0) {
+            opts->csv_every = (long)parse_input(argv[++i], 1, 1e9, 100);
+        } else {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return false;
+        }
+    }
+    return finish_common_options(&opts->common);
+}
+
+static void print_summary(const EVSimulation *sim, const EVRunSummary *summary, double wall_time) {
+    printf("mode:              %s\n", drive_mode_name(sim->drive_mode));
+    if (sim->route) {
+        printf("route:             %s (%.1f km, %.0f m climb)\n", sim->route->name, sim->route->length,
+               sim->route->climb);
+    }
+    if (!ev_drivetrain_is_direct(&sim->drivetrain)) {
+        char drivetrain[160];
+        ev_drivetrain_describe(&sim->drivetrain, drivetrain, sizeof(drivetrain));
+        printf("drivetrain:        %s\n", drivetrain);
+    }
+    printf("steps:             %ld\n", summary->steps);
+    printf("simulated time:    %.1f s\n", summary->sim_time);
+    printf("distance:          %.3f km\n", summary->distance);
+    printf("energy consumed:   %.3f kWh\n", summary->energy_consumed);
+    printf("final SOC:         %.2f %%\n", summary->soc);
+    printf("efficiency:        %.1f Wh/km\n", summary->energy_efficiency);
+    printf("peak battery temp: %.2f °C\n", summary->peak_battery_temp);
+    printf("max speed:         %.1f km/h\n", summary->max_speed);
+    printf("wall time:         %.3f s (%.0fx real time)\n", wall_time,
+           wall_time > 0 ? summary->sim_time / wall_time : 0);
+}
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void init_integrator(EVIntegrator *integrator, const CommonOptions *opts) {
+    ev_integrator_init(integrator, opts->solver);
+    integrator->rtol = opts->rtol;
+}
+
+static int run_single(RunOptions *run, EVIntegrator *integrator, EVRunSummary *summary) {
+    CommonOptions *opts = &run->common;
+    EVCycle *cycle = NULL;
+    if (uses_cycle(opts) && !(cycle = open_cycle(opts))) return 1;
+    FILE *csv = NULL;
+    if (run->csv_path) {
+        csv = fopen(run->csv_path, "w");
+        if (!csv) {
+            fprintf(stderr, "Failed to open %s\n", run->csv_path);
+            ev_cycle_close(cycle);
+            return 1;
+        }
+        fprintf(csv, "time_s,speed_kmh,accel_ms2,soc_pct,distance_km,energy_kwh,torque_nm,rpm,battery_temp_c,efficiency_whkm,battery_v,battery_a\n");
+    }
+    EVTelemetryWriter *record = NULL;
+    if (run->record_path && !(record = ev_telemetry_create(run->record_path, run->record_compress))) {
+        fprintf(stderr, "Failed to open %s\n", run->record_path);
+        if (csv) fclose(csv);
+        ev_cycle_close(cycle);
+        return 1;
+    }
+    EVSimulation *sim = &opts->sim;
+    EVInput input = { 0 };
+    ev_run_summary_begin(summary, sim);
+    long max_steps = max_steps_for(opts);
+    /// Adaptive solvers count accepted steps and run to the same end time instead
+    bool adaptive = ev_solver_is_adaptive(opts->solver);
+    double end_time = max_steps * opts->dt;
+    double t = run->start_time;
+    while (adaptive ? t < end_time - 1e-9 : run->start_steps + summary->steps < max_steps) {
+        double h = opts->dt;
+        if (cycle) {
+            if (!ev_cycle_driver_input(cycle, sim, t, &input)) break;
+        } else {
+            input.acceleration = ev_profile_accel(&opts->profile, t) * sim->vehicle.aggressiveness;
+            if (adaptive) h = ev_profile_next_change(&opts->profile, t) - t;
+        }
+        if (adaptive && t + h > end_time) h = end_time - t;
+        uint64_t perf = ev_perf_begin();
+        double taken = ev_integrator_advance(integrator, sim, &input, h);
+        ev_perf_end(EV_PERF_PHYSICS_STEP, perf);
+        ev_run_summary_sample(summary, sim);
+        t = adaptive ? t + taken : (run->start_steps + summary->steps) * opts->dt;
+        if (csv && summary->steps % run->csv_every == 0) {
+            fprintf(csv, "%.3f,%.3f,%.3f,%.4f,%.5f,%.5f,%.2f,%.1f,%.3f,%.2f,%.3f,%.3f\n",
+                    t, sim->vehicle_speed, sim->acceleration, sim->soc, sim->distance,
+                    sim->energy_consumed, sim->motor_torque, sim->motor_rpm,
+                    sim->battery_temp, sim->energy_efficiency, sim->battery_voltage, sim->battery_current);
+        }
+        if (record) ev_telemetry_append(record, t, sim);
+        if (opts->until_empty && sim->soc <= 0) break;
+        if (run->stop_distance > 0 && sim->distance >= run->stop_distance) break;
+    }
+    ev_run_summary_end(summary, sim, t);
+    if (csv) fclose(csv);
+    ev_cycle_close(cycle);
+    if (!ev_telemetry_close(record)) {
+        fprintf(stderr, "Failed to write %s\n", run->record_path);
+        return 1;
+    }
+    return 0;
+}
+
+/// Pack and thermal network for common->sim as the options ask, owned by the caller
+static bool build_model(CommonOptions *common, EVPack **pack, EVThermal **thermal) {
+    *pack = NULL;
+    *thermal = NULL;
+    if (common->pack_series > 0) {
+        EVPackParams params;
+        ev_pack_params_default(&params, common->pack_series, common->pack_parallel,
+                               common->sim.battery_capacity);
+        if (!(*pack = ev_pack_new(&params))) {
+            fprintf(stderr, "Failed to allocate the battery pack\n");
+            return false;
+        }
+        common->sim.pack = *pack;
+    }
+    if (common->thermal) {
+        EVThermalParams params;
+        ev_thermal_params_default(&params);
+        params.coolant_flow = common->coolant_flow;
+        if (!(*thermal = ev_thermal_new(&params, *pack))) {
+            fprintf(stderr, "Failed to allocate the thermal network\n");
+            ev_pack_free(*pack);
+            *pack = NULL;
+            return false;
+        }
+        common->sim.thermal = *thermal;
+    }
+    return true;
+}
+
+static int cmd_run(int argc, char **argv) {
+    RunOptions opts;
+    if (!parse_run_options(argc, argv, &opts)) {
+        print_usage();
+        return 1;
+    }
+    EVRunSummary summary;
+    CommonOptions *common = &opts.common;
+    EVPack *pack;
+    EVThermal *thermal;
+    if (!build_model(common, &pack, &thermal)) return 1;
+    EVInverter *inverter = NULL;
+    if (opts.electrical) {
+        EVPmsmParams motor;
+        EVInverterParams params;
+        ev_pmsm_params_default(&motor);
+        ev_inverter_params_default(&params);
+        if (!(inverter = ev_inverter_new(&motor, &params))) {
+            fprintf(stderr, "Failed to allocate the inverter model\n");
+            ev_thermal_free(thermal);
+            ev_pack_free(pack);
+            return 1;
+        }
+        common->sim.inverter = inverter;
+    }
+    ev_sim_reset(&common->sim);
+    common->sim.is_running = true;
+    EVIntegrator integrator;
+    init_integrator(&integrator, common);
+    if (opts.perf) {
+        ev_perf_enable(true);
+        ev_perf_name_thread("run");
+    }
+    double start = wall_seconds();
+    int rc = run_single(&opts, &integrator, &summary);
+    double wall = wall_seconds() - start;
+    if (rc == 0) {
+        print_summary(&common->sim, &summary, wall);
+        printf("solver:            %s (%ld derivative evaluations, %ld rejected steps)\n",
+               ev_solver_name(integrator.solver), integrator.evaluations, integrator.rejected);
+    }
+    if (rc == 0 && pack) {
+        printf("pack:              %ds%dp, %d cells of %.1f Ah, %.1f V at %.1f A\n", pack->params.series,
+               pack->params.parallel, pack->cells, pack->params.capacity_ah, pack->terminal_voltage,
+               pack->current_total);
+        printf("cell SOC:          %.2f-%.2f %% (mean %.2f %%)\n", pack->soc_min * 100, pack->soc_max * 100,
+               pack->soc_mean * 100);
+        printf("cell temperature:  %.2f-%.2f °C (mean %.2f °C)\n", pack->temp_min, pack->temp_max,
+               pack->temp_mean);
+        printf("pack step rate:    %.1f kHz of whole-vehicle steps\n",
+               wall > 0 ? summary.steps / wall / 1000 : 0);
+    }
+    if (rc == 0 && opts.perf) {
+        EVPerfStats stats;
+        ev_perf_stats(EV_PERF_PHYSICS_STEP, &stats);
+        printf("step cost:         p50 %.0f ns, p99 %.0f ns, max %.0f ns over %llu steps\n", stats.p50,
+               stats.p99, stats.max, (unsigned long long)stats.count);
+        if (opts.perf_trace_path && !ev_perf_write_trace(opts.perf_trace_path)) {
+            fprintf(stderr, "Failed to write %s\n", opts.perf_trace_path);
+            rc = 1;
+        }
+    }
+    if (rc == 0 && thermal) {
+        printf("modules:           %d, hottest %.2f °C\n", thermal->params.modules,
+               ev_thermal_module_max(thermal));
+        printf("motor:             winding %.2f °C, housing %.2f °C\n",
+               ev_thermal_temp(thermal, EV_THERMAL_WINDING), ev_thermal_temp(thermal, EV_THERMAL_HOUSING));
+        printf("inverter:          junction %.2f °C, heatsink %.2f °C\n",
+               ev_thermal_temp(thermal, EV_THERMAL_JUNCTION), ev_thermal_temp(thermal, EV_THERMAL_HEATSINK));
+        printf("coolant:           %.2f °C at %.2fx flow\n", ev_thermal_temp(thermal, EV_THERMAL_COOLANT),
+               thermal->flow);
+        printf("derating:          %.3f now, %.3f minimum (%ld factorizations)\n", thermal->derating,
+               thermal->min_derating, thermal->factorizations);
+    }
+    if (rc == 0 && inverter) {
+        printf("electrical losses: copper %.3f kWh, conduction %.3f kWh, switching %.3f kWh\n",
+               inverter->copper_energy / 3.6e6, inverter->conduction_energy / 3.6e6,
+               inverter->switching_energy / 3.6e6);
+        double substeps = (double)inverter->periods * EV_INVERTER_SUBSTEPS;
+        printf("electrical steps:  %.3g of %.3g us (%.1f M/s), last efficiency %.3f\n", substeps,
+               inverter->step * 1e6, wall > 0 ? substeps / wall / 1e6 : 0, inverter->efficiency);
+    }
+    ev_inverter_free(inverter);
+    ev_thermal_free(thermal);
+    ev_pack_free(pack);
+    if (rc != 0) return 1;
+    return 0;
+}
+
+static bool parse_fleet_options(int argc, char **argv, FleetOptions *opts) {
+    init_common_options(&opts->common);
+    opts->count = 1024;
+    opts->seed = 1;
+    opts->configs_path = NULL;
+    opts->out_path = NULL;
+    opts->kernel = EV_FLEET_KERNEL_AUTO;
+    for (int i = 0; i < argc; i++) {
+        int used = parse_common_option(&opts->common, argc, argv, i);
+        if (used < 0) return false;
+        if (used > 0) {
+            i += used - 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return false;
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+        if (strcmp(arg, "--count") == 0) {
+            opts->count = (int)parse_input(val, 1, 1e8, 1024);
+        } else if (strcmp(arg, "--seed") == 0) {
+            opts->seed = strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--configs") == 0) {
+            opts->configs_path = val;
+        } else if (strcmp(arg, "--out") == 0) {
+            opts->out_path = val;
+        } else if (strcmp(arg, "--kernel") == 0) {
+            if (strcmp(val, "auto") == 0) opts->kernel = EV_FLEET_KERNEL_AUTO;
+            else if (strcmp(val, "scalar") == 0) opts->kernel = EV_FLEET_KERNEL_SCALAR;
+            else if (strcmp(val, "avx2") == 0) opts->kernel = EV_FLEET_KERNEL_AVX2;
+            else if (strcmp(val, "avx512") == 0) opts->kernel = EV_FLEET_KERNEL_AVX512;
+            else {
+                fprintf(stderr, "Unknown kernel: %s\n", val);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+    return finish_common_options(&opts->common);
+}
+
+/// One vehicle per line: voltage,capacity,power,mode,regen_pct; other lines are skipped
+static EVFleet *load_fleet_configs(const char *path, const EVSimulation *base) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return NULL;
+    }
+    int capacity = 256, count = 0;
+    EVSimulation *configs = malloc(sizeof(EVSimulation) * capacity);
+    char line[256];
+    while (configs && fgets(line, sizeof(line), file)) {
+        double voltage, battery, power, regen;
+        char mode_name[16];
+        if (sscanf(line, "%lf,%lf,%lf,%15[^,],%lf", &voltage, &battery, &power, mode_name, &regen) != 5) continue;
+        EVSimulation sim = *base;
+        if (!drive_mode_from_name(mode_name, &sim.drive_mode)) continue;
+        sim.battery_voltage = voltage;
+        sim.battery_capacity = battery;
+        sim.motor_power = power;
+        sim.regen_efficiency = regen / 100.0;
+        sim.regen_braking = regen > 0;
+        if (count == capacity) {
+            capacity *= 2;
+            EVSimulation *grown = realloc(configs, sizeof(EVSimulation) * capacity);
+            if (!grown) break;
+            configs = grown;
+        }
+        configs[count++] = sim;
+    }
+    fclose(file);
+    EVFleet *fleet = count > 0 ? ev_fleet_new(count) : NULL;
+    for (int i = 0; fleet && i < count; i++) ev_fleet_set_vehicle(fleet, i, &configs[i]);
+    free(configs);
+    if (!fleet) fprintf(stderr, "No vehicle configurations in %s\n", path);
+    return fleet;
+}
+
+static double random_in(uint64_t *state, double min, double max) {
+    return min + (max - min) * ev_random_uniform(state);
+}
+
+static EVFleet *random_fleet(int count, uint64_t seed, const EVSimulation *base) {
+    EVFleet *fleet = ev_fleet_new(count);
+    if (!fleet) return NULL;
+    uint64_t state = seed;
+    for (int i = 0; i < count; i++) {
+        EVSimulation sim = *base;
+        sim.battery_voltage = random_in(&state, 100, 1000);
+        sim.battery_capacity = random_in(&state, 10, 200);
+        sim.motor_power = random_in(&state, 50, 500);
+        sim.regen_efficiency = random_in(&state, 0, 1);
+        sim.regen_braking = true;
+        sim.drive_mode = (DriveMode)(ev_random_next(&state) % DRIVE_MODE_COUNT);
+        ev_fleet_set_vehicle(fleet, i, &sim);
+    }
+    return fleet;
+}
+
+static int cmd_fleet(int argc, char **argv) {
+    FleetOptions opts;
+    if (!parse_fleet_options(argc, argv, &opts)) {
+        print_usage();
+        return 1;
+    }
+    CommonOptions *common = &opts.common;
+    if (common->solver != EV_SOLVER_EULER) {
+        fprintf(stderr, "The fleet kernels only implement the euler solver\n");
+        return 1;
+    }
+    if (common->sim.motor_map) {
+        fprintf(stderr, "The fleet kernels only implement the flat motor efficiency\n");
+        return 1;
+    }
+    if (common->pack_series > 0) {
+        fprintf(stderr, "The fleet kernels only implement the constant-voltage battery\n");
+        return 1;
+    }
+    if (common->thermal) {
+        fprintf(stderr, "The fleet kernels only implement the scalar battery temperature\n");
+        return 1;
+    }
+    if (common->sim.route) {
+        fprintf(stderr, "The fleet kernels only implement the level road\n");
+        return 1;
+    }
+    if (!ev_drivetrain_is_direct(&common->sim.drivetrain)) {
+        fprintf(stderr, "The fleet kernels only implement the direct drivetrain\n");
+        return 1;
+    }
+    EVFleet *fleet = opts.configs_path ? load_fleet_configs(opts.configs_path, &common->sim)
+                                       : random_fleet(opts.count, opts.seed, &common->sim);
+    if (!fleet) return 1;
+    FILE *out = opts.out_path ? fopen(opts.out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", opts.out_path);
+        ev_fleet_free(fleet);
+        return 1;
+    }
+    EVCycle *cycle = NULL;
+    if (uses_cycle(common) && !(cycle = open_cycle(common))) {
+        if (out != stdout) fclose(out);
+        ev_fleet_free(fleet);
+        return 1;
+    }
+    EVFleetKernel kernel = ev_fleet_set_kernel(fleet, opts.kernel);
+    double start = wall_seconds();
+    long steps = ev_fleet_run(fleet, cycle, &common->profile, common->dt, max_steps_for(common), common->until_empty);
+    double wall = wall_seconds() - start;
+    ev_cycle_close(cycle);
+    fprintf(out, "vehicle,voltage_v,capacity_kwh,power_kw,mode,regen_pct,distance_km,energy_kwh,soc_pct,efficiency_whkm,peak_battery_temp_c\n");
+    for (int i = 0; i < fleet->count; i++) {
+        fprintf(out, "%d,%.1f,%.2f,%.1f,%s,%.1f,%.4f,%.4f,%.3f,%.2f,%.3f\n", i,
+                fleet->battery_voltage[i], fleet->battery_capacity[i], fleet->motor_power[i],
+                drive_mode_name(fleet->drive_mode[i]), fleet->regen_braking[i] > 0.5 ? fleet->regen_efficiency[i] * 100 : 0,
+                fleet->distance[i], fleet->energy_consumed[i], fleet->soc[i],
+                fleet->energy_efficiency[i], fleet->peak_battery_temp[i]);
+    }
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "fleet: %d vehicles, %ld steps, kernel %s, %.3f s wall, %.1fM vehicle-steps/s\n",
+            fleet->count, steps, ev_fleet_kernel_name(kernel), wall,
+            wall > 0 ? (double)fleet->count * steps / wall / 1e6 : 0);
+    ev_fleet_free(fleet);
+    return 0;
+}
+
+static bool parse_axis(const char *spec, double lo, double hi, EVSweepAxis *axis) {
+    EVSweepAxis parsed;
+    if (sscanf(spec, "%lf:%lf:%d", &parsed.min, &parsed.max, &parsed.levels) != 3) return false;
+    if (parsed.min < lo || parsed.max > hi || parsed.min > parsed.max || parsed.levels < 1) return false;
+    *axis = parsed;
+    return true;
+}
+
+static bool parse_modes(const char *list, unsigned *mask) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    *mask = 0;
+    for (char *name = strtok(buffer, ","); name; name = strtok(NULL, ",")) {
+        DriveMode mode;
+        if (!drive_mode_from_name(name, &mode)) return false;
+        *mask |= 1u << mode;
+    }
+    return *mask != 0;
+}
+
+static bool parse_splits(const char *list, unsigned *mask) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    *mask = 0;
+    for (char *name = strtok(buffer, ","); name; name = strtok(NULL, ",")) {
+        EVSplitStrategy strategy;
+        if (!ev_split_strategy_from_name(name, &strategy)) return false;
+        *mask |= 1u << strategy;
+    }
+    return *mask != 0;
+}
+
+static bool parse_sweep_options(int argc, char **argv, SweepOptions *opts) {
+    init_common_options(&opts->common);
+    opts->common.duration = 86400;
+    ev_sweep_spec_init(&opts->spec);
+    opts->threads = 0;
+    opts->out_path = NULL;
+    for (int i = 0; i < argc; i++) {
+        int used = parse_common_option(&opts->common, argc, argv, i);
+        if (used < 0) return false;
+        if (used > 0) {
+            i += used - 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return false;
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+        bool ok = true;
+        if (strcmp(arg, "--method") == 0) {
+            if (strcmp(val, "grid") == 0) opts->spec.method = EV_SWEEP_GRID;
+            else if (strcmp(val, "lhs") == 0) opts->spec.method = EV_SWEEP_LHS;
+            else ok = false;
+        } else if (strcmp(arg, "--samples") == 0) {
+            opts->spec.samples = (int)parse_input(val, 1, 1e8, 256);
+        } else if (strcmp(arg, "--seed") == 0) {
+            opts->spec.seed = strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--voltage-axis") == 0) {
+            ok = parse_axis(val, 100, 1000, &opts->spec.voltage);
+        } else if (strcmp(arg, "--capacity-axis") == 0) {
+            ok = parse_axis(val, 10, 200, &opts->spec.capacity);
+        } else if (strcmp(arg, "--power-axis") == 0) {
+            ok = parse_axis(val, 50, 500, &opts->spec.power);
+        } else if (strcmp(arg, "--regen-axis") == 0) {
+            ok = parse_axis(val, 0, 100, &opts->spec.regen);
+        } else if (strcmp(arg, "--modes") == 0) {
+            ok = parse_modes(val, &opts->spec.mode_mask);
+        } else if (strcmp(arg, "--split-axis") == 0) {
+            ok = parse_axis(val, 0, 100, &opts->spec.split);
+        } else if (strcmp(arg, "--splits") == 0) {
+            ok = parse_splits(val, &opts->spec.split_mask);
+        } else if (strcmp(arg, "--threads") == 0) {
+            opts->threads = (int)parse_input(val, 0, 4096, 0);
+        } else if (strcmp(arg, "--out") == 0) {
+            opts->out_path = val;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg, val);
+            return false;
+        }
+    }
+    return finish_common_options(&opts->common);
+}
+
+static void write_sweep_result(const EVSweepResult *result, void *user_data) {
+    FILE *out = user_data;
+    const EVSimulation *c = &result->config;
+    const EVRunSummary *s = &result->summary;
+    const EVDrivetrain *d = &c->drivetrain;
+    char split[24] = "";
+    if (ev_drivetrain_two_axle(d) && d->strategy == EV_SPLIT_FIXED) {
+        snprintf(split, sizeof(split), "%.1f", d->split * 100);
+    }
+    fprintf(out, "%d,%d,%.1f,%.2f,%.1f,%s,%.1f,%.4f,%.2f,%.3f,%.1f,%d,%s,%s,%s\n",
+            result->run, result->worker, c->battery_voltage, c->battery_capacity, c->motor_power,
+            drive_mode_name(c->drive_mode), c->regen_braking ? c->regen_efficiency * 100 : 0,
+            s->distance, s->energy_efficiency, s->peak_battery_temp, s->sim_time, s->soc <= 0,
+            ev_drivetrain_is_direct(d) ? "direct" : ev_drivetrain_topology_name(d->topology),
+            ev_drivetrain_two_axle(d) ? ev_split_strategy_name(d->strategy) : "", split);
+    fflush(out);
+}
+
+static int cmd_sweep(int argc, char **argv) {
+    SweepOptions opts;
+    if (!parse_sweep_options(argc, argv, &opts)) {
+        print_usage();
+        return 1;
+    }
+    CommonOptions *common = &opts.common;
+    EVSimulation *configs;
+    int count = ev_sweep_build(&opts.spec, &common->sim, &configs);
+    if (count <= 0) {
+        fprintf(stderr, "Sweep specification produced no runs\n");
+        return 1;
+    }
+    FILE *out = opts.out_path ? fopen(opts.out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", opts.out_path);
+        free(configs);
+        return 1;
+    }
+    if (uses_cycle(common)) {
+        EVCycle *cycle = open_cycle(common);
+        if (!cycle) {
+            free(configs);
+            return 1;
+        }
+        ev_cycle_close(cycle);
+    }
+    EVSweepRunOptions run = {
+        .profile = common->profile,
+        .cycle_name = common->cycle_name,
+        .cycle_path = common->cycle_path,
+        .dt = common->dt,
+        .max_time = common->duration,
+        .solver = common->solver,
+        .rtol = common->rtol,
+        .pack_series = common->pack_series,
+        .pack_parallel = common->pack_parallel,
+        .thermal = common->thermal,
+        .coolant_flow = common->coolant_flow,
+        .threads = opts.threads
+    };
+    fprintf(out, "run,worker,voltage_v,capacity_kwh,power_kw,mode,regen_pct,range_km,efficiency_whkm,peak_battery_temp_c,sim_time_s,emptied,drivetrain,split_strategy,front_split_pct\n");
+    double start = wall_seconds();
+    int rc = ev_sweep_run(configs, count, &run, write_sweep_result, out);
+    double wall = wall_seconds() - start;
+    if (out != stdout) fclose(out);
+    free(configs);
+    if (rc < 0) {
+        fprintf(stderr, "Sweep failed to start its workers\n");
+        return 1;
+    }
+    if (rc > 0) {
+        fprintf(stderr, "sweep: %d of %d runs failed to set up their pack, thermal network or cycle\n", rc, count);
+        return 1;
+    }
+    int threads = opts.threads > 0 ? opts.threads : ev_cpu_count();
+    if (threads > count) threads = count;
+    fprintf(stderr, "sweep: %d runs on %d thread%s, %.3f s wall, %.1f runs/s\n",
+            count, threads, threads == 1 ? "" : "s", wall, wall > 0 ? count / wall : 0);
+    return 0;
+}
+
+static bool parse_percentiles(const char *list, MonteCarloOptions *opts) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    opts->percentile_count = 0;
+    for (char *item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+        char *end;
+        double p = strtod(item, &end);
+        if (end == item || *end || p < 0 || p > 100 || opts->percentile_count == MAX_PERCENTILES) return false;
+        opts->percentiles[opts->percentile_count++] = p;
+    }
+    return opts->percentile_count > 0;
+}
+
+static bool parse_monte_carlo_options(int argc, char **argv, MonteCarloOptions *opts) {
+    static const struct {
+        const char *option;
+        EVMonteCarloParam param;
+    } dists[] = {
+        { "--mass-dist", EV_MC_MASS },
+        { "--drag-dist", EV_MC_DRAG },
+        { "--rolling-dist", EV_MC_ROLLING },
+        { "--regen-dist", EV_MC_REGEN },
+        { "--ambient-dist", EV_MC_AMBIENT },
+        { "--aggressiveness-dist", EV_MC_AGGRESSIVENESS }
+    };
+    init_common_options(&opts->common);
+    opts->common.duration = 86400;
+    ev_monte_carlo_spec_init(&opts->spec);
+    parse_percentiles("1,5,10,25,50,75,90,95,99", opts);
+    opts->threads = 0;
+    opts->out_path = NULL;
+    opts->samples_path = NULL;
+    for (int i = 0; i < argc; i++) {
+        int used = parse_common_option(&opts->common, argc, argv, i);
+        if (used < 0) return false;
+        if (used > 0) {
+            i += used - 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return false;
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+        bool ok = true;
+        int dist = -1;
+        for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++) {
+            if (strcmp(arg, dists[d].option) == 0) dist = (int)d;
+        }
+        if (dist >= 0) {
+            EVMonteCarloParam param = dists[dist].param;
+            ok = ev_distribution_parse(val, param, &opts->spec.params[param]);
+        } else if (strcmp(arg, "--samples") == 0) {
+            opts->spec.samples = (long)parse_input(val, 1, 1e9, 100000);
+        } else if (strcmp(arg, "--seed") == 0) {
+            opts->spec.seed = strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--percentiles") == 0) {
+            ok = parse_percentiles(val, opts);
+        } else if (strcmp(arg, "--threads") == 0) {
+            opts->threads = (int)parse_input(val, 0, 4096, 0);
+        } else if (strcmp(arg, "--out") == 0) {
+            opts->out_path = val;
+        } else if (strcmp(arg, "--samples-out") == 0) {
+            opts->samples_path = val;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg, val);
+            return false;
+        }
+    }
+    return finish_common_options(&opts->common);
+}
+
+static void write_monte_carlo_sample(const EVMonteCarloSample *sample, void *user_data) {
+    FILE *out = user_data;
+    const EVRunSummary *s = &sample->summary;
+    fprintf(out, "%ld,%d", sample->index, sample->worker);
+    for (int p = 0; p < EV_MC_PARAMS; p++) fprintf(out, ",%.6g", sample->values[p]);
+    fprintf(out, ",%.4f,%.2f,%.3f,%.1f,%d\n", s->distance, s->energy_efficiency, s->peak_battery_temp,
+            s->sim_time, s->soc <= 0);
+}
+
+static int cmd_monte_carlo(int argc, char **argv) {
+    MonteCarloOptions opts;
+    if (!parse_monte_carlo_options(argc, argv, &opts)) {
+        print_usage();
+        return 1;
+    }
+    CommonOptions *common = &opts.common;
+    if (common->pack_series > 0) {
+        fprintf(stderr, "Monte Carlo runs only implement the constant-voltage battery\n");
+        return 1;
+    }
+    if (common->sim.route) {
+        fprintf(stderr, "Monte Carlo runs sample the vehicle constants a route table precomputes; "
+                "use --ambient-dist instead of --ambient\n");
+        return 1;
+    }
+    if (uses_cycle(common)) {
+        EVCycle *cycle = open_cycle(common);
+        if (!cycle) return 1;
+        ev_cycle_close(cycle);
+    }
+    EVMonteCarloResult *result = malloc(sizeof(EVMonteCarloResult));
+    FILE *out = opts.out_path ? fopen(opts.out_path, "w") : stdout;
+    FILE *samples = opts.samples_path ? fopen(opts.samples_path, "w") : NULL;
+    if (!result || !out || (opts.samples_path && !samples)) {
+        if (!result) fprintf(stderr, "Out of memory\n");
+        else fprintf(stderr, "Failed to open %s\n", !out ? opts.out_path : opts.samples_path);
+        if (out && out != stdout) fclose(out);
+        if (samples) fclose(samples);
+        free(result);
+        return 1;
+    }
+    if (samples) {
+        fprintf(samples, "sample,worker");
+        for (int p = 0; p < EV_MC_PARAMS; p++) fprintf(samples, ",%s", ev_monte_carlo_param_name(p));
+        fprintf(samples, ",range_km,efficiency_whkm,peak_battery_temp_c,sim_time_s,emptied\n");
+    }
+    EVSweepRunOptions run = {
+        .profile = common->profile,
+        .cycle_name = common->cycle_name,
+        .cycle_path = common->cycle_path,
+        .dt = common->dt,
+        .max_time = common->duration,
+        .solver = common->solver,
+        .rtol = common->rtol,
+        .thermal = common->thermal,
+        .coolant_flow = common->coolant_flow,
+        .threads = opts.threads
+    };
+    double start = wall_seconds();
+    int rc = ev_monte_carlo_run(&opts.spec, &common->sim, &run, samples ? write_monte_carlo_sample : NULL,
+                                samples, result);
+    double wall = wall_seconds() - start;
+    if (samples) fclose(samples);
+    if (rc == 0) {
+        fprintf(out, "metric,count,mean,min");
+        for (int p = 0; p < opts.percentile_count; p++) fprintf(out, ",p%g", opts.percentiles[p]);
+        fprintf(out, ",max\n");
+        for (int m = 0; m < EV_MC_METRICS; m++) {
+            const EVQuantiles *q = &result->metrics[m];
+            fprintf(out, "%s,%llu,%.4f,%.4f", ev_monte_carlo_metric_name(m), (unsigned long long)q->count,
+                    ev_quantiles_mean(q), q->min);
+            for (int p = 0; p < opts.percentile_count; p++) {
+                fprintf(out, ",%.4f", ev_quantiles_value(q, opts.percentiles[p] / 100));
+            }
+            fprintf(out, ",%.4f\n", q->max);
+        }
+    }
+    if (out != stdout) fclose(out);
+    long failed = result->failed;
+    free(result);
+    if (rc != 0) {
+        fprintf(stderr, "Monte Carlo failed to start its workers\n");
+        return 1;
+    }
+    if (failed > 0) {
+        fprintf(stderr, "montecarlo: %ld samples failed to set up their thermal network or cycle\n", failed);
+        return 1;
+    }
+    int threads = opts.threads > 0 ? opts.threads : ev_cpu_count();
+    long count = opts.spec.samples;
+    if (threads > count) threads = (int)count;
+    fprintf(stderr, "montecarlo: %ld samples on %d thread%s, seed %llu, %.3f s wall, %.1f samples/s\n", count,
+            threads, threads == 1 ? "" : "s", (unsigned long long)opts.spec.seed, wall, wall > 0 ? count / wall : 0);
+    return 0;
+}
+
+static bool parse_seasons(const char *spec, EVAgingDuty *duty) {
+    const char *p = spec;
+    for (int s = 0; s < EV_SEASONS; s++) {
+        char *end;
+        double temp = strtod(p, &end);
+        if (end == p || temp < -40 || temp > 60) return false;
+        duty->season_ambient[s] = temp;
+        p = end;
+        if (s < EV_SEASONS - 1 && *p++ != ':') return false;
+    }
+    return *p == 0;
+}
+
+static bool parse_aging_options(int argc, char **argv, AgingOptions *opts) {
+    init_common_options(&opts->common);
+    opts->common.duration = 6 * 3600;
+    ev_aging_params_default(&opts->params);
+    ev_aging_duty_default(&opts->duty);
+    opts->out_path = NULL;
+    for (int i = 0; i < argc; i++) {
+        int used = parse_common_option(&opts->common, argc, argv, i);
+        if (used < 0) return false;
+        if (used > 0) {
+            i += used - 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return false;
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+        bool ok = true;
+        if (strcmp(arg, "--years") == 0) {
+            opts->duty.years = parse_input(val, 1.0 / 12, 30, 8);
+        } else if (strcmp(arg, "--daily-km") == 0) {
+            opts->duty.daily_distance = parse_input(val, 0, 1000, 10);
+        } else if (strcmp(arg, "--trips") == 0) {
+            opts->duty.trips = (int)parse_input(val, 1, 24, 2);
+        } else if (strcmp(arg, "--charge-soc") == 0) {
+            opts->duty.charge_soc = parse_input(val, 10, 100, 90);
+        } else if (strcmp(arg, "--charge-power") == 0) {
+            opts->duty.charge_power = parse_input(val, 1, 350, 11);
+        } else if (strcmp(arg, "--seasons") == 0) {
+            ok = parse_seasons(val, &opts->duty);
+        } else if (strcmp(arg, "--resim-fade") == 0) {
+            opts->duty.resim_fade = parse_input(val, 0.1, 50, 1) / 100;
+        } else if (strcmp(arg, "--out") == 0) {
+            opts->out_path = val;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg, val);
+            return false;
+        }
+    }
+    return finish_common_options(&opts->common);
+}
+
+static void write_aging_step(const EVAgingStep *step, void *user_data) {
+    FILE *out = user_data;
+    fprintf(out, "%d,%.4f,%.3f,%.3f,%.3f,%.3f,%.1f,%d\n", step->month, step->years, step->soh * 100,
+            step->state.calendar_loss * 100, step->state.cycle_loss * 100, step->capacity, step->equivalent_cycles,
+            step->resimulated);
+}
+
+static int cmd_aging(int argc, char **argv) {
+    AgingOptions opts;
+    if (!parse_aging_options(argc, argv, &opts)) {
+        print_usage();
+        return 1;
+    }
+    CommonOptions *common = &opts.common;
+    if (common->pack_series > 0) {
+        fprintf(stderr, "Aging runs only implement the constant-voltage battery\n");
+        return 1;
+    }
+    if (common->sim.route) {
+        fprintf(stderr, "Aging runs set the air density per season a route table precomputes; "
+                "use --seasons instead of --ambient\n");
+        return 1;
+    }
+    if (uses_cycle(common)) {
+        EVCycle *cycle = open_cycle(common);
+        if (!cycle) return 1;
+        ev_cycle_close(cycle);
+    }
+    FILE *out = opts.out_path ? fopen(opts.out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", opts.out_path);
+        return 1;
+    }
+    EVSweepRunOptions run = {
+        .profile = common->profile,
+        .cycle_name = common->cycle_name,
+        .cycle_path = common->cycle_path,
+        .dt = common->dt,
+        .max_time = common->duration,
+        .solver = common->solver,
+        .rtol = common->rtol,
+        .thermal = common->thermal,
+        .coolant_flow = common->coolant_flow,
+        .threads = 1
+    };
+    fprintf(out, "month,years,soh_pct,calendar_loss_pct,cycle_loss_pct,capacity_kwh,efc,resimulated\n");
+    EVAgingSummary summary;
+    double start = wall_seconds();
+    int rc = ev_aging_run(&opts.params, &opts.duty, &common->sim, &run, write_aging_step, out, &summary);
+    double wall = wall_seconds() - start;
+    if (out != stdout) fclose(out);
+    if (rc != 0) {
+        fprintf(stderr, "Aging run failed to start\n");
+        return 1;
+    }
+    const EVAgingDuty *duty = &opts.duty;
+    fprintf(stderr, "aging: %d months, %.1f km/day in %d trips, charged to %.0f %% at %.1f kW\n",
+            summary.months, duty->daily_distance, duty->trips, duty->charge_soc, duty->charge_power);
+    fprintf(stderr, "  state of health:  %.2f %% (calendar %.2f %%, cycle %.2f %%)\n", summary.soh * 100,
+            summary.state.calendar_loss * 100, summary.state.cycle_loss * 100);
+    fprintf(stderr, "  capacity:         %.2f of %.2f kWh\n", summary.capacity, common->sim.battery_capacity);
+    fprintf(stderr, "  full cycles:      %.1f\n", summary.equivalent_cycles);
+    if (summary.short_days > 0) {
+        fprintf(stderr, "  short days:       %.0f (the battery ran out before the day's distance)\n",
+                summary.short_days);
+    }
+    fprintf(stderr, "  simulated:        %d x %d days, %ld steps, %.3f s wall\n", summary.simulations, EV_SEASONS,
+            summary.steps, wall);
+    return 0;
+}
+
+static bool parse_depot_options(int argc, char **argv, DepotOptions *opts) {
+    init_common_options(&opts->common);
+    opts->common.duration = 6 * 3600;
+    ev_depot_params_default(&opts->params);
+    opts->out_path = NULL;
+    EVDepotParams *p = &opts->params;
+    for (int i = 0; i < argc; i++) {
+        int used = parse_common_option(&opts->common, argc, argv, i);
+        if (used < 0) return false;
+        if (used > 0) {
+            i += used - 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return false;
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+        bool ok = true;
+        if (strcmp(arg, "--vehicles") == 0) {
+            p->vehicles = (int)parse_input(val, 1, 100000, 500);
+        } else if (strcmp(arg, "--chargers") == 0) {
+            p->chargers = (int)parse_input(val, 1, 100000, 150);
+        } else if (strcmp(arg, "--charger-power") == 0) {
+            p->charger_power = parse_input(val, 1, 1000, 50);
+        } else if (strcmp(arg, "--site-power") == 0) {
+            p->site_power = parse_input(val, 0, 1e6, 3000);
+        } else if (strcmp(arg, "--days") == 0) {
+            p->days = parse_input(val, 1, 366, 30);
+        } else if (strcmp(arg, "--seed") == 0) {
+            p->seed = strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--departures") == 0) {
+            ok = sscanf(val, "%lf:%lf", &p->first_departure, &p->last_departure) == 2 &&
+                 p->first_departure >= 0 && p->first_departure <= p->last_departure && p->last_departure < 24;
+        } else if (strcmp(arg, "--shift-hours") == 0) {
+            p->shift_hours = parse_input(val, 0.5, 23, 9);
+        } else if (strcmp(arg, "--shift-km") == 0) {
+            p->shift_distance = parse_input(val, 0.1, 1000, 8);
+        } else if (strcmp(arg, "--depot-ambient") == 0) {
+            p->ambient = parse_input(val, -40, 50, 15);
+        } else if (strcmp(arg, "--target-soc") == 0) {
+            p->target_soc = parse_input(val, 20, 100, 90);
+        } else if (strcmp(arg, "--cv-soc") == 0) {
+            p->cv_soc = parse_input(val, 10, 99, 80);
+        } else if (strcmp(arg, "--out") == 0) {
+            opts->out_path = val;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg, val);
+            return false;
+        }
+    }
+    if (p->cv_soc >= p->target_soc) {
+        fprintf(stderr, "--cv-soc must be below --target-soc\n");
+        return false;
+    }
+    return finish_common_options(&opts->common);
+}
+
+static void write_depot_interval(const EVDepotInterval *interval, void *user_data) {
+    FILE *out = user_data;
+    fprintf(out, "%d,%.4f,%.2f,%.2f,%d,%d\n", interval->index, interval->index * EV_DEPOT_INTERVAL / 3600,
+            interval->load, interval->peak, interval->charging, interval->waiting);
+}
+
+static int cmd_depot(int argc, char **argv) {
+    DepotOptions opts;
+    if (!parse_depot_options(argc, argv, &opts)) {
+        print_usage();
+        return 1;
+    }
+    CommonOptions *common = &opts.common;
+    if (common->pack_series > 0) {
+        fprintf(stderr, "Depot runs only implement the constant-voltage battery\n");
+        return 1;
+    }
+    if (common->sim.route) {
+        fprintf(stderr, "Depot runs drive without a route; use --depot-ambient instead of --ambient\n");
+        return 1;
+    }
+    if (uses_cycle(common)) {
+        EVCycle *cycle = open_cycle(common);
+        if (!cycle) return 1;
+        ev_cycle_close(cycle);
+    }
+    FILE *out = opts.out_path ? fopen(opts.out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", opts.out_path);
+        return 1;
+    }
+    EVSweepRunOptions run = {
+        .profile = common->profile,
+        .cycle_name = common->cycle_name,
+        .cycle_path = common->cycle_path,
+        .dt = common->dt,
+        .max_time = common->duration,
+        .solver = common->solver,
+        .rtol = common->rtol,
+        .thermal = common->thermal,
+        .coolant_flow = common->coolant_flow,
+        .threads = 1
+    };
+    fprintf(out, "interval,hour,load_kw,peak_kw,charging,waiting\n");
+    EVDepotSummary summary;
+    double start = wall_seconds();
+    int rc = ev_depot_run(&opts.params, &common->sim, &run, write_depot_interval, out, &summary);
+    double wall = wall_seconds() - start;
+    if (out != stdout) fclose(out);
+    if (rc != 0) {
+        fprintf(stderr, "Depot run failed to start\n");
+        return 1;
+    }
+    const EVDepotParams *p = &opts.params;
+    fprintf(stderr, "depot: %d vehicles, %d chargers of %.0f kW, site cap %.0f kW, %.0f days\n", p->vehicles,
+            p->chargers, p->charger_power, p->site_power, p->days);
+    fprintf(stderr, "  shifts:           %ld, %ld cut short, %ld left below %.0f %% (mean %.1f %%)\n",
+            summary.shifts, summary.stranded, summary.undercharged, p->target_soc, summary.departure_soc);
+    fprintf(stderr, "  grid energy:      %.1f MWh\n", summary.energy / 1000);
+    fprintf(stderr, "  peak load:        %.1f kW (%.1f kW over 15 min)\n", summary.peak_load, summary.peak_demand);
+    fprintf(stderr, "  sessions:         %ld, wait mean %.2f h, max %.2f h\n", summary.sessions, summary.mean_wait,
+            summary.max_wait);
+    fprintf(stderr, "  chargers in use:  %.1f %%\n", summary.utilization * 100);
+    fprintf(stderr, "  temp limited:     %.1f h of charging\n", summary.temp_limited);
+    fprintf(stderr, "  simulated:        %ld events, %ld steps, %ld of %ld shifts reused, %.3f s wall\n",
+            summary.events, summary.steps, summary.reused, summary.shifts, wall);
+    return 0;
+}
+
+/// "mode=sport,regen=0,power=200,flow=1.5"; the text itself names the branch
+static bool parse_branch_spec(const char *text, BranchSpec *spec) {
+    memset(spec, 0, sizeof(*spec));
+    spec->regen = -1;
+    spec->power = 0;
+    spec->coolant_flow = -2;
+    snprintf(spec->name, sizeof(spec->name), "%s", text);
+    const char *p = text;
+    while (*p) {
+        char key[16], value[32];
+        int used = 0;
+        if (sscanf(p, "%15[a-z]=%31[^,]%n", key, value, &used) != 2) return false;
+        p += used;
+        if (*p == ',') p++;
+        char *end;
+        double number = strtod(value, &end);
+        bool numeric = end != value && *end == 0;
+        if (strcmp(key, "mode") == 0) {
+            if (!drive_mode_from_name(value, &spec->mode)) return false;
+            spec->mode_set = true;
+        } else if (strcmp(key, "regen") == 0 && numeric && number >= 0 && number <= 100) {
+            spec->regen = number;
+        } else if (strcmp(key, "power") == 0 && numeric && number >= 50 && number <= 500) {
+            spec->power = number;
+        } else if (strcmp(key, "flow") == 0 && numeric && number >= -1 && number <= 4) {
+            spec->coolant_flow = number < 0 ? -1 : number;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void apply_branch_spec(const BranchSpec *spec, EVSimulation *sim) {
+    if (spec->mode_set) sim->drive_mode = spec->mode;
+    if (spec->regen >= 0) {
+        sim->regen_braking = spec->regen > 0;
+        if (spec->regen > 0) sim->regen_efficiency = spec->regen / 100.0;
+    }
+    if (spec->power > 0) sim->motor_power = spec->power;
+    if (spec->coolant_flow >= -1 && sim->thermal) ev_thermal_set_flow(sim->thermal, spec->coolant_flow);
+}
+
+static bool add_branch(ForkOptions *opts, const char *text) {
+    if (opts->branch_count == opts->branch_capacity) {
+        int capacity = opts->branch_capacity ? opts->branch_capacity * 2 : 16;
+        BranchSpec *grown = realloc(opts->branches, sizeof(BranchSpec) * capacity);
+        if (!grown) return false;
+        opts->branches = grown;
+        opts->branch_capacity = capacity;
+    }
+    if (!parse_branch_spec(text, &opts->branches[opts->branch_count])) {
+        fprintf(stderr, "Invalid branch: %s\n", text);
+        return false;
+    }
+    opts->branch_count++;
+    return true;
+}
+
+static bool add_branch_file(ForkOptions *opts, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] && line[0] != '#') ok = add_branch(opts, line);
+    }
+    fclose(file);
+    return ok;
+}
+
+static bool parse_fork_options(int argc, char **argv, ForkOptions *opts) {
+    init_common_options(&opts->common);
+    opts->at_distance = 40;
+    opts->from_path = NULL;
+    opts->save_path = NULL;
+    opts->branches = NULL;
+    opts->branch_count = 0;
+    opts->branch_capacity = 0;
+    opts->threads = 0;
+    opts->out_path = NULL;
+    if (!add_branch(opts, "")) return false;
+    snprintf(opts->branches[0].name, sizeof(opts->branches[0].name), "base");
+    for (int i = 0; i < argc; i++) {
+        int used = parse_common_option(&opts->common, argc, argv, i);
+        if (used < 0) return false;
+        if (used > 0) {
+            i += used - 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return false;
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+        if (strcmp(arg, "--at-km") == 0) {
+            opts->at_distance = parse_input(val, 1e-3, 1e6, 40);
+        } else if (strcmp(arg, "--from") == 0) {
+            opts->from_path = val;
+        } else if (strcmp(arg, "--save") == 0) {
+            opts->save_path = val;
+        } else if (strcmp(arg, "--branch") == 0) {
+            if (!add_branch(opts, val)) return false;
+        } else if (strcmp(arg, "--branches") == 0) {
+            if (!add_branch_file(opts, val)) return false;
+        } else if (strcmp(arg, "--threads") == 0) {
+            opts->threads = (int)parse_input(val, 1, 4096, 0);
+        } else if (strcmp(arg, "--out") == 0) {
+            opts->out_path = val;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+    return finish_common_options(&opts->common);
+}
+
+typedef struct {
+    EVRunSummary summary;
+    double soc;                // %
+    bool failed;
+} ForkResult;
+
+/// Branches are handed out one at a time; each forks its own copy of the snapshot
+typedef struct {
+    const ForkOptions *opts;
+    const EVSnapshot *snapshot;
+    ForkResult *results;
+    atomic_int next;
+} ForkPool;
+
+static void *fork_worker(void *arg) {
+    ForkPool *pool = arg;
+    const ForkOptions *opts = pool->opts;
+    for (int b; (b = atomic_fetch_add(&pool->next, 1)) < opts->branch_count;) {
+        ForkResult *result = &pool->results[b];
+        EVBranch branch;
+        if (!ev_snapshot_fork(pool->snapshot, &branch, 1)) {
+            result->failed = true;
+            continue;
+        }
+        branch.sim.motor_map = opts->common.sim.motor_map;
+        branch.sim.route = opts->common.sim.route;
+        branch.sim.drivetrain = opts->common.sim.drivetrain;
+        apply_branch_spec(&opts->branches[b], &branch.sim);
+        RunOptions run = {
+            .common = opts->common,
+            .csv_every = 1,
+            .start_time = branch.time,
+            .start_steps = branch.steps
+        };
+        run.common.sim = branch.sim;
+        run.common.solver = branch.integrator.solver;
+        result->failed = run_single(&run, &branch.integrator, &result->summary) != 0;
+        result->soc = run.common.sim.soc;
+        ev_branch_free(&branch);
+    }
+    return NULL;
+}
+
+/// The shared prefix from the options, up to opts->at_distance
+static EVSnapshot *run_prefix(ForkOptions *opts, double *wall) {
+    CommonOptions *common = &opts->common;
+    EVPack *pack;
+    EVThermal *thermal;
+    if (!build_model(common, &pack, &thermal)) return NULL;
+    ev_sim_reset(&common->sim);
+    common->sim.is_running = true;
+    RunOptions run = {
+        .common = *common,
+        .csv_every = 1,
+        .stop_distance = opts->at_distance
+    };
+    EVIntegrator integrator;
+    init_integrator(&integrator, common);
+    EVRunSummary summary;
+    double start = wall_seconds();
+    EVSnapshot *snapshot = NULL;
+    if (run_single(&run, &integrator, &summary) == 0) {
+        if (run.common.sim.distance < opts->at_distance) {
+            fprintf(stderr, "The run ended at %.3f km, before the fork point\n", run.common.sim.distance);
+        } else if (!(snapshot = ev_snapshot_take(&run.common.sim, &integrator, summary.sim_time, summary.steps,
+                                                 NULL))) {
+            fprintf(stderr, "Failed to allocate the snapshot\n");
+        }
+    }
+    *wall = wall_seconds() - start;
+    ev_thermal_free(thermal);
+    ev_pack_free(pack);
+    return snapshot;
+}
+
+static int cmd_fork(int argc, char **argv) {
+    ForkOptions opts;
+    if (!parse_fork_options(argc, argv, &opts)) {
+        free(opts.branches);
+        print_usage();
+        return 1;
+    }
+    double prefix_wall = 0;
+    EVSnapshot *snapshot = NULL;
+    if (opts.from_path) {
+        if (!(snapshot = ev_snapshot_load(opts.from_path))) fprintf(stderr, "Failed to load snapshot %s\n", opts.from_path);
+    } else {
+        snapshot = run_prefix(&opts, &prefix_wall);
+    }
+    if (!snapshot) {
+        free(opts.branches);
+        return 1;
+    }
+    int rc = 0;
+    if (opts.save_path && !ev_snapshot_save(snapshot, opts.save_path)) {
+        fprintf(stderr, "Failed to write %s\n", opts.save_path);
+        rc = 1;
+    }
+    const EVSimulation *fork_point = ev_snapshot_sim(snapshot);
+    for (int b = 0; rc == 0 && b < opts.branch_count; b++) {
+        if (opts.branches[b].coolant_flow >= -1 && !fork_point->thermal) {
+            fprintf(stderr, "Branch %s sets the coolant flow, but the snapshot has no thermal network\n",
+                    opts.branches[b].name);
+            rc = 1;
+        }
+    }
+    ForkResult *results = calloc(opts.branch_count, sizeof(ForkResult));
+    FILE *out = opts.out_path ? fopen(opts.out_path, "w") : stdout;
+    if (rc == 0 && (!results || !out)) {
+        fprintf(stderr, out ? "Failed to allocate the branch results\n" : "Failed to open %s\n", opts.out_path);
+        rc = 1;
+    }
+    int threads = opts.threads > 0 ? opts.threads : ev_cpu_count();
+    if (threads > opts.branch_count) threads = opts.branch_count;
+    double wall = 0;
+    if (rc == 0) {
+        ForkPool pool = { .opts = &opts, .snapshot = snapshot, .results = results };
+        atomic_init(&pool.next, 0);
+        pthread_t *workers = calloc(threads, sizeof(pthread_t));
+        int started = 0;
+        double start = wall_seconds();
+        while (workers && started < threads - 1 && pthread_create(&workers[started], NULL, fork_worker, &pool) == 0) {
+            started++;
+        }
+        fork_worker(&pool);
+        for (int w = 0; w < started; w++) pthread_join(workers[w], NULL);
+        wall = wall_seconds() - start;
+        threads = started + 1;
+        free(workers);
+        fprintf(out, "branch,distance_km,energy_kwh,soc_pct,efficiency_whkm,peak_battery_temp_c,max_speed_kmh,sim_time_s\n");
+        for (int b = 0; b < opts.branch_count; b++) {
+            const EVRunSummary *s = &results[b].summary;
+            if (results[b].failed) {
+                fprintf(stderr, "Branch %s failed\n", opts.branches[b].name);
+                rc = 1;
+                continue;
+            }
+            fprintf(out, "\"%s\",%.4f,%.4f,%.2f,%.2f,%.3f,%.1f,%.1f\n", opts.branches[b].name, s->distance,
+                    s->energy_consumed, results[b].soc, s->energy_efficiency, s->peak_battery_temp, s->max_speed,
+                    s->sim_time);
+        }
+    }
+    if (out && out != stdout) fclose(out);
+    if (rc == 0) {
+        fprintf(stderr, "fork: %.3f km, %.1f s %s; %d branches on %d threads, %.3f s wall\n",
+                fork_point->distance, ev_snapshot_time(snapshot),
+                opts.from_path ? "loaded" : "simulated once", opts.branch_count, threads, wall);
+        if (!opts.from_path) fprintf(stderr, "prefix: %.3f s wall\n", prefix_wall);
+    }
+    free(results);
+    ev_snapshot_free(snapshot);
+    free(opts.branches);
+    return rc;
+}
+
+/// Decodes a recording column by column, one chunk-sized block at a time
+static int cmd_export(int argc, char **argv) {
+    if (argc < 1 || strncmp(argv[0], "--", 2) == 0) {
+        print_usage();
+        return 1;
+    }
+    const char *path = argv[0];
+    const char *out_path = NULL;
+    long every = 1;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--every") == 0) {
+            every = (long)parse_input(argv[++i], 1, 1e9, 1);
+        } else if (i + 1 < argc && strcmp(argv[i], "--out") == 0) {
+            out_path = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+    EVTelemetryReader *reader = ev_telemetry_open(path);
+    if (!reader) {
+        fprintf(stderr, "Failed to open telemetry file %s\n", path);
+        return 1;
+    }
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", out_path);
+        ev_telemetry_free(reader);
+        return 1;
+    }
+    for (int c = 0; c < EV_TLM_COLUMN_COUNT; c++) {
+        fprintf(out, "%s%c", ev_telemetry_column_names[c], c + 1 < EV_TLM_COLUMN_COUNT ? ',' : '\n');
+    }
+    static double block[EV_TLM_COLUMN_COUNT][EV_TELEMETRY_CHUNK_ROWS];
+    long rows = ev_telemetry_rows(reader);
+    for (long first = 0; first < rows; first += EV_TELEMETRY_CHUNK_ROWS) {
+        long n = 0;
+        for (int c = 0; c < EV_TLM_COLUMN_COUNT; c++) {
+            n = ev_telemetry_read_column(reader, (EVTelemetryColumn)c, first, EV_TELEMETRY_CHUNK_ROWS, block[c]);
+        }
+        for (long r = 0; r < n; r++) {
+            if ((first + r) % every != 0) continue;
+            for (int c = 0; c < EV_TLM_COLUMN_COUNT; c++) {
+                fprintf(out, "%.17g%c", block[c][r], c + 1 < EV_TLM_COLUMN_COUNT ? ',' : '\n');
+            }
+        }
+    }
+    if (out != stdout) fclose(out);
+    ev_telemetry_free(reader);
+    return 0;
+}
+
+static bool has_suffix(const char *text, const char *suffix) {
+    size_t n = strlen(text), m = strlen(suffix);
+    return n >= m && strcmp(text + n - m, suffix) == 0;
+}
+
+/// Builds or loads a map, optionally converts it, and measures batched lookup throughput
+static int cmd_motor_map(int argc, char **argv) {
+    const char *spec = "pmsm";
+    const char *out_path = NULL;
+    long bench = 0;
+    for (int i = 0; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--map") == 0) {
+            spec = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--out") == 0) {
+            out_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--bench") == 0) {
+            bench = (long)parse_input(argv[++i], 0, 1e12, 0);
+        } else {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+    double start = wall_seconds();
+    EVMotorMap *map = ev_motor_map_open(spec);
+    double build = wall_seconds() - start;
+    if (!map) {
+        fprintf(stderr, "Failed to load motor map %s\n", spec);
+        return 1;
+    }
+    double peak = 0;
+    for (int i = 0; i < map->speed_points; i++) {
+        for (int j = 0; j < map->torque_points; j++) {
+            double e = map->efficiency[(long)i * map->stride + j];
+            if (e > peak) peak = e;
+        }
+    }
+    printf("grid:              %d speeds x %d torques (%.1f KiB)\n", map->speed_points, map->torque_points,
+           map->speed_points * map->stride * sizeof(float) / 1024.0);
+    printf("range:             0-%.0f RPM, 0-%.0f Nm at %.0f kW rated\n", map->max_rpm, map->max_torque,
+           map->rated_power);
+    printf("peak efficiency:   %.2f %%\n", peak * 100);
+    printf("build time:        %.3f ms\n", build * 1000);
+    int rc = 0;
+    if (out_path) {
+        bool ok = has_suffix(out_path, ".csv") ? ev_motor_map_save_csv(map, out_path)
+                                               : ev_motor_map_save(map, out_path);
+        if (!ok) {
+            fprintf(stderr, "Failed to write %s\n", out_path);
+            rc = 1;
+        }
+    }
+    if (bench > 0) {
+        static double rpm[MOTOR_BENCH_BATCH], torque[MOTOR_BENCH_BATCH], eff[MOTOR_BENCH_BATCH];
+        uint64_t state = 1;
+        for (int k = 0; k < MOTOR_BENCH_BATCH; k++) {
+            rpm[k] = ev_random_uniform(&state) * map->max_rpm;
+            torque[k] = ev_random_uniform(&state) * map->max_torque;
+        }
+        double sum = 0;
+        start = wall_seconds();
+        for (long done = 0; done < bench; done += MOTOR_BENCH_BATCH) {
+            long n = bench - done < MOTOR_BENCH_BATCH ? bench - done : MOTOR_BENCH_BATCH;
+            ev_motor_map_lookup_batch(map, rpm, torque, eff, n);
+            sum += eff[n - 1];
+        }
+        double wall = wall_seconds() - start;
+        printf("lookups:           %ld in %.3f s, %.1f M/s (%.2f ns each, checksum %.3f)\n", bench, wall,
+               wall > 0 ? bench / wall / 1e6 : 0, wall > 0 ? wall / bench * 1e9 : 0, sum);
+    }
+    ev_motor_map_free(map);
+    return rc;
+}
+
+static int cmd_serve(int argc, char **argv) {
+    EVServerOptions options;
+    ev_server_options_init(&options);
+    for (int i = 0; i < argc; i++) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+        if (strcmp(arg, "--socket") == 0) {
+            options.socket_path = val;
+        } else if (strcmp(arg, "--port") == 0) {
+            options.port = (int)parse_input(val, 0, 65535, 7878);
+        } else if (strcmp(arg, "--threads") == 0) {
+            options.threads = (int)parse_input(val, 1, 4096, 0);
+        } else if (strcmp(arg, "--max-inflight") == 0) {
+            options.max_inflight = (int)parse_input(val, 1, 1e7, 4096);
+        } else if (strcmp(arg, "--queue") == 0) {
+            options.queue_limit = (int)parse_input(val, 1, 1e8, 65536);
+        } else if (strcmp(arg, "--fleet-batch") == 0) {
+            options.fleet_batch = (int)parse_input(val, 1, 1e6, 1024);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            print_usage();
+            return 1;
+        }
+    }
+    return ev_server_run(&options);
+}
+
+static int cmd_bench(int argc, char **argv) {
+    EVBenchOptions options;
+    ev_bench_options_init(&options);
+    const char *out_path = NULL;
+    const char *baseline_path = NULL;
+    double threshold = 25;
+    for (int i = 0; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--out") == 0) {
+            out_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--threshold") == 0) {
+            threshold = parse_input(argv[++i], 0, 1000, 25);
+        } else if (i + 1 < argc && strcmp(argv[i], "--min-time") == 0) {
+            options.min_time = parse_input(argv[++i], 0.001, 60, 0.2);
+        } else if (i + 1 < argc && strcmp(argv[i], "--repeat") == 0) {
+            options.repeat = (int)parse_input(argv[++i], 1, 64, 5);
+        } else if (i + 1 < argc && strcmp(argv[i], "--size") == 0) {
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 || options.width < 16 ||
+                options.height < 16 || options.width > 8192 || options.height > 8192) {
+                fprintf(stderr, "Invalid surface size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i + 1 < argc && strcmp(argv[i], "--filter") == 0) {
+            options.filter = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+    /// Read first, so a bad baseline fails before minutes of measuring
+    EVBenchReport baseline;
+    if (baseline_path && !ev_bench_read_json(&baseline, baseline_path)) {
+        fprintf(stderr, "Failed to read benchmark baseline %s\n", baseline_path);
+        return 1;
+    }
+    EVBenchReport report;
+    ev_bench_run(&report, &options, stderr);
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", out_path);
+        return 1;
+    }
+    bool ok = ev_bench_write_json(&report, out);
+    if (out != stdout) ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s\n", out_path ? out_path : "results");
+        return 1;
+    }
+    if (!baseline_path) return 0;
+    int regressions = ev_bench_compare(&report, &baseline, threshold / 100, stderr);
+    if (regressions > 0) {
+        fprintf(stderr, "%d benchmark%s slower than the baseline by more than %.0f %%\n", regressions,
+                regressions == 1 ? "" : "s", threshold);
+        return 1;
+    }
+    return 0;
+}
+
+static int dispatch(int argc, char **argv) {
+    /// Skip the "--headless" switch
+    argc--;
+    argv++;
+    if (argc > 0 && (strcmp(argv[0], "--help") == 0 || strcmp(argv[0], "-h") == 0)) {
+        print_usage();
+        return 0;
+    }
+    if (argc > 0 && strcmp(argv[0], "run") == 0) {
+        return cmd_run(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "fleet") == 0) {
+        return cmd_fleet(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "sweep") == 0) {
+        return cmd_sweep(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "montecarlo") == 0) {
+        return cmd_monte_carlo(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "aging") == 0) {
+        return cmd_aging(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "depot") == 0) {
+        return cmd_depot(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "export") == 0) {
+        return cmd_export(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "motor-map") == 0) {
+        return cmd_motor_map(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "bench") == 0) {
+        return cmd_bench(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "fork") == 0) {
+        return cmd_fork(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strcmp(argv[0], "serve") == 0) {
+        return cmd_serve(argc - 1, argv + 1);
+    }
+    if (argc > 0 && strncmp(argv[0], "--", 2) != 0) {
+        fprintf(stderr, "Unknown command: %s\n", argv[0]);
+        print_usage();
+        return 1;
+    }
+    return cmd_run(argc, argv);
+}
+
+int ev_cli_main(int argc, char **argv) {
+    int rc = dispatch(argc, argv);
+    ev_motor_map_free(motor_map);
+    motor_map = NULL;
+    ev_route_free(route);
+    route = NULL;
+    return rc;
+}
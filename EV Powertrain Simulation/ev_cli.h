@@ -0,0 +1,7 @@
+#ifndef EV_CLI_H
+#define EV_CLI_H
+
+/// Headless entry point, argv[0] is the "--headless" switch itself
+int ev_cli_main(int argc, char **argv);
+
+#endif
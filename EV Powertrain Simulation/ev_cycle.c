@@ -0,0 +1,367 @@
+#include "ev_cycle.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CSV_BUFFER_SIZE (1 << 20)
+
+/// NEDC urban part (ECE-15), repeated four times
+static const EVCyclePoint ece15_points[] = {
+    { 0, 0.0 }, { 11, 0.0 }, { 15, 15.0 }, { 23, 15.0 }, { 25, 10.0 }, { 28, 0.0 },
+    { 49, 0.0 }, { 54, 15.0 }, { 56, 15.0 }, { 61, 32.0 }, { 85, 32.0 }, { 93, 10.0 },
+    { 96, 0.0 }, { 117, 0.0 }, { 122, 15.0 }, { 124, 15.0 }, { 133, 35.0 }, { 135, 35.0 },
+    { 143, 50.0 }, { 155, 50.0 }, { 163, 35.0 }, { 176, 35.0 }, { 178, 35.0 }, { 185, 10.0 },
+    { 188, 0.0 }, { 195, 0.0 }
+};
+
+/// NEDC extra-urban part (EUDC)
+static const EVCyclePoint eudc_points[] = {
+    { 0, 0.0 }, { 20, 0.0 }, { 25, 15.0 }, { 27, 15.0 }, { 36, 35.0 }, { 38, 35.0 },
+    { 50, 50.0 }, { 52, 50.0 }, { 61, 70.0 }, { 111, 70.0 }, { 119, 50.0 }, { 188, 50.0 },
+    { 201, 70.0 }, { 251, 70.0 }, { 286, 100.0 }, { 316, 100.0 }, { 336, 120.0 }, { 346, 120.0 },
+    { 362, 80.0 }, { 370, 50.0 }, { 380, 0.0 }, { 400, 0.0 }
+};
+
+/// WLTC class 3 modal approximation: per-phase duration, distance and peak speed
+/// match the regulation (Low/Medium/High/Extra High, 1800 s, 23.27 km, 131.3 km/h)
+static const EVCyclePoint wltc3_points[] = {
+    { 0, 0.0 }, { 11, 0.0 }, { 25, 16.0 }, { 40, 27.9 }, { 55, 23.9 }, { 70, 12.0 },
+    { 80, 0.0 }, { 100, 0.0 }, { 115, 20.0 }, { 135, 31.9 }, { 150, 23.9 }, { 170, 0.0 },
+    { 180, 0.0 }, { 200, 23.9 }, { 225, 38.3 }, { 250, 35.9 }, { 270, 56.5 }, { 300, 31.9 },
+    { 320, 35.9 }, { 345, 16.0 }, { 360, 0.0 }, { 385, 0.0 }, { 400, 16.0 }, { 420, 27.9 },
+    { 440, 30.3 }, { 460, 20.0 }, { 480, 23.9 }, { 500, 12.0 }, { 515, 0.0 }, { 530, 0.0 },
+    { 545, 20.0 }, { 560, 12.0 }, { 575, 0.0 }, { 589, 0.0 }, { 595, 0.0 }, { 609, 30.7 },
+    { 629, 51.1 }, { 659, 56.2 }, { 684, 46.0 }, { 704, 20.4 }, { 714, 0.0 }, { 729, 0.0 },
+    { 749, 40.9 }, { 779, 61.3 }, { 809, 76.6 }, { 839, 66.5 }, { 869, 56.2 }, { 894, 40.9 },
+    { 914, 51.1 }, { 939, 35.8 }, { 959, 0.0 }, { 974, 0.0 }, { 989, 35.8 }, { 1004, 25.6 },
+    { 1014, 0.0 }, { 1022, 0.0 }, { 1027, 0.0 }, { 1042, 30.4 }, { 1067, 56.4 }, { 1102, 69.4 },
+    { 1142, 60.7 }, { 1172, 73.7 }, { 1197, 52.1 }, { 1217, 0.0 }, { 1232, 0.0 }, { 1252, 43.4 },
+    { 1282, 69.4 }, { 1322, 97.4 }, { 1362, 78.1 }, { 1392, 65.1 }, { 1422, 73.7 }, { 1452, 52.1 },
+    { 1470, 0.0 }, { 1477, 0.0 }, { 1482, 0.0 }, { 1502, 44.4 }, { 1532, 79.0 }, { 1567, 98.7 },
+    { 1607, 108.6 }, { 1647, 131.3 }, { 1677, 118.5 }, { 1707, 113.6 }, { 1737, 123.4 }, { 1762, 98.7 },
+    { 1782, 49.4 }, { 1795, 0.0 }, { 1800, 0.0 }
+};
+
+/// UDDS modal approximation (1369 s, 11.99 km, 91.2 km/h peak)
+static const EVCyclePoint udds_points[] = {
+    { 0, 0.0 }, { 20, 0.0 }, { 30, 29.7 }, { 40, 53.4 }, { 55, 59.3 }, { 85, 57.0 },
+    { 105, 47.5 }, { 125, 0.0 }, { 165, 0.0 }, { 180, 35.6 }, { 200, 71.2 }, { 230, 91.1 },
+    { 260, 91.2 }, { 290, 91.1 }, { 310, 83.1 }, { 330, 47.5 }, { 345, 0.0 }, { 360, 0.0 },
+    { 375, 29.7 }, { 390, 47.5 }, { 410, 41.5 }, { 425, 0.0 }, { 440, 0.0 }, { 455, 35.6 },
+    { 470, 53.4 }, { 490, 47.5 }, { 505, 0.0 }, { 520, 0.0 }, { 540, 41.5 }, { 560, 59.3 },
+    { 580, 47.5 }, { 595, 0.0 }, { 610, 0.0 }, { 625, 35.6 }, { 640, 47.5 }, { 660, 41.5 },
+    { 675, 0.0 }, { 690, 0.0 }, { 700, 23.7 }, { 715, 41.5 }, { 730, 29.7 }, { 745, 0.0 },
+    { 760, 0.0 }, { 775, 35.6 }, { 790, 53.4 }, { 810, 41.5 }, { 825, 0.0 }, { 845, 0.0 },
+    { 860, 29.7 }, { 880, 47.5 }, { 900, 41.5 }, { 915, 0.0 }, { 930, 0.0 }, { 945, 41.5 },
+    { 965, 59.3 }, { 985, 47.5 }, { 1000, 0.0 }, { 1015, 0.0 }, { 1030, 29.7 }, { 1045, 47.5 },
+    { 1060, 35.6 }, { 1075, 0.0 }, { 1090, 0.0 }, { 1100, 23.7 }, { 1115, 35.6 }, { 1130, 29.7 },
+    { 1145, 0.0 }, { 1160, 0.0 }, { 1175, 41.5 }, { 1195, 53.4 }, { 1215, 47.5 }, { 1230, 0.0 },
+    { 1245, 0.0 }, { 1260, 29.7 }, { 1280, 47.5 }, { 1300, 35.6 }, { 1320, 0.0 }, { 1335, 0.0 },
+    { 1345, 23.7 }, { 1355, 11.9 }, { 1362, 0.0 }, { 1369, 0.0 }
+};
+
+/// HWFET modal approximation (765 s, 16.45 km, 96.4 km/h peak)
+static const EVCyclePoint hwfet_points[] = {
+    { 0, 0.0 }, { 2, 0.0 }, { 30, 61.8 }, { 60, 77.3 }, { 100, 82.4 }, { 140, 77.3 },
+    { 180, 87.6 }, { 220, 80.4 }, { 260, 82.4 }, { 300, 96.4 }, { 340, 92.7 }, { 380, 82.4 },
+    { 420, 72.1 }, { 460, 82.4 }, { 500, 90.7 }, { 540, 84.5 }, { 580, 87.6 }, { 620, 80.4 },
+    { 660, 82.4 }, { 700, 77.3 }, { 730, 51.5 }, { 760, 0.0 }, { 765, 0.0 }
+};
+
+const EVCycleInfo ev_cycle_builtins[] = {
+    { "nedc",  "NEDC, 4 x ECE-15 + EUDC (1180 s)" },
+    { "wltc3", "WLTC class 3 (1800 s, modal approximation)" },
+    { "udds",  "EPA UDDS / FTP-72 (1369 s, modal approximation)" },
+    { "hwfet", "EPA HWFET (765 s, modal approximation)" }
+};
+
+const int ev_cycle_builtin_count = sizeof(ev_cycle_builtins) / sizeof(ev_cycle_builtins[0]);
+
+struct EVCycle {
+    char name[64];
+    /// Built-in knots
+    EVCyclePoint *owned_points;
+    const EVCyclePoint *points;
+    int count;
+    int index;
+    /// Streamed CSV
+    FILE *file;
+    char *io_buffer;
+    double time_base;          // s, time of the first sample in the file
+    bool has_base;
+    double last_read;          // s, guards against non-monotonic samples
+    /// Cursor
+    EVCyclePoint prev;
+    EVCyclePoint next;
+    double offset;             // s, start of the current repetition
+    double end_time;           // s, known once the trace has run out
+    bool primed;
+    bool ended;
+    bool repeat;
+};
+
+#define ARRAY_COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static EVCycle *cycle_new(const char *name) {
+    EVCycle *cycle = calloc(1, sizeof(EVCycle));
+    if (cycle) snprintf(cycle->name, sizeof(cycle->name), "%s", name);
+    return cycle;
+}
+
+/// Joins traces end to end, dropping the duplicated t = 0 knot of each later part
+static EVCyclePoint *concat_points(const EVCyclePoint *const *parts, const int *counts, int n, int *total) {
+    int size = 0;
+    for (int i = 0; i < n; i++) size += counts[i];
+    EVCyclePoint *points = malloc(sizeof(EVCyclePoint) * size);
+    if (!points) return NULL;
+    int k = 0;
+    double offset = 0;
+    for (int i = 0; i < n; i++) {
+        for (int j = (k > 0 ? 1 : 0); j < counts[i]; j++) {
+            points[k].time = parts[i][j].time + offset;
+            points[k].speed = parts[i][j].speed;
+            k++;
+        }
+        offset = points[k - 1].time;
+    }
+    *total = k;
+    return points;
+}
+
+EVCycle *ev_cycle_open_builtin(const char *name) {
+    EVCycle *cycle = NULL;
+    if (strcmp(name, "nedc") == 0) {
+        const EVCyclePoint *parts[] = { ece15_points, ece15_points, ece15_points, ece15_points, eudc_points };
+        int counts[] = { ARRAY_COUNT(ece15_points), ARRAY_COUNT(ece15_points), ARRAY_COUNT(ece15_points),
+                         ARRAY_COUNT(ece15_points), ARRAY_COUNT(eudc_points) };
+        cycle = cycle_new(name);
+        if (!cycle) return NULL;
+        cycle->owned_points = concat_points(parts, counts, 5, &cycle->count);
+        if (!cycle->owned_points) {
+            free(cycle);
+            return NULL;
+        }
+        cycle->points = cycle->owned_points;
+    } else if (strcmp(name, "wltc3") == 0 || strcmp(name, "udds") == 0 || strcmp(name, "hwfet") == 0) {
+        cycle = cycle_new(name);
+        if (!cycle) return NULL;
+        if (name[0] == 'w') {
+            cycle->points = wltc3_points;
+            cycle->count = ARRAY_COUNT(wltc3_points);
+        } else if (name[0] == 'u') {
+            cycle->points = udds_points;
+            cycle->count = ARRAY_COUNT(udds_points);
+        } else {
+            cycle->points = hwfet_points;
+            cycle->count = ARRAY_COUNT(hwfet_points);
+        }
+    }
+    return cycle;
+}
+
+EVCycle *ev_cycle_open_csv(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) return NULL;
+    const char *base = strrchr(path, '/');
+    EVCycle *cycle = cycle_new(base ? base + 1 : path);
+    if (!cycle) {
+        fclose(file);
+        return NULL;
+    }
+    cycle->file = file;
+    /// A large stdio buffer keeps long 1 kHz logs streaming without holding them in memory
+    cycle->io_buffer = malloc(CSV_BUFFER_SIZE);
+    if (cycle->io_buffer) setvbuf(file, cycle->io_buffer, _IOFBF, CSV_BUFFER_SIZE);
+    return cycle;
+}
+
+EVCycle *ev_cycle_open_points(const char *name, const EVCyclePoint *points, int count) {
+    if (count < 1) return NULL;
+    for (int i = 0; i < count; i++) {
+        if (!isfinite(points[i].time) || !isfinite(points[i].speed) || points[i].time < 0) return NULL;
+        if (i > 0 && points[i].time < points[i - 1].time) return NULL;
+    }
+    EVCycle *cycle = cycle_new(name);
+    if (!cycle) return NULL;
+    cycle->owned_points = malloc(sizeof(EVCyclePoint) * count);
+    if (!cycle->owned_points) {
+        free(cycle);
+        return NULL;
+    }
+    memcpy(cycle->owned_points, points, sizeof(EVCyclePoint) * count);
+    cycle->points = cycle->owned_points;
+    cycle->count = count;
+    return cycle;
+}
+
+void ev_cycle_close(EVCycle *cycle) {
+    if (!cycle) return;
+    if (cycle->file) fclose(cycle->file);
+    free(cycle->io_buffer);
+    free(cycle->owned_points);
+    free(cycle);
+}
+
+const char *ev_cycle_name(const EVCycle *cycle) {
+    return cycle->name;
+}
+
+void ev_cycle_set_repeat(EVCycle *cycle, bool repeat) {
+    cycle->repeat = repeat;
+}
+
+static bool parse_sample(const char *line, EVCyclePoint *pt) {
+    char *end;
+    while (isspace((unsigned char)*line)) line++;
+    double time = strtod(line, &end);
+    if (end == line) return false;
+    line = end;
+    while (*line == ',' || *line == ';' || *line == ' ' || *line == '\t') line++;
+    double speed = strtod(line, &end);
+    if (end == line) return false;
+    pt->time = time;
+    pt->speed = speed < 0 ? 0 : speed;
+    return true;
+}
+
+static bool fetch(EVCycle *cycle, EVCyclePoint *pt) {
+    if (!cycle->file) {
+        if (cycle->index >= cycle->count) return false;
+        *pt = cycle->points[cycle->index++];
+        return true;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), cycle->file)) {
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            /// An overlong line would come back in pieces, and a piece can parse as a sample
+            int c;
+            while ((c = fgetc(cycle->file)) != EOF && c != '\n') {}
+            continue;
+        }
+        if (!parse_sample(line, pt)) continue;
+        if (!cycle->has_base) {
+            cycle->time_base = pt->time;
+            cycle->last_read = pt->time;
+            cycle->has_base = true;
+        }
+        if (pt->time < cycle->last_read) continue;
+        cycle->last_read = pt->time;
+        pt->time -= cycle->time_base;
+        return true;
+    }
+    return false;
+}
+
+static bool restart_source(EVCycle *cycle) {
+    cycle->index = 0;
+    if (cycle->file) {
+        if (fseek(cycle->file, 0, SEEK_SET) != 0) return false;
+        cycle->has_base = false;
+    }
+    return true;
+}
+
+static bool prime(EVCycle *cycle) {
+    EVCyclePoint first;
+    if (!fetch(cycle, &first)) {
+        cycle->ended = true;
+        return false;
+    }
+    cycle->prev = first;
+    cycle->next = first;
+    cycle->primed = true;
+    return true;
+}
+
+bool ev_cycle_rewind(EVCycle *cycle) {
+    cycle->primed = false;
+    cycle->ended = false;
+    cycle->offset = 0;
+    cycle->end_time = 0;
+    return restart_source(cycle);
+}
+
+bool ev_cycle_target(EVCycle *cycle, double t, double *speed) {
+    if (cycle->ended) {
+        *speed = cycle->next.speed;
+        return false;
+    }
+    if (!cycle->primed && !prime(cycle)) {
+        *speed = 0;
+        return false;
+    }
+    double local = t - cycle->offset;
+    while (cycle->next.time < local) {
+        EVCyclePoint pt;
+        if (fetch(cycle, &pt)) {
+            cycle->prev = cycle->next;
+            cycle->next = pt;
+            continue;
+        }
+        double period = cycle->next.time;
+        if (!cycle->repeat || period <= 0 || !restart_source(cycle) || !prime(cycle)) {
+            cycle->ended = true;
+            cycle->end_time = cycle->offset + period;
+            *speed = cycle->next.speed;
+            return false;
+        }
+        cycle->offset += period;
+        local -= period;
+    }
+    double span = cycle->next.time - cycle->prev.time;
+    if (span <= 0 || local <= cycle->prev.time) {
+        *speed = span <= 0 ? cycle->next.speed : cycle->prev.speed;
+    } else {
+        double w = (local - cycle->prev.time) / span;
+        *speed = cycle->prev.speed + (cycle->next.speed - cycle->prev.speed) * w;
+    }
+    return true;
+}
+
+bool ev_cycle_finished(const EVCycle *cycle, double t) {
+    return cycle->ended && t >= cycle->end_time;
+}
+
+double ev_driver_accel(const EVSimulation *sim, double target_speed, double lookahead) {
+    double speed_ms = sim->vehicle_speed / 3.6;
+    double target_ms = target_speed / 3.6;
+    if (target_ms <= 0 && speed_ms < 0.1) return 0;
+    double resistance;
+    if (sim->route) {   /// Climbs ask for more, descents for less
+        const EVRouteSample *road = ev_route_at(sim->route, sim->distance);
+        double air = speed_ms + road->headwind;
+        resistance = road->drag_k * air * fabs(air) + road->resistance;
+    } else {
+        const EVVehicleParams *vehicle = &sim->vehicle;
+        resistance = 0.5 * vehicle->drag_coeff * vehicle->frontal_area * vehicle->air_density * speed_ms *
+                     speed_ms / vehicle->mass + vehicle->rolling_resistance * EV_GRAVITY;
+    }
+    return (target_ms - speed_ms) / lookahead + resistance;
+}
+
+bool ev_cycle_driver_input(EVCycle *cycle, const EVSimulation *sim, double t, EVInput *input) {
+    double target;
+    ev_cycle_target(cycle, t + EV_DRIVER_LOOKAHEAD, &target);
+    if (ev_cycle_finished(cycle, t)) return false;
+    input->acceleration = ev_driver_accel(sim, target, EV_DRIVER_LOOKAHEAD / sim->vehicle.aggressiveness);
+    return true;
+}
+
+void ev_cycle_run(EVSimulation *sim, EVCycle *cycle, double dt, double max_time,
+                  bool until_empty, EVRunSummary *summary) {
+    ev_run_summary_begin(summary, sim);
+    EVInput input = { 0 };
+    long max_steps = (long)(max_time / dt + 0.5);
+    double t = 0;
+    EVStepKernel step = ev_sim_step_kernel(sim);
+    while (summary->steps < max_steps && ev_cycle_driver_input(cycle, sim, t, &input)) {
+        step(sim, &input, dt);
+        ev_run_summary_sample(summary, sim);
+        t = summary->steps * dt;
+        if (until_empty && sim->soc <= 0) break;
+    }
+    ev_run_summary_end(summary, sim, t);
+}
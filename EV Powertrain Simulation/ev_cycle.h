@@ -0,0 +1,55 @@
+#ifndef EV_CYCLE_H
+#define EV_CYCLE_H
+
+#include <stdbool.h>
+#include "ev_sim.h"
+
+/// One knot of a speed-vs-time trace, linearly interpolated between knots
+typedef struct {
+    double time;               // s
+    double speed;              // km/h
+} EVCyclePoint;
+
+/// Forward-only cursor over a drive cycle; CSV traces are streamed, never loaded whole
+typedef struct EVCycle EVCycle;
+
+typedef struct {
+    const char *name;
+    const char *description;
+} EVCycleInfo;
+
+extern const EVCycleInfo ev_cycle_builtins[];
+extern const int ev_cycle_builtin_count;
+
+EVCycle *ev_cycle_open_builtin(const char *name);
+/// "time_s,speed_kmh" per line (also ';', tab or space separated); other lines are skipped
+EVCycle *ev_cycle_open_csv(const char *path);
+/// A copy of count knots, times increasing from 0; NULL on bad input
+EVCycle *ev_cycle_open_points(const char *name, const EVCyclePoint *points, int count);
+void ev_cycle_close(EVCycle *cycle);
+const char *ev_cycle_name(const EVCycle *cycle);
+
+/// Start over from t = 0; when repeating, the trace restarts after its last knot
+bool ev_cycle_rewind(EVCycle *cycle);
+void ev_cycle_set_repeat(EVCycle *cycle, bool repeat);
+
+/// Target speed at t; t must not decrease between calls. Returns false past the end
+bool ev_cycle_target(EVCycle *cycle, double t, double *speed);
+
+/// True once the trace has run out and t is past its last knot
+bool ev_cycle_finished(const EVCycle *cycle, double t);
+
+/// Acceleration request that tracks the trace: closes the speed gap over one lookahead
+/// and adds back what drag and rolling resistance will take
+double ev_driver_accel(const EVSimulation *sim, double target_speed, double lookahead);
+
+/// Driver input for step time t; false once the trace (plus lookahead) is finished
+bool ev_cycle_driver_input(EVCycle *cycle, const EVSimulation *sim, double t, EVInput *input);
+
+/// Like ev_sim_run(), driven by the cycle until it ends (or max_time, or SOC 0)
+void ev_cycle_run(EVSimulation *sim, EVCycle *cycle, double dt, double max_time,
+                  bool until_empty, EVRunSummary *summary);
+
+#define EV_DRIVER_LOOKAHEAD 1.0    // s
+
+#endif
@@ -0,0 +1,595 @@
+#include "ev_depot.h"
+#include "ev_cycle.h"
+#include "ev_integrator.h"
+#include "ev_route.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DAY 86400.0                    // s
+#define CV_STEP 2.0                    // % SOC between CV taper breakpoints
+#define TEMP_STEP 2.0                  // °C between derating breakpoints
+#define SNAP 1e-7                      // a breakpoint this close counts as reached
+#define REUSE_SOC 1e-3                 // % a shift may start from the last one's SOC and reuse it
+#define REUSE_TEMP 1e-3                // °C likewise for the battery temperature
+
+typedef enum {
+    VEHICLE_PARKED,
+    VEHICLE_WAITING,
+    VEHICLE_CHARGING,
+    VEHICLE_AWAY
+} VehicleState;
+
+/// Every vehicle owns two scheduler slots, vehicle * SLOTS + slot
+enum {
+    SLOT_SHIFT,                // next departure, or the arrival while away
+    SLOT_CHARGE,               // next charging breakpoint
+    SLOTS
+};
+
+typedef struct {
+    VehicleState state;
+    double distance;           // km per shift
+    double next_departure;     // s
+    double soc;                // %
+    double temp;               // °C
+    double since;              // s, soc and temp are up to date to here
+    double request;            // kW from the grid the battery takes to its next breakpoint
+    double power;              // kW from the grid it is given
+    bool limited;              // request held back by temperature
+    double arrived;            // s
+    int list_index;            // in the charging or waiting list
+    /// The last shift driven through the powertrain, as changes from its start
+    bool shift_cached;
+    double shift_soc;          // % at its start
+    double shift_temp;         // °C at its start
+    double shift_soc_change;   // %
+    double shift_temp_change;  // °C
+    double shift_time;         // s
+} Vehicle;
+
+/// Indexed binary min-heap of slots by time, then slot, so each slot is queued at most once
+/// and moving it is a sift rather than a stale entry
+typedef struct {
+    double *time;              // per slot
+    int *heap;
+    int *position;             // per slot, -1 when not queued
+    int count;
+} Scheduler;
+
+typedef struct {
+    double request;
+    int vehicle;
+} Share;
+
+typedef struct {
+    const EVDepotParams *params;
+    const EVSweepRunOptions *options;
+    const EVSimulation *base;
+    EVCycle *cycle;            // rewound for every shift
+    EVThermal *thermal;        // soaked to ambient before every shift
+    EVDepotSummary *summary;
+    Vehicle *vehicles;
+    Scheduler scheduler;
+    int *charging_list;
+    int charging;
+    int *waiting_list;
+    int waiting;
+    Share *shares;             // scratch for the site cap
+    double capacity;           // kWh
+    double now;                // s
+    int free_chargers;
+    double requested;          // kW, sum over the charging vehicles
+    double load;               // kW from the grid
+    bool capped;               // the site cap held back the last allocation
+    EVDepotInterval *intervals;
+    int interval_count;
+    double busy;               // charger seconds
+    double waited;             // s over every session
+    double departure_soc;      // % summed over every departure
+} Depot;
+
+void ev_depot_params_default(EVDepotParams *params) {
+    params->vehicles = 500;
+    params->chargers = 150;
+    params->charger_power = 50;
+    params->site_power = 3000;
+    params->days = 30;
+    params->seed = 1;
+    params->first_departure = 5;
+    params->last_departure = 9;
+    params->shift_hours = 9;
+    params->shift_distance = 8;
+    params->shift_spread = 0.25;
+    params->ambient = 15;
+    params->target_soc = 90;
+    params->cv_soc = 80;
+    params->cv_floor = 0.1;
+    params->max_crate = 1.0;
+    params->efficiency = 0.93;
+    params->heat_rise = 20;
+    params->time_constant = 3600;
+    params->cold_temp = 5;
+    params->cold_crate = 0.3;
+    params->derate_temp = 40;
+    params->max_temp = 50;
+}
+
+static bool before(const Scheduler *s, int a, int b) {
+    return s->time[a] < s->time[b] || (s->time[a] == s->time[b] && a < b);
+}
+
+static void sift_up(Scheduler *s, int i) {
+    int slot = s->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!before(s, slot, s->heap[parent])) break;
+        s->heap[i] = s->heap[parent];
+        s->position[s->heap[i]] = i;
+        i = parent;
+    }
+    s->heap[i] = slot;
+    s->position[slot] = i;
+}
+
+static void sift_down(Scheduler *s, int i) {
+    int slot = s->heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->count) break;
+        if (child + 1 < s->count && before(s, s->heap[child + 1], s->heap[child])) child++;
+        if (!before(s, s->heap[child], slot)) break;
+        s->heap[i] = s->heap[child];
+        s->position[s->heap[i]] = i;
+        i = child;
+    }
+    s->heap[i] = slot;
+    s->position[slot] = i;
+}
+
+static void schedule(Scheduler *s, int slot, double time) {
+    int i = s->position[slot];
+    if (i < 0) {
+        i = s->count++;
+        s->heap[i] = slot;
+        s->time[slot] = time;
+        sift_up(s, i);
+        return;
+    }
+    double old = s->time[slot];
+    s->time[slot] = time;
+    if (time < old) sift_up(s, i);
+    else sift_down(s, i);
+}
+
+static void cancel(Scheduler *s, int slot) {
+    int i = s->position[slot];
+    if (i < 0) return;
+    s->position[slot] = -1;
+    int last = s->heap[--s->count];
+    if (i == s->count) return;
+    s->heap[i] = last;
+    s->position[last] = i;
+    sift_up(s, i);
+    sift_down(s, s->position[last]);
+}
+
+static int vehicle_slot(const Depot *depot, const Vehicle *v, int slot) {
+    return (int)(v - depot->vehicles) * SLOTS + slot;
+}
+
+static void list_add(int *list, int *count, Depot *depot, Vehicle *v) {
+    v->list_index = (*count)++;
+    list[v->list_index] = (int)(v - depot->vehicles);
+}
+
+static void list_remove(int *list, int *count, Depot *depot, Vehicle *v) {
+    int last = list[--(*count)];
+    list[v->list_index] = last;
+    depot->vehicles[last].list_index = v->list_index;
+}
+
+/// Brings v's SOC and temperature up to now at its constant power: the temperature relaxes
+/// towards ambient plus the heat of that power in closed form
+static void settle(Depot *depot, Vehicle *v) {
+    double dt = depot->now - v->since;
+    if (dt <= 0) return;
+    const EVDepotParams *p = depot->params;
+    double crate = v->power * p->efficiency / depot->capacity;
+    double steady = p->ambient + p->heat_rise * crate * crate;
+    v->temp = steady + (v->temp - steady) * exp(-dt / p->time_constant);
+    v->soc = fmin(v->soc + crate * dt / 36, 100);
+    if (v->limited) depot->summary->temp_limited += dt / 3600;
+    v->since = depot->now;
+}
+
+/// Midpoint of the step-wide cell of [low, high] that value is in
+static double cell_middle(double value, double low, double high, double step) {
+    double start = low + floor((value - low + SNAP) / step) * step;
+    return (start + fmin(start + step, high)) / 2;
+}
+
+/// kW from the grid the battery takes at its SOC and temperature, held until the next breakpoint
+static double charge_request(const Depot *depot, Vehicle *v) {
+    const EVDepotParams *p = depot->params;
+    v->limited = false;
+    if (v->soc >= p->target_soc - SNAP) return 0;
+    double battery = fmin(p->charger_power * p->efficiency, p->max_crate * depot->capacity);
+    if (v->soc >= p->cv_soc - SNAP) {
+        double soc = cell_middle(v->soc, p->cv_soc, p->target_soc, CV_STEP);
+        battery *= p->cv_floor + (1 - p->cv_floor) * (p->target_soc - soc) / (p->target_soc - p->cv_soc);
+    }
+    double allowed = battery;
+    if (v->temp >= p->max_temp - SNAP) {
+        allowed = 0;
+    } else if (v->temp >= p->derate_temp - SNAP) {
+        double temp = cell_middle(v->temp, p->derate_temp, p->max_temp, TEMP_STEP);
+        allowed *= (p->max_temp - temp) / (p->max_temp - p->derate_temp);
+    }
+    if (v->temp < p->cold_temp - SNAP) allowed = fmin(allowed, p->cold_crate * depot->capacity);
+    v->limited = allowed < battery;
+    return allowed / p->efficiency;
+}
+
+/// The next temperature breakpoint a battery warming (or cooling) from temp meets, NAN if none
+static double edge_above(const EVDepotParams *p, double temp) {
+    if (temp < p->cold_temp - SNAP) return p->cold_temp;
+    if (temp < p->derate_temp - SNAP) return p->derate_temp;
+    if (temp >= p->max_temp - SNAP) return NAN;
+    return fmin(p->derate_temp + (floor((temp - p->derate_temp + SNAP) / TEMP_STEP) + 1) * TEMP_STEP, p->max_temp);
+}
+
+static double edge_below(const EVDepotParams *p, double temp) {
+    if (temp > p->max_temp + SNAP) return p->max_temp;
+    if (temp > p->derate_temp + SNAP) {
+        return fmax(p->derate_temp + (ceil((temp - p->derate_temp - SNAP) / TEMP_STEP) - 1) * TEMP_STEP,
+                    p->derate_temp);
+    }
+    if (temp > p->cold_temp + SNAP) return p->cold_temp;
+    return NAN;
+}
+
+/// When v's SOC reaches its next CV step or its temperature the next limit edge at its power
+static double next_breakpoint(const Depot *depot, const Vehicle *v) {
+    const EVDepotParams *p = depot->params;
+    double battery = v->power * p->efficiency;
+    double wait = INFINITY;
+    if (battery > 0) {
+        double next = v->soc < p->cv_soc - SNAP ? p->cv_soc
+                    : fmin(p->cv_soc + (floor((v->soc - p->cv_soc + SNAP) / CV_STEP) + 1) * CV_STEP, p->target_soc);
+        wait = (next - v->soc) / 100 * depot->capacity / battery * 3600;
+    }
+    double crate = battery / depot->capacity;
+    double steady = p->ambient + p->heat_rise * crate * crate;
+    double edge = steady > v->temp + SNAP ? edge_above(p, v->temp)
+                : steady < v->temp - SNAP ? edge_below(p, v->temp) : NAN;
+    /// Only an edge short of the steady state is ever reached
+    if (!isnan(edge) && (edge - steady) * (v->temp - steady) > 0) {
+        wait = fmin(wait, p->time_constant * log((v->temp - steady) / (edge - steady)));
+    }
+    return depot->now + wait;
+}
+
+static void reschedule(Depot *depot, Vehicle *v) {
+    double time = next_breakpoint(depot, v);
+    if (isinf(time)) cancel(&depot->scheduler, vehicle_slot(depot, v, SLOT_CHARGE));
+    else schedule(&depot->scheduler, vehicle_slot(depot, v, SLOT_CHARGE), time);
+}
+
+static int compare_shares(const void *a, const void *b) {
+    const Share *x = a, *y = b;
+    if (x->request != y->request) return x->request < y->request ? -1 : 1;
+    return x->vehicle - y->vehicle;
+}
+
+/// Gives the charging vehicles their power after changed's request (or the charging set)
+/// changed. Under the site cap only changed moves; over it the cap is shared max-min fairly:
+/// in order of request, each gets its request or an equal share of what is left if less
+static void reallocate(Depot *depot, Vehicle *changed) {
+    double cap = depot->params->site_power;
+    if (depot->charging == 0) depot->requested = 0;
+    if (cap <= 0 || (!depot->capped && depot->requested <= cap)) {
+        if (changed && changed->state == VEHICLE_CHARGING) {
+            changed->power = changed->request;
+            reschedule(depot, changed);
+        }
+        depot->load = depot->requested;
+        depot->capped = false;
+        return;
+    }
+    int n = depot->charging;
+    double requested = 0;
+    for (int k = 0; k < n; k++) {
+        Vehicle *v = &depot->vehicles[depot->charging_list[k]];
+        settle(depot, v);
+        depot->shares[k].request = v->request;
+        depot->shares[k].vehicle = depot->charging_list[k];
+        requested += v->request;
+    }
+    qsort(depot->shares, n, sizeof(Share), compare_shares);
+    double left = cap;
+    for (int k = 0; k < n; k++) {
+        Vehicle *v = &depot->vehicles[depot->shares[k].vehicle];
+        v->power = fmin(v->request, left / (n - k));
+        left -= v->power;
+        reschedule(depot, v);
+    }
+    depot->requested = requested;
+    depot->load = cap - left;
+    depot->capped = requested > cap;
+}
+
+static void plug(Depot *depot, Vehicle *v) {
+    settle(depot, v);
+    v->state = VEHICLE_CHARGING;
+    depot->free_chargers--;
+    list_add(depot->charging_list, &depot->charging, depot, v);
+    double wait = depot->now - v->arrived;
+    depot->waited += wait;
+    if (wait / 3600 > depot->summary->max_wait) depot->summary->max_wait = wait / 3600;
+    depot->summary->sessions++;
+    v->power = 0;
+    v->request = charge_request(depot, v);
+    depot->requested += v->request;
+    reallocate(depot, v);
+}
+
+/// Frees v's charger for the waiting vehicle that leaves first
+static void unplug(Depot *depot, Vehicle *v) {
+    settle(depot, v);
+    cancel(&depot->scheduler, vehicle_slot(depot, v, SLOT_CHARGE));
+    list_remove(depot->charging_list, &depot->charging, depot, v);
+    depot->requested -= v->request;
+    v->request = 0;
+    v->power = 0;
+    v->limited = false;
+    v->state = VEHICLE_PARKED;
+    depot->free_chargers++;
+    Vehicle *next = NULL;
+    for (int k = 0; k < depot->waiting; k++) {
+        Vehicle *w = &depot->vehicles[depot->waiting_list[k]];
+        if (!next || w->next_departure < next->next_departure ||
+            (w->next_departure == next->next_departure && w < next)) {
+            next = w;
+        }
+    }
+    if (next) {
+        list_remove(depot->waiting_list, &depot->waiting, depot, next);
+        plug(depot, next);
+    } else {
+        reallocate(depot, NULL);
+    }
+}
+
+static void breakpoint(Depot *depot, Vehicle *v) {
+    settle(depot, v);
+    double request = charge_request(depot, v);
+    if (v->soc >= depot->params->target_soc - SNAP) {
+        unplug(depot, v);
+        return;
+    }
+    depot->requested += request - v->request;
+    v->request = request;
+    reallocate(depot, v);
+}
+
+static void arrive(Depot *depot, Vehicle *v) {
+    v->state = VEHICLE_PARKED;
+    v->arrived = depot->now;
+    schedule(&depot->scheduler, vehicle_slot(depot, v, SLOT_SHIFT), fmax(v->next_departure, depot->now));
+    if (v->soc >= depot->params->target_soc - SNAP) return;
+    if (depot->free_chargers > 0) {
+        plug(depot, v);
+    } else {
+        v->state = VEHICLE_WAITING;
+        list_add(depot->waiting_list, &depot->waiting, depot, v);
+    }
+}
+
+/// Drives v's shift through the powertrain from its SOC and battery temperature. Returns the
+/// time taken (s). Its distance never changes and it mostly leaves charged to the target at the
+/// same temperature, so a start within REUSE_SOC and REUSE_TEMP of the last one driven takes
+/// that shift's changes instead of integrating it again
+static double drive_shift(Depot *depot, Vehicle *v) {
+    if (v->shift_cached && fabs(v->soc - v->shift_soc) < REUSE_SOC && fabs(v->temp - v->shift_temp) < REUSE_TEMP) {
+        depot->summary->reused++;
+        v->soc += v->shift_soc_change;
+        v->temp += v->shift_temp_change;
+        return v->shift_time;
+    }
+    const EVSweepRunOptions *options = depot->options;
+    EVCycle *cycle = depot->cycle;
+    EVSimulation sim = *depot->base;
+    sim.battery_capacity = depot->capacity;
+    sim.vehicle.air_density = ev_air_density(0, depot->params->ambient);
+    sim.pack = NULL;
+    sim.thermal = depot->thermal;
+    ev_sim_reset(&sim);
+    sim.is_running = true;
+    sim.energy_consumed = (1 - v->soc / 100) * sim.battery_capacity;
+    sim.soc = v->soc;
+    sim.battery_temp = v->temp < 10 ? 10 : v->temp > 70 ? 70 : v->temp;
+    EVIntegrator integrator;
+    ev_integrator_init(&integrator, options->solver);
+    integrator.rtol = options->rtol;
+    bool adaptive = ev_solver_is_adaptive(options->solver);
+    EVInput input = { 0 };
+    double t = 0;
+    if (!cycle || ev_cycle_rewind(cycle)) {
+        while (sim.distance < v->distance && sim.soc > 0 && t < options->max_time) {
+            double h = options->dt;
+            if (cycle) {
+                if (!ev_cycle_driver_input(cycle, &sim, t, &input)) break;
+            } else {
+                input.acceleration = ev_profile_accel(&options->profile, t) * sim.vehicle.aggressiveness;
+                if (adaptive) h = ev_profile_next_change(&options->profile, t) - t;
+            }
+            if (adaptive && t + h > options->max_time) h = options->max_time - t;
+            t += ev_integrator_advance(&integrator, &sim, &input, h);
+            depot->summary->steps++;
+        }
+    }
+    bool stranded = sim.distance < v->distance - 1e-6;
+    if (stranded) depot->summary->stranded++;
+    /// A stranded shift depends on where the battery ran out, so it is never reused
+    v->shift_cached = !stranded;
+    v->shift_soc = v->soc;
+    v->shift_temp = v->temp;
+    v->shift_soc_change = sim.soc - v->soc;
+    v->shift_temp_change = sim.battery_temp - v->temp;
+    v->shift_time = t;
+    v->soc = sim.soc > 0 ? sim.soc : 0;
+    v->temp = sim.battery_temp;
+    return t;
+}
+
+static void depart(Depot *depot, Vehicle *v) {
+    const EVDepotParams *p = depot->params;
+    settle(depot, v);
+    if (v->state == VEHICLE_CHARGING) unplug(depot, v);
+    else if (v->state == VEHICLE_WAITING) list_remove(depot->waiting_list, &depot->waiting, depot, v);
+    depot->summary->shifts++;
+    depot->departure_soc += v->soc;
+    if (v->soc < p->target_soc - 1) depot->summary->undercharged++;
+    double drive = drive_shift(depot, v);
+    double away = fmax(p->shift_hours * 3600, drive);
+    /// Parked out for the rest of the shift
+    v->temp = p->ambient + (v->temp - p->ambient) * exp(-(away - drive) / p->time_constant);
+    v->state = VEHICLE_AWAY;
+    v->since = depot->now + away;
+    v->next_departure += DAY;
+    schedule(&depot->scheduler, vehicle_slot(depot, v, SLOT_SHIFT), depot->now + away);
+}
+
+/// Integrates the site load, constant since the last event, up to time
+static void advance(Depot *depot, double time) {
+    int used = depot->params->chargers - depot->free_chargers;
+    while (depot->now < time) {
+        int index = (int)(depot->now / EV_DEPOT_INTERVAL);
+        if (index >= depot->interval_count) {
+            depot->now = time;
+            break;
+        }
+        double end = fmin((index + 1) * EV_DEPOT_INTERVAL, time);
+        double dt = end - depot->now;
+        EVDepotInterval *interval = &depot->intervals[index];
+        interval->load += depot->load * dt / EV_DEPOT_INTERVAL;
+        depot->summary->energy += depot->load * dt / 3600;
+        depot->busy += used * dt;
+        depot->now = end;
+    }
+}
+
+/// Folds the load and queue after an event into the current interval's peaks
+static void note(Depot *depot) {
+    int index = (int)(depot->now / EV_DEPOT_INTERVAL);
+    if (index >= depot->interval_count) return;
+    EVDepotInterval *interval = &depot->intervals[index];
+    if (depot->load > interval->peak) interval->peak = depot->load;
+    if (depot->charging > interval->charging) interval->charging = depot->charging;
+    if (depot->waiting > interval->waiting) interval->waiting = depot->waiting;
+    if (depot->load > depot->summary->peak_load) depot->summary->peak_load = depot->load;
+}
+
+static void free_depot(Depot *depot) {
+    free(depot->vehicles);
+    free(depot->scheduler.time);
+    free(depot->scheduler.heap);
+    free(depot->scheduler.position);
+    free(depot->charging_list);
+    free(depot->waiting_list);
+    free(depot->shares);
+    free(depot->intervals);
+    ev_thermal_free(depot->thermal);
+    ev_cycle_close(depot->cycle);
+}
+
+int ev_depot_run(const EVDepotParams *params, const EVSimulation *base, const EVSweepRunOptions *options,
+                 EVDepotCallback callback, void *user_data, EVDepotSummary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    if (options->pack_series > 0 || params->vehicles < 1 || params->chargers < 1 || params->days <= 0 ||
+        base->battery_capacity <= 0) {
+        return -1;
+    }
+    int n = params->vehicles;
+    double horizon = params->days * DAY;
+    Depot depot = {
+        .params = params,
+        .options = options,
+        .base = base,
+        .summary = summary,
+        .capacity = base->battery_capacity,
+        .free_chargers = params->chargers,
+        .interval_count = (int)ceil(horizon / EV_DEPOT_INTERVAL)
+    };
+    depot.vehicles = calloc(n, sizeof(Vehicle));
+    depot.scheduler.time = calloc(n * SLOTS, sizeof(double));
+    depot.scheduler.heap = calloc(n * SLOTS, sizeof(int));
+    depot.scheduler.position = malloc(n * SLOTS * sizeof(int));
+    depot.charging_list = calloc(n, sizeof(int));
+    depot.waiting_list = calloc(n, sizeof(int));
+    depot.shares = calloc(n, sizeof(Share));
+    depot.intervals = calloc(depot.interval_count, sizeof(EVDepotInterval));
+    bool ok = depot.vehicles && depot.scheduler.time && depot.scheduler.heap && depot.scheduler.position &&
+              depot.charging_list && depot.waiting_list && depot.shares && depot.intervals;
+    if (ok && (options->cycle_name || options->cycle_path)) {
+        depot.cycle = options->cycle_path ? ev_cycle_open_csv(options->cycle_path)
+                                          : ev_cycle_open_builtin(options->cycle_name);
+        if ((ok = depot.cycle != NULL)) ev_cycle_set_repeat(depot.cycle, true);
+    }
+    if (ok && options->thermal) {
+        EVThermalParams thermal_params;
+        ev_thermal_params_default(&thermal_params);
+        thermal_params.coolant_flow = options->coolant_flow;
+        thermal_params.ambient_temp = params->ambient;
+        ok = (depot.thermal = ev_thermal_new(&thermal_params, NULL)) != NULL;
+    }
+    if (!ok) {
+        free_depot(&depot);
+        return -1;
+    }
+    for (int i = 0; i < n * SLOTS; i++) depot.scheduler.position[i] = -1;
+    /// One Philox block per vehicle: its departure time and shift distance, the same every day
+    uint32_t key[2] = { (uint32_t)params->seed, (uint32_t)(params->seed >> 32) };
+    for (int i = 0; i < n; i++) {
+        uint32_t counter[4] = { (uint32_t)i, 0, 0, 0 }, bits[4];
+        ev_philox4x32(counter, key, bits);
+        double u1 = ev_random_unit((uint64_t)bits[0] << 32 | bits[1]);
+        double u2 = ev_random_unit((uint64_t)bits[2] << 32 | bits[3]);
+        Vehicle *v = &depot.vehicles[i];
+        v->state = VEHICLE_PARKED;
+        v->next_departure = (params->first_departure + (params->last_departure - params->first_departure) * u1) * 3600;
+        v->distance = params->shift_distance * (1 + params->shift_spread * (2 * u2 - 1));
+        v->soc = params->target_soc;
+        v->temp = params->ambient;
+        schedule(&depot.scheduler, i * SLOTS + SLOT_SHIFT, v->next_departure);
+    }
+    while (depot.scheduler.count > 0) {
+        int slot = depot.scheduler.heap[0];
+        double time = depot.scheduler.time[slot];
+        if (time > horizon) break;
+        cancel(&depot.scheduler, slot);
+        advance(&depot, time);
+        summary->events++;
+        Vehicle *v = &depot.vehicles[slot / SLOTS];
+        if (slot % SLOTS == SLOT_CHARGE) breakpoint(&depot, v);
+        else if (v->state == VEHICLE_AWAY) arrive(&depot, v);
+        else depart(&depot, v);
+        note(&depot);
+    }
+    advance(&depot, horizon);
+    for (int k = 0; k < depot.interval_count; k++) {
+        if (depot.intervals[k].load > summary->peak_demand) summary->peak_demand = depot.intervals[k].load;
+    }
+    if (callback) {
+        for (int k = 0; k < depot.interval_count; k++) {
+            depot.intervals[k].index = k;
+            callback(&depot.intervals[k], user_data);
+        }
+    }
+    summary->departure_soc = summary->shifts > 0 ? depot.departure_soc / summary->shifts : 0;
+    summary->mean_wait = summary->sessions > 0 ? depot.waited / summary->sessions / 3600 : 0;
+    summary->utilization = depot.busy / (params->chargers * horizon);
+    free_depot(&depot);
+    return 0;
+}
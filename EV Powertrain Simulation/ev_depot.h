@@ -0,0 +1,82 @@
+#ifndef EV_DEPOT_H
+#define EV_DEPOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ev_sim.h"
+#include "ev_sweep.h"
+
+#define EV_DEPOT_INTERVAL 900.0        // s, the demand interval grid connections are billed on
+
+/// A depot of identical vehicles, each driving one shift a day and charging between shifts
+typedef struct {
+    int vehicles;
+    int chargers;
+    double charger_power;      // kW from the grid per charger
+    double site_power;         // kW cap on the sum of every charger; <= 0 uncapped
+    double days;
+    uint64_t seed;             // each vehicle's departure time and shift distance
+    double first_departure;    // h after midnight, departures spread evenly at random to
+    double last_departure;     // h
+    double shift_hours;        // away from the depot, at least the drive itself
+    double shift_distance;     // km driven per shift
+    double shift_spread;       // share each vehicle's distance differs by, at most
+    double ambient;            // °C at the depot and on the road
+    /// CC-CV charging, powers on the battery side
+    double target_soc;         // %
+    double cv_soc;             // %, constant current up to here, then tapering to the target
+    double cv_floor;           // share of the CC power left at the target
+    double max_crate;          // C, constant-current limit
+    double efficiency;         // grid to battery
+    /// Battery temperature while parked: first order towards ambient plus the charging heat
+    double heat_rise;          // °C above ambient at steady 1 C charging, grows with C²
+    double time_constant;      // s
+    double cold_temp;          // °C, below it charging is held to cold_crate
+    double cold_crate;         // C
+    double derate_temp;        // °C, from here charging power falls linearly
+    double max_temp;           // °C, to nothing here
+} EVDepotParams;
+
+typedef struct {
+    int index;                 // from midnight of day 0
+    double load;               // kW average from the grid
+    double peak;               // kW instantaneous
+    int charging;              // most vehicles charging at once
+    int waiting;               // most vehicles waiting for a charger at once
+} EVDepotInterval;
+
+typedef struct {
+    long events;               // scheduler events handled
+    long shifts;
+    long stranded;             // shifts the battery ran out on
+    long undercharged;         // departures below the target SOC
+    double departure_soc;      // %, mean
+    long sessions;             // charging sessions started
+    double energy;             // kWh from the grid
+    double peak_load;          // kW instantaneous
+    double peak_demand;        // kW, highest interval average
+    double mean_wait;          // h from arrival to a charger, over the sessions
+    double max_wait;           // h
+    double utilization;        // share of charger time in use
+    double temp_limited;       // h of charging held back by battery temperature
+    long steps;                // physics steps integrated
+    long reused;               // shifts that took the vehicle's previous shift instead
+} EVDepotSummary;
+
+/// Called for every demand interval in order, once the run has finished
+typedef void (*EVDepotCallback)(const EVDepotInterval *interval, void *user_data);
+
+void ev_depot_params_default(EVDepotParams *params);
+
+/// Event-driven: a scheduler pops departures, arrivals and charging breakpoints in time order,
+/// with no tick in between. Every vehicle starts charged at midnight of day 0. A shift drives
+/// base with the options' solver, cycle or profile from the vehicle's SOC and battery
+/// temperature. Back at the depot a vehicle takes a free charger or waits for one, earliest next
+/// departure first, and is unplugged when charged or when it leaves. Charging power is constant
+/// between breakpoints: the CV taper steps every 2 % SOC and the temperature limits every 2 °C,
+/// each solved in closed form, and the site cap shares power out max-min fairly whenever the
+/// charging set or a request changes. options->pack_series must be 0. Returns 0 on success
+int ev_depot_run(const EVDepotParams *params, const EVSimulation *base, const EVSweepRunOptions *options,
+                 EVDepotCallback callback, void *user_data, EVDepotSummary *summary);
+
+#endif
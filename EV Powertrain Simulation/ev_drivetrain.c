@@ -0,0 +1,200 @@
+#include "ev_drivetrain.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_RATIO 1.0                  // overall, motor turns per wheel turn
+#define MAX_RATIO 20.0
+
+static const char *const topology_names[EV_DRIVETRAIN_TOPOLOGY_COUNT] = {
+    [EV_DRIVETRAIN_SINGLE] = "single",
+    [EV_DRIVETRAIN_TWO_SPEED] = "2speed",
+    [EV_DRIVETRAIN_DUAL] = "dual",
+    [EV_DRIVETRAIN_QUAD] = "quad"
+};
+
+static const char *const strategy_names[EV_SPLIT_COUNT] = {
+    [EV_SPLIT_FIXED] = "fixed",
+    [EV_SPLIT_REAR_FIRST] = "rear-first",
+    [EV_SPLIT_OPTIMAL] = "optimal"
+};
+
+#define EV_DRIVETRAIN_KERNEL_NAME(id, name, topology, strategy) [EV_DRIVETRAIN_KERNEL_##id] = #name,
+static const char *const kernel_names[EV_DRIVETRAIN_KERNEL_COUNT] = {
+    EV_DRIVETRAIN_KERNELS(EV_DRIVETRAIN_KERNEL_NAME)
+};
+
+void ev_drivetrain_direct(EVDrivetrain *drivetrain) {
+    memset(drivetrain, 0, sizeof(*drivetrain));
+    drivetrain->topology = EV_DRIVETRAIN_SINGLE;
+    drivetrain->strategy = EV_SPLIT_FIXED;
+    drivetrain->rpm_per_kmh[0] = EV_DIRECT_RPM_PER_KMH;
+    drivetrain->rpm_per_kmh[1] = EV_DIRECT_RPM_PER_KMH;
+    drivetrain->shift_speed = INFINITY;
+    drivetrain->gear_efficiency = 1.0;
+}
+
+void ev_drivetrain_default(EVDrivetrain *drivetrain, EVDrivetrainTopology topology) {
+    ev_drivetrain_direct(drivetrain);
+    drivetrain->topology = topology;
+    double ratios[2] = { 6.2, 6.2 };
+    switch (topology) {
+    case EV_DRIVETRAIN_TWO_SPEED:
+        /// Launch gear for low-speed torque, overdrive keeps the motor slow on the motorway
+        ratios[0] = 9.3;
+        ratios[1] = 5.6;
+        drivetrain->shift_speed = 70;
+        drivetrain->gear_efficiency = 0.96;
+        break;
+    case EV_DRIVETRAIN_DUAL:
+        /// The smaller front machine is geared a little shorter
+        ratios[1] = 6.8;
+        drivetrain->gear_efficiency = 0.97;
+        drivetrain->front_power = 0.4;
+        drivetrain->split = 0.4;
+        break;
+    case EV_DRIVETRAIN_QUAD:
+        /// No differentials or half shafts, one planetary stage per hub
+        drivetrain->gear_efficiency = 0.985;
+        drivetrain->front_power = 0.5;
+        drivetrain->split = 0.5;
+        break;
+    default:
+        drivetrain->gear_efficiency = 0.97;
+        break;
+    }
+    drivetrain->rpm_per_kmh[0] = ratios[0] * EV_WHEEL_RPM_PER_KMH;
+    drivetrain->rpm_per_kmh[1] = ratios[1] * EV_WHEEL_RPM_PER_KMH;
+}
+
+static bool parse_ratio(const char *text, double *ratio) {
+    char *end;
+    *ratio = strtod(text, &end);
+    return end != text && *end == 0 && *ratio >= MIN_RATIO && *ratio <= MAX_RATIO;
+}
+
+bool ev_drivetrain_parse(const char *spec, EVDrivetrain *drivetrain) {
+    char topology[16];
+    int used = 0;
+    if (sscanf(spec, "%15[a-z0-9]%n", topology, &used) != 1) return false;
+    int t = 0;
+    while (t < EV_DRIVETRAIN_TOPOLOGY_COUNT && strcmp(topology, topology_names[t]) != 0) t++;
+    if (t == EV_DRIVETRAIN_TOPOLOGY_COUNT) return false;
+    EVDrivetrain d;
+    ev_drivetrain_default(&d, (EVDrivetrainTopology)t);
+    bool two_axle = ev_drivetrain_two_axle(&d);
+    const char *p = spec + used;
+    if (*p == ',') p++;
+    else if (*p) return false;
+    while (*p) {
+        char key[16], value[32];
+        used = 0;
+        if (sscanf(p, "%15[a-z]=%31[^,]%n", key, value, &used) != 2) return false;
+        p += used;
+        if (*p == ',') p++;
+        char *end;
+        double number = strtod(value, &end);
+        bool numeric = end != value && *end == 0;
+        if (strcmp(key, "ratio") == 0) {
+            char *colon = strchr(value, ':');
+            double first, second;
+            if (colon) *colon = 0;
+            if (!parse_ratio(value, &first)) return false;
+            if (colon && !parse_ratio(colon + 1, &second)) return false;
+            if (colon && d.topology == EV_DRIVETRAIN_SINGLE) return false;
+            if (!colon) second = first;
+            /// One ratio for a two-speed box would leave nothing to shift to
+            if (d.topology == EV_DRIVETRAIN_TWO_SPEED && !colon) return false;
+            d.rpm_per_kmh[0] = first * EV_WHEEL_RPM_PER_KMH;
+            d.rpm_per_kmh[1] = second * EV_WHEEL_RPM_PER_KMH;
+        } else if (strcmp(key, "shift") == 0 && d.topology == EV_DRIVETRAIN_TWO_SPEED && numeric &&
+                   number > 0 && number <= 250) {
+            d.shift_speed = number;
+        } else if (strcmp(key, "front") == 0 && two_axle && numeric && number > 0 && number < 100) {
+            d.front_power = number / 100;
+        } else if (strcmp(key, "split") == 0 && two_axle) {
+            if (numeric && number >= 0 && number <= 100) {
+                d.strategy = EV_SPLIT_FIXED;
+                d.split = number / 100;
+            } else if (!ev_split_strategy_from_name(value, &d.strategy)) {
+                return false;
+            }
+        } else if (strcmp(key, "gears") == 0 && numeric && number >= 50 && number <= 100) {
+            d.gear_efficiency = number / 100;
+        } else {
+            return false;
+        }
+    }
+    *drivetrain = d;
+    return true;
+}
+
+void ev_drivetrain_describe(const EVDrivetrain *drivetrain, char *buf, int size) {
+    const EVDrivetrain *d = drivetrain;
+    if (ev_drivetrain_is_direct(d)) {
+        snprintf(buf, size, "direct, %.0f RPM per km/h", d->rpm_per_kmh[0]);
+        return;
+    }
+    double first = d->rpm_per_kmh[0] / EV_WHEEL_RPM_PER_KMH, second = d->rpm_per_kmh[1] / EV_WHEEL_RPM_PER_KMH;
+    int n = snprintf(buf, size, "%s", ev_drivetrain_topology_name(d->topology));
+    if (n < 0 || n >= size) return;
+    if (d->topology == EV_DRIVETRAIN_TWO_SPEED) {
+        n += snprintf(buf + n, size - n, ", %.2f:%.2f, upshift at %.0f km/h", first, second, d->shift_speed);
+    } else if (ev_drivetrain_two_axle(d)) {
+        if (d->strategy == EV_SPLIT_FIXED) n += snprintf(buf + n, size - n, ", fixed %.0f %% front", d->split * 100);
+        else n += snprintf(buf + n, size - n, ", %s", ev_split_strategy_name(d->strategy));
+        if (n < size) {
+            n += snprintf(buf + n, size - n, ", %.0f %% of the power in front, %.2f:%.2f", d->front_power * 100,
+                          first, second);
+        }
+    } else {
+        n += snprintf(buf + n, size - n, ", %.2f", first);
+    }
+    if (n < size) snprintf(buf + n, size - n, ", gears %.1f %%", d->gear_efficiency * 100);
+}
+
+bool ev_drivetrain_is_direct(const EVDrivetrain *drivetrain) {
+    return drivetrain->topology == EV_DRIVETRAIN_SINGLE && drivetrain->gear_efficiency == 1.0 &&
+           drivetrain->rpm_per_kmh[0] == EV_DIRECT_RPM_PER_KMH;
+}
+
+bool ev_drivetrain_two_axle(const EVDrivetrain *drivetrain) {
+    return drivetrain->topology == EV_DRIVETRAIN_DUAL || drivetrain->topology == EV_DRIVETRAIN_QUAD;
+}
+
+const char *ev_drivetrain_topology_name(EVDrivetrainTopology topology) {
+    return (topology >= 0 && topology < EV_DRIVETRAIN_TOPOLOGY_COUNT) ? topology_names[topology] : "unknown";
+}
+
+const char *ev_split_strategy_name(EVSplitStrategy strategy) {
+    return (strategy >= 0 && strategy < EV_SPLIT_COUNT) ? strategy_names[strategy] : "unknown";
+}
+
+bool ev_split_strategy_from_name(const char *name, EVSplitStrategy *strategy) {
+    for (int i = 0; i < EV_SPLIT_COUNT; i++) {
+        if (strcmp(name, strategy_names[i]) == 0) {
+            *strategy = (EVSplitStrategy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+EVDrivetrainKernel ev_drivetrain_kernel(const EVDrivetrain *drivetrain) {
+    switch (drivetrain->topology) {
+    case EV_DRIVETRAIN_TWO_SPEED:
+        return EV_DRIVETRAIN_KERNEL_TWO_SPEED;
+    case EV_DRIVETRAIN_DUAL:
+    case EV_DRIVETRAIN_QUAD:
+        if (drivetrain->strategy == EV_SPLIT_REAR_FIRST) return EV_DRIVETRAIN_KERNEL_REAR_FIRST;
+        if (drivetrain->strategy == EV_SPLIT_OPTIMAL) return EV_DRIVETRAIN_KERNEL_OPTIMAL_SPLIT;
+        return EV_DRIVETRAIN_KERNEL_FIXED_SPLIT;
+    default:
+        return EV_DRIVETRAIN_KERNEL_SINGLE;
+    }
+}
+
+const char *ev_drivetrain_kernel_name(EVDrivetrainKernel kernel) {
+    return (kernel >= 0 && kernel < EV_DRIVETRAIN_KERNEL_COUNT) ? kernel_names[kernel] : "unknown";
+}
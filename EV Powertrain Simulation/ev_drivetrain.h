@@ -0,0 +1,152 @@
+#ifndef EV_DRIVETRAIN_H
+#define EV_DRIVETRAIN_H
+
+#include <stdbool.h>
+#include "ev_motor.h"
+
+#define EV_WHEEL_RPM_PER_KMH 8.04      // wheel RPM per km/h, 0.33 m rolling radius
+#define EV_DIRECT_RPM_PER_KMH 50.0     // motor RPM per km/h of the lumped drivetrain
+
+/// The per-topology helpers below are only ever called with constant topology and strategy
+/// arguments; forced inline, every test on them folds away in the kernel that calls them
+#if defined(__GNUC__)
+#define EV_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define EV_ALWAYS_INLINE inline
+#endif
+
+typedef enum {
+    EV_DRIVETRAIN_SINGLE,      // one motor, one fixed reduction
+    EV_DRIVETRAIN_TWO_SPEED,   // one motor, two ratios, upshift at shift_speed
+    EV_DRIVETRAIN_DUAL,        // a motor per axle, each with its own reduction
+    EV_DRIVETRAIN_QUAD,        // an in-wheel motor per wheel with a hub reduction
+    EV_DRIVETRAIN_TOPOLOGY_COUNT
+} EVDrivetrainTopology;
+
+/// How a two-axle drivetrain shares the shaft power between its axles
+typedef enum {
+    EV_SPLIT_FIXED,            // the front axle takes split of the demand
+    EV_SPLIT_REAR_FIRST,       // the rear alone up to its rating, the front adds the rest
+    EV_SPLIT_OPTIMAL,          // the least electrical input of rear only, front only and in
+                               // proportion to the ratings, among those within the ratings
+    EV_SPLIT_COUNT
+} EVSplitStrategy;
+
+/// Gearing and motor layout. Held by value in EVSimulation, so a sweep can vary it per run
+typedef struct {
+    EVDrivetrainTopology topology;
+    EVSplitStrategy strategy;  // two-axle topologies only
+    double rpm_per_kmh[2];     // motor RPM per km/h: [0] the rear or only motor, or first gear;
+                               // [1] the front motors, or second gear
+    double shift_speed;        // km/h, two-speed upshift
+    double gear_efficiency;    // reductions and differentials; 1.0 when the motor efficiency
+                               // already covers them
+    double front_power;        // share of motor_power on the front axle, two-axle only
+    double split;              // front share of the shaft power for EV_SPLIT_FIXED
+} EVDrivetrain;
+
+/// Every specialized kernel as (ID, name, topology, strategy). Quad runs the dual kernels: both
+/// in-wheel motors of an axle turn at one speed and share its load equally, so one motor of
+/// half the axle's rating stands for the pair and has the same efficiency
+#define EV_DRIVETRAIN_KERNELS(X)                                                  \
+    X(SINGLE, single, EV_DRIVETRAIN_SINGLE, EV_SPLIT_FIXED)                       \
+    X(TWO_SPEED, two_speed, EV_DRIVETRAIN_TWO_SPEED, EV_SPLIT_FIXED)              \
+    X(FIXED_SPLIT, fixed_split, EV_DRIVETRAIN_DUAL, EV_SPLIT_FIXED)               \
+    X(REAR_FIRST, rear_first, EV_DRIVETRAIN_DUAL, EV_SPLIT_REAR_FIRST)            \
+    X(OPTIMAL_SPLIT, optimal_split, EV_DRIVETRAIN_DUAL, EV_SPLIT_OPTIMAL)
+
+#define EV_DRIVETRAIN_KERNEL_ID(id, name, topology, strategy) EV_DRIVETRAIN_KERNEL_##id,
+
+typedef enum {
+    EV_DRIVETRAIN_KERNELS(EV_DRIVETRAIN_KERNEL_ID)
+    EV_DRIVETRAIN_KERNEL_COUNT
+} EVDrivetrainKernel;
+
+/// The lumped drivetrain every EVSimulation starts with: one motor at 50 RPM per km/h whose
+/// efficiency covers the gears
+void ev_drivetrain_direct(EVDrivetrain *drivetrain);
+/// Typical gearing for a topology; a single-speed 150 kW car turns its motor at 50 RPM per km/h
+void ev_drivetrain_default(EVDrivetrain *drivetrain, EVDrivetrainTopology topology);
+/// "TOPOLOGY[,key=value...]": single, 2speed, dual or quad, then ratio=R or R1:R2 (overall,
+/// rear:front or first:second), shift=KMH, front=PCT (front axle's share of the power),
+/// split=fixed|rear-first|optimal or a front PCT (fixed), gears=PCT (gear efficiency).
+/// false on bad input
+bool ev_drivetrain_parse(const char *spec, EVDrivetrain *drivetrain);
+/// "dual (rear-first, 40 % front), 9.7:7.5" into buf
+void ev_drivetrain_describe(const EVDrivetrain *drivetrain, char *buf, int size);
+bool ev_drivetrain_is_direct(const EVDrivetrain *drivetrain);
+bool ev_drivetrain_two_axle(const EVDrivetrain *drivetrain);
+
+const char *ev_drivetrain_topology_name(EVDrivetrainTopology topology);
+const char *ev_split_strategy_name(EVSplitStrategy strategy);
+bool ev_split_strategy_from_name(const char *name, EVSplitStrategy *strategy);
+
+/// Which kernel runs this drivetrain. Loops call it once per run, never per step
+EVDrivetrainKernel ev_drivetrain_kernel(const EVDrivetrain *drivetrain);
+const char *ev_drivetrain_kernel_name(EVDrivetrainKernel kernel);
+
+/// RPM of the rear, or only, motor at speed (km/h)
+static EV_ALWAYS_INLINE double ev_drivetrain_rpm(const EVDrivetrain *d, EVDrivetrainTopology topology,
+                                                 double speed) {
+    if (topology == EV_DRIVETRAIN_TWO_SPEED) return speed * d->rpm_per_kmh[speed < d->shift_speed ? 0 : 1];
+    return speed * d->rpm_per_kmh[0];
+}
+
+/// Torque (Nm) the motors give from power (kW) at speed (km/h), summed over the motors; P/ω
+/// per motor with a 0.1 rad/s guard at standstill
+static EV_ALWAYS_INLINE double ev_drivetrain_torque(const EVDrivetrain *d, EVDrivetrainTopology topology,
+                                                    double power, double speed) {
+    const double rpm_to_omega = 2 * 3.14159265358979323846;
+    if (topology != EV_DRIVETRAIN_DUAL) {
+        return power * 1000 / (ev_drivetrain_rpm(d, topology, speed) / 60 * rpm_to_omega + 0.1);
+    }
+    double front = power * d->front_power;
+    return (power - front) * 1000 / (speed * d->rpm_per_kmh[0] / 60 * rpm_to_omega + 0.1) +
+           front * 1000 / (speed * d->rpm_per_kmh[1] / 60 * rpm_to_omega + 0.1);
+}
+
+/// kW both axles draw when the front one delivers share of shaft_power (kW). An axle without
+/// load draws nothing, as if its motors were decoupled
+static EV_ALWAYS_INLINE double ev_drivetrain_split_input(const EVMotorMap *map, double rear_power,
+                                                         double front_power, double rear_rpm, double front_rpm,
+                                                         double shaft_power, double share) {
+    double rear = (1 - share) * shaft_power, front = share * shaft_power;
+    return rear / ev_motor_drive_efficiency(map, rear_power, rear_rpm, rear) +
+           front / ev_motor_drive_efficiency(map, front_power, front_rpm, front);
+}
+
+/// Shaft power over electrical input, gear losses included, while the motors deliver
+/// shaft_power (kW, > 0) at speed (km/h). motor_power (kW) is the whole drivetrain's. map
+/// NULL is EV_MOTOR_FLAT_EFFICIENCY for every motor, where every split costs the same
+static EV_ALWAYS_INLINE double ev_drivetrain_efficiency(const EVDrivetrain *d, EVDrivetrainTopology topology,
+                                                        EVSplitStrategy strategy, const EVMotorMap *map,
+                                                        double motor_power, double speed, double shaft_power) {
+    if (!map) return EV_MOTOR_FLAT_EFFICIENCY * d->gear_efficiency;
+    if (topology != EV_DRIVETRAIN_DUAL) {
+        double rpm = ev_drivetrain_rpm(d, topology, speed);
+        return ev_motor_drive_efficiency(map, motor_power, rpm, shaft_power) * d->gear_efficiency;
+    }
+    double front_power = motor_power * d->front_power, rear_power = motor_power - front_power;
+    double rear_rpm = speed * d->rpm_per_kmh[0], front_rpm = speed * d->rpm_per_kmh[1];
+    /// Front shares that keep both axles within their ratings
+    double low = shaft_power > rear_power ? 1 - rear_power / shaft_power : 0;
+    double high = shaft_power > front_power ? front_power / shaft_power : 1;
+    double share = d->split;
+    if (strategy == EV_SPLIT_REAR_FIRST) share = low;
+    if (strategy == EV_SPLIT_OPTIMAL) share = d->front_power;
+    double input = ev_drivetrain_split_input(map, rear_power, front_power, rear_rpm, front_rpm, shaft_power, share);
+    if (strategy == EV_SPLIT_OPTIMAL && low <= high) {
+        /// Losses are close to convex in the share, so the cheapest of both ends of the feasible
+        /// range and the proportional split is near the best; at partial load that is often
+        /// one motor alone near its sweet spot
+        double rear_biased = ev_drivetrain_split_input(map, rear_power, front_power, rear_rpm, front_rpm,
+                                                       shaft_power, low);
+        double front_biased = ev_drivetrain_split_input(map, rear_power, front_power, rear_rpm, front_rpm,
+                                                        shaft_power, high);
+        input = rear_biased < input ? rear_biased : input;
+        input = front_biased < input ? front_biased : input;
+    }
+    return shaft_power / input * d->gear_efficiency;
+}
+
+#endif
@@ -0,0 +1,434 @@
+#include "ev_fleet.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EV_FLEET_X86 1
+#include <immintrin.h>
+#endif
+
+/// Per-step constants, computed once so the kernels only see multiplies and adds
+typedef struct {
+    double dt;
+    double drag_k;             // 0.5 * Cd * A * rho / mass
+    double rolling_decel;      // m/s²
+    double hours;              // dt in hours
+    double rpm_to_rad;         // (RPM -> rad/s)
+} StepConstants;
+
+static void *aligned_block(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, EV_FLEET_ALIGN);
+#else
+    return aligned_alloc(EV_FLEET_ALIGN, size);
+#endif
+}
+
+static void aligned_block_free(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+#define FLEET_COLUMNS 18
+
+/// Every double column of the fleet, in allocation order
+static void fleet_columns(EVFleet *fleet, double **columns[FLEET_COLUMNS]) {
+    double **list[FLEET_COLUMNS] = {
+        &fleet->battery_voltage, &fleet->battery_capacity, &fleet->motor_power,
+        &fleet->regen_efficiency, &fleet->regen_braking, &fleet->max_accel, &fleet->power_factor,
+        &fleet->vehicle_speed, &fleet->acceleration, &fleet->motor_rpm, &fleet->motor_torque,
+        &fleet->soc, &fleet->distance, &fleet->energy_consumed, &fleet->battery_temp,
+        &fleet->energy_efficiency, &fleet->peak_battery_temp, &fleet->accel_request
+    };
+    memcpy(columns, list, sizeof(list));
+}
+
+EVFleet *ev_fleet_new(int count) {
+    if (count <= 0) return NULL;
+    EVFleet *fleet = calloc(1, sizeof(EVFleet));
+    if (!fleet) return NULL;
+    fleet->count = count;
+    fleet->capacity = (count + EV_FLEET_LANES - 1) / EV_FLEET_LANES * EV_FLEET_LANES;
+    double **columns[FLEET_COLUMNS];
+    fleet_columns(fleet, columns);
+    size_t column_bytes = (size_t)fleet->capacity * sizeof(double);
+    size_t total = column_bytes * FLEET_COLUMNS + (size_t)fleet->capacity * sizeof(DriveMode);
+    total = (total + EV_FLEET_ALIGN - 1) / EV_FLEET_ALIGN * EV_FLEET_ALIGN;
+    char *block = aligned_block(total);
+    if (!block) {
+        free(fleet);
+        return NULL;
+    }
+    for (int c = 0; c < FLEET_COLUMNS; c++) *columns[c] = (double *)(block + column_bytes * c);
+    fleet->drive_mode = (DriveMode *)(block + column_bytes * FLEET_COLUMNS);
+    EVSimulation defaults;
+    ev_sim_init(&defaults);
+    for (int i = 0; i < fleet->capacity; i++) ev_fleet_set_vehicle(fleet, i, &defaults);
+    /// Padding lanes start empty so they stay parked
+    for (int i = count; i < fleet->capacity; i++) fleet->soc[i] = 0;
+    ev_fleet_set_kernel(fleet, EV_FLEET_KERNEL_AUTO);
+    return fleet;
+}
+
+void ev_fleet_free(EVFleet *fleet) {
+    if (!fleet) return;
+    aligned_block_free(fleet->battery_voltage);
+    free(fleet);
+}
+
+void ev_fleet_set_vehicle(EVFleet *fleet, int i, const EVSimulation *sim) {
+    const DriveModeParams *mode = &drive_mode_params[sim->drive_mode];
+    fleet->battery_voltage[i] = sim->battery_voltage;
+    fleet->battery_capacity[i] = sim->battery_capacity;
+    fleet->motor_power[i] = sim->motor_power;
+    fleet->regen_efficiency[i] = sim->regen_efficiency;
+    fleet->regen_braking[i] = sim->regen_braking ? 1.0 : 0.0;
+    fleet->max_accel[i] = mode->max_accel;
+    fleet->power_factor[i] = mode->power_factor;
+    fleet->drive_mode[i] = sim->drive_mode;
+    fleet->vehicle_speed[i] = sim->vehicle_speed;
+    fleet->acceleration[i] = sim->acceleration;
+    fleet->motor_rpm[i] = sim->motor_rpm;
+    fleet->motor_torque[i] = sim->motor_torque;
+    fleet->soc[i] = sim->soc;
+    fleet->distance[i] = sim->distance;
+    fleet->energy_consumed[i] = sim->energy_consumed;
+    fleet->battery_temp[i] = sim->battery_temp;
+    fleet->energy_efficiency[i] = sim->energy_efficiency;
+    fleet->peak_battery_temp[i] = sim->battery_temp;
+    fleet->accel_request[i] = 0;
+}
+
+void ev_fleet_get_vehicle(const EVFleet *fleet, int i, EVSimulation *sim) {
+    sim->battery_voltage = fleet->battery_voltage[i];
+    sim->battery_capacity = fleet->battery_capacity[i];
+    sim->motor_power = fleet->motor_power[i];
+    sim->regen_efficiency = fleet->regen_efficiency[i];
+    sim->regen_braking = fleet->regen_braking[i] > 0.5;
+    sim->drive_mode = fleet->drive_mode[i];
+    sim->vehicle_speed = fleet->vehicle_speed[i];
+    sim->acceleration = fleet->acceleration[i];
+    sim->motor_rpm = fleet->motor_rpm[i];
+    sim->motor_torque = fleet->motor_torque[i];
+    sim->soc = fleet->soc[i];
+    sim->distance = fleet->distance[i];
+    sim->energy_consumed = fleet->energy_consumed[i];
+    sim->battery_temp = fleet->battery_temp[i];
+    sim->energy_efficiency = fleet->energy_efficiency[i];
+    sim->is_running = fleet->soc[i] > 0;
+}
+
+void ev_fleet_reset(EVFleet *fleet) {
+    for (int i = 0; i < fleet->count; i++) {
+        fleet->vehicle_speed[i] = 0;
+        fleet->acceleration[i] = 0;
+        fleet->motor_rpm[i] = 0;
+        fleet->motor_torque[i] = 0;
+        fleet->soc[i] = 100;
+        fleet->distance[i] = 0;
+        fleet->energy_consumed[i] = 0;
+        fleet->battery_temp[i] = 25.0;
+        fleet->energy_efficiency[i] = 0;
+        fleet->peak_battery_temp[i] = 25.0;
+        fleet->accel_request[i] = 0;
+    }
+}
+
+const char *ev_fleet_kernel_name(EVFleetKernel kernel) {
+    switch (kernel) {
+        case EV_FLEET_KERNEL_SCALAR: return "scalar";
+        case EV_FLEET_KERNEL_AVX2: return "avx2";
+        case EV_FLEET_KERNEL_AVX512: return "avx512";
+        default: return "auto";
+    }
+}
+
+static bool kernel_supported(EVFleetKernel kernel) {
+    switch (kernel) {
+        case EV_FLEET_KERNEL_SCALAR:
+            return true;
+#ifdef EV_FLEET_X86
+        case EV_FLEET_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case EV_FLEET_KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+EVFleetKernel ev_fleet_set_kernel(EVFleet *fleet, EVFleetKernel kernel) {
+    if (kernel == EV_FLEET_KERNEL_AUTO) kernel = EV_FLEET_KERNEL_AVX512;
+    while (kernel != EV_FLEET_KERNEL_SCALAR && !kernel_supported(kernel)) kernel--;
+    fleet->kernel = kernel;
+    return kernel;
+}
+
+static inline double min_d(double a, double b) { return a < b ? a : b; }
+static inline double max_d(double a, double b) { return a > b ? a : b; }
+
+/// Same physics as ev_sim_step(), written with selects so the compiler can vectorize it
+static void step_scalar(EVFleet *f, const StepConstants *k) {
+    for (int i = 0; i < f->capacity; i++) {
+        bool live = f->soc[i] > 0;
+        double max_accel = f->max_accel[i];
+        double power_factor = f->power_factor[i];
+        double acceleration = min_d(max_d(f->accel_request[i], -max_accel), max_accel);
+        double speed_ms = f->vehicle_speed[i] / 3.6;
+        speed_ms += (acceleration - k->drag_k * speed_ms * speed_ms - k->rolling_decel) * k->dt;
+        double speed = min_d(max_d(speed_ms * 3.6, 0), EV_MAX_SPEED);
+        double rpm = speed * 50;
+        double torque = f->motor_power[i] * power_factor * 1000 / (rpm * k->rpm_to_rad + 0.1);
+        double distance = f->distance[i] + speed * k->hours;
+        double temp_efficiency = 1.0 - max_d(f->battery_temp[i] - 40, 0) * 0.01;
+        double power_use = f->motor_power[i] * power_factor *
+                           (0.5 + 0.5 * fabs(acceleration)) / (0.85 * temp_efficiency);
+        double energy = f->energy_consumed[i] + power_use * k->hours;
+        double soc = max_d(100 - energy / f->battery_capacity[i] * 100, 0);
+        bool regen = acceleration < 0 && f->regen_braking[i] > 0.5;
+        double regen_energy = energy - f->regen_efficiency[i] * power_use * 0.5 * k->hours;
+        double regen_soc = min_d(100 - regen_energy / f->battery_capacity[i] * 100, 100);
+        energy = regen ? regen_energy : energy;
+        soc = regen ? regen_soc : soc;
+        double temp = f->battery_temp[i] + (power_use / f->motor_power[i]) * 0.1 * k->dt - 0.05 * k->dt;
+        temp = min_d(max_d(temp, 10), 70);
+        double efficiency = distance > 0 ? energy * 1000 / distance : 0;
+        f->acceleration[i] = live ? acceleration : f->acceleration[i];
+        f->vehicle_speed[i] = live ? speed : f->vehicle_speed[i];
+        f->motor_rpm[i] = live ? rpm : f->motor_rpm[i];
+        f->motor_torque[i] = live ? torque : f->motor_torque[i];
+        f->distance[i] = live ? distance : f->distance[i];
+        f->energy_consumed[i] = live ? energy : f->energy_consumed[i];
+        f->soc[i] = live ? soc : f->soc[i];
+        f->battery_temp[i] = live ? temp : f->battery_temp[i];
+        f->energy_efficiency[i] = live ? efficiency : f->energy_efficiency[i];
+        f->peak_battery_temp[i] = live ? max_d(f->peak_battery_temp[i], temp) : f->peak_battery_temp[i];
+    }
+}
+
+#ifdef EV_FLEET_X86
+
+__attribute__((target("avx2,fma")))
+static void step_avx2(EVFleet *f, const StepConstants *k) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d hundred = _mm256_set1_pd(100.0);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d kmh_to_ms = _mm256_set1_pd(1.0 / 3.6);
+    const __m256d ms_to_kmh = _mm256_set1_pd(3.6);
+    const __m256d max_speed = _mm256_set1_pd(EV_MAX_SPEED);
+    const __m256d dt = _mm256_set1_pd(k->dt);
+    const __m256d hours = _mm256_set1_pd(k->hours);
+    const __m256d drag_k = _mm256_set1_pd(k->drag_k);
+    const __m256d rolling = _mm256_set1_pd(k->rolling_decel);
+    const __m256d rpm_to_rad = _mm256_set1_pd(k->rpm_to_rad);
+    const __m256d temp_min = _mm256_set1_pd(10.0);
+    const __m256d temp_max = _mm256_set1_pd(70.0);
+    const __m256d derate_start = _mm256_set1_pd(40.0);
+    const __m256d derate_slope = _mm256_set1_pd(0.01);
+    const __m256d motor_eff = _mm256_set1_pd(0.85);
+    const __m256d heat_k = _mm256_set1_pd(0.1 * k->dt);
+    const __m256d cooling = _mm256_set1_pd(0.05 * k->dt);
+    for (int i = 0; i < f->capacity; i += 4) {
+        __m256d soc_old = _mm256_load_pd(f->soc + i);
+        __m256d live = _mm256_cmp_pd(soc_old, zero, _CMP_GT_OQ);
+        __m256d max_accel = _mm256_load_pd(f->max_accel + i);
+        __m256d power_factor = _mm256_load_pd(f->power_factor + i);
+        __m256d motor_power = _mm256_load_pd(f->motor_power + i);
+        __m256d capacity = _mm256_load_pd(f->battery_capacity + i);
+        __m256d acceleration = _mm256_min_pd(_mm256_max_pd(_mm256_load_pd(f->accel_request + i),
+                                                           _mm256_xor_pd(max_accel, sign)), max_accel);
+        __m256d speed_ms = _mm256_mul_pd(_mm256_load_pd(f->vehicle_speed + i), kmh_to_ms);
+        __m256d net = _mm256_sub_pd(_mm256_fnmadd_pd(_mm256_mul_pd(drag_k, speed_ms), speed_ms, acceleration), rolling);
+        speed_ms = _mm256_fmadd_pd(net, dt, speed_ms);
+        __m256d speed = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(speed_ms, ms_to_kmh), zero), max_speed);
+        __m256d rpm = _mm256_mul_pd(speed, _mm256_set1_pd(50.0));
+        __m256d rated = _mm256_mul_pd(motor_power, power_factor);
+        __m256d torque = _mm256_div_pd(_mm256_mul_pd(rated, _mm256_set1_pd(1000.0)),
+                                       _mm256_fmadd_pd(rpm, rpm_to_rad, _mm256_set1_pd(0.1)));
+        __m256d distance = _mm256_fmadd_pd(speed, hours, _mm256_load_pd(f->distance + i));
+        __m256d temp = _mm256_load_pd(f->battery_temp + i);
+        __m256d temp_efficiency = _mm256_fnmadd_pd(_mm256_max_pd(_mm256_sub_pd(temp, derate_start), zero),
+                                                   derate_slope, one);
+        __m256d demand = _mm256_fmadd_pd(half, _mm256_andnot_pd(sign, acceleration), half);
+        __m256d power_use = _mm256_div_pd(_mm256_mul_pd(rated, demand), _mm256_mul_pd(motor_eff, temp_efficiency));
+        __m256d energy = _mm256_fmadd_pd(power_use, hours, _mm256_load_pd(f->energy_consumed + i));
+        __m256d soc = _mm256_max_pd(_mm256_fnmadd_pd(_mm256_div_pd(energy, capacity), hundred, hundred), zero);
+        __m256d regen = _mm256_and_pd(_mm256_cmp_pd(acceleration, zero, _CMP_LT_OQ),
+                                      _mm256_cmp_pd(_mm256_load_pd(f->regen_braking + i), half, _CMP_GT_OQ));
+        __m256d recovered = _mm256_mul_pd(_mm256_mul_pd(_mm256_load_pd(f->regen_efficiency + i), power_use),
+                                          _mm256_mul_pd(half, hours));
+        __m256d regen_energy = _mm256_sub_pd(energy, recovered);
+        __m256d regen_soc = _mm256_min_pd(_mm256_fnmadd_pd(_mm256_div_pd(regen_energy, capacity), hundred, hundred),
+                                          hundred);
+        energy = _mm256_blendv_pd(energy, regen_energy, regen);
+        soc = _mm256_blendv_pd(soc, regen_soc, regen);
+        temp = _mm256_sub_pd(_mm256_fmadd_pd(_mm256_div_pd(power_use, motor_power), heat_k, temp), cooling);
+        temp = _mm256_min_pd(_mm256_max_pd(temp, temp_min), temp_max);
+        __m256d moved = _mm256_cmp_pd(distance, zero, _CMP_GT_OQ);
+        __m256d efficiency = _mm256_and_pd(_mm256_div_pd(_mm256_mul_pd(energy, _mm256_set1_pd(1000.0)), distance), moved);
+        __m256d peak = _mm256_max_pd(_mm256_load_pd(f->peak_battery_temp + i), temp);
+#define STORE_LIVE(column, value) \
+        _mm256_store_pd(f->column + i, _mm256_blendv_pd(_mm256_load_pd(f->column + i), value, live))
+        STORE_LIVE(acceleration, acceleration);
+        STORE_LIVE(vehicle_speed, speed);
+        STORE_LIVE(motor_rpm, rpm);
+        STORE_LIVE(motor_torque, torque);
+        STORE_LIVE(distance, distance);
+        STORE_LIVE(energy_consumed, energy);
+        STORE_LIVE(soc, soc);
+        STORE_LIVE(battery_temp, temp);
+        STORE_LIVE(energy_efficiency, efficiency);
+        STORE_LIVE(peak_battery_temp, peak);
+#undef STORE_LIVE
+    }
+}
+
+__attribute__((target("avx512f")))
+static void step_avx512(EVFleet *f, const StepConstants *k) {
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d hundred = _mm512_set1_pd(100.0);
+    const __m512d kmh_to_ms = _mm512_set1_pd(1.0 / 3.6);
+    const __m512d ms_to_kmh = _mm512_set1_pd(3.6);
+    const __m512d max_speed = _mm512_set1_pd(EV_MAX_SPEED);
+    const __m512d dt = _mm512_set1_pd(k->dt);
+    const __m512d hours = _mm512_set1_pd(k->hours);
+    const __m512d drag_k = _mm512_set1_pd(k->drag_k);
+    const __m512d rolling = _mm512_set1_pd(k->rolling_decel);
+    const __m512d rpm_to_rad = _mm512_set1_pd(k->rpm_to_rad);
+    const __m512d temp_min = _mm512_set1_pd(10.0);
+    const __m512d temp_max = _mm512_set1_pd(70.0);
+    const __m512d derate_start = _mm512_set1_pd(40.0);
+    const __m512d derate_slope = _mm512_set1_pd(0.01);
+    const __m512d motor_eff = _mm512_set1_pd(0.85);
+    const __m512d heat_k = _mm512_set1_pd(0.1 * k->dt);
+    const __m512d cooling = _mm512_set1_pd(0.05 * k->dt);
+    for (int i = 0; i < f->capacity; i += 8) {
+        __mmask8 live = _mm512_cmp_pd_mask(_mm512_load_pd(f->soc + i), zero, _CMP_GT_OQ);
+        __m512d max_accel = _mm512_load_pd(f->max_accel + i);
+        __m512d power_factor = _mm512_load_pd(f->power_factor + i);
+        __m512d motor_power = _mm512_load_pd(f->motor_power + i);
+        __m512d capacity = _mm512_load_pd(f->battery_capacity + i);
+        __m512d acceleration = _mm512_min_pd(_mm512_max_pd(_mm512_load_pd(f->accel_request + i),
+                                                           _mm512_sub_pd(zero, max_accel)), max_accel);
+        __m512d speed_ms = _mm512_mul_pd(_mm512_load_pd(f->vehicle_speed + i), kmh_to_ms);
+        __m512d net = _mm512_sub_pd(_mm512_fnmadd_pd(_mm512_mul_pd(drag_k, speed_ms), speed_ms, acceleration), rolling);
+        speed_ms = _mm512_fmadd_pd(net, dt, speed_ms);
+        __m512d speed = _mm512_min_pd(_mm512_max_pd(_mm512_mul_pd(speed_ms, ms_to_kmh), zero), max_speed);
+        __m512d rpm = _mm512_mul_pd(speed, _mm512_set1_pd(50.0));
+        __m512d rated = _mm512_mul_pd(motor_power, power_factor);
+        __m512d torque = _mm512_div_pd(_mm512_mul_pd(rated, _mm512_set1_pd(1000.0)),
+                                       _mm512_fmadd_pd(rpm, rpm_to_rad, _mm512_set1_pd(0.1)));
+        __m512d distance = _mm512_fmadd_pd(speed, hours, _mm512_load_pd(f->distance + i));
+        __m512d temp = _mm512_load_pd(f->battery_temp + i);
+        __m512d temp_efficiency = _mm512_fnmadd_pd(_mm512_max_pd(_mm512_sub_pd(temp, derate_start), zero),
+                                                   derate_slope, one);
+        __m512d demand = _mm512_fmadd_pd(half, _mm512_abs_pd(acceleration), half);
+        __m512d power_use = _mm512_div_pd(_mm512_mul_pd(rated, demand), _mm512_mul_pd(motor_eff, temp_efficiency));
+        __m512d energy = _mm512_fmadd_pd(power_use, hours, _mm512_load_pd(f->energy_consumed + i));
+        __m512d soc = _mm512_max_pd(_mm512_fnmadd_pd(_mm512_div_pd(energy, capacity), hundred, hundred), zero);
+        __mmask8 regen = _mm512_cmp_pd_mask(acceleration, zero, _CMP_LT_OQ) &
+                         _mm512_cmp_pd_mask(_mm512_load_pd(f->regen_braking + i), half, _CMP_GT_OQ);
+        __m512d recovered = _mm512_mul_pd(_mm512_mul_pd(_mm512_load_pd(f->regen_efficiency + i), power_use),
+                                          _mm512_mul_pd(half, hours));
+        __m512d regen_energy = _mm512_sub_pd(energy, recovered);
+        __m512d regen_soc = _mm512_min_pd(_mm512_fnmadd_pd(_mm512_div_pd(regen_energy, capacity), hundred, hundred),
+                                          hundred);
+        energy = _mm512_mask_blend_pd(regen, energy, regen_energy);
+        soc = _mm512_mask_blend_pd(regen, soc, regen_soc);
+        temp = _mm512_sub_pd(_mm512_fmadd_pd(_mm512_div_pd(power_use, motor_power), heat_k, temp), cooling);
+        temp = _mm512_min_pd(_mm512_max_pd(temp, temp_min), temp_max);
+        __mmask8 moved = _mm512_cmp_pd_mask(distance, zero, _CMP_GT_OQ);
+        __m512d efficiency = _mm512_maskz_div_pd(moved, _mm512_mul_pd(energy, _mm512_set1_pd(1000.0)), distance);
+        __m512d peak = _mm512_max_pd(_mm512_load_pd(f->peak_battery_temp + i), temp);
+#define STORE_LIVE(column, value) \
+        _mm512_mask_store_pd(f->column + i, live, value)
+        STORE_LIVE(acceleration, acceleration);
+        STORE_LIVE(vehicle_speed, speed);
+        STORE_LIVE(motor_rpm, rpm);
+        STORE_LIVE(motor_torque, torque);
+        STORE_LIVE(distance, distance);
+        STORE_LIVE(energy_consumed, energy);
+        STORE_LIVE(soc, soc);
+        STORE_LIVE(battery_temp, temp);
+        STORE_LIVE(energy_efficiency, efficiency);
+        STORE_LIVE(peak_battery_temp, peak);
+#undef STORE_LIVE
+    }
+}
+
+#endif
+
+void ev_fleet_track_speed(EVFleet *fleet, double target_speed, double lookahead) {
+    const double drag_k = 0.5 * EV_DRAG_COEFF * EV_FRONTAL_AREA * EV_AIR_DENSITY / EV_VEHICLE_MASS;
+    const double rolling_decel = EV_ROLLING_RESISTANCE * EV_GRAVITY;
+    double target_ms = target_speed / 3.6;
+    for (int i = 0; i < fleet->capacity; i++) {
+        double speed_ms = fleet->vehicle_speed[i] / 3.6;
+        double accel = (target_ms - speed_ms) / lookahead + drag_k * speed_ms * speed_ms + rolling_decel;
+        fleet->accel_request[i] = (target_ms <= 0 && speed_ms < 0.1) ? 0 : accel;
+    }
+}
+
+void ev_fleet_step(EVFleet *fleet, double dt) {
+    StepConstants k = {
+        .dt = dt,
+        .drag_k = 0.5 * EV_DRAG_COEFF * EV_FRONTAL_AREA * EV_AIR_DENSITY / EV_VEHICLE_MASS,
+        .rolling_decel = EV_ROLLING_RESISTANCE * EV_GRAVITY,
+        .hours = dt / 3600,
+        .rpm_to_rad = 2 * M_PI / 60
+    };
+    switch (fleet->kernel) {
+#ifdef EV_FLEET_X86
+        case EV_FLEET_KERNEL_AVX512:
+            step_avx512(fleet, &k);
+            break;
+        case EV_FLEET_KERNEL_AVX2:
+            step_avx2(fleet, &k);
+            break;
+#endif
+        default:
+            step_scalar(fleet, &k);
+            break;
+    }
+}
+
+static bool all_parked(const EVFleet *fleet) {
+    for (int i = 0; i < fleet->count; i++) {
+        if (fleet->soc[i] > 0) return false;
+    }
+    return true;
+}
+
+long ev_fleet_run(EVFleet *fleet, EVCycle *cycle, const EVProfile *profile, double dt, long max_steps,
+                  bool until_empty) {
+    long steps = 0;
+    while (steps < max_steps) {
+        double t = steps * dt;
+        if (cycle) {
+            double target;
+            ev_cycle_target(cycle, t + EV_DRIVER_LOOKAHEAD, &target);
+            if (ev_cycle_finished(cycle, t)) break;
+            ev_fleet_track_speed(fleet, target, EV_DRIVER_LOOKAHEAD);
+        } else {
+            double accel = ev_profile_accel(profile, t);
+            for (int i = 0; i < fleet->capacity; i++) fleet->accel_request[i] = accel;
+        }
+        ev_fleet_step(fleet, dt);
+        steps++;
+        if (until_empty && (steps & 1023) == 0 && all_parked(fleet)) break;
+    }
+    return steps;
+}
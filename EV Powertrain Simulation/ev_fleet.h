@@ -0,0 +1,66 @@
+#ifndef EV_FLEET_H
+#define EV_FLEET_H
+
+#include "ev_sim.h"
+#include "ev_cycle.h"
+
+#define EV_FLEET_ALIGN 64
+#define EV_FLEET_LANES 8           // padding unit, one AVX-512 register of doubles
+
+typedef enum {
+    EV_FLEET_KERNEL_AUTO,
+    EV_FLEET_KERNEL_SCALAR,
+    EV_FLEET_KERNEL_AVX2,
+    EV_FLEET_KERNEL_AVX512
+} EVFleetKernel;
+
+/// N vehicles in struct-of-arrays layout, every array padded to EV_FLEET_LANES
+typedef struct {
+    int count;
+    int capacity;
+    EVFleetKernel kernel;
+    /// Configuration
+    double *battery_voltage;       // V
+    double *battery_capacity;      // kWh
+    double *motor_power;           // kW
+    double *regen_efficiency;      // 0.0 to 1.0
+    double *regen_braking;         // 1.0 when regen braking is on, else 0.0
+    double *max_accel;             // m/s², from drive_mode_params
+    double *power_factor;          // from drive_mode_params
+    DriveMode *drive_mode;
+    /// State
+    double *vehicle_speed;         // km/h
+    double *acceleration;          // m/s²
+    double *motor_rpm;             // RPM
+    double *motor_torque;          // Nm
+    double *soc;                   // %
+    double *distance;              // km
+    double *energy_consumed;       // kWh
+    double *battery_temp;          // °C
+    double *energy_efficiency;     // Wh/km
+    double *peak_battery_temp;     // °C
+    double *accel_request;         // m/s², driver input for the next step
+} EVFleet;
+
+EVFleet *ev_fleet_new(int count);
+void ev_fleet_free(EVFleet *fleet);
+void ev_fleet_set_vehicle(EVFleet *fleet, int i, const EVSimulation *sim);
+void ev_fleet_get_vehicle(const EVFleet *fleet, int i, EVSimulation *sim);
+void ev_fleet_reset(EVFleet *fleet);
+
+/// Returns the kernel actually used, falling back when the CPU lacks support
+EVFleetKernel ev_fleet_set_kernel(EVFleet *fleet, EVFleetKernel kernel);
+const char *ev_fleet_kernel_name(EVFleetKernel kernel);
+
+/// Fills accel_request so every vehicle tracks target_speed (km/h), see ev_driver_accel()
+void ev_fleet_track_speed(EVFleet *fleet, double target_speed, double lookahead);
+
+/// Advances every vehicle by dt using accel_request; vehicles at 0 % SOC stay parked
+void ev_fleet_step(EVFleet *fleet, double dt);
+
+/// Up to max_steps of dt, every vehicle tracking cycle or, when it is NULL, following profile.
+/// until_empty ends early once every vehicle is parked. Returns the steps taken
+long ev_fleet_run(EVFleet *fleet, EVCycle *cycle, const EVProfile *profile, double dt, long max_steps,
+                  bool until_empty);
+
+#endif
@@ -0,0 +1,366 @@
+#include "ev_integrator.h"
+#include "ev_step.h"
+#include <math.h>
+#include <string.h>
+
+#define STATE_SPEED 0          // m/s
+#define STATE_DISTANCE 1       // km
+#define STATE_ENERGY 2         // kWh
+#define STATE_TEMP 3           // °C
+
+#define TIME_EPSILON 1e-9      // s
+
+static const char *const solver_names[EV_SOLVER_COUNT] = { "euler", "rk4", "rk45", "semi-implicit" };
+
+/// Everything the derivatives need that stays fixed while the input is held
+typedef struct {
+    double accel;              // m/s², clamped by drive mode
+    double drag_k;             // 1/m, drag deceleration per (m/s)²
+    double rolling;            // m/s²
+    const EVRoute *route;      // replaces drag_k and rolling where the state has driven to
+    double base_power;         // kW shaft power, before motor efficiency and temperature derating
+    const EVMotorMap *motor_map;
+    const EVDrivetrain *drivetrain;
+    double regen_keep;         // share of drawn energy not returned by regen
+    double motor_power;        // kW
+    double vmax;               // m/s
+    double derating;           // thermal network's derating, held over the step; 0 derates
+                               // from the integrated battery temperature instead
+    double held_efficiency;    // inverter model's, held over the step; 0 looks up the drivetrain
+} Model;
+
+void ev_integrator_init(EVIntegrator *integrator, EVSolver solver) {
+    memset(integrator, 0, sizeof(*integrator));
+    integrator->solver = solver;
+    integrator->rtol = 1e-6;
+    integrator->atol[STATE_SPEED] = 1e-5;
+    integrator->atol[STATE_DISTANCE] = 1e-8;
+    integrator->atol[STATE_ENERGY] = 1e-8;
+    integrator->atol[STATE_TEMP] = 1e-6;
+    integrator->h_min = 1e-4;
+    integrator->h_max = 60;
+}
+
+const char *ev_solver_name(EVSolver solver) {
+    return (solver >= 0 && solver < EV_SOLVER_COUNT) ? solver_names[solver] : "unknown";
+}
+
+bool ev_solver_from_name(const char *name, EVSolver *solver) {
+    for (int i = 0; i < EV_SOLVER_COUNT; i++) {
+        if (strcmp(name, solver_names[i]) == 0) {
+            *solver = (EVSolver)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ev_solver_is_adaptive(EVSolver solver) {
+    return solver == EV_SOLVER_RK45;
+}
+
+static void build_model(Model *m, const EVSimulation *sim, const EVInput *input) {
+    const DriveModeParams *mode = &drive_mode_params[sim->drive_mode];
+    double accel = input->acceleration;
+    double climb = ev_sim_climb(sim);
+    if (accel > mode->max_accel + climb) accel = mode->max_accel + climb;
+    if (accel < -mode->max_accel + climb) accel = -mode->max_accel + climb;
+    m->accel = accel;
+    const EVVehicleParams *vehicle = &sim->vehicle;
+    m->drag_k = 0.5 * vehicle->drag_coeff * vehicle->frontal_area * vehicle->air_density / vehicle->mass;
+    m->rolling = vehicle->rolling_resistance * EV_GRAVITY;
+    m->route = sim->route;
+    /// The mass is held over the step; it only changes at delivery stops
+    double load = sim->route ? ev_route_at(sim->route, sim->distance)->load : 1.0;
+    m->base_power = sim->motor_power * mode->power_factor * (0.5 + 0.5 * fabs(accel) * load);
+    m->regen_keep = (accel < 0 && sim->regen_braking) ? 1.0 - sim->regen_efficiency * 0.5 : 1.0;
+    m->motor_power = sim->motor_power;
+    m->motor_map = sim->motor_map;
+    m->drivetrain = &sim->drivetrain;
+    m->vmax = EV_MAX_SPEED / 3.6;
+    m->derating = sim->thermal ? sim->thermal->derating : 0;
+    m->held_efficiency = sim->inverter ? sim->inverter->efficiency : 0;
+}
+
+static double temp_efficiency(const Model *m, double temp) {
+    if (m->derating > 0) return m->derating;
+    return 1.0 - (temp > 40 ? (temp - 40) * 0.01 : 0);
+}
+
+/// Drivetrain efficiency at speed v (m/s). This and every function taking a topology and a
+/// strategy are instantiated per drivetrain kernel at the end of the file
+static EV_ALWAYS_INLINE double motor_efficiency(const Model *m, double v,
+                                                EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    if (m->held_efficiency > 0) return m->held_efficiency;
+    return ev_drivetrain_efficiency(m->drivetrain, topology, strategy, m->motor_map, m->motor_power, v * 3.6,
+                                    m->base_power);
+}
+
+static EV_ALWAYS_INLINE void derivatives(const Model *m, const double *y, double *dy,
+                                         EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    double v = y[STATE_SPEED];
+    double dv;
+    if (m->route) {
+        const EVRouteSample *road = ev_route_at(m->route, y[STATE_DISTANCE]);
+        double air = v + road->headwind;
+        dv = m->accel - road->drag_k * air * fabs(air) - road->resistance;
+    } else {
+        dv = m->accel - m->drag_k * v * v - m->rolling;
+    }
+    if ((v <= 0 && dv < 0) || (v >= m->vmax && dv > 0)) dv = 0;
+    dy[STATE_SPEED] = dv;
+    dy[STATE_DISTANCE] = (v > 0 ? v : 0) / 1000;
+    double power = m->base_power / (motor_efficiency(m, v, topology, strategy) * temp_efficiency(m, y[STATE_TEMP]));
+    dy[STATE_ENERGY] = power * m->regen_keep / 3600;
+    double dtemp = power / m->motor_power * 0.1 - 0.05;
+    double temp = y[STATE_TEMP];
+    if ((temp <= 10 && dtemp < 0) || (temp >= 70 && dtemp > 0)) dtemp = 0;
+    dy[STATE_TEMP] = dtemp;
+}
+
+/// Net battery draw (kW) at state y
+static EV_ALWAYS_INLINE double battery_power(const Model *m, const double *y,
+                                             EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    double v = y[STATE_SPEED] > 0 ? y[STATE_SPEED] : 0;
+    double efficiency = motor_efficiency(m, v, topology, strategy) * temp_efficiency(m, y[STATE_TEMP]);
+    return m->base_power / efficiency * m->regen_keep;
+}
+
+/// d(dT/dt)/dT of the heating term, for the linearly implicit thermal update
+static EV_ALWAYS_INLINE double thermal_jacobian(const Model *m, double v, double temp,
+                                                EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    if (m->derating > 0 || temp <= 40 || temp >= 70) return 0;
+    double eff = temp_efficiency(m, temp);
+    return m->base_power / motor_efficiency(m, v, topology, strategy) * 0.01 / (eff * eff) / m->motor_power * 0.1;
+}
+
+/// Kept out of line: inlined, GCC packs these loads into one vector store that the scalar
+/// stage loads then stall on, which cost ~5x per step with AVX enabled
+__attribute__((noinline)) static void load_state(const EVSimulation *sim, double *y) {
+    y[STATE_SPEED] = sim->vehicle_speed / 3.6;
+    y[STATE_DISTANCE] = sim->distance;
+    y[STATE_ENERGY] = sim->energy_consumed;
+    y[STATE_TEMP] = sim->battery_temp;
+}
+
+/// Applies the same limits as ev_sim_step() and recomputes the derived outputs
+static EV_ALWAYS_INLINE void store_state(EVSimulation *sim, const Model *m, const double *y,
+                                         EVDrivetrainTopology topology) {
+    const DriveModeParams *mode = &drive_mode_params[sim->drive_mode];
+    sim->acceleration = m->accel;
+    sim->vehicle_speed = y[STATE_SPEED] * 3.6;
+    if (sim->vehicle_speed < 0) sim->vehicle_speed = 0;
+    if (sim->vehicle_speed > EV_MAX_SPEED) sim->vehicle_speed = EV_MAX_SPEED;
+    sim->motor_rpm = ev_drivetrain_rpm(&sim->drivetrain, topology, sim->vehicle_speed);
+    sim->motor_torque = ev_drivetrain_torque(&sim->drivetrain, topology, sim->motor_power * mode->power_factor,
+                                             sim->vehicle_speed);
+    sim->distance = y[STATE_DISTANCE];
+    sim->energy_consumed = y[STATE_ENERGY];
+    sim->soc = 100 - (sim->energy_consumed / sim->battery_capacity * 100);
+    if (sim->soc < 0) sim->soc = 0;
+    if (sim->soc > 100) sim->soc = 100;
+    sim->battery_temp = y[STATE_TEMP];
+    if (sim->battery_temp < 10) sim->battery_temp = 10;
+    if (sim->battery_temp > 70) sim->battery_temp = 70;
+    sim->energy_efficiency = sim->distance > 0 ? (sim->energy_consumed * 1000) / sim->distance : 0;
+}
+
+static EV_ALWAYS_INLINE void rk4_step(EVIntegrator *integrator, const Model *m, double *y, double h,
+                                      EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    double k1[EV_STATE_DIM], k2[EV_STATE_DIM], k3[EV_STATE_DIM], k4[EV_STATE_DIM], tmp[EV_STATE_DIM];
+    derivatives(m, y, k1, topology, strategy);
+    for (int i = 0; i < EV_STATE_DIM; i++) tmp[i] = y[i] + 0.5 * h * k1[i];
+    derivatives(m, tmp, k2, topology, strategy);
+    for (int i = 0; i < EV_STATE_DIM; i++) tmp[i] = y[i] + 0.5 * h * k2[i];
+    derivatives(m, tmp, k3, topology, strategy);
+    for (int i = 0; i < EV_STATE_DIM; i++) tmp[i] = y[i] + h * k3[i];
+    derivatives(m, tmp, k4, topology, strategy);
+    for (int i = 0; i < EV_STATE_DIM; i++) y[i] += h / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+    integrator->evaluations += 4;
+}
+
+/// Mechanics as in ev_sim_step(); temperature by linearized backward Euler, stable for any h
+static EV_ALWAYS_INLINE void semi_implicit_step(EVIntegrator *integrator, const Model *m, double *y, double h,
+                                                EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    double dy[EV_STATE_DIM];
+    derivatives(m, y, dy, topology, strategy);
+    integrator->evaluations++;
+    double v = y[STATE_SPEED] + dy[STATE_SPEED] * h;
+    if (v < 0) v = 0;
+    if (v > m->vmax) v = m->vmax;
+    y[STATE_SPEED] = v;
+    y[STATE_DISTANCE] += v / 1000 * h;
+    y[STATE_ENERGY] += dy[STATE_ENERGY] * h;
+    double denom = 1 - h * thermal_jacobian(m, v, y[STATE_TEMP], topology, strategy);
+    if (denom < 0.1) denom = 0.1;
+    y[STATE_TEMP] += h * dy[STATE_TEMP] / denom;
+}
+
+/// Dormand-Prince 5(4) tableau; the model is autonomous while the input is held, so no c_i
+static const double dp_a[7][6] = {
+    { 0 },
+    { 1.0 / 5 },
+    { 3.0 / 40, 9.0 / 40 },
+    { 44.0 / 45, -56.0 / 15, 32.0 / 9 },
+    { 19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729 },
+    { 9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656 },
+    { 35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84 }
+};
+static const double dp_b5[7] = { 35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84, 0 };
+static const double dp_b4[7] = {
+    5179.0 / 57600, 0, 7571.0 / 16695, 393.0 / 640, -92097.0 / 339200, 187.0 / 2100, 1.0 / 40
+};
+
+/// One trial step; returns the scaled error norm (<= 1 means within tolerance)
+static EV_ALWAYS_INLINE double dp45_trial(EVIntegrator *integrator, const Model *m, const double *y, double h,
+                                          double *out, EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    double k[7][EV_STATE_DIM], tmp[EV_STATE_DIM];
+    derivatives(m, y, k[0], topology, strategy);
+    for (int s = 1; s < 7; s++) {
+        for (int i = 0; i < EV_STATE_DIM; i++) {
+            double sum = 0;
+            for (int j = 0; j < s; j++) sum += dp_a[s][j] * k[j][i];
+            tmp[i] = y[i] + h * sum;
+        }
+        derivatives(m, tmp, k[s], topology, strategy);
+    }
+    integrator->evaluations += 7;
+    double norm = 0;
+    for (int i = 0; i < EV_STATE_DIM; i++) {
+        double y5 = y[i], err = 0;
+        for (int s = 0; s < 7; s++) {
+            y5 += h * dp_b5[s] * k[s][i];
+            err += h * (dp_b5[s] - dp_b4[s]) * k[s][i];
+        }
+        out[i] = y5;
+        double scale = integrator->atol[i] + integrator->rtol * fmax(fabs(y[i]), fabs(y5));
+        double e = fabs(err) / scale;
+        if (e > norm) norm = e;
+    }
+    return norm;
+}
+
+static EV_ALWAYS_INLINE double rk45_advance(EVIntegrator *integrator, const Model *m, double *y, double h,
+                                            EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    double step = integrator->h > 0 ? integrator->h : 0.1;
+    if (step > integrator->h_max) step = integrator->h_max;
+    bool limited = step >= h;
+    if (limited) step = h;
+    double y5[EV_STATE_DIM];
+    for (;;) {
+        double err = dp45_trial(integrator, m, y, step, y5, topology, strategy);
+        double factor = err > 0 ? 0.9 * pow(err, -0.2) : 5;
+        if (factor > 5) factor = 5;
+        if (factor < 0.2) factor = 0.2;
+        if (err <= 1 || step <= integrator->h_min) {
+            /// A step cut short by the caller says nothing about the size the error allows
+            if (!(limited && factor >= 1)) {
+                integrator->h = step * factor;
+                if (integrator->h > integrator->h_max) integrator->h = integrator->h_max;
+            }
+            memcpy(y, y5, sizeof(y5));
+            return step;
+        }
+        integrator->rejected++;
+        step *= factor;
+        if (step < integrator->h_min) step = integrator->h_min;
+        limited = false;
+    }
+}
+
+static EV_ALWAYS_INLINE double advance(EVIntegrator *integrator, EVSimulation *sim, const EVInput *input, double h,
+                                       EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    if (integrator->solver == EV_SOLVER_EULER) {
+        ev_step_kernel(sim, input, h, topology, strategy);
+        integrator->evaluations++;
+        return h;
+    }
+    Model m;
+    double y[EV_STATE_DIM];
+    build_model(&m, sim, input);
+    load_state(sim, y);
+    double taken = h;
+    switch (integrator->solver) {
+    case EV_SOLVER_RK4:
+        rk4_step(integrator, &m, y, h, topology, strategy);
+        break;
+    case EV_SOLVER_RK45:
+        taken = rk45_advance(integrator, &m, y, h, topology, strategy);
+        break;
+    default:
+        semi_implicit_step(integrator, &m, y, h, topology, strategy);
+        break;
+    }
+    store_state(sim, &m, y, topology);
+    /// The pack, when there is one, is stepped alongside with the draw at the end of the step
+    ev_sim_battery_step(sim, battery_power(&m, y, topology, strategy), taken);
+    if (sim->thermal) {
+        double v = y[STATE_SPEED] > 0 ? y[STATE_SPEED] : 0;
+        ev_sim_thermal_step(sim, m.base_power, motor_efficiency(&m, v, topology, strategy), taken);
+    }
+    if (sim->inverter) ev_sim_inverter_step(sim, m.base_power, taken);
+    return taken;
+}
+
+static EV_ALWAYS_INLINE void run_loop(EVIntegrator *integrator, EVSimulation *sim, const EVProfile *profile,
+                                      EVCycle *cycle, double dt, double max_time, bool until_empty,
+                                      EVRunSummary *summary, EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    ev_run_summary_begin(summary, sim);
+    EVInput input = { 0 };
+    bool adaptive = ev_solver_is_adaptive(integrator->solver);
+    long max_steps = (long)(max_time / dt + 0.5);
+    double end_time = max_steps * dt;
+    double t = 0;
+    while (adaptive ? t < end_time - TIME_EPSILON : summary->steps < max_steps) {
+        double h = dt;
+        if (cycle) {
+            if (!ev_cycle_driver_input(cycle, sim, t, &input)) break;
+        } else {
+            input.acceleration = ev_profile_accel(profile, t) * sim->vehicle.aggressiveness;
+            if (adaptive) h = ev_profile_next_change(profile, t) - t;
+        }
+        if (adaptive && t + h > end_time) h = end_time - t;
+        double taken = advance(integrator, sim, &input, h, topology, strategy);
+        ev_run_summary_sample(summary, sim);
+        t = adaptive ? t + taken : summary->steps * dt;
+        if (until_empty && sim->soc <= 0) break;
+    }
+    ev_run_summary_end(summary, sim, t);
+}
+
+typedef double (*AdvanceKernel)(EVIntegrator *integrator, EVSimulation *sim, const EVInput *input, double h);
+typedef void (*RunKernel)(EVIntegrator *integrator, EVSimulation *sim, const EVProfile *profile, EVCycle *cycle,
+                          double dt, double max_time, bool until_empty, EVRunSummary *summary);
+
+#define INTEGRATOR_KERNELS(id, name, topology, strategy)                                              \
+    static double advance_##name(EVIntegrator *integrator, EVSimulation *sim, const EVInput *input,   \
+                                 double h) {                                                          \
+        return advance(integrator, sim, input, h, topology, strategy);                                \
+    }                                                                                                 \
+    static void run_##name(EVIntegrator *integrator, EVSimulation *sim, const EVProfile *profile,     \
+                           EVCycle *cycle, double dt, double max_time, bool until_empty,              \
+                           EVRunSummary *summary) {                                                   \
+        run_loop(integrator, sim, profile, cycle, dt, max_time, until_empty, summary, topology, strategy); \
+    }
+EV_DRIVETRAIN_KERNELS(INTEGRATOR_KERNELS)
+
+#define ADVANCE_KERNEL_ENTRY(id, name, topology, strategy) [EV_DRIVETRAIN_KERNEL_##id] = advance_##name,
+static const AdvanceKernel advance_kernels[EV_DRIVETRAIN_KERNEL_COUNT] = {
+    EV_DRIVETRAIN_KERNELS(ADVANCE_KERNEL_ENTRY)
+};
+
+#define RUN_KERNEL_ENTRY(id, name, topology, strategy) [EV_DRIVETRAIN_KERNEL_##id] = run_##name,
+static const RunKernel run_kernels[EV_DRIVETRAIN_KERNEL_COUNT] = {
+    EV_DRIVETRAIN_KERNELS(RUN_KERNEL_ENTRY)
+};
+
+double ev_integrator_advance(EVIntegrator *integrator, EVSimulation *sim, const EVInput *input, double h) {
+    return advance_kernels[ev_drivetrain_kernel(&sim->drivetrain)](integrator, sim, input, h);
+}
+
+void ev_integrator_run(EVIntegrator *integrator, EVSimulation *sim, const EVProfile *profile,
+                       EVCycle *cycle, double dt, double max_time, bool until_empty,
+                       EVRunSummary *summary) {
+    run_kernels[ev_drivetrain_kernel(&sim->drivetrain)](integrator, sim, profile, cycle, dt, max_time,
+                                                        until_empty, summary);
+}
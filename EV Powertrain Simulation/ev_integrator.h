@@ -0,0 +1,45 @@
+#ifndef EV_INTEGRATOR_H
+#define EV_INTEGRATOR_H
+
+#include <stdbool.h>
+#include "ev_sim.h"
+#include "ev_cycle.h"
+
+typedef enum {
+    EV_SOLVER_EULER,           // ev_sim_step(), the original explicit update
+    EV_SOLVER_RK4,             // classic fixed-step Runge-Kutta
+    EV_SOLVER_RK45,            // adaptive Dormand-Prince 5(4)
+    EV_SOLVER_SEMI_IMPLICIT,   // explicit mechanics, linearly implicit thermal path
+    EV_SOLVER_COUNT
+} EVSolver;
+
+/// Integrated state: speed (m/s), distance (km), energy drawn (kWh), battery temperature (°C)
+#define EV_STATE_DIM 4
+
+typedef struct {
+    EVSolver solver;
+    double rtol;               // RK45 relative tolerance
+    double atol[EV_STATE_DIM]; // RK45 absolute tolerance per state component
+    double h_min;              // s, RK45 accepts steps this small even above tolerance
+    double h_max;              // s
+    double h;                  // s, RK45 step size carried into the next call
+    long evaluations;          // derivative evaluations so far
+    long rejected;             // RK45 steps retried with a smaller h
+} EVIntegrator;
+
+void ev_integrator_init(EVIntegrator *integrator, EVSolver solver);
+const char *ev_solver_name(EVSolver solver);
+bool ev_solver_from_name(const char *name, EVSolver *solver);
+bool ev_solver_is_adaptive(EVSolver solver);
+
+/// Advances sim with input held constant. Fixed-step solvers take exactly h; RK45 takes one
+/// accepted step of at most h. Returns the step taken (s)
+double ev_integrator_advance(EVIntegrator *integrator, EVSimulation *sim, const EVInput *input, double h);
+
+/// ev_sim_run() (cycle NULL) or ev_cycle_run() with the integrator's solver. Adaptive solvers
+/// stretch steps up to the next profile change; on a cycle they are capped at dt
+void ev_integrator_run(EVIntegrator *integrator, EVSimulation *sim, const EVProfile *profile,
+                       EVCycle *cycle, double dt, double max_time, bool until_empty,
+                       EVRunSummary *summary);
+
+#endif
@@ -0,0 +1,409 @@
+#include "ev_inverter.h"
+#include "ev_motor.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SUBSTEPS EV_INVERTER_SUBSTEPS
+#define LANES 8                    // arrays padded by a cache line of doubles, the first holding step -1
+#define STRIDE (SUBSTEPS + LANES)
+#define SQRT3 1.7320508075688772
+#define MIN_OMEGA 0.1              // rad/s, torque request floor on shaft speed
+
+/// Per-step arrays of one PWM period, in the scratch block
+enum {
+    ARRAY_CARRIER,             // center-aligned triangle, 0 at the period edges and 1 in the middle
+    ARRAY_COS,
+    ARRAY_SIN,
+    ARRAY_VD,
+    ARRAY_VQ,
+    ARRAY_ID,
+    ARRAY_IQ,
+    ARRAY_SA,                  // leg states, 1 with the upper switch on; step -1 is the last period's
+    ARRAY_SB,
+    ARRAY_SC,
+    ARRAY_IA,
+    ARRAY_IB,
+    ARRAY_IC,
+    ARRAY_CONDUCTION,          // W
+    ARRAY_SWITCHING,           // J
+    ARRAY_COPPER,              // W
+    ARRAY_TORQUE,              // Nm
+    ARRAY_DC,                  // A
+    ARRAYS
+};
+
+static void *aligned_block(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, EV_INVERTER_ALIGN);
+#else
+    return aligned_alloc(EV_INVERTER_ALIGN, size);
+#endif
+}
+
+static void aligned_block_free(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static inline double *array(const EVInverter *inverter, int a) {
+    return inverter->scratch + (size_t)STRIDE * a + LANES;
+}
+
+void ev_pmsm_params_default(EVPmsmParams *params) {
+    params->pole_pairs = 4;
+    params->resistance = 0.01;
+    params->ld = 0.2e-3;
+    params->lq = 0.3e-3;
+    params->flux = 0.08;
+    params->max_current = 600;
+}
+
+void ev_inverter_params_default(EVInverterParams *params) {
+    params->pwm_frequency = 10000;
+    params->igbt_vce0 = 0.8;
+    params->igbt_rce = 1.5e-3;
+    params->diode_vf0 = 0.9;
+    params->diode_rd = 1.2e-3;
+    params->switch_energy = 0.02;
+    params->ref_voltage = 400;
+    params->ref_current = 400;
+    params->bandwidth = 500;
+}
+
+EVInverter *ev_inverter_new(const EVPmsmParams *motor, const EVInverterParams *params) {
+    if (motor->pole_pairs < 1 || motor->resistance <= 0 || motor->ld <= 0 || motor->lq <= 0 || motor->flux <= 0 ||
+        motor->max_current <= 0 || params->pwm_frequency <= 0 || params->ref_voltage <= 0 ||
+        params->ref_current <= 0 || params->bandwidth <= 0) {
+        return NULL;
+    }
+    EVInverter *inverter = calloc(1, sizeof(EVInverter));
+    if (!inverter) return NULL;
+    inverter->scratch = aligned_block((size_t)STRIDE * ARRAYS * sizeof(double));
+    if (!inverter->scratch) {
+        free(inverter);
+        return NULL;
+    }
+    memset(inverter->scratch, 0, (size_t)STRIDE * ARRAYS * sizeof(double));
+    inverter->motor = *motor;
+    inverter->params = *params;
+    inverter->step = 1 / params->pwm_frequency / SUBSTEPS;
+    double *carrier = array(inverter, ARRAY_CARRIER);
+    for (int k = 0; k < SUBSTEPS; k++) {
+        double phase = (k + 0.5) / SUBSTEPS;
+        carrier[k] = phase < 0.5 ? 2 * phase : 2 - 2 * phase;
+    }
+    atomic_init(&inverter->sequence, 0);
+    ev_inverter_reset(inverter);
+    return inverter;
+}
+
+void ev_inverter_free(EVInverter *inverter) {
+    if (!inverter) return;
+    aligned_block_free(inverter->scratch);
+    free(inverter);
+}
+
+void ev_inverter_reset(EVInverter *inverter) {
+    unsigned sequence = atomic_load_explicit(&inverter->sequence, memory_order_relaxed);
+    atomic_store_explicit(&inverter->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    inverter->id = 0;
+    inverter->iq = 0;
+    inverter->angle = 0;
+    inverter->integral_d = 0;
+    inverter->integral_q = 0;
+    inverter->debt = 0;
+    inverter->efficiency = EV_MOTOR_FLAT_EFFICIENCY;
+    inverter->copper_loss = 0;
+    inverter->conduction_loss = 0;
+    inverter->switching_loss = 0;
+    inverter->torque = 0;
+    inverter->dc_current = 0;
+    inverter->copper_energy = 0;
+    inverter->conduction_energy = 0;
+    inverter->switching_energy = 0;
+    inverter->periods = 0;
+    for (int a = ARRAY_SA; a <= ARRAY_SC; a++) array(inverter, a)[-1] = 0;
+    inverter->ring_head = 0;
+    inverter->ring_count = 0;
+    atomic_store_explicit(&inverter->sequence, sequence + 2, memory_order_release);
+}
+
+/// The per-step loops select with copysign, truncation to int and 0/1 arithmetic: GCC will not
+/// if-convert a comparison of doubles feeding arithmetic under the default -ftrapping-math
+
+/// sin and cos of x in [-π, π]: folded into [-π/2, π/2] and a Taylor polynomial there, good to
+/// 1e-7
+static inline void sin_cos(double x, double *s, double *c) {
+    int quadrant = (int)(fabs(x) * (2 / M_PI));
+    double outer = quadrant < 1 ? quadrant : 1;
+    double reflected = copysign(M_PI, x) - x;
+    double folded = x + outer * (reflected - x);
+    double x2 = folded * folded;
+    *s = folded * (1 + x2 * (-1.0 / 6 + x2 * (1.0 / 120 + x2 * (-1.0 / 5040 + x2 * (1.0 / 362880 +
+                   x2 * (-1.0 / 39916800))))));
+    double cosine = 1 + x2 * (-1.0 / 2 + x2 * (1.0 / 24 + x2 * (-1.0 / 720 + x2 * (1.0 / 40320 +
+                    x2 * (-1.0 / 3628800 + x2 * (1.0 / 479001600))))));
+    *c = (1 - 2 * outer) * cosine;
+}
+
+/// W lost in one leg carrying current (A, out of the leg positive): in the IGBT when the switch
+/// that is on conducts the current's direction, otherwise in the antiparallel diode
+static inline double leg_loss(double current, double upper, double vce0, double rce, double vf0, double rd) {
+    double i = fabs(current);
+    double positive = 0.5 + copysign(0.5, current);
+    double igbt = upper * positive + (1 - upper) * (1 - positive);
+    double diode_loss = (vf0 + rd * i) * i;
+    return diode_loss + igbt * ((vce0 + rce * i) * i - diode_loss);
+}
+
+/// Sum of one period's array, in LANES independent partial sums the compiler can keep in vectors
+static double period_sum(const double *restrict values) {
+    double lanes[LANES] = { 0 };
+    for (int k = 0; k < SUBSTEPS; k += LANES) {
+        for (int l = 0; l < LANES; l++) lanes[l] += values[k + l];
+    }
+    double total = 0;
+    for (int l = 0; l < LANES; l++) total += lanes[l];
+    return total;
+}
+
+typedef struct {
+    double conduction;         // J
+    double switching;          // J
+    double copper;             // J
+    double torque;             // Nm·s
+    double dc_current;         // A·s
+} PeriodTotals;
+
+/// dq current references for torque (Nm) at omega (rad/s electrical): id = 0 below base speed,
+/// then just enough negative id to keep the flux linkage within what dc_voltage can drive, with
+/// iq cut back to the current and voltage limits
+static void current_references(const EVPmsmParams *motor, double torque, double omega, double dc_voltage,
+                               double *id_ref, double *iq_ref) {
+    double limit = motor->max_current;
+    double iq = torque / (1.5 * motor->pole_pairs * motor->flux);
+    iq = ev_motor_clamp(iq, -limit, limit);
+    double id = 0;
+    double flux_max = 0.95 * dc_voltage / SQRT3 / fmax(fabs(omega), MIN_OMEGA);
+    double flux_q = motor->lq * iq;
+    if (motor->flux * motor->flux + flux_q * flux_q > flux_max * flux_max) {
+        if (fabs(flux_q) > flux_max) {
+            iq = copysign(flux_max / motor->lq, iq);
+            flux_q = motor->lq * iq;
+        }
+        id = (sqrt(fmax(flux_max * flux_max - flux_q * flux_q, 0)) - motor->flux) / motor->ld;
+        if (id < -limit) id = -limit;
+        double room = sqrt(limit * limit - id * id);
+        iq = ev_motor_clamp(iq, -room, room);
+    }
+    *id_ref = id;
+    *iq_ref = iq;
+}
+
+/// One PWM period: the controller, then the switching model stepped SUBSTEPS times in passes.
+/// The passes over angle, switching and losses are independent per step and vectorize; only
+/// the current integration is a recurrence
+static void run_period(EVInverter *inverter, double torque, double omega, double dc_voltage, PeriodTotals *totals) {
+    const EVPmsmParams *motor = &inverter->motor;
+    const EVInverterParams *params = &inverter->params;
+    double period = 1 / params->pwm_frequency;
+    double h = inverter->step;
+    double r = motor->resistance, ld = motor->ld, lq = motor->lq, flux = motor->flux;
+
+    /// Current controller, sampled at the period edge where the carrier is at its vertex
+    double id_ref, iq_ref;
+    current_references(motor, torque, omega, dc_voltage, &id_ref, &iq_ref);
+    double bandwidth = 2 * M_PI * params->bandwidth;
+    double error_d = id_ref - inverter->id, error_q = iq_ref - inverter->iq;
+    double integral_d = inverter->integral_d + bandwidth * r * error_d * period;
+    double integral_q = inverter->integral_q + bandwidth * r * error_q * period;
+    double vd_ref = bandwidth * ld * error_d + integral_d - omega * lq * inverter->iq;
+    double vq_ref = bandwidth * lq * error_q + integral_q + omega * (ld * inverter->id + flux);
+    double v_limit = dc_voltage / SQRT3;           // linear range of SVPWM
+    double magnitude = sqrt(vd_ref * vd_ref + vq_ref * vq_ref);
+    if (magnitude > v_limit) {     /// Saturated: scale the vector back and hold the integrators
+        vd_ref *= v_limit / magnitude;
+        vq_ref *= v_limit / magnitude;
+    } else {
+        inverter->integral_d = integral_d;
+        inverter->integral_q = integral_q;
+    }
+
+    /// SVPWM duties by min-max zero-sequence injection, at the angle the period averages to
+    double s, c;
+    double middle = inverter->angle + 0.5 * omega * period;
+    middle = middle > M_PI ? middle - 2 * M_PI : middle < -M_PI ? middle + 2 * M_PI : middle;
+    sin_cos(middle, &s, &c);
+    double alpha = vd_ref * c - vq_ref * s, beta = vd_ref * s + vq_ref * c;
+    double va = alpha, vb = -0.5 * alpha + 0.5 * SQRT3 * beta, vc = -0.5 * alpha - 0.5 * SQRT3 * beta;
+    double offset = -0.5 * (fmax(va, fmax(vb, vc)) + fmin(va, fmin(vb, vc)));
+    double duty_a = ev_motor_clamp(0.5 + (va + offset) / dc_voltage, 0, 1);
+    double duty_b = ev_motor_clamp(0.5 + (vb + offset) / dc_voltage, 0, 1);
+    double duty_c = ev_motor_clamp(0.5 + (vc + offset) / dc_voltage, 0, 1);
+
+    const double *restrict carrier = array(inverter, ARRAY_CARRIER);
+    double *restrict cosine = array(inverter, ARRAY_COS);
+    double *restrict sine = array(inverter, ARRAY_SIN);
+    double *restrict vd = array(inverter, ARRAY_VD);
+    double *restrict vq = array(inverter, ARRAY_VQ);
+    double *restrict id = array(inverter, ARRAY_ID);
+    double *restrict iq = array(inverter, ARRAY_IQ);
+    double *restrict sa = array(inverter, ARRAY_SA);
+    double *restrict sb = array(inverter, ARRAY_SB);
+    double *restrict sc = array(inverter, ARRAY_SC);
+    double *restrict ia = array(inverter, ARRAY_IA);
+    double *restrict ib = array(inverter, ARRAY_IB);
+    double *restrict ic = array(inverter, ARRAY_IC);
+    double *restrict conduction = array(inverter, ARRAY_CONDUCTION);
+    double *restrict switching = array(inverter, ARRAY_SWITCHING);
+    double *restrict copper = array(inverter, ARRAY_COPPER);
+    double *restrict torque_out = array(inverter, ARRAY_TORQUE);
+    double *restrict dc = array(inverter, ARRAY_DC);
+
+    /// Pass 1: rotor angle, leg states against the carrier, and the phase voltages in dq
+    double angle = inverter->angle, advance = omega * h;
+    for (int k = 0; k < SUBSTEPS; k++) {   /// The sweep stays within (-3π, 3π), so truncation floors
+        double theta = angle + advance * (k + 0.5);
+        theta -= 2 * M_PI * ((int)((theta + 3 * M_PI) * (0.5 / M_PI)) - 1);
+        double sin_k, cos_k;
+        sin_cos(theta, &sin_k, &cos_k);
+        double a = 0.5 + copysign(0.5, duty_a - carrier[k]);
+        double b = 0.5 + copysign(0.5, duty_b - carrier[k]);
+        double cc = 0.5 + copysign(0.5, duty_c - carrier[k]);
+        double common = (a + b + cc) * (1.0 / 3);
+        double phase_alpha = dc_voltage * (a - common);
+        double phase_beta = dc_voltage * (b - cc) * (1 / SQRT3);
+        vd[k] = phase_alpha * cos_k + phase_beta * sin_k;
+        vq[k] = -phase_alpha * sin_k + phase_beta * cos_k;
+        cosine[k] = cos_k;
+        sine[k] = sin_k;
+        sa[k] = a;
+        sb[k] = b;
+        sc[k] = cc;
+    }
+
+    /// Pass 2: dq currents, semi-implicit Euler (iq sees the updated id)
+    double cur_d = inverter->id, cur_q = inverter->iq;
+    double gain_d = h / ld, gain_q = h / lq;
+    for (int k = 0; k < SUBSTEPS; k++) {
+        cur_d += gain_d * (vd[k] - r * cur_d + omega * lq * cur_q);
+        cur_q += gain_q * (vq[k] - r * cur_q - omega * (ld * cur_d + flux));
+        id[k] = cur_d;
+        iq[k] = cur_q;
+    }
+
+    /// Pass 3: phase currents and everything per step that follows from them
+    double vce0 = params->igbt_vce0, rce = params->igbt_rce, vf0 = params->diode_vf0, rd = params->diode_rd;
+    double edge_energy = params->switch_energy * dc_voltage / params->ref_voltage / params->ref_current;
+    double torque_k = 1.5 * motor->pole_pairs;
+    for (int k = 0; k < SUBSTEPS; k++) {
+        double i_alpha = id[k] * cosine[k] - iq[k] * sine[k];
+        double i_beta = id[k] * sine[k] + iq[k] * cosine[k];
+        double a = i_alpha, b = -0.5 * i_alpha + 0.5 * SQRT3 * i_beta, cc = -0.5 * i_alpha - 0.5 * SQRT3 * i_beta;
+        ia[k] = a;
+        ib[k] = b;
+        ic[k] = cc;
+        conduction[k] = leg_loss(a, sa[k], vce0, rce, vf0, rd) + leg_loss(b, sb[k], vce0, rce, vf0, rd) +
+                        leg_loss(cc, sc[k], vce0, rce, vf0, rd);
+        switching[k] = edge_energy * (fabs(sa[k] - sa[k - 1]) * fabs(a) + fabs(sb[k] - sb[k - 1]) * fabs(b) +
+                                      fabs(sc[k] - sc[k - 1]) * fabs(cc));
+        copper[k] = 1.5 * r * (id[k] * id[k] + iq[k] * iq[k]);
+        torque_out[k] = torque_k * (flux * iq[k] + (ld - lq) * id[k] * iq[k]);
+        dc[k] = sa[k] * a + sb[k] * b + sc[k] * cc;
+    }
+
+    /// Pass 4: reductions, then the state for the next period
+    totals->conduction += period_sum(conduction) * h;
+    totals->switching += period_sum(switching);
+    totals->copper += period_sum(copper) * h;
+    totals->torque += period_sum(torque_out) * h;
+    totals->dc_current += period_sum(dc) * h;
+    inverter->id = cur_d;
+    inverter->iq = cur_q;
+    angle += omega * period;
+    inverter->angle = angle - 2 * M_PI * ceil((angle - M_PI) / (2 * M_PI));
+    sa[-1] = sa[SUBSTEPS - 1];
+    sb[-1] = sb[SUBSTEPS - 1];
+    sc[-1] = sc[SUBSTEPS - 1];
+    for (int k = EV_INVERTER_SCOPE_EVERY - 1; k < SUBSTEPS; k += EV_INVERTER_SCOPE_EVERY) {
+        int slot = inverter->ring_head;
+        inverter->ring[0][slot] = (float)ia[k];
+        inverter->ring[1][slot] = (float)ib[k];
+        inverter->ring[2][slot] = (float)ic[k];
+        inverter->ring_head = (slot + 1) % EV_INVERTER_SCOPE;
+        if (inverter->ring_count < EV_INVERTER_SCOPE) inverter->ring_count++;
+    }
+}
+
+void ev_inverter_advance(EVInverter *inverter, double shaft_power, double rpm, double dc_voltage, double dt) {
+    double period = 1 / inverter->params.pwm_frequency;
+    inverter->debt += dt;
+    if (inverter->debt < period || dc_voltage <= 0) return;
+    /// The angle sweep per period must stay under half a turn for the per-step wrap
+    double omega_limit = 0.9 * M_PI / period;
+    double omega_shaft = rpm * 2 * M_PI / 60;
+    double omega = ev_motor_clamp(omega_shaft * inverter->motor.pole_pairs, -omega_limit, omega_limit);
+    const EVPmsmParams *motor = &inverter->motor;
+    double peak = 1.5 * motor->pole_pairs * motor->flux * motor->max_current;
+    double torque = ev_motor_clamp(shaft_power * 1000 / fmax(fabs(omega_shaft), MIN_OMEGA), -peak, peak);
+
+    unsigned sequence = atomic_load_explicit(&inverter->sequence, memory_order_relaxed);
+    atomic_store_explicit(&inverter->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    PeriodTotals totals = { 0 };
+    int periods = 0;
+    while (inverter->debt >= period) {
+        run_period(inverter, torque, omega, dc_voltage, &totals);
+        inverter->debt -= period;
+        periods++;
+    }
+    double span = periods * period;
+    inverter->conduction_loss = totals.conduction / span;
+    inverter->switching_loss = totals.switching / span;
+    inverter->copper_loss = totals.copper / span;
+    inverter->torque = totals.torque / span;
+    inverter->dc_current = totals.dc_current / span;
+    inverter->conduction_energy += totals.conduction;
+    inverter->switching_energy += totals.switching;
+    inverter->copper_energy += totals.copper;
+    inverter->periods += periods;
+    if (shaft_power > 0) {
+        double loss = (inverter->conduction_loss + inverter->switching_loss + inverter->copper_loss) / 1000;
+        double efficiency = shaft_power / (shaft_power + loss);
+        inverter->efficiency = efficiency > EV_MOTOR_MIN_EFFICIENCY ? efficiency : EV_MOTOR_MIN_EFFICIENCY;
+    }
+    atomic_store_explicit(&inverter->sequence, sequence + 2, memory_order_release);
+}
+
+bool ev_inverter_scope(EVInverter *inverter, EVPhaseScope *scope) {
+    for (int attempt = 0; attempt < 4; attempt++) {
+        unsigned begin = atomic_load_explicit(&inverter->sequence, memory_order_acquire);
+        if (begin & 1) continue;
+        int count = inverter->ring_count, head = inverter->ring_head;
+        int first = (head - count + EV_INVERTER_SCOPE) % EV_INVERTER_SCOPE;
+        for (int p = 0; p < 3; p++) {
+            int tail = EV_INVERTER_SCOPE - first < count ? EV_INVERTER_SCOPE - first : count;
+            memcpy(scope->current[p], &inverter->ring[p][first], tail * sizeof(float));
+            memcpy(scope->current[p] + tail, inverter->ring[p], (count - tail) * sizeof(float));
+        }
+        scope->copper_loss = inverter->copper_loss;
+        scope->conduction_loss = inverter->conduction_loss;
+        scope->switching_loss = inverter->switching_loss;
+        scope->torque = inverter->torque;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&inverter->sequence, memory_order_relaxed) != begin) continue;
+        scope->count = count;
+        scope->sample_period = inverter->step * EV_INVERTER_SCOPE_EVERY;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,101 @@
+#ifndef EV_INVERTER_H
+#define EV_INVERTER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define EV_INVERTER_SUBSTEPS 128       // electrical steps per PWM period, a multiple of every vector width
+#define EV_INVERTER_SCOPE 2048         // phase current samples kept for drawing
+#define EV_INVERTER_SCOPE_EVERY 16     // electrical steps per scope sample
+#define EV_INVERTER_ALIGN 64           // bytes
+
+/// Permanent magnet synchronous machine in the rotor (dq) frame, amplitude-invariant Clarke
+typedef struct {
+    int pole_pairs;
+    double resistance;         // Ω per phase
+    double ld;                 // H
+    double lq;                 // H
+    double flux;               // Wb, magnet flux linkage
+    double max_current;        // A, phase current amplitude limit
+} EVPmsmParams;
+
+/// Two-level three-phase IGBT bridge with space vector PWM, a symmetric triangle carrier
+typedef struct {
+    double pwm_frequency;      // Hz
+    double igbt_vce0;          // V, on-state threshold
+    double igbt_rce;           // Ω, on-state slope
+    double diode_vf0;          // V
+    double diode_rd;           // Ω
+    double switch_energy;      // J per edge (turn-on, turn-off and recovery averaged) at the reference point,
+                               // scaling with DC voltage and current
+    double ref_voltage;        // V
+    double ref_current;        // A
+    double bandwidth;          // Hz, current loop
+} EVInverterParams;
+
+/// Consistent copy of the phase current ring for drawing on another thread
+typedef struct {
+    float current[3][EV_INVERTER_SCOPE];   // A per phase, oldest first
+    int count;
+    double sample_period;      // s
+    double copper_loss;        // W, averages over the last macro step
+    double conduction_loss;    // W
+    double switching_loss;     // W
+    double torque;             // Nm
+} EVPhaseScope;
+
+typedef struct {
+    EVPmsmParams motor;
+    EVInverterParams params;
+    double step;               // s, one PWM period over EV_INVERTER_SUBSTEPS
+    /// State carried between PWM periods
+    double id;                 // A
+    double iq;                 // A
+    double angle;              // rad, electrical, in (-π, π]
+    double integral_d;         // V, current controller integrators
+    double integral_q;         // V
+    double debt;               // s of macro time not yet covered by whole PWM periods
+    /// Averages over the PWM periods run by the last macro step, held until the next one
+    /// runs at least a period
+    double efficiency;         // shaft power over shaft power plus copper and inverter losses
+    double copper_loss;        // W
+    double conduction_loss;    // W
+    double switching_loss;     // W
+    double torque;             // Nm, electromagnetic
+    double dc_current;         // A
+    /// Totals since the last reset
+    double copper_energy;      // J
+    double conduction_energy;  // J
+    double switching_energy;   // J
+    long periods;
+    /// One PWM period of per-step arrays, aligned for the vectorized passes
+    double *scratch;
+    /// Phase current ring, read on other threads through ev_inverter_scope()
+    atomic_uint sequence;      // odd while ev_inverter_advance() writes
+    float ring[3][EV_INVERTER_SCOPE];
+    int ring_head;
+    int ring_count;
+} EVInverter;
+
+void ev_pmsm_params_default(EVPmsmParams *params);
+void ev_inverter_params_default(EVInverterParams *params);
+
+/// NULL on bad parameters or allocation failure
+EVInverter *ev_inverter_new(const EVPmsmParams *motor, const EVInverterParams *params);
+void ev_inverter_free(EVInverter *inverter);
+/// Motor at rest with no current, totals and ring cleared
+void ev_inverter_reset(EVInverter *inverter);
+
+/// Co-simulates the electrical model over dt of macro time. Whole PWM periods run while the
+/// time owed covers one: each period the current controller sets the voltage vector for
+/// shaft_power (kW) at rpm from the field-weakened torque request, then the bridge and machine
+/// are integrated EV_INVERTER_SUBSTEPS times with the legs switched against the carrier. Speed
+/// and DC voltage are held over the macro step. A step shorter than a PWM period keeps the
+/// last averages
+void ev_inverter_advance(EVInverter *inverter, double shaft_power, double rpm, double dc_voltage, double dt);
+
+/// Copies the ring and the latest averages. False when a writer kept it busy, leaving scope
+/// partly overwritten
+bool ev_inverter_scope(EVInverter *inverter, EVPhaseScope *scope);
+
+#endif
@@ -0,0 +1,360 @@
+#include "ev_montecarlo.h"
+#include "ev_cycle.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SAMPLE_CHUNK 16                // samples a worker claims at a time
+#define SUM_SCALE 1024.0               // EVQuantiles.sum units per unit
+#define SUM_LIMIT 1048576.0            // 2^20, |value| added to the sum: 2^33 samples fit in 63 bits
+
+typedef struct {
+    const char *name;
+    double min;                // valid range, draws are clamped to it
+    double max;
+    EVDistribution fallback;
+} ParamInfo;
+
+static const ParamInfo param_info[EV_MC_PARAMS] = {
+    [EV_MC_MASS] = { "mass_kg", 500, 5000, { EV_DIST_NORMAL, 1500, 75, 0 } },
+    [EV_MC_DRAG] = { "drag_coeff", 0.1, 1.0, { EV_DIST_NORMAL, 0.3, 0.015, 0 } },
+    [EV_MC_ROLLING] = { "rolling_resistance", 0.002, 0.05, { EV_DIST_UNIFORM, 0.008, 0.012, 0 } },
+    [EV_MC_REGEN] = { "regen_pct", 0, 100, { EV_DIST_UNIFORM, 40, 60, 0 } },
+    [EV_MC_AMBIENT] = { "ambient_c", -40, 50, { EV_DIST_NORMAL, 15, 10, 0 } },
+    [EV_MC_AGGRESSIVENESS] = { "aggressiveness", 0.2, 3, { EV_DIST_TRIANGULAR, 0.7, 1.6, 1.0 } }
+};
+
+static const char *const metric_names[EV_MC_METRICS] = {
+    [EV_MC_RANGE] = "range_km",
+    [EV_MC_EFFICIENCY] = "efficiency_whkm",
+    [EV_MC_PEAK_TEMP] = "peak_battery_temp_c"
+};
+
+static const char *const dist_names[EV_DIST_COUNT] = {
+    [EV_DIST_FIXED] = "fixed",
+    [EV_DIST_UNIFORM] = "uniform",
+    [EV_DIST_NORMAL] = "normal",
+    [EV_DIST_TRIANGULAR] = "triangular"
+};
+
+typedef struct {
+    const EVMonteCarloSpec *spec;
+    const EVSimulation *base;
+    const EVSweepRunOptions *options;
+    EVMonteCarloCallback callback;
+    void *user_data;
+    pthread_mutex_t callback_lock;
+    atomic_long next;          // first sample of the next unclaimed chunk
+    EVMonteCarloResult *results;   // one per worker, merged at the end
+} MonteCarloPool;
+
+typedef struct {
+    MonteCarloPool *pool;
+    int id;
+} MonteCarloWorker;
+
+void ev_quantiles_init(EVQuantiles *quantiles) {
+    memset(quantiles, 0, sizeof(*quantiles));
+    quantiles->min = INFINITY;
+    quantiles->max = -INFINITY;
+}
+
+static int quantile_bucket(double value) {
+    if (!(value >= ldexp(1, EV_QUANTILE_MIN_EXP))) return 0;
+    int e;
+    double m = frexp(value, &e);   // value = m * 2^e, m in [0.5, 1)
+    int octave = e - 1 - EV_QUANTILE_MIN_EXP;
+    if (octave >= EV_QUANTILE_MAX_EXP - EV_QUANTILE_MIN_EXP) return EV_QUANTILE_BUCKETS - 1;
+    int sub = (int)((2 * m - 1) * (1 << EV_QUANTILE_SUB_BITS));
+    return (octave << EV_QUANTILE_SUB_BITS) + sub;
+}
+
+static double quantile_bucket_low(int index) {
+    int octave = index >> EV_QUANTILE_SUB_BITS;
+    int sub = index & ((1 << EV_QUANTILE_SUB_BITS) - 1);
+    return ldexp(1 + (double)sub / (1 << EV_QUANTILE_SUB_BITS), octave + EV_QUANTILE_MIN_EXP);
+}
+
+void ev_quantiles_add(EVQuantiles *quantiles, double value) {
+    if (isnan(value)) return;
+    quantiles->count++;
+    quantiles->buckets[quantile_bucket(value)]++;
+    if (value < quantiles->min) quantiles->min = value;
+    if (value > quantiles->max) quantiles->max = value;
+    double clamped = value < -SUM_LIMIT ? -SUM_LIMIT : value > SUM_LIMIT ? SUM_LIMIT : value;
+    quantiles->sum += llround(clamped * SUM_SCALE);
+}
+
+void ev_quantiles_merge(EVQuantiles *into, const EVQuantiles *from) {
+    into->count += from->count;
+    into->sum += from->sum;
+    if (from->min < into->min) into->min = from->min;
+    if (from->max > into->max) into->max = from->max;
+    for (int b = 0; b < EV_QUANTILE_BUCKETS; b++) into->buckets[b] += from->buckets[b];
+}
+
+double ev_quantiles_value(const EVQuantiles *quantiles, double p) {
+    if (quantiles->count == 0) return NAN;
+    if (p <= 0) return quantiles->min;
+    if (p >= 1) return quantiles->max;
+    double rank = p * quantiles->count;
+    uint64_t seen = 0;
+    for (int b = 0; b < EV_QUANTILE_BUCKETS; b++) {
+        uint64_t n = quantiles->buckets[b];
+        if (n == 0 || seen + n < rank) {
+            seen += n;
+            continue;
+        }
+        /// The end buckets are open; the extremes bound them instead
+        double low = b == 0 ? quantiles->min : quantile_bucket_low(b);
+        double high = b == EV_QUANTILE_BUCKETS - 1 ? quantiles->max : quantile_bucket_low(b + 1);
+        double value = low + (high - low) * (rank - seen) / n;
+        if (value < quantiles->min) value = quantiles->min;
+        if (value > quantiles->max) value = quantiles->max;
+        return value;
+    }
+    return quantiles->max;
+}
+
+double ev_quantiles_mean(const EVQuantiles *quantiles) {
+    return quantiles->count ? quantiles->sum / SUM_SCALE / quantiles->count : NAN;
+}
+
+void ev_monte_carlo_spec_init(EVMonteCarloSpec *spec) {
+    for (int p = 0; p < EV_MC_PARAMS; p++) spec->params[p] = param_info[p].fallback;
+    spec->samples = 100000;
+    spec->seed = 1;
+}
+
+const char *ev_monte_carlo_param_name(EVMonteCarloParam param) {
+    return (param >= 0 && param < EV_MC_PARAMS) ? param_info[param].name : "unknown";
+}
+
+const char *ev_monte_carlo_metric_name(EVMonteCarloMetric metric) {
+    return (metric >= 0 && metric < EV_MC_METRICS) ? metric_names[metric] : "unknown";
+}
+
+bool ev_distribution_parse(const char *spec, EVMonteCarloParam param, EVDistribution *dist) {
+    const ParamInfo *info = &param_info[param];
+    char name[16];
+    double v[3];
+    int used = 0;
+    EVDistribution parsed = { EV_DIST_FIXED, 0, 0, 0 };
+    if (sscanf(spec, "%lf%n", &v[0], &used) == 1 && spec[used] == 0) {
+        parsed.a = v[0];
+    } else {
+        int fields = sscanf(spec, "%15[a-z]:%lf:%lf:%lf", name, &v[0], &v[1], &v[2]);
+        if (fields < 2) return false;
+        if (strcmp(name, "fixed") == 0 && fields == 2) {
+            parsed.a = v[0];
+        } else if (strcmp(name, "uniform") == 0 && fields == 3) {
+            parsed = (EVDistribution){ EV_DIST_UNIFORM, v[0], v[1], 0 };
+        } else if (strcmp(name, "normal") == 0 && fields == 3) {
+            parsed = (EVDistribution){ EV_DIST_NORMAL, v[0], v[1], 0 };
+        } else if (strcmp(name, "triangular") == 0 && fields == 4) {
+            parsed = (EVDistribution){ EV_DIST_TRIANGULAR, v[0], v[2], v[1] };
+        } else {
+            return false;
+        }
+    }
+    bool ok;
+    switch (parsed.kind) {
+    case EV_DIST_UNIFORM:
+        ok = parsed.a >= info->min && parsed.a <= parsed.b && parsed.b <= info->max;
+        break;
+    case EV_DIST_NORMAL:
+        ok = parsed.a >= info->min && parsed.a <= info->max && parsed.b >= 0;
+        break;
+    case EV_DIST_TRIANGULAR:
+        ok = parsed.a >= info->min && parsed.a <= parsed.c && parsed.c <= parsed.b && parsed.b <= info->max;
+        break;
+    default:
+        ok = parsed.a >= info->min && parsed.a <= info->max;
+        break;
+    }
+    if (ok) *dist = parsed;
+    return ok;
+}
+
+void ev_distribution_describe(const EVDistribution *dist, char *buf, int size) {
+    switch (dist->kind) {
+    case EV_DIST_UNIFORM:
+    case EV_DIST_NORMAL:
+        snprintf(buf, size, "%s:%g:%g", dist_names[dist->kind], dist->a, dist->b);
+        break;
+    case EV_DIST_TRIANGULAR:
+        snprintf(buf, size, "%s:%g:%g:%g", dist_names[dist->kind], dist->a, dist->c, dist->b);
+        break;
+    default:
+        snprintf(buf, size, "%s:%g", dist_names[EV_DIST_FIXED], dist->a);
+        break;
+    }
+}
+
+/// u1, u2 in [0, 1)
+static double draw(const EVDistribution *dist, double u1, double u2) {
+    switch (dist->kind) {
+    case EV_DIST_UNIFORM:
+        return dist->a + (dist->b - dist->a) * u1;
+    case EV_DIST_NORMAL:    /// Box-Muller; 1 - u1 keeps the logarithm finite
+        return dist->a + dist->b * sqrt(-2 * log(1 - u1)) * cos(2 * M_PI * u2);
+    case EV_DIST_TRIANGULAR: {
+        double span = dist->b - dist->a;
+        if (span <= 0) return dist->a;
+        double left = dist->c - dist->a;
+        if (u1 * span < left) return dist->a + sqrt(u1 * span * left);
+        return dist->b - sqrt((1 - u1) * span * (dist->b - dist->c));
+    }
+    default:
+        return dist->a;
+    }
+}
+
+void ev_monte_carlo_draw(const EVMonteCarloSpec *spec, long index, double values[EV_MC_PARAMS]) {
+    const uint32_t key[2] = { (uint32_t)spec->seed, (uint32_t)(spec->seed >> 32) };
+    for (int p = 0; p < EV_MC_PARAMS; p++) {
+        const uint32_t counter[4] = { (uint32_t)index, (uint32_t)((uint64_t)index >> 32), (uint32_t)p, 0 };
+        uint32_t bits[4];
+        ev_philox4x32(counter, key, bits);
+        double u1 = ev_random_unit((uint64_t)bits[0] << 32 | bits[1]);
+        double u2 = ev_random_unit((uint64_t)bits[2] << 32 | bits[3]);
+        double value = draw(&spec->params[p], u1, u2);
+        if (value < param_info[p].min) value = param_info[p].min;
+        if (value > param_info[p].max) value = param_info[p].max;
+        values[p] = value;
+    }
+}
+
+/// The draw's inputs into sim; the ambient temperature sets the air density here and the
+/// starting temperatures once the run is reset
+static void apply_draw(EVSimulation *sim, const double values[EV_MC_PARAMS]) {
+    sim->vehicle.mass = values[EV_MC_MASS];
+    sim->vehicle.drag_coeff = values[EV_MC_DRAG];
+    sim->vehicle.rolling_resistance = values[EV_MC_ROLLING];
+    sim->vehicle.air_density = ev_air_density(0, values[EV_MC_AMBIENT]);
+    sim->vehicle.aggressiveness = values[EV_MC_AGGRESSIVENESS];
+    sim->regen_efficiency = values[EV_MC_REGEN] / 100.0;
+    sim->regen_braking = values[EV_MC_REGEN] > 0;
+}
+
+static void *monte_carlo_worker(void *arg) {
+    MonteCarloWorker *worker = arg;
+    MonteCarloPool *pool = worker->pool;
+    const EVMonteCarloSpec *spec = pool->spec;
+    const EVSweepRunOptions *options = pool->options;
+    EVMonteCarloResult *result = &pool->results[worker->id];
+    /// One network and one cycle cursor per worker, reset between samples
+    EVThermal *thermal = NULL;
+    if (options->thermal) {
+        EVThermalParams params;
+        ev_thermal_params_default(&params);
+        params.coolant_flow = options->coolant_flow;
+        thermal = ev_thermal_new(&params, NULL);
+    }
+    EVCycle *cycle = NULL;
+    if (options->cycle_name || options->cycle_path) {
+        cycle = options->cycle_path ? ev_cycle_open_csv(options->cycle_path)
+                                    : ev_cycle_open_builtin(options->cycle_name);
+        if (cycle) ev_cycle_set_repeat(cycle, true);
+    }
+    bool ready = (!options->thermal || thermal) && (!(options->cycle_name || options->cycle_path) || cycle);
+    for (;;) {
+        long begin = atomic_fetch_add(&pool->next, SAMPLE_CHUNK);
+        if (begin >= spec->samples) break;
+        long end = begin + SAMPLE_CHUNK < spec->samples ? begin + SAMPLE_CHUNK : spec->samples;
+        for (long i = begin; i < end; i++) {
+            EVMonteCarloSample sample = { .index = i, .worker = worker->id };
+            ev_monte_carlo_draw(spec, i, sample.values);
+            double ambient = sample.values[EV_MC_AMBIENT];
+            EVSimulation sim = *pool->base;
+            apply_draw(&sim, sample.values);
+            sim.pack = NULL;
+            sim.thermal = thermal;
+            if (thermal) thermal->params.ambient_temp = ambient;
+            ev_sim_reset(&sim);
+            /// The scalar model's clamp; the network starts at ambient and overrides it
+            sim.battery_temp = ambient < 10 ? 10 : ambient > 70 ? 70 : ambient;
+            sim.is_running = true;
+            if (!ready || (cycle && !ev_cycle_rewind(cycle))) {
+                /// A zeroed summary would drag every percentile towards 0
+                result->failed++;
+                continue;
+            }
+            EVIntegrator integrator;
+            ev_integrator_init(&integrator, options->solver);
+            integrator.rtol = options->rtol;
+            ev_integrator_run(&integrator, &sim, &options->profile, cycle, options->dt, options->max_time, true,
+                              &sample.summary);
+            ev_quantiles_add(&result->metrics[EV_MC_RANGE], sample.summary.distance);
+            ev_quantiles_add(&result->metrics[EV_MC_EFFICIENCY], sample.summary.energy_efficiency);
+            ev_quantiles_add(&result->metrics[EV_MC_PEAK_TEMP], sample.summary.peak_battery_temp);
+            if (pool->callback) {
+                pthread_mutex_lock(&pool->callback_lock);
+                pool->callback(&sample, pool->user_data);
+                pthread_mutex_unlock(&pool->callback_lock);
+            }
+        }
+    }
+    ev_cycle_close(cycle);
+    ev_thermal_free(thermal);
+    return NULL;
+}
+
+int ev_monte_carlo_run(const EVMonteCarloSpec *spec, const EVSimulation *base, const EVSweepRunOptions *options,
+                       EVMonteCarloCallback callback, void *user_data, EVMonteCarloResult *result) {
+    for (int m = 0; m < EV_MC_METRICS; m++) ev_quantiles_init(&result->metrics[m]);
+    result->failed = 0;
+    if (options->pack_series > 0) return -1;
+    long chunks = (spec->samples + SAMPLE_CHUNK - 1) / SAMPLE_CHUNK;
+    int workers = options->threads > 0 ? options->threads : ev_cpu_count();
+    if (workers > chunks) workers = (int)chunks;
+    if (workers < 1) return 0;
+    MonteCarloPool pool = {
+        .spec = spec,
+        .base = base,
+        .options = options,
+        .callback = callback,
+        .user_data = user_data
+    };
+    atomic_init(&pool.next, 0);
+    pool.results = malloc(sizeof(EVMonteCarloResult) * workers);
+    MonteCarloWorker *args = calloc(workers, sizeof(MonteCarloWorker));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    if (!pool.results || !args || !threads) {
+        free(pool.results);
+        free(args);
+        free(threads);
+        return -1;
+    }
+    pthread_mutex_init(&pool.callback_lock, NULL);
+    for (int w = 0; w < workers; w++) {
+        for (int m = 0; m < EV_MC_METRICS; m++) ev_quantiles_init(&pool.results[w].metrics[m]);
+        pool.results[w].failed = 0;
+        args[w].pool = &pool;
+        args[w].id = w;
+    }
+    int started = 0;
+    for (int w = 1; w < workers; w++) {
+        if (pthread_create(&threads[w], NULL, monte_carlo_worker, &args[w]) != 0) break;
+        started = w;
+    }
+    /// The calling thread is worker 0 and keeps claiming chunks until none are left
+    monte_carlo_worker(&args[0]);
+    for (int w = 1; w <= started; w++) pthread_join(threads[w], NULL);
+    for (int w = 0; w < workers; w++) {
+        for (int m = 0; m < EV_MC_METRICS; m++) ev_quantiles_merge(&result->metrics[m], &pool.results[w].metrics[m]);
+        result->failed += pool.results[w].failed;
+    }
+    pthread_mutex_destroy(&pool.callback_lock);
+    free(pool.results);
+    free(args);
+    free(threads);
+    return 0;
+}
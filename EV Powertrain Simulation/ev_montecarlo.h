@@ -0,0 +1,109 @@
+#ifndef EV_MONTECARLO_H
+#define EV_MONTECARLO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ev_sim.h"
+#include "ev_sweep.h"
+
+#define EV_QUANTILE_SUB_BITS 8         // 256 buckets per power of two, 0.4 % wide
+#define EV_QUANTILE_MIN_EXP (-10)      // values below 2^-10 share the first bucket
+#define EV_QUANTILE_MAX_EXP 20         // and values from 2^20 up the last
+#define EV_QUANTILE_BUCKETS ((EV_QUANTILE_MAX_EXP - EV_QUANTILE_MIN_EXP) << EV_QUANTILE_SUB_BITS)
+
+/// Streaming quantiles in constant memory: log-linear bucket counts plus the exact extremes.
+/// Counts and the fixed-point sum merge exactly, so every statistic is the same however the
+/// samples were split over threads
+typedef struct {
+    uint64_t count;
+    double min;
+    double max;
+    int64_t sum;               // units of 2^-10
+    uint64_t buckets[EV_QUANTILE_BUCKETS];
+} EVQuantiles;
+
+void ev_quantiles_init(EVQuantiles *quantiles);
+/// NaN is ignored
+void ev_quantiles_add(EVQuantiles *quantiles, double value);
+void ev_quantiles_merge(EVQuantiles *into, const EVQuantiles *from);
+/// p from 0 (the minimum) to 1 (the maximum), interpolated within its bucket; NaN when empty
+double ev_quantiles_value(const EVQuantiles *quantiles, double p);
+double ev_quantiles_mean(const EVQuantiles *quantiles);
+
+typedef enum {
+    EV_DIST_FIXED,             // a
+    EV_DIST_UNIFORM,           // a to b
+    EV_DIST_NORMAL,            // mean a, standard deviation b
+    EV_DIST_TRIANGULAR,        // a to b, most likely c
+    EV_DIST_COUNT
+} EVDistKind;
+
+typedef struct {
+    EVDistKind kind;
+    double a;
+    double b;
+    double c;
+} EVDistribution;
+
+/// Sampled inputs; every draw is clamped to the parameter's valid range
+typedef enum {
+    EV_MC_MASS,                // kg
+    EV_MC_DRAG,                // drag coefficient
+    EV_MC_ROLLING,             // rolling resistance coefficient
+    EV_MC_REGEN,               // regen efficiency, %
+    EV_MC_AMBIENT,             // °C: air density and the battery's starting temperature
+    EV_MC_AGGRESSIVENESS,      // driver, see EVVehicleParams
+    EV_MC_PARAMS
+} EVMonteCarloParam;
+
+typedef enum {
+    EV_MC_RANGE,               // km
+    EV_MC_EFFICIENCY,          // Wh/km
+    EV_MC_PEAK_TEMP,           // °C, peak battery temperature
+    EV_MC_METRICS
+} EVMonteCarloMetric;
+
+typedef struct {
+    EVDistribution params[EV_MC_PARAMS];
+    long samples;
+    uint64_t seed;
+} EVMonteCarloSpec;
+
+typedef struct {
+    long index;
+    int worker;
+    double values[EV_MC_PARAMS];
+    EVRunSummary summary;
+} EVMonteCarloSample;
+
+typedef struct {
+    EVQuantiles metrics[EV_MC_METRICS];
+    long failed;               // samples whose thermal network or cycle could not be set up
+} EVMonteCarloResult;
+
+/// Called once per finished sample, failed ones excepted, serialized across workers, in no particular order
+typedef void (*EVMonteCarloCallback)(const EVMonteCarloSample *sample, void *user_data);
+
+void ev_monte_carlo_spec_init(EVMonteCarloSpec *spec);
+const char *ev_monte_carlo_param_name(EVMonteCarloParam param);
+const char *ev_monte_carlo_metric_name(EVMonteCarloMetric metric);
+
+/// "fixed:V" (or just V), "uniform:MIN:MAX", "normal:MEAN:SD" or "triangular:MIN:MODE:MAX",
+/// checked against the parameter's valid range; false on bad input
+bool ev_distribution_parse(const char *spec, EVMonteCarloParam param, EVDistribution *dist);
+/// "normal:1500:75" into buf
+void ev_distribution_describe(const EVDistribution *dist, char *buf, int size);
+
+/// The inputs of sample index, a pure function of the spec's distributions, seed and index:
+/// one Philox block per parameter, counter (index, parameter), key the seed
+void ev_monte_carlo_draw(const EVMonteCarloSpec *spec, long index, double values[EV_MC_PARAMS]);
+
+/// Runs spec->samples copies of base, each to empty with its own draw, on every worker the
+/// options allow, and merges their quantiles into *result. Memory does not grow with the
+/// sample count. A sample whose thermal network or cycle cannot be set up is left out of the
+/// quantiles and counted in result->failed. options->pack_series must be 0. Returns 0 when
+/// the workers ran, even if samples failed
+int ev_monte_carlo_run(const EVMonteCarloSpec *spec, const EVSimulation *base, const EVSweepRunOptions *options,
+                       EVMonteCarloCallback callback, void *user_data, EVMonteCarloResult *result);
+
+#endif
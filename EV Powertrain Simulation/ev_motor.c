@@ -0,0 +1,334 @@
+#include "ev_motor.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EV_MOTOR_X86 1
+#include <immintrin.h>
+#endif
+
+#define MAP_MAGIC "EVMMAP01"
+#define MAP_MAX_POINTS 4096        // per axis
+#define GRID_TOLERANCE 1e-6        // relative deviation allowed from an even axis spacing
+
+typedef struct {
+    char magic[8];
+    uint32_t speed_points;
+    uint32_t torque_points;
+    double rated_power;        // kW
+    double max_rpm;            // RPM
+    double max_torque;         // Nm
+} MapFileHeader;
+
+typedef struct {
+    double rpm;
+    double torque;
+    double efficiency;
+} MapPoint;
+
+static void *aligned_block(size_t size) {
+    size = (size + EV_MOTOR_MAP_ALIGN - 1) / EV_MOTOR_MAP_ALIGN * EV_MOTOR_MAP_ALIGN;
+#ifdef _WIN32
+    return _aligned_malloc(size, EV_MOTOR_MAP_ALIGN);
+#else
+    return aligned_alloc(EV_MOTOR_MAP_ALIGN, size);
+#endif
+}
+
+static void aligned_block_free(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+void ev_motor_params_default(EVMotorParams *params) {
+    /// A 150 kW traction PMSM: ~96 % peak, ~90 % at light urban load
+    params->rated_power = 150;
+    params->peak_torque = 310;
+    params->max_rpm = 10000;
+    params->copper_loss = 0.083;
+    params->iron_loss = 75;
+    params->windage_loss = 7.5;
+    params->fixed_loss = 200;
+}
+
+static EVMotorMap *map_alloc(int speed_points, int torque_points, double rated_power, double max_rpm,
+                             double max_torque) {
+    if (speed_points < 2 || torque_points < 2 || speed_points > MAP_MAX_POINTS ||
+        torque_points > MAP_MAX_POINTS || rated_power <= 0 || max_rpm <= 0 || max_torque <= 0) {
+        return NULL;
+    }
+    EVMotorMap *map = calloc(1, sizeof(EVMotorMap));
+    if (!map) return NULL;
+    int line_floats = EV_MOTOR_MAP_ALIGN / sizeof(float);
+    map->stride = (torque_points + line_floats - 1) / line_floats * line_floats;
+    map->efficiency = aligned_block((size_t)speed_points * map->stride * sizeof(float));
+    if (!map->efficiency) {
+        free(map);
+        return NULL;
+    }
+    memset(map->efficiency, 0, (size_t)speed_points * map->stride * sizeof(float));
+    map->speed_points = speed_points;
+    map->torque_points = torque_points;
+    map->rated_power = rated_power;
+    map->max_rpm = max_rpm;
+    map->max_torque = max_torque;
+    map->rpm_to_index = (speed_points - 1) / max_rpm;
+    map->torque_to_index = (torque_points - 1) / max_torque;
+    map->last_speed = speed_points - 1;
+    map->last_torque = torque_points - 1;
+    return map;
+}
+
+/// Standstill has no defined efficiency, so the 0 RPM row copies the first moving one; every
+/// entry is floored so a lookup never divides by zero
+static void map_finish(EVMotorMap *map) {
+    float *first = map->efficiency;
+    memcpy(first, first + map->stride, map->torque_points * sizeof(float));
+    for (int i = 0; i < map->speed_points; i++) {
+        float *row = map->efficiency + (long)i * map->stride;
+        for (int j = 0; j < map->torque_points; j++) {
+            if (!(row[j] >= EV_MOTOR_MIN_EFFICIENCY)) row[j] = EV_MOTOR_MIN_EFFICIENCY;
+            if (row[j] > 1) row[j] = 1;
+        }
+    }
+}
+
+EVMotorMap *ev_motor_map_generate(const EVMotorParams *params, int speed_points, int torque_points) {
+    EVMotorMap *map = map_alloc(speed_points, torque_points, params->rated_power, params->max_rpm,
+                                params->peak_torque);
+    if (!map) return NULL;
+    for (int i = 0; i < speed_points; i++) {
+        double rpm = i / map->rpm_to_index;
+        double krpm = rpm / 1000;
+        double speed_loss = params->iron_loss * pow(krpm, 1.5) + params->windage_loss * krpm * krpm;
+        float *row = map->efficiency + (long)i * map->stride;
+        for (int j = 0; j < torque_points; j++) {
+            double torque = j / map->torque_to_index;
+            double shaft = torque * rpm * (2 * M_PI / 60);   // W
+            double loss = params->copper_loss * torque * torque + speed_loss + params->fixed_loss;
+            row[j] = (float)(shaft / (shaft + loss));
+        }
+    }
+    map_finish(map);
+    return map;
+}
+
+static bool even_axis(const double *values, int count, double *step) {
+    if (values[0] != 0) return false;
+    *step = values[count - 1] / (count - 1);
+    for (int k = 1; k < count; k++) {
+        if (fabs(values[k] - k * *step) > GRID_TOLERANCE * values[count - 1]) return false;
+    }
+    return true;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/// Sorts values and drops duplicates, returns the distinct count
+static int distinct(double *values, long count) {
+    qsort(values, count, sizeof(double), compare_double);
+    int n = 0;
+    for (long k = 0; k < count; k++) {
+        if (n == 0 || values[k] != values[n - 1]) values[n++] = values[k];
+    }
+    return n;
+}
+
+static EVMotorMap *load_csv(FILE *file, const char *path) {
+    MapPoint *points = NULL;
+    long count = 0, allocated = 0;
+    double rated_power = 150;
+    bool percent = false;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        double kw;
+        if (sscanf(line, "# rated_kw %lf", &kw) == 1 && kw > 0) rated_power = kw;
+        MapPoint p;
+        if (sscanf(line, "%lf,%lf,%lf", &p.rpm, &p.torque, &p.efficiency) != 3) continue;
+        if (p.rpm < 0 || p.torque < 0) continue;
+        if (count == allocated) {
+            allocated = allocated ? allocated * 2 : 1024;
+            MapPoint *grown = realloc(points, allocated * sizeof(MapPoint));
+            if (!grown) {
+                free(points);
+                return NULL;
+            }
+            points = grown;
+        }
+        if (p.efficiency > 1.5) percent = true;
+        points[count++] = p;
+    }
+    double *rpms = malloc((count + 1) * sizeof(double));
+    double *torques = malloc((count + 1) * sizeof(double));
+    EVMotorMap *map = NULL;
+    if (count >= 4 && rpms && torques) {
+        for (long k = 0; k < count; k++) {
+            rpms[k] = points[k].rpm;
+            torques[k] = points[k].torque;
+        }
+        int speed_points = distinct(rpms, count);
+        int torque_points = distinct(torques, count);
+        double rpm_step, torque_step;
+        if ((long)speed_points * torque_points != count || speed_points < 2 || torque_points < 2 ||
+            !even_axis(rpms, speed_points, &rpm_step) || !even_axis(torques, torque_points, &torque_step)) {
+            fprintf(stderr, "%s: motor map must be a full, evenly spaced grid starting at 0 RPM and 0 Nm\n", path);
+        } else {
+            map = map_alloc(speed_points, torque_points, rated_power, rpms[speed_points - 1],
+                            torques[torque_points - 1]);
+        }
+        for (long k = 0; map && k < count; k++) {
+            int i = (int)(points[k].rpm / rpm_step + 0.5);
+            int j = (int)(points[k].torque / torque_step + 0.5);
+            double eff = percent ? points[k].efficiency / 100 : points[k].efficiency;
+            map->efficiency[(long)i * map->stride + j] = (float)eff;
+        }
+        if (map) map_finish(map);
+    }
+    free(rpms);
+    free(torques);
+    free(points);
+    return map;
+}
+
+static EVMotorMap *load_binary(FILE *file) {
+    MapFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1) return NULL;
+    EVMotorMap *map = map_alloc((int)header.speed_points, (int)header.torque_points, header.rated_power,
+                                header.max_rpm, header.max_torque);
+    if (!map) return NULL;
+    for (int i = 0; i < map->speed_points; i++) {
+        if (fread(map->efficiency + (long)i * map->stride, sizeof(float), map->torque_points, file) !=
+            (size_t)map->torque_points) {
+            ev_motor_map_free(map);
+            return NULL;
+        }
+    }
+    map_finish(map);
+    return map;
+}
+
+EVMotorMap *ev_motor_map_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    char magic[8] = { 0 };
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    rewind(file);
+    EVMotorMap *map = got == sizeof(magic) && memcmp(magic, MAP_MAGIC, sizeof(magic)) == 0
+                    ? load_binary(file) : load_csv(file, path);
+    fclose(file);
+    return map;
+}
+
+EVMotorMap *ev_motor_map_open(const char *spec) {
+    if (strcmp(spec, "pmsm") == 0) {
+        EVMotorParams params;
+        ev_motor_params_default(&params);
+        return ev_motor_map_generate(&params, EV_MOTOR_MAP_POINTS, EV_MOTOR_MAP_POINTS);
+    }
+    return ev_motor_map_load(spec);
+}
+
+bool ev_motor_map_save(const EVMotorMap *map, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    MapFileHeader header = {
+        .speed_points = (uint32_t)map->speed_points,
+        .torque_points = (uint32_t)map->torque_points,
+        .rated_power = map->rated_power,
+        .max_rpm = map->max_rpm,
+        .max_torque = map->max_torque
+    };
+    memcpy(header.magic, MAP_MAGIC, sizeof(header.magic));
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < map->speed_points; i++) {
+        ok = fwrite(map->efficiency + (long)i * map->stride, sizeof(float), map->torque_points, file) ==
+             (size_t)map->torque_points;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+bool ev_motor_map_save_csv(const EVMotorMap *map, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "# rated_kw %g\nrpm,torque_nm,efficiency\n", map->rated_power);
+    for (int i = 0; i < map->speed_points; i++) {
+        for (int j = 0; j < map->torque_points; j++) {
+            fprintf(file, "%.9g,%.9g,%.6f\n", i / map->rpm_to_index, j / map->torque_to_index,
+                    map->efficiency[(long)i * map->stride + j]);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+void ev_motor_map_free(EVMotorMap *map) {
+    if (!map) return;
+    aligned_block_free(map->efficiency);
+    free(map);
+}
+
+static void lookup_batch_scalar(const EVMotorMap *map, const double *rpm, const double *torque,
+                                double *efficiency, long count) {
+    for (long k = 0; k < count; k++) efficiency[k] = ev_motor_map_lookup(map, rpm[k], torque[k]);
+}
+
+#ifdef EV_MOTOR_X86
+/// Four lookups per iteration, the corners fetched with gathers
+__attribute__((target("avx2,fma")))
+static void lookup_batch_avx2(const EVMotorMap *map, const double *rpm, const double *torque,
+                              double *efficiency, long count) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFll));
+    const __m256d rpm_to_index = _mm256_set1_pd(map->rpm_to_index);
+    const __m256d torque_to_index = _mm256_set1_pd(map->torque_to_index);
+    const __m256d last_speed = _mm256_set1_pd(map->last_speed);
+    const __m256d last_torque = _mm256_set1_pd(map->last_torque);
+    const __m256d last_speed_cell = _mm256_set1_pd(map->last_speed - 1);
+    const __m256d last_torque_cell = _mm256_set1_pd(map->last_torque - 1);
+    const __m128i stride = _mm_set1_epi32(map->stride);
+    const __m128i next_row = _mm_set1_epi32(map->stride + 1);
+    const float *grid = map->efficiency;
+    long k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m256d x = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(_mm256_loadu_pd(rpm + k), rpm_to_index), zero),
+                                  last_speed);
+        __m256d y = _mm256_min_pd(_mm256_mul_pd(_mm256_and_pd(_mm256_loadu_pd(torque + k), abs_mask),
+                                                torque_to_index), last_torque);
+        __m128i i = _mm256_cvttpd_epi32(_mm256_min_pd(x, last_speed_cell));
+        __m128i j = _mm256_cvttpd_epi32(_mm256_min_pd(y, last_torque_cell));
+        __m256d fx = _mm256_sub_pd(x, _mm256_cvtepi32_pd(i));
+        __m256d fy = _mm256_sub_pd(y, _mm256_cvtepi32_pd(j));
+        __m128i base = _mm_add_epi32(_mm_mullo_epi32(i, stride), j);
+        __m256d e00 = _mm256_cvtps_pd(_mm_i32gather_ps(grid, base, 4));
+        __m256d e01 = _mm256_cvtps_pd(_mm_i32gather_ps(grid + 1, base, 4));
+        __m256d e10 = _mm256_cvtps_pd(_mm_i32gather_ps(grid, _mm_add_epi32(base, stride), 4));
+        __m256d e11 = _mm256_cvtps_pd(_mm_i32gather_ps(grid, _mm_add_epi32(base, next_row), 4));
+        __m256d low = _mm256_fmadd_pd(_mm256_sub_pd(e01, e00), fy, e00);
+        __m256d high = _mm256_fmadd_pd(_mm256_sub_pd(e11, e10), fy, e10);
+        _mm256_storeu_pd(efficiency + k, _mm256_fmadd_pd(_mm256_sub_pd(high, low), fx, low));
+    }
+    lookup_batch_scalar(map, rpm + k, torque + k, efficiency + k, count - k);
+}
+#endif
+
+void ev_motor_map_lookup_batch(const EVMotorMap *map, const double *rpm, const double *torque,
+                               double *efficiency, long count) {
+#ifdef EV_MOTOR_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        lookup_batch_avx2(map, rpm, torque, efficiency, count);
+        return;
+    }
+#endif
+    lookup_batch_scalar(map, rpm, torque, efficiency, count);
+}
@@ -0,0 +1,84 @@
+#ifndef EV_MOTOR_H
+#define EV_MOTOR_H
+
+#include <math.h>
+#include <stdbool.h>
+
+#define EV_MOTOR_FLAT_EFFICIENCY 0.85  // drivetrain efficiency without a map
+#define EV_MOTOR_MIN_EFFICIENCY 0.05   // floor for map entries, keeps power_use finite
+#define EV_MOTOR_MAP_ALIGN 64          // bytes
+#define EV_MOTOR_MAP_POINTS 64         // default grid points per axis
+
+/// Parametric PMSM loss model used to generate a map
+typedef struct {
+    double rated_power;        // kW
+    double peak_torque;        // Nm
+    double max_rpm;            // RPM
+    double copper_loss;        // W/Nm², I²R loss, proportional to torque²
+    double iron_loss;          // W at 1000 RPM, hysteresis and eddy, scales with speed^1.5
+    double windage_loss;       // W at 1000 RPM, friction and windage, scales with speed²
+    double fixed_loss;         // W, inverter and auxiliary
+} EVMotorParams;
+
+/// Efficiency over a regular torque-speed grid, axes starting at 0. Immutable once built, so
+/// one map is shared read-only by every thread and every EVSimulation that points at it
+typedef struct {
+    double rated_power;        // kW, lookups scale torque by rated_power / motor_power
+    double max_rpm;            // RPM, last speed row
+    double max_torque;         // Nm, last torque column
+    double rpm_to_index;       // 1/RPM
+    double torque_to_index;    // 1/Nm
+    double last_speed;         // speed_points - 1
+    double last_torque;        // torque_points - 1
+    int speed_points;
+    int torque_points;
+    int stride;                // floats per speed row, padded to whole cache lines
+    float *efficiency;         // [speed][stride], EV_MOTOR_MAP_ALIGN-aligned
+} EVMotorMap;
+
+void ev_motor_params_default(EVMotorParams *params);
+
+/// Evaluates the loss model on a speed_points x torque_points grid; NULL on bad input
+EVMotorMap *ev_motor_map_generate(const EVMotorParams *params, int speed_points, int torque_points);
+/// "rpm,torque_nm,efficiency" CSV on a regular grid (efficiency as a fraction or in %, an
+/// optional "# rated_kw N" line), or a file written by ev_motor_map_save()
+EVMotorMap *ev_motor_map_load(const char *path);
+/// "pmsm" generates the default map, anything else is loaded from a file
+EVMotorMap *ev_motor_map_open(const char *spec);
+bool ev_motor_map_save(const EVMotorMap *map, const char *path);
+bool ev_motor_map_save_csv(const EVMotorMap *map, const char *path);
+void ev_motor_map_free(EVMotorMap *map);
+
+/// Compiles to minsd/maxsd; fmin()/fmax() are library calls unless NaN handling is relaxed
+static inline double ev_motor_clamp(double v, double lo, double hi) {
+    v = v > lo ? v : lo;
+    return v < hi ? v : hi;
+}
+
+/// Bilinear efficiency at |torque|; both axes are clamped to the grid. No branches, so batch
+/// loops over it vectorize
+static inline double ev_motor_map_lookup(const EVMotorMap *map, double rpm, double torque) {
+    double x = ev_motor_clamp(rpm * map->rpm_to_index, 0, map->last_speed);
+    double y = ev_motor_clamp(fabs(torque) * map->torque_to_index, 0, map->last_torque);
+    int i = (int)ev_motor_clamp(x, 0, map->last_speed - 1);
+    int j = (int)ev_motor_clamp(y, 0, map->last_torque - 1);
+    double fx = x - i, fy = y - j;
+    const float *row = map->efficiency + (long)i * map->stride + j;
+    double low = row[0] + (row[1] - row[0]) * fy;
+    double high = row[map->stride] + (row[map->stride + 1] - row[map->stride]) * fy;
+    return low + (high - low) * fx;
+}
+
+/// Efficiency of a motor_power (kW) machine delivering shaft_power (kW) at rpm. Torque follows
+/// from P/ω and saturates at the map edge near standstill
+static inline double ev_motor_drive_efficiency(const EVMotorMap *map, double motor_power, double rpm,
+                                               double shaft_power) {
+    double omega = rpm * (2 * 3.14159265358979323846 / 60);
+    omega = omega > 1e-3 ? omega : 1e-3;
+    return ev_motor_map_lookup(map, rpm, shaft_power * 1000 / omega * (map->rated_power / motor_power));
+}
+
+void ev_motor_map_lookup_batch(const EVMotorMap *map, const double *rpm, const double *torque,
+                               double *efficiency, long count);
+
+#endif
@@ -0,0 +1,214 @@
+#include "ev_perf.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CALIBRATION_TIME 20000000      // ns of CLOCK_MONOTONIC the TSC is measured against
+#define TRACE_MARGIN 1024              // ring slots skipped on export, a live thread may be
+                                       // overwriting them
+
+static const char *const stage_names[EV_PERF_STAGES] = {
+    [EV_PERF_PHYSICS_STEP] = "physics step",
+    [EV_PERF_WAVE_UPDATE] = "waveform update",
+    [EV_PERF_LABEL_FORMAT] = "label format",
+    [EV_PERF_LABEL_SET] = "label set",
+    [EV_PERF_DRAW_LATENCY] = "draw latency",
+    [EV_PERF_DRAW] = "draw",
+    [EV_PERF_CAIRO_STROKE] = "cairo stroke",
+    [EV_PERF_FRAME_INTERVAL] = "frame interval"
+};
+
+typedef struct {
+    _Atomic uint64_t begin;    // ticks
+    _Atomic uint64_t end;      // ticks
+    _Atomic uint32_t stage;
+} PerfEvent;
+
+/// One per thread that has recorded anything. Only the owning thread writes counts and
+/// events, with plain relaxed stores, so recording never takes a lock or a locked RMW.
+/// Blocks are never freed; a thread that exits hands its block to the next new thread
+typedef struct PerfThread {
+    struct PerfThread *next;
+    atomic_bool in_use;
+    int tid;
+    char name[32];
+    _Atomic uint64_t counts[EV_PERF_STAGES][EV_PERF_BUCKETS];
+    atomic_size_t trace_head;  // events ever written
+    /// Reader side, as of the last ev_perf_reset()
+    uint64_t baseline[EV_PERF_STAGES][EV_PERF_BUCKETS];
+    size_t trace_baseline;
+    PerfEvent events[EV_PERF_TRACE_EVENTS];
+} PerfThread;
+
+atomic_bool ev_perf_enabled = false;
+
+static _Atomic(PerfThread *) threads = NULL;
+static atomic_int next_tid = 1;
+static _Thread_local PerfThread *local = NULL;
+static _Thread_local char local_name[32];   // applied when the thread claims a block
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double ns_per_tick = 1;
+static uint64_t origin;        // ticks at calibration, time zero of the trace
+
+static void release_thread(void *block) {
+    atomic_store_explicit(&((PerfThread *)block)->in_use, false, memory_order_release);
+}
+
+static void create_key(void) {
+    pthread_key_create(&thread_key, release_thread);
+}
+
+static PerfThread *claim_thread(void) {
+    pthread_once(&key_once, create_key);
+    PerfThread *block = NULL;
+    for (PerfThread *t = atomic_load(&threads); t && !block; t = t->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&t->in_use, &expected, true)) block = t;
+    }
+    if (!block) {
+        if (!(block = calloc(1, sizeof(PerfThread)))) return NULL;
+        atomic_init(&block->in_use, true);
+        block->tid = atomic_fetch_add(&next_tid, 1);
+        snprintf(block->name, sizeof(block->name), "thread %d", block->tid);
+        PerfThread *head = atomic_load(&threads);
+        do {
+            block->next = head;
+        } while (!atomic_compare_exchange_weak(&threads, &head, block));
+    }
+    if (local_name[0]) snprintf(block->name, sizeof(block->name), "%s", local_name);
+    pthread_setspecific(thread_key, block);
+    return block;
+}
+
+static int bucket_of(uint64_t ticks) {
+    if (ticks < 8) return (int)ticks;
+#if defined(__GNUC__)
+    int e = 63 - __builtin_clzll(ticks);
+#else
+    int e = 0;
+    while ((ticks >> e) > 1) e++;
+#endif
+    int index = (e - 2) * 8 + (int)((ticks >> (e - 3)) & 7);
+    return index < EV_PERF_BUCKETS ? index : EV_PERF_BUCKETS - 1;
+}
+
+static double bucket_low(int index) {
+    if (index < 8) return index;
+    int e = index / 8 + 2;
+    return ldexp(8 + index % 8, e - 3);
+}
+
+void ev_perf_record(EVPerfStage stage, uint64_t begin, uint64_t end) {
+    PerfThread *t = local;
+    if (!t && !(t = local = claim_thread())) return;
+    _Atomic uint64_t *count = &t->counts[stage][bucket_of(end > begin ? end - begin : 0)];
+    atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + 1, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&t->trace_head, memory_order_relaxed);
+    PerfEvent *event = &t->events[head % EV_PERF_TRACE_EVENTS];
+    atomic_store_explicit(&event->begin, begin, memory_order_relaxed);
+    atomic_store_explicit(&event->end, end, memory_order_relaxed);
+    atomic_store_explicit(&event->stage, stage, memory_order_relaxed);
+    atomic_store_explicit(&t->trace_head, head + 1, memory_order_release);
+}
+
+static void calibrate(void) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t first = ev_perf_ticks();
+    long elapsed;
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec);
+    } while (elapsed < CALIBRATION_TIME);
+    uint64_t last = ev_perf_ticks();
+    if (last > first) ns_per_tick = (double)elapsed / (last - first);
+    origin = first;
+}
+
+void ev_perf_enable(bool enabled) {
+    if (enabled) pthread_once(&calibrate_once, calibrate);
+    atomic_store(&ev_perf_enabled, enabled);
+}
+
+void ev_perf_name_thread(const char *name) {
+    snprintf(local_name, sizeof(local_name), "%s", name);
+    if (local) snprintf(local->name, sizeof(local->name), "%s", name);
+}
+
+const char *ev_perf_stage_name(EVPerfStage stage) {
+    return (stage >= 0 && stage < EV_PERF_STAGES) ? stage_names[stage] : "unknown";
+}
+
+void ev_perf_stats(EVPerfStage stage, EVPerfStats *stats) {
+    uint64_t merged[EV_PERF_BUCKETS] = { 0 };
+    uint64_t total = 0;
+    for (PerfThread *t = atomic_load(&threads); t; t = t->next) {
+        for (int b = 0; b < EV_PERF_BUCKETS; b++) {
+            uint64_t n = atomic_load_explicit(&t->counts[stage][b], memory_order_relaxed) - t->baseline[stage][b];
+            merged[b] += n;
+            total += n;
+        }
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->count = total;
+    if (total == 0) return;
+    uint64_t p50_rank = (total + 1) / 2, p99_rank = total - total / 100;
+    uint64_t seen = 0;
+    bool have_p50 = false;
+    for (int b = 0; b < EV_PERF_BUCKETS; b++) {
+        if (merged[b] == 0) continue;
+        double middle = (bucket_low(b) + bucket_low(b + 1)) / 2 * ns_per_tick;
+        seen += merged[b];
+        if (!have_p50 && seen >= p50_rank) {
+            stats->p50 = middle;
+            have_p50 = true;
+        }
+        if (stats->p99 == 0 && seen >= p99_rank) stats->p99 = middle;
+        stats->max = bucket_low(b + 1) * ns_per_tick;
+    }
+}
+
+void ev_perf_reset(void) {
+    for (PerfThread *t = atomic_load(&threads); t; t = t->next) {
+        for (int s = 0; s < EV_PERF_STAGES; s++) {
+            for (int b = 0; b < EV_PERF_BUCKETS; b++) {
+                t->baseline[s][b] = atomic_load_explicit(&t->counts[s][b], memory_order_relaxed);
+            }
+        }
+        t->trace_baseline = atomic_load_explicit(&t->trace_head, memory_order_acquire);
+    }
+}
+
+bool ev_perf_write_trace(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) return false;
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool first_event = true;
+    for (PerfThread *t = atomic_load(&threads); t; t = t->next) {
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                first_event ? "" : ",\n", t->tid, t->name);
+        first_event = false;
+        size_t head = atomic_load_explicit(&t->trace_head, memory_order_acquire);
+        size_t first = t->trace_baseline;
+        if (head > EV_PERF_TRACE_EVENTS - TRACE_MARGIN && head - (EV_PERF_TRACE_EVENTS - TRACE_MARGIN) > first) {
+            first = head - (EV_PERF_TRACE_EVENTS - TRACE_MARGIN);
+        }
+        for (size_t i = first; i < head; i++) {
+            const PerfEvent *event = &t->events[i % EV_PERF_TRACE_EVENTS];
+            uint64_t begin = atomic_load_explicit(&event->begin, memory_order_relaxed);
+            uint64_t end = atomic_load_explicit(&event->end, memory_order_relaxed);
+            uint32_t stage = atomic_load_explicit(&event->stage, memory_order_relaxed);
+            if (end < begin || begin < origin || stage >= EV_PERF_STAGES) continue;
+            fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"evsim\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                    "\"ts\": %.3f, \"dur\": %.3f}", stage_names[stage], t->tid,
+                    (begin - origin) * ns_per_tick / 1000, (end - begin) * ns_per_tick / 1000);
+        }
+    }
+    fprintf(out, "\n]}\n");
+    bool ok = !ferror(out);
+    return fclose(out) == 0 && ok;
+}
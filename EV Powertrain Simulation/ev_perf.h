@@ -0,0 +1,71 @@
+#ifndef EV_PERF_H
+#define EV_PERF_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define EV_PERF_BUCKETS 320            // log-linear in ticks, 8 per power of two (~6 % resolution)
+#define EV_PERF_TRACE_EVENTS 65536     // per thread, the most recent are kept for export
+
+/// Instrumented hot-path stages
+typedef enum {
+    EV_PERF_PHYSICS_STEP,      // one runner step, all integrator substeps
+    EV_PERF_WAVE_UPDATE,       // appending a sample to the waveform history
+    EV_PERF_LABEL_FORMAT,      // status label text
+    EV_PERF_LABEL_SET,         // handing the texts to GTK
+    EV_PERF_DRAW_LATENCY,      // queue_draw until the draw callback runs
+    EV_PERF_DRAW,              // whole waveform draw callback
+    EV_PERF_CAIRO_STROKE,      // stroking one waveform channel
+    EV_PERF_FRAME_INTERVAL,    // between frame clock ticks
+    EV_PERF_STAGES
+} EVPerfStage;
+
+typedef struct {
+    uint64_t count;
+    double p50;                // ns
+    double p99;                // ns
+    double max;                // ns, upper edge of the highest occupied bucket
+} EVPerfStats;
+
+/// Off by default; while off, ev_perf_begin() is one relaxed load
+extern atomic_bool ev_perf_enabled;
+
+/// TSC on x86 (calibrated against CLOCK_MONOTONIC on the first enable), nanoseconds elsewhere
+static inline uint64_t ev_perf_ticks(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/// Start of a timed section; 0 when profiling is off, which ev_perf_end() then ignores
+static inline uint64_t ev_perf_begin(void) {
+    return atomic_load_explicit(&ev_perf_enabled, memory_order_relaxed) ? ev_perf_ticks() : 0;
+}
+
+/// Records [begin, end] in the calling thread's histogram and trace ring
+void ev_perf_record(EVPerfStage stage, uint64_t begin, uint64_t end);
+
+static inline void ev_perf_end(EVPerfStage stage, uint64_t begin) {
+    if (begin) ev_perf_record(stage, begin, ev_perf_ticks());
+}
+
+void ev_perf_enable(bool enabled);
+/// Label for the calling thread in traces; allocates nothing until the thread records
+void ev_perf_name_thread(const char *name);
+const char *ev_perf_stage_name(EVPerfStage stage);
+
+/// Merged over every thread since the last ev_perf_reset(); call from one thread only
+void ev_perf_stats(EVPerfStage stage, EVPerfStats *stats);
+void ev_perf_reset(void);
+
+/// Chrome trace event JSON (chrome://tracing, Perfetto) of the recorded events still in the
+/// rings. Events written while the export runs may be missing
+bool ev_perf_write_trace(const char *path);
+
+#endif
@@ -0,0 +1,392 @@
+#include "ev_render.h"
+#include "ev_perf.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+void ev_wave_view_fit(EVWaveView *view, const EVSimulation *sim) {
+    const EVPack *pack = sim->pack;
+    view->voltage_range = (pack ? pack->params.series * EV_CELL_MAX_VOLTAGE : sim->battery_voltage) * 1.2;
+    const DriveModeParams *mode = &drive_mode_params[sim->drive_mode];
+    double nominal_voltage = pack ? pack->params.series * EV_CELL_NOMINAL_VOLTAGE : sim->battery_voltage;
+    view->current_range = sim->motor_power * 1000 * mode->power_factor * (0.5 + 0.5 * mode->max_accel) /
+                          (EV_MOTOR_FLAT_EFFICIENCY * nominal_voltage) * 1.2;
+}
+
+double ev_wave_view_end(const EVWaveView *view) {
+    return view->end < 0 ? view->history->samples : view->end;
+}
+
+/// Drawing order, colour and legend of each channel
+typedef struct {
+    double red;
+    double green;
+    double blue;
+    const char *label;
+} ChannelStyle;
+
+static const ChannelStyle channel_styles[EV_WAVE_CHANNELS] = {
+    [EV_WAVE_VOLTAGE] = { 1.0, 0.2, 0.2, "Voltage (V)" },
+    [EV_WAVE_CURRENT] = { 0.2, 1.0, 0.2, "Current (A)" },
+    [EV_WAVE_SPEED] = { 0.2, 0.2, 1.0, "Speed (km/h)" },
+    [EV_WAVE_TEMP] = { 1.0, 1.0, 0.2, "Temp (°C)" }
+};
+
+#define LEGEND_WIDTH 160
+#define LEGEND_HEIGHT 90
+
+/// Value at the bottom of the view and the range drawn over 80 % of its height
+static void channel_scale(const EVWaveView *view, EVWaveChannelId channel, double *offset, double *range) {
+    *offset = 0;
+    switch (channel) {
+    case EV_WAVE_VOLTAGE:
+        *range = view->voltage_range;
+        break;
+    case EV_WAVE_CURRENT:
+        *range = view->current_range;
+        break;
+    case EV_WAVE_SPEED:
+        *range = 200;
+        break;
+    default:
+        *offset = 10;  // Scale 10°C to 70°C
+        *range = 60;
+        break;
+    }
+}
+
+static void stroke_channel(cairo_t *cr) {
+    uint64_t perf = ev_perf_begin();
+    cairo_stroke(cr);
+    ev_perf_end(EV_PERF_CAIRO_STROKE, perf);
+}
+
+/// One vertex pair per pixel column once the view holds more samples than pixels. Returns the y
+/// the trace ends at, NAN when nothing was drawn
+static double draw_wave_channel(cairo_t *cr, const EVWaveView *view, EVWaveChannelId channel, int width,
+                                int height) {
+    static double col_min[EV_RENDER_MAX_COLUMNS], col_max[EV_RENDER_MAX_COLUMNS];
+    const EVWaveHistory *history = view->history;
+    double offset, range;
+    channel_scale(view, channel, &offset, &range);
+    double span = view->span;
+    double first = ev_wave_view_end(view) - span;
+    double last_y = NAN;
+    if (span <= width) {
+        long a = first < 0 ? 0 : (long)ceil(first);
+        long b = (long)ev_wave_view_end(view);
+        if (b > history->samples) b = history->samples;
+        for (long i = a; i < b; i++) {
+            double x = (i - first) / span * width;
+            double y = height - ((ev_wave_sample(history, channel, i) - offset) / range * height * 0.8);
+            if (isnan(last_y)) cairo_move_to(cr, x, y);
+            else cairo_line_to(cr, x, y);
+            last_y = y;
+        }
+    } else {
+        int columns = width < EV_RENDER_MAX_COLUMNS ? width : EV_RENDER_MAX_COLUMNS;
+        ev_wave_decimate(history, channel, first, span, columns, col_min, col_max);
+        for (int c = 0; c < columns; c++) {
+            if (isnan(col_min[c])) continue;
+            double x = (c + 0.5) * width / columns;
+            double y_min = height - ((col_min[c] - offset) / range * height * 0.8);
+            double y_max = height - ((col_max[c] - offset) / range * height * 0.8);
+            if (isnan(last_y)) cairo_move_to(cr, x, y_min);
+            else cairo_line_to(cr, x, y_min);
+            cairo_line_to(cr, x, y_max);
+            last_y = y_max;
+        }
+    }
+    stroke_channel(cr);
+    return last_y;
+}
+
+static void draw_background(cairo_t *cr, int width, int height) {
+    cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
+    cairo_paint(cr);
+    cairo_set_source_rgb(cr, 0.3, 0.3, 0.3);
+    cairo_set_line_width(cr, 0.5);
+    for (int i = 0; i <= 10; i++) {
+        cairo_move_to(cr, 0, i * height / 10);
+        cairo_line_to(cr, width, i * height / 10);
+        cairo_move_to(cr, i * width / 10, 0);
+        cairo_line_to(cr, i * width / 10, height);
+    }
+    cairo_stroke(cr);
+}
+
+static void draw_legend(cairo_t *cr) {
+    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size(cr, 14);
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) {
+        const ChannelStyle *style = &channel_styles[c];
+        cairo_set_source_rgb(cr, style->red, style->green, style->blue);
+        cairo_move_to(cr, 10, 20 + 20 * c);
+        cairo_show_text(cr, style->label);
+    }
+}
+
+void ev_render_waveforms(cairo_t *cr, const EVWaveView *view, int width, int height) {
+    draw_background(cr, width, height);
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) {
+        const ChannelStyle *style = &channel_styles[c];
+        cairo_set_source_rgb(cr, style->red, style->green, style->blue);
+        cairo_set_line_width(cr, 2.0);
+        draw_wave_channel(cr, view, (EVWaveChannelId)c, width, height);
+    }
+    draw_legend(cr);
+}
+
+void ev_wave_layers_init(EVWaveLayers *layers) {
+    memset(layers, 0, sizeof(*layers));
+}
+
+void ev_wave_layers_free(EVWaveLayers *layers) {
+    if (layers->background) cairo_surface_destroy(layers->background);
+    if (layers->legend) cairo_surface_destroy(layers->legend);
+    for (int t = 0; t < 2; t++) {
+        if (layers->traces[t]) cairo_surface_destroy(layers->traces[t]);
+    }
+    ev_wave_layers_init(layers);
+}
+
+void ev_wave_layers_invalidate(EVWaveLayers *layers) {
+    layers->valid = false;
+}
+
+/// Image surface of width x height units at scale device pixels per unit, cleared
+static cairo_surface_t *layer_surface(int width, int height, int scale) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width * scale, height * scale);
+    cairo_surface_set_device_scale(surface, scale, scale);
+    return surface;
+}
+
+/// Image surfaces rather than ones similar to the target: GTK draws into a recording surface,
+/// where each scroll would record the whole previous frame again
+static bool build_layers(EVWaveLayers *layers, int width, int height, int scale) {
+    ev_wave_layers_free(layers);
+    layers->background = layer_surface(width, height, scale);
+    layers->legend = layer_surface(LEGEND_WIDTH, LEGEND_HEIGHT, scale);
+    for (int t = 0; t < 2; t++) {
+        layers->traces[t] = layer_surface(width, height, scale);
+    }
+    cairo_surface_t *surfaces[] = { layers->background, layers->legend, layers->traces[0], layers->traces[1] };
+    for (int s = 0; s < 4; s++) {
+        if (cairo_surface_status(surfaces[s]) != CAIRO_STATUS_SUCCESS) {
+            ev_wave_layers_free(layers);
+            return false;
+        }
+    }
+    layers->width = width;
+    layers->height = height;
+    layers->scale = scale;
+    cairo_t *cr = cairo_create(layers->background);
+    draw_background(cr, width, height);
+    cairo_destroy(cr);
+    cr = cairo_create(layers->legend);
+    draw_legend(cr);
+    cairo_destroy(cr);
+    return true;
+}
+
+/// Strokes the whole view into the current traces surface
+static void redraw_traces(EVWaveLayers *layers, const EVWaveView *view) {
+    cairo_t *cr = cairo_create(layers->traces[0]);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_set_line_width(cr, 2.0);
+    cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) {
+        const ChannelStyle *style = &channel_styles[c];
+        cairo_set_source_rgb(cr, style->red, style->green, style->blue);
+        layers->last_y[c] = draw_wave_channel(cr, view, (EVWaveChannelId)c, layers->width, layers->height);
+    }
+    cairo_destroy(cr);
+    layers->end = ev_wave_view_end(view);
+    layers->last_sample = (long)ceil(layers->end) - 1;
+    if (layers->last_sample >= view->history->samples) layers->last_sample = view->history->samples - 1;
+    layers->span = view->span;
+    layers->following = view->end < 0;
+    layers->voltage_range = view->voltage_range;
+    layers->current_range = view->current_range;
+    layers->valid = true;
+}
+
+/// Scrolls the traces left by shift whole pixels, moving the right edge as many pixels' worth
+/// of samples on, and strokes only what that brings into view: samples up to the new edge, or
+/// one min/max column per new pixel, each trace continued from where it ended
+static void scroll_traces(EVWaveLayers *layers, const EVWaveView *view, int shift) {
+    static double col_min[EV_RENDER_MAX_COLUMNS], col_max[EV_RENDER_MAX_COLUMNS];
+    int width = layers->width, height = layers->height;
+    double pixels_per_sample = width / view->span;
+    double old_end = layers->end;
+    double end = old_end + shift / pixels_per_sample;
+    cairo_surface_t *scrolled = layers->traces[1];
+    cairo_t *cr = cairo_create(scrolled);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);   /// What the old surface does not cover clears
+    cairo_set_source_surface(cr, layers->traces[0], -shift, 0);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_set_line_width(cr, 2.0);
+    cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+    const EVWaveHistory *history = view->history;
+    long last = (long)ceil(end) - 1;
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) {
+        const ChannelStyle *style = &channel_styles[c];
+        cairo_set_source_rgb(cr, style->red, style->green, style->blue);
+        double offset, range;
+        channel_scale(view, (EVWaveChannelId)c, &offset, &range);
+        if (view->span <= width) {
+            long first = layers->last_sample >= 0 ? layers->last_sample : 0;
+            for (long i = first; i <= last; i++) {
+                double x = width - (end - i) * pixels_per_sample;
+                double y = height - ((ev_wave_sample(history, (EVWaveChannelId)c, i) - offset) / range * height * 0.8);
+                if (i == first) cairo_move_to(cr, x, y);
+                else cairo_line_to(cr, x, y);
+            }
+        } else {
+            ev_wave_decimate(history, (EVWaveChannelId)c, old_end, end - old_end, shift, col_min, col_max);
+            double last_y = layers->last_y[c];
+            if (!isnan(last_y)) cairo_move_to(cr, width - shift - 0.5, last_y);
+            for (int k = 0; k < shift; k++) {
+                if (isnan(col_min[k])) continue;
+                double x = width - shift + k + 0.5;
+                double y_min = height - ((col_min[k] - offset) / range * height * 0.8);
+                double y_max = height - ((col_max[k] - offset) / range * height * 0.8);
+                if (isnan(last_y)) cairo_move_to(cr, x, y_min);
+                else cairo_line_to(cr, x, y_min);
+                cairo_line_to(cr, x, y_max);
+                last_y = y_max;
+            }
+            layers->last_y[c] = last_y;
+        }
+        stroke_channel(cr);
+    }
+    cairo_destroy(cr);
+    layers->traces[1] = layers->traces[0];
+    layers->traces[0] = scrolled;
+    if (last > layers->last_sample) layers->last_sample = last;
+    layers->end = end;
+}
+
+void ev_render_waveforms_retained(cairo_t *cr, EVWaveLayers *layers, const EVWaveView *view, int width,
+                                  int height, int scale) {
+    if (scale < 1) scale = 1;
+    if ((!layers->background || layers->width != width || layers->height != height || layers->scale != scale) &&
+        !build_layers(layers, width, height, scale)) {
+        ev_render_waveforms(cr, view, width, height);
+        return;
+    }
+    const EVWaveHistory *history = view->history;
+    bool same_scale = layers->valid && layers->span == view->span &&
+                      layers->voltage_range == view->voltage_range && layers->current_range == view->current_range;
+    if (!same_scale || !layers->following || view->end >= 0 || history->samples < layers->end ||
+        width > EV_RENDER_MAX_COLUMNS) {
+        /// A still view only changes with its window; a following one redraws after a jump
+        if (!same_scale || layers->following != (view->end < 0) || layers->end != ev_wave_view_end(view)) {
+            redraw_traces(layers, view);
+        }
+    } else {
+        double shift = floor((history->samples - layers->end) * width / view->span);
+        if (shift >= width) redraw_traces(layers, view);
+        else if (shift >= 1) scroll_traces(layers, view, (int)shift);
+    }
+    cairo_set_source_surface(cr, layers->background, 0, 0);
+    cairo_paint(cr);
+    cairo_set_source_surface(cr, layers->traces[0], 0, 0);
+    cairo_paint(cr);
+    cairo_set_source_surface(cr, layers->legend, 0, 0);
+    cairo_paint(cr);
+}
+
+void ev_render_phase_currents(cairo_t *cr, const EVPhaseScope *scope, int width, int height) {
+    static const double colors[3][3] = { { 1.0, 0.4, 0.2 }, { 0.3, 0.8, 1.0 }, { 0.9, 0.3, 0.9 } };
+    cairo_set_source_rgb(cr, 0.05, 0.05, 0.05);
+    cairo_rectangle(cr, 0, 0, width, height);
+    cairo_fill(cr);
+    cairo_set_source_rgb(cr, 0.3, 0.3, 0.3);
+    cairo_set_line_width(cr, 0.5);
+    cairo_move_to(cr, 0, height / 2.0);
+    cairo_line_to(cr, width, height / 2.0);
+    cairo_stroke(cr);
+    double range = 1;
+    for (int p = 0; p < 3; p++) {
+        for (int i = 0; i < scope->count; i++) range = fmax(range, fabs(scope->current[p][i]));
+    }
+    /// At most one vertex per pixel column; the window is a few thousand samples
+    int stride = scope->count > width && width > 0 ? scope->count / width : 1;
+    for (int p = 0; p < 3 && scope->count > 1; p++) {
+        cairo_set_source_rgb(cr, colors[p][0], colors[p][1], colors[p][2]);
+        cairo_set_line_width(cr, 1.5);
+        for (int i = 0; i < scope->count; i += stride) {
+            double x = (double)i / (scope->count - 1) * width;
+            double y = height / 2.0 - scope->current[p][i] / range * height * 0.45;
+            if (i == 0) cairo_move_to(cr, x, y);
+            else cairo_line_to(cr, x, y);
+        }
+        cairo_stroke(cr);
+    }
+    cairo_select_font_face(cr, "Monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size(cr, 12);
+    static const char *const names[3] = { "ia", "ib", "ic" };
+    for (int p = 0; p < 3; p++) {
+        cairo_set_source_rgb(cr, colors[p][0], colors[p][1], colors[p][2]);
+        cairo_move_to(cr, 10 + 30 * p, 16);
+        cairo_show_text(cr, names[p]);
+    }
+    char legend[160];
+    snprintf(legend, sizeof(legend), "±%.0f A over %.1f ms  %.0f Nm  copper %.2f kW  conduction %.2f kW  "
+             "switching %.2f kW", range, scope->count * scope->sample_period * 1e3, scope->torque,
+             scope->copper_loss / 1000, scope->conduction_loss / 1000, scope->switching_loss / 1000);
+    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+    cairo_move_to(cr, 110, 16);
+    cairo_show_text(cr, legend);
+}
+
+/// ns, µs or ms with three significant digits
+static void format_duration(char *buf, size_t size, double ns) {
+    if (ns < 1000) snprintf(buf, size, "%.0f ns", ns);
+    else if (ns < 1e6) snprintf(buf, size, "%.3g us", ns / 1e3);
+    else snprintf(buf, size, "%.3g ms", ns / 1e6);
+}
+
+void ev_render_perf_overlay(cairo_t *cr, int width, int height) {
+    const double line = 16, box_width = 330;
+    double box_height = line * (EV_PERF_STAGES + 1) + 8;
+    double left = width - box_width - 10;
+    cairo_set_source_rgba(cr, 0, 0, 0, 0.7);
+    cairo_rectangle(cr, left, 10, box_width, box_height < height - 20 ? box_height : height - 20);
+    cairo_fill(cr);
+    cairo_select_font_face(cr, "Monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size(cr, 12);
+    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+    char row[96];
+    snprintf(row, sizeof(row), "%-15s %10s %10s %8s", "stage", "p50", "p99", "count");
+    cairo_move_to(cr, left + 6, 10 + line);
+    cairo_show_text(cr, row);
+    for (int s = 0; s < EV_PERF_STAGES; s++) {
+        EVPerfStats stats;
+        ev_perf_stats((EVPerfStage)s, &stats);
+        char p50[24] = "-", p99[24] = "-";
+        if (stats.count > 0) {
+            format_duration(p50, sizeof(p50), stats.p50);
+            format_duration(p99, sizeof(p99), stats.p99);
+        }
+        snprintf(row, sizeof(row), "%-15s %10s %10s %8llu", ev_perf_stage_name((EVPerfStage)s), p50, p99,
+                 (unsigned long long)stats.count);
+        cairo_move_to(cr, left + 6, 10 + line * (s + 2));
+        cairo_show_text(cr, row);
+    }
+}
+
+void ev_status_text_format(EVStatusText *text, const EVSimulation *sim) {
+    snprintf(text->speed, sizeof(text->speed), "%.1f km/h", sim->vehicle_speed);
+    snprintf(text->soc, sizeof(text->soc), "%.1f %%", sim->soc);
+    snprintf(text->distance, sizeof(text->distance), "%.2f km", sim->distance);
+    snprintf(text->energy, sizeof(text->energy), "%.2f kWh", sim->energy_consumed);
+    snprintf(text->torque, sizeof(text->torque), "%.1f Nm", sim->motor_torque);
+    snprintf(text->rpm, sizeof(text->rpm), "%.0f RPM", sim->motor_rpm);
+    snprintf(text->temp, sizeof(text->temp), "%.1f °C", sim->battery_temp);
+    snprintf(text->efficiency, sizeof(text->efficiency), "%.0f Wh/km", sim->energy_efficiency);
+}
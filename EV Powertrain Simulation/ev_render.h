@@ -0,0 +1,80 @@
+#ifndef EV_RENDER_H
+#define EV_RENDER_H
+
+#include <cairo.h>
+#include "ev_sim.h"
+#include "ev_waveform.h"
+
+#define EV_RENDER_MAX_COLUMNS 4096     // pixel columns decimated per channel
+
+/// What the waveform view shows; drawing needs cairo only, so the same code renders into
+/// the GTK drawing area and into offscreen image surfaces
+typedef struct {
+    const EVWaveHistory *history;
+    double span;               // samples across the view
+    double end;                // sample at the right edge, < 0 follows the newest
+    double voltage_range;      // V at 80 % of the height
+    double current_range;      // A at 80 % of the height
+} EVWaveView;
+
+/// Offscreen layers the dashboard composites each frame. The background grid and the legend are
+/// drawn once per size; the traces are scrolled by whole pixels while the view follows the
+/// newest sample, so a frame strokes only the samples that arrived since the last one
+typedef struct {
+    cairo_surface_t *background;   // fill and grid
+    cairo_surface_t *legend;       // transparent, top left
+    cairo_surface_t *traces[2];    // transparent; [0] is current, [1] the scroll target
+    int width;
+    int height;
+    int scale;                 // device pixels per unit
+    bool valid;                // traces match the fields below
+    bool following;
+    double span;               // samples
+    double end;                // sample at the right edge
+    double voltage_range;      // V
+    double current_range;      // A
+    long last_sample;          // newest sample stroked, -1 for none
+    double last_y[EV_WAVE_CHANNELS];   // where each decimated trace ends, NAN for nowhere
+} EVWaveLayers;
+
+/// Status label texts, formatted without touching any widget
+typedef struct {
+    char speed[32];
+    char soc[32];
+    char distance[32];
+    char energy[32];
+    char torque[32];
+    char rpm[32];
+    char temp[32];
+    char efficiency[32];
+} EVStatusText;
+
+/// Voltage scaled to the full-charge voltage, so pack sag shows against a fixed axis;
+/// current to the drive mode's peak draw
+void ev_wave_view_fit(EVWaveView *view, const EVSimulation *sim);
+double ev_wave_view_end(const EVWaveView *view);
+
+/// Background grid, the four channels and their legend
+void ev_render_waveforms(cairo_t *cr, const EVWaveView *view, int width, int height);
+
+void ev_wave_layers_init(EVWaveLayers *layers);
+void ev_wave_layers_free(EVWaveLayers *layers);
+/// Forces the next frame to redraw the traces, for when the history is replaced
+void ev_wave_layers_invalidate(EVWaveLayers *layers);
+
+/// Same picture as ev_render_waveforms() from the layers, image surfaces at scale device pixels
+/// per unit (the widget's scale factor), rebuilt when the size or the scale changes. Falls back
+/// to drawing directly when surfaces cannot be created
+void ev_render_waveforms_retained(cairo_t *cr, EVWaveLayers *layers, const EVWaveView *view, int width,
+                                  int height, int scale);
+
+/// The inverter's three phase currents over the scope window, scaled to the largest, with the
+/// loss averages in the legend
+void ev_render_phase_currents(cairo_t *cr, const EVPhaseScope *scope, int width, int height);
+
+void ev_status_text_format(EVStatusText *text, const EVSimulation *sim);
+
+/// p50/p99 per profiled stage in a translucent box at the top right
+void ev_render_perf_overlay(cairo_t *cr, int width, int height);
+
+#endif
@@ -0,0 +1,214 @@
+#include "ev_route.h"
+#include "ev_sim.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SEA_LEVEL_PRESSURE 101325.0    // Pa
+#define AIR_GAS_CONSTANT 287.05        // J/(kg·K), dry air
+#define GENERATED_STEP 0.1             // km between knots of the generated routes
+
+const EVRouteInfo ev_route_builtins[] = {
+    { "flat",     "level road, only the environment defaults apply" },
+    { "rolling",  "50 km of rolling hills, 25 m swells every 3 km (about 5 % grades)" },
+    { "pass",     "60 km over a 900 m mountain pass, 4.5 % up and down" },
+    { "delivery", "40 km hilly delivery loop, 800 kg dropped off in ten stops" }
+};
+
+const int ev_route_builtin_count = sizeof(ev_route_builtins) / sizeof(ev_route_builtins[0]);
+
+void ev_route_params_default(EVRouteParams *params) {
+    params->headwind = 0;
+    params->temperature = 15;
+    params->payload = 0;
+    params->trailer_mass = 0;
+    params->trailer_drag_area = 0;
+    params->resolution = EV_ROUTE_RESOLUTION;
+}
+
+double ev_air_density(double elevation, double temperature) {
+    double pressure = SEA_LEVEL_PRESSURE * pow(1 - 2.25577e-5 * elevation, 5.25588);
+    return pressure / (AIR_GAS_CONSTANT * (temperature + 273.15));
+}
+
+static double knot_value(double value, double fallback) {
+    return isnan(value) ? fallback : value;
+}
+
+/// Linear between knots k and k + 1 at d (km), clamped to the ends
+static double interpolate(const EVRouteKnot *knots, int count, int k, double d, size_t field, double fallback) {
+    const double *a = (const double *)((const char *)&knots[k] + field);
+    if (k + 1 >= count || d <= knots[k].distance) return knot_value(*a, fallback);
+    const double *b = (const double *)((const char *)&knots[k + 1] + field);
+    double span = knots[k + 1].distance - knots[k].distance;
+    double w = span > 0 ? (d - knots[k].distance) / span : 1;
+    if (w > 1) w = 1;
+    return knot_value(*a, fallback) + (knot_value(*b, fallback) - knot_value(*a, fallback)) * w;
+}
+
+/// Last knot at or before d, searching forward from k
+static int knot_before(const EVRouteKnot *knots, int count, int k, double d) {
+    while (k + 1 < count && knots[k + 1].distance <= d) k++;
+    return k;
+}
+
+EVRoute *ev_route_build(const char *name, const EVRouteKnot *knots, int count, const EVRouteParams *params) {
+    if (count < 1 || params->resolution <= 0) return NULL;
+    for (int k = 0; k < count; k++) {
+        if (isnan(knots[k].distance) || isnan(knots[k].elevation) || knots[k].distance < 0) return NULL;
+        if (k > 0 && knots[k].distance < knots[k - 1].distance) return NULL;
+    }
+    double step = params->resolution / 1000;       // km
+    double length = knots[count - 1].distance;
+    long entries = (long)(length / step) + 1;
+    EVRoute *route = calloc(1, sizeof(EVRoute));
+    if (!route) return NULL;
+    route->samples = malloc(sizeof(EVRouteSample) * entries);
+    if (!route->samples) {
+        free(route);
+        return NULL;
+    }
+    snprintf(route->name, sizeof(route->name), "%s", name);
+    route->length = length;
+    route->per_km = 1 / step;
+    route->count = entries;
+    double base_drag_area = EV_DRAG_COEFF * EV_FRONTAL_AREA + params->trailer_drag_area;
+    int k = 0;
+    for (long i = 0; i < entries; i++) {
+        double d0 = i * step, d1 = d0 + step, mid = d0 + step / 2;
+        k = knot_before(knots, count, k, d0);
+        double e0 = interpolate(knots, count, k, d0, offsetof(EVRouteKnot, elevation), 0);
+        int k1 = knot_before(knots, count, k, d1);
+        double e1 = interpolate(knots, count, k1, d1, offsetof(EVRouteKnot, elevation), 0);
+        int km = knot_before(knots, count, k, mid);
+        double elevation = (e0 + e1) / 2;
+        double temperature = interpolate(knots, count, km, mid, offsetof(EVRouteKnot, temperature), params->temperature);
+        double headwind = interpolate(knots, count, km, mid, offsetof(EVRouteKnot, headwind), params->headwind);
+        /// Cargo changes at the stops, not gradually between them
+        double payload = knot_value(knots[km].payload, params->payload);
+        double mass = EV_VEHICLE_MASS + payload + params->trailer_mass;
+        double grade = (e1 - e0) / params->resolution;
+        double cos_theta = 1 / sqrt(1 + grade * grade);
+        EVRouteSample *sample = &route->samples[i];
+        sample->drag_k = (float)(0.5 * ev_air_density(elevation, temperature) * base_drag_area / mass);
+        sample->resistance = (float)(EV_GRAVITY * (grade * cos_theta + EV_ROLLING_RESISTANCE * cos_theta));
+        sample->headwind = (float)headwind;
+        sample->load = (float)(mass / EV_VEHICLE_MASS);
+        if (e1 > e0) route->climb += e1 - e0;
+    }
+    return route;
+}
+
+/// Knots every GENERATED_STEP km over length km; elevation(d) and payload(d) describe the road
+static EVRoute *generate(const char *name, double length, double (*elevation)(double), double (*payload)(double),
+                         const EVRouteParams *params) {
+    int count = (int)(length / GENERATED_STEP + 0.5) + 1;
+    EVRouteKnot *knots = malloc(sizeof(EVRouteKnot) * count);
+    if (!knots) return NULL;
+    for (int k = 0; k < count; k++) {
+        double d = k * GENERATED_STEP;
+        knots[k] = (EVRouteKnot){ .distance = d, .elevation = elevation(d), .headwind = NAN,
+                                  .temperature = NAN, .payload = payload ? payload(d) : NAN };
+    }
+    EVRoute *route = ev_route_build(name, knots, count, params);
+    free(knots);
+    return route;
+}
+
+static double rolling_elevation(double d) {
+    return 100 + 25 * sin(2 * M_PI * d / 3);
+}
+
+/// 10 km of valley, 20 km up, 10 km over the top, 20 km down
+static double pass_elevation(double d) {
+    if (d < 10) return 300;
+    if (d < 30) return 300 + (d - 10) * 45;
+    if (d < 40) return 1200;
+    if (d < 60) return 1200 - (d - 40) * 45;
+    return 300;
+}
+
+static double delivery_elevation(double d) {
+    return 150 + 30 * sin(2 * M_PI * d / 8) + 6 * sin(2 * M_PI * d / 1.5);
+}
+
+static double delivery_payload(double d) {
+    int stops = (int)(d / 4);
+    return stops >= 10 ? 0 : 800 - 80 * stops;
+}
+
+static EVRoute *open_builtin(const char *name, const EVRouteParams *params) {
+    if (strcmp(name, "flat") == 0) {
+        EVRouteKnot knot = { .distance = 0, .elevation = 0, .headwind = NAN, .temperature = NAN, .payload = NAN };
+        return ev_route_build(name, &knot, 1, params);
+    }
+    if (strcmp(name, "rolling") == 0) return generate(name, 50, rolling_elevation, NULL, params);
+    if (strcmp(name, "pass") == 0) return generate(name, 60, pass_elevation, NULL, params);
+    if (strcmp(name, "delivery") == 0) return generate(name, 40, delivery_elevation, delivery_payload, params);
+    return NULL;
+}
+
+/// Next field of a CSV line; an empty or unparsable field is NAN. False at the end of the line
+static bool parse_field(const char **line, double *value) {
+    const char *p = *line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0' || *p == '\n' || *p == '\r') return false;
+    char *end;
+    *value = strtod(p, &end);
+    if (end == p) *value = NAN;
+    p = end;
+    while (*p && *p != ',' && *p != ';' && *p != '\t' && *p != '\n') p++;
+    if (*p == ',' || *p == ';' || *p == '\t') p++;
+    *line = p;
+    return true;
+}
+
+EVRoute *ev_route_load(const char *path, const EVRouteParams *params) {
+    FILE *file = fopen(path, "r");
+    if (!file) return NULL;
+    EVRouteKnot *knots = NULL;
+    int count = 0, capacity = 0;
+    bool ok = true;
+    char line[512];
+    while (ok && fgets(line, sizeof(line), file)) {
+        double fields[5] = { NAN, NAN, NAN, NAN, NAN };
+        const char *p = line;
+        for (int f = 0; f < 5 && parse_field(&p, &fields[f]); f++) {}
+        if (isnan(fields[0]) || isnan(fields[1])) continue;   /// header, comment or blank
+        if (count == capacity) {
+            int grown = capacity ? capacity * 2 : 256;
+            EVRouteKnot *more = grown <= EV_ROUTE_MAX_KNOTS ? realloc(knots, sizeof(EVRouteKnot) * grown) : NULL;
+            if (!more) {
+                ok = false;
+                break;
+            }
+            knots = more;
+            capacity = grown;
+        }
+        knots[count++] = (EVRouteKnot){ fields[0], fields[1], fields[2], fields[3], fields[4] };
+    }
+    fclose(file);
+    const char *base = strrchr(path, '/');
+    EVRoute *route = ok ? ev_route_build(base ? base + 1 : path, knots, count, params) : NULL;
+    free(knots);
+    return route;
+}
+
+EVRoute *ev_route_open(const char *spec, const EVRouteParams *params) {
+    for (int i = 0; i < ev_route_builtin_count; i++) {
+        if (strcmp(spec, ev_route_builtins[i].name) == 0) return open_builtin(spec, params);
+    }
+    return ev_route_load(spec, params);
+}
+
+void ev_route_free(EVRoute *route) {
+    if (!route) return;
+    free(route->samples);
+    free(route);
+}
@@ -0,0 +1,79 @@
+#ifndef EV_ROUTE_H
+#define EV_ROUTE_H
+
+#include <stdbool.h>
+
+#define EV_ROUTE_RESOLUTION 10.0       // m per table entry by default
+#define EV_ROUTE_MAX_KNOTS 1000000
+
+/// One knot of a route profile, linearly interpolated between knots. NAN columns take the
+/// environment defaults
+typedef struct {
+    double distance;           // km
+    double elevation;          // m
+    double headwind;           // m/s, along the road, negative is a tailwind
+    double temperature;        // °C, air
+    double payload;            // kg, cargo on board from here on
+} EVRouteKnot;
+
+/// Everything along the road that is not in the knots
+typedef struct {
+    double headwind;           // m/s
+    double temperature;        // °C
+    double payload;            // kg
+    double trailer_mass;       // kg
+    double trailer_drag_area;  // m², Cd·A the trailer adds
+    double resolution;         // m per table entry
+} EVRouteParams;
+
+/// Per-entry forces, already reduced to what the step needs. 16 bytes, four to a cache line
+typedef struct {
+    float drag_k;              // 1/m, 0.5·ρ·Cd·A / mass
+    float resistance;          // m/s², g·(sin θ + Crr·cos θ)
+    float headwind;            // m/s
+    float load;                // mass / EV_VEHICLE_MASS, scales the traction power
+} EVRouteSample;
+
+/// Precomputed at fixed distance steps; immutable once built, so one route is shared
+/// read-only by every thread and every EVSimulation that points at it. Past the last knot the
+/// road stays level under the last knot's conditions
+typedef struct {
+    char name[64];
+    double length;             // km
+    double per_km;             // entries per km
+    double climb;              // m, sum of the rises
+    long count;
+    EVRouteSample *samples;
+} EVRoute;
+
+typedef struct {
+    const char *name;
+    const char *description;
+} EVRouteInfo;
+
+extern const EVRouteInfo ev_route_builtins[];
+extern const int ev_route_builtin_count;
+
+void ev_route_params_default(EVRouteParams *params);
+
+/// Knots must be sorted by distance; NULL on bad input
+EVRoute *ev_route_build(const char *name, const EVRouteKnot *knots, int count, const EVRouteParams *params);
+/// "distance_km,elevation_m[,headwind_ms[,temp_c[,payload_kg]]]" per line, other lines are
+/// skipped; empty columns take the defaults
+EVRoute *ev_route_load(const char *path, const EVRouteParams *params);
+/// A built-in name ("flat", "rolling", "pass", "delivery"), anything else is loaded from a file
+EVRoute *ev_route_open(const char *spec, const EVRouteParams *params);
+void ev_route_free(EVRoute *route);
+
+/// Dry air, barometric pressure at elevation (m) and temperature (°C); 1.225 at sea level
+/// and 15 °C
+double ev_air_density(double elevation, double temperature);
+
+/// O(1): a multiply, a clamp and one load
+static inline const EVRouteSample *ev_route_at(const EVRoute *route, double distance) {
+    double x = distance * route->per_km;
+    long i = x > 0 ? (long)x : 0;
+    return &route->samples[i < route->count ? i : route->count - 1];
+}
+
+#endif
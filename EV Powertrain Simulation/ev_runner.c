@@ -0,0 +1,251 @@
+#include "ev_runner.h"
+#include "ev_perf.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_CATCH_UP_STEPS 100     // after a longer stall the schedule restarts from now
+
+struct EVRunner {
+    double dt;                 // s
+    long sample_every;         // steps between ring samples
+    pthread_t thread;
+    bool started;
+    atomic_bool running;
+    atomic_bool reset_requested;
+    _Atomic uint64_t accel_bits;
+    EVCycle *cycle;
+    EVTelemetryWriter *record;
+    EVIntegrator integrator;
+    double record_time;        // s, keeps counting across runs so recordings stay monotonic
+    EVRunnerState state;       // producer-owned working copy
+    /// Seqlock: odd while the producer is writing
+    _Alignas(64) atomic_uint seq;
+    EVRunnerState published;
+    /// SPSC ring: head written only by the producer, tail only by the consumer
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_long dropped;
+    EVRunnerState ring[EV_RUNNER_RING_SIZE];
+};
+
+static uint64_t double_bits(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+EVRunner *ev_runner_new(double rate_hz, double sample_period) {
+    if (rate_hz <= 0) return NULL;
+    EVRunner *runner = calloc(1, sizeof(EVRunner));
+    if (!runner) return NULL;
+    runner->dt = 1.0 / rate_hz;
+    runner->sample_every = (long)(sample_period * rate_hz + 0.5);
+    if (runner->sample_every < 1) runner->sample_every = 1;
+    atomic_init(&runner->running, false);
+    atomic_init(&runner->reset_requested, false);
+    atomic_init(&runner->accel_bits, double_bits(0));
+    atomic_init(&runner->seq, 0);
+    atomic_init(&runner->head, 0);
+    atomic_init(&runner->tail, 0);
+    atomic_init(&runner->dropped, 0);
+    ev_integrator_init(&runner->integrator, EV_SOLVER_EULER);
+    return runner;
+}
+
+void ev_runner_free(EVRunner *runner) {
+    if (!runner) return;
+    if (runner->started) ev_runner_stop(runner, NULL);
+    free(runner);
+}
+
+double ev_runner_dt(const EVRunner *runner) {
+    return runner->dt;
+}
+
+static void publish(EVRunner *runner) {
+    unsigned seq = atomic_load_explicit(&runner->seq, memory_order_relaxed);
+    atomic_store_explicit(&runner->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    runner->published = runner->state;
+    atomic_store_explicit(&runner->seq, seq + 2, memory_order_release);
+}
+
+static void push_sample(EVRunner *runner) {
+    size_t head = atomic_load_explicit(&runner->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&runner->tail, memory_order_acquire);
+    if (head - tail == EV_RUNNER_RING_SIZE) {
+        /// The UI fell behind; the waveform loses a sample, the physics keeps its rate
+        atomic_fetch_add_explicit(&runner->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    runner->ring[head & (EV_RUNNER_RING_SIZE - 1)] = runner->state;
+    atomic_store_explicit(&runner->head, head + 1, memory_order_release);
+}
+
+static void reset_state(EVRunner *runner) {
+    EVRunnerState *state = &runner->state;
+    ev_sim_reset(&state->sim);
+    state->time = 0;
+    state->steps = 0;
+    state->accel_request = 0;
+    state->finished = false;
+    /// Like a fresh start, the restarted run must not inherit the last step size or counters
+    ev_integrator_init(&runner->integrator, runner->integrator.solver);
+    if (runner->cycle) ev_cycle_rewind(runner->cycle);
+}
+
+static void step_once(EVRunner *runner) {
+    EVRunnerState *state = &runner->state;
+    if (atomic_exchange_explicit(&runner->reset_requested, false, memory_order_acquire)) {
+        reset_state(runner);
+    }
+    if (state->finished) return;
+    EVInput input = {
+        .acceleration = bits_double(atomic_load_explicit(&runner->accel_bits, memory_order_relaxed))
+    };
+    if (runner->cycle && !ev_cycle_driver_input(runner->cycle, &state->sim, state->time, &input)) {
+        state->finished = true;
+        publish(runner);
+        push_sample(runner);
+        return;
+    }
+    uint64_t perf = ev_perf_begin();
+    for (double left = runner->dt; left > 1e-12;) {
+        left -= ev_integrator_advance(&runner->integrator, &state->sim, &input, left);
+    }
+    ev_perf_end(EV_PERF_PHYSICS_STEP, perf);
+    state->steps++;
+    state->time = state->steps * runner->dt;
+    state->accel_request = input.acceleration;
+    runner->record_time += runner->dt;
+    if (runner->record) ev_telemetry_append(runner->record, runner->record_time, &state->sim);
+    publish(runner);
+    if (state->steps % runner->sample_every == 0) push_sample(runner);
+}
+
+static void add_seconds(struct timespec *ts, double seconds) {
+    long ns = ts->tv_nsec + (long)(seconds * 1e9);
+    ts->tv_sec += ns / 1000000000L;
+    ts->tv_nsec = ns % 1000000000L;
+}
+
+static bool before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/// Absolute deadlines, so sleep overshoot does not accumulate into the step schedule
+static void *runner_thread(void *arg) {
+    EVRunner *runner = arg;
+    struct timespec next, now;
+    ev_perf_name_thread("simulation");
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (atomic_load_explicit(&runner->running, memory_order_acquire)) {
+        step_once(runner);
+        add_seconds(&next, runner->dt);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec limit = next;
+        add_seconds(&limit, runner->dt * MAX_CATCH_UP_STEPS);
+        if (before(&limit, &now)) next = now;
+        if (before(&now, &next)) clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+bool ev_runner_start(EVRunner *runner, const EVSimulation *sim, EVCycle *cycle, EVTelemetryWriter *record) {
+    if (runner->started) return false;
+    /// A fresh run starts from the solver's initial step size and zeroed counters
+    ev_integrator_init(&runner->integrator, runner->integrator.solver);
+    return ev_runner_resume(runner, sim, 0, 0, NULL, cycle, record);
+}
+
+bool ev_runner_resume(EVRunner *runner, const EVSimulation *sim, double time, long steps,
+                      const EVIntegrator *integrator, EVCycle *cycle, EVTelemetryWriter *record) {
+    if (runner->started) return false;
+    runner->cycle = cycle;
+    runner->record = record;
+    memset(&runner->state, 0, sizeof(runner->state));
+    runner->state.sim = *sim;
+    runner->state.sim.is_running = true;
+    runner->state.time = time;
+    runner->state.steps = steps;
+    if (integrator) runner->integrator = *integrator;
+    atomic_store(&runner->reset_requested, false);
+    atomic_store(&runner->head, 0);
+    atomic_store(&runner->tail, 0);
+    atomic_store(&runner->dropped, 0);
+    publish(runner);
+    atomic_store(&runner->running, true);
+    if (pthread_create(&runner->thread, NULL, runner_thread, runner) != 0) {
+        atomic_store(&runner->running, false);
+        return false;
+    }
+    runner->started = true;
+    return true;
+}
+
+void ev_runner_stop(EVRunner *runner, EVRunnerState *state) {
+    if (runner->started) {
+        atomic_store(&runner->running, false);
+        pthread_join(runner->thread, NULL);
+        runner->started = false;
+    }
+    runner->state.sim.is_running = false;
+    publish(runner);
+    if (state) *state = runner->state;
+}
+
+bool ev_runner_is_running(const EVRunner *runner) {
+    return runner->started;
+}
+
+void ev_runner_set_solver(EVRunner *runner, EVSolver solver) {
+    if (!runner->started) ev_integrator_init(&runner->integrator, solver);
+}
+
+const EVIntegrator *ev_runner_integrator(const EVRunner *runner) {
+    return &runner->integrator;
+}
+
+void ev_runner_set_accel(EVRunner *runner, double acceleration) {
+    atomic_store_explicit(&runner->accel_bits, double_bits(acceleration), memory_order_relaxed);
+}
+
+void ev_runner_request_reset(EVRunner *runner) {
+    atomic_store_explicit(&runner->reset_requested, true, memory_order_release);
+}
+
+void ev_runner_snapshot(EVRunner *runner, EVRunnerState *state) {
+    for (;;) {
+        unsigned begin = atomic_load_explicit(&runner->seq, memory_order_acquire);
+        if (begin & 1) continue;
+        *state = runner->published;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&runner->seq, memory_order_relaxed) == begin) return;
+    }
+}
+
+int ev_runner_drain(EVRunner *runner, EVRunnerState *states, int max) {
+    size_t tail = atomic_load_explicit(&runner->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&runner->head, memory_order_acquire);
+    int n = 0;
+    while (tail != head && n < max) {
+        states[n++] = runner->ring[tail & (EV_RUNNER_RING_SIZE - 1)];
+        tail++;
+    }
+    atomic_store_explicit(&runner->tail, tail, memory_order_release);
+    return n;
+}
+
+long ev_runner_dropped(const EVRunner *runner) {
+    return atomic_load_explicit(&runner->dropped, memory_order_relaxed);
+}
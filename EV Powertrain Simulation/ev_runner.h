@@ -0,0 +1,57 @@
+#ifndef EV_RUNNER_H
+#define EV_RUNNER_H
+
+#include <stdbool.h>
+#include "ev_sim.h"
+#include "ev_cycle.h"
+#include "ev_telemetry.h"
+#include "ev_integrator.h"
+
+#define EV_RUNNER_DEFAULT_RATE 1000.0  // Hz
+#define EV_RUNNER_RING_SIZE 1024       // sampled states, power of two
+
+/// What the simulation thread publishes after a step
+typedef struct {
+    EVSimulation sim;
+    double time;               // s since start or reset
+    long steps;
+    double accel_request;      // m/s², driver input used for the last step
+    bool finished;             // drive cycle ended, the thread is idling
+} EVRunnerState;
+
+/// Steps one EVSimulation at a fixed rate on its own thread. The latest state is published
+/// through a seqlock; every sample_period of simulated time a copy also goes into an SPSC ring
+typedef struct EVRunner EVRunner;
+
+EVRunner *ev_runner_new(double rate_hz, double sample_period);
+void ev_runner_free(EVRunner *runner);
+double ev_runner_dt(const EVRunner *runner);
+
+/// Starts stepping from *sim with the solver state reset; cycle and record stay owned by the
+/// caller and are only touched by the thread until ev_runner_stop() returns
+bool ev_runner_start(EVRunner *runner, const EVSimulation *sim, EVCycle *cycle, EVTelemetryWriter *record);
+/// Like ev_runner_start(), carrying on a run at time and steps (a restored snapshot); the
+/// cycle should be rewound. integrator, when not NULL, replaces the solver state
+bool ev_runner_resume(EVRunner *runner, const EVSimulation *sim, double time, long steps,
+                      const EVIntegrator *integrator, EVCycle *cycle, EVTelemetryWriter *record);
+/// Joins the thread and returns the final state
+void ev_runner_stop(EVRunner *runner, EVRunnerState *state);
+bool ev_runner_is_running(const EVRunner *runner);
+
+/// Solver for subsequent runs (default euler); RK45 may split a step into several
+void ev_runner_set_solver(EVRunner *runner, EVSolver solver);
+/// Solver state as of the last step; only meaningful while the thread is stopped
+const EVIntegrator *ev_runner_integrator(const EVRunner *runner);
+
+/// Manual acceleration request (ignored while a drive cycle drives)
+void ev_runner_set_accel(EVRunner *runner, double acceleration);
+/// Resets the state and rewinds the cycle at the next step boundary
+void ev_runner_request_reset(EVRunner *runner);
+
+/// Consistent copy of the latest published state; never blocks the producer
+void ev_runner_snapshot(EVRunner *runner, EVRunnerState *state);
+/// Pops up to max sampled states, oldest first
+int ev_runner_drain(EVRunner *runner, EVRunnerState *states, int max);
+long ev_runner_dropped(const EVRunner *runner);
+
+#endif
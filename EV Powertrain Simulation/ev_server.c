@@ -0,0 +1,718 @@
+#include "ev_server.h"
+#include "ev_cycle.h"
+#include "ev_fleet.h"
+#include "ev_integrator.h"
+#include "ev_sweep.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(EVServerBatchHeader) == 16, "EVServerBatchHeader is part of the wire format");
+_Static_assert(sizeof(EVServerJob) == 80, "EVServerJob is part of the wire format");
+_Static_assert(sizeof(EVServerResult) == 80, "EVServerResult is part of the wire format");
+_Static_assert(sizeof(EVCyclePoint) == 16, "EVCyclePoint is part of the wire format");
+
+#define MAX_CLIENTS 1024
+#define READ_CHUNK 65536               // bytes per client per wakeup, keeps clients fair
+#define MAX_PACK_CELLS 4096
+
+typedef struct Client Client;
+
+typedef struct {
+    Client *client;
+    uint32_t id;
+    uint32_t count;
+    uint32_t remaining;        // jobs not answered yet
+} Batch;
+
+typedef struct Job {
+    struct Job *prev;
+    struct Job *next;
+    EVServerJob spec;
+    EVCyclePoint *points;      // spec.cycle_points knots, NULL for a built-in cycle
+    Batch *batch;
+} Job;
+
+/// Input is only touched by the I/O thread; everything else, the flags included, is guarded
+/// by the server lock
+struct Client {
+    int fd;
+    int refs;                  // the I/O thread's, plus one per queued or running job
+    bool closed;               // socket gone, results are dropped
+    bool eof;                  // the client is done sending; closed once all is answered
+    bool failed;               // protocol error; closed once the error frame is out
+    bool error_sent;           // the error frame is queued, nothing more is parsed
+    uint8_t *in;
+    size_t in_length;
+    size_t in_capacity;
+    uint8_t *out;
+    size_t out_length;
+    size_t out_sent;
+    size_t out_capacity;
+    long inflight;             // jobs queued or running
+};
+
+typedef struct {
+    const EVServerOptions *options;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    Job *head;
+    Job *tail;
+    long queued;
+    bool stop;
+    int wake[2];               // pipe, finished jobs wake the I/O thread
+    long jobs;
+    long batches;
+    long coalesced;            // jobs that ran in a fleet batch
+    long fleet_runs;
+} Server;
+
+static volatile sig_atomic_t stop_requested = 0;
+static int signal_wake = -1;
+
+static void handle_signal(int signo) {
+    (void)signo;
+    stop_requested = 1;
+    if (signal_wake >= 0) {
+        ssize_t ignored = write(signal_wake, "s", 1);
+        (void)ignored;
+    }
+}
+
+void ev_server_options_init(EVServerOptions *options) {
+    options->socket_path = NULL;
+    options->port = 7878;
+    options->threads = 0;
+    options->max_inflight = 4096;
+    options->queue_limit = 65536;
+    options->fleet_batch = 1024;
+    options->output_limit = 4 << 20;
+}
+
+static void wake_io(Server *server) {
+    ssize_t ignored = write(server->wake[1], "w", 1);   // a full pipe is already awake
+    (void)ignored;
+}
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/// Output, under the lock
+static bool append_out(Client *client, const void *data, size_t size) {
+    if (client->out_sent > 0 && client->out_sent == client->out_length) {
+        client->out_sent = client->out_length = 0;
+    }
+    if (client->out_length + size > client->out_capacity) {
+        if (client->out_sent > 0) {
+            memmove(client->out, client->out + client->out_sent, client->out_length - client->out_sent);
+            client->out_length -= client->out_sent;
+            client->out_sent = 0;
+        }
+        size_t capacity = client->out_capacity ? client->out_capacity : 4096;
+        while (client->out_length + size > capacity) capacity *= 2;
+        if (capacity != client->out_capacity) {
+            uint8_t *grown = realloc(client->out, capacity);
+            if (!grown) return false;
+            client->out = grown;
+            client->out_capacity = capacity;
+        }
+    }
+    memcpy(client->out + client->out_length, data, size);
+    client->out_length += size;
+    return true;
+}
+
+static void append_frame(Client *client, EVServerMessage message, uint32_t batch_id, uint32_t count,
+                         const void *body, size_t body_size) {
+    if (client->closed) return;
+    EVServerBatchHeader header = { message, EV_SERVER_VERSION, batch_id, count };
+    uint32_t length = (uint32_t)(sizeof(header) + body_size);
+    /// Out of memory loses the connection rather than one answer the client would wait for
+    if (!append_out(client, &length, sizeof(length)) || !append_out(client, &header, sizeof(header)) ||
+        (body_size && !append_out(client, body, body_size))) {
+        client->failed = true;
+    }
+}
+
+static void release_client(Client *client) {
+    if (--client->refs > 0) return;
+    free(client->in);
+    free(client->out);
+    free(client);
+}
+
+/// Sends one job's result (none when result is NULL) and the batch's end after its last.
+/// Under the lock
+static void answer(Server *server, Batch *batch, const EVServerResult *result) {
+    Client *client = batch->client;
+    if (result) {
+        append_frame(client, EV_MSG_RESULT, batch->id, 1, result, sizeof(*result));
+        server->jobs++;
+    }
+    client->inflight--;
+    if (--batch->remaining == 0) {
+        append_frame(client, EV_MSG_BATCH_DONE, batch->id, batch->count, NULL, 0);
+        free(batch);
+    }
+    release_client(client);
+}
+
+static void finish_job(Server *server, Job *job, const EVServerResult *result) {
+    answer(server, job->batch, result);
+    free(job->points);
+    free(job);
+}
+
+static void unlink_job(Server *server, Job *job) {
+    if (job->prev) job->prev->next = job->next;
+    else server->head = job->next;
+    if (job->next) job->next->prev = job->prev;
+    else server->tail = job->prev;
+    job->prev = job->next = NULL;
+    server->queued--;
+}
+
+static void invalid_result(const EVServerJob *spec, EVServerJobStatus status, EVServerResult *result) {
+    memset(result, 0, sizeof(*result));
+    result->job_id = spec->job_id;
+    result->status = status;
+}
+
+static bool job_valid(const EVServerJob *spec) {
+    if (spec->drive_mode >= DRIVE_MODE_COUNT || spec->solver >= EV_SOLVER_COUNT) return false;
+    if (!(spec->voltage >= 100 && spec->voltage <= 1000)) return false;
+    if (!(spec->capacity >= 10 && spec->capacity <= 200)) return false;
+    if (!(spec->motor_power >= 50 && spec->motor_power <= 500)) return false;
+    if (!(spec->regen_efficiency >= 0 && spec->regen_efficiency <= 1)) return false;
+    if (!(spec->dt >= 1e-6 && spec->dt <= 10)) return false;
+    if (!(spec->duration >= 0 && spec->duration <= 1e9)) return false;
+    if (memchr(spec->cycle, '\0', sizeof(spec->cycle)) == NULL) return false;
+    if (spec->pack_series > 0 && (spec->pack_parallel == 0 ||
+                                  (long)spec->pack_series * spec->pack_parallel > MAX_PACK_CELLS)) {
+        return false;
+    }
+    return true;
+}
+
+/// Jobs that ev_fleet_step() runs like ev_sim_step() would, to rounding, while the battery lasts.
+/// Until-empty jobs are left out: a fleet only checks for parked vehicles every 1024 steps and
+/// reports one step count for all of them
+static bool coalescable(const Job *job) {
+    const EVServerJob *spec = &job->spec;
+    return spec->solver == EV_SOLVER_EULER && spec->pack_series == 0 &&
+           !(spec->flags & (EV_JOB_THERMAL | EV_JOB_UNTIL_EMPTY)) && !job->points;
+}
+
+/// Same cycle, step and duration: one fleet run can carry both
+static bool same_fleet(const Job *a, const Job *b) {
+    return coalescable(b) && strcmp(a->spec.cycle, b->spec.cycle) == 0 && a->spec.dt == b->spec.dt &&
+           a->spec.duration == b->spec.duration &&
+           (a->spec.flags & EV_JOB_CYCLE_REPEAT) == (b->spec.flags & EV_JOB_CYCLE_REPEAT);
+}
+
+/// Pops the oldest job and, when it can run in a fleet, every queued job that can share the
+/// run, up to fleet_batch. Under the lock
+static int take_jobs(Server *server, Job **group) {
+    Job *first = server->head;
+    unlink_job(server, first);
+    group[0] = first;
+    int count = 1;
+    if (!coalescable(first)) return 1;
+    for (Job *job = server->head; job && count < server->options->fleet_batch;) {
+        Job *next = job->next;
+        if (same_fleet(first, job)) {
+            unlink_job(server, job);
+            group[count++] = job;
+        }
+        job = next;
+    }
+    return count;
+}
+
+static void job_simulation(const EVServerJob *spec, EVSimulation *sim) {
+    ev_sim_init(sim);
+    sim->battery_voltage = spec->voltage;
+    sim->battery_capacity = spec->capacity;
+    sim->motor_power = spec->motor_power;
+    sim->regen_efficiency = spec->regen_efficiency;
+    sim->regen_braking = (spec->flags & EV_JOB_REGEN) != 0;
+    sim->drive_mode = drive_mode_from_index(spec->drive_mode);
+}
+
+/// A single pass of a drive cycle ends the run by itself unless the job gives a duration
+static double job_max_time(const EVServerJob *spec, bool has_cycle) {
+    if (spec->duration > 0) return spec->duration;
+    return has_cycle && !(spec->flags & EV_JOB_CYCLE_REPEAT) ? 1e9 : 3600;
+}
+
+/// false for an unknown cycle; *cycle stays NULL for the default profile
+static bool open_job_cycle(const Job *job, EVCycle **cycle) {
+    *cycle = NULL;
+    if (job->points) {
+        *cycle = ev_cycle_open_points("inline", job->points, (int)job->spec.cycle_points);
+    } else if (job->spec.cycle[0]) {
+        *cycle = ev_cycle_open_builtin(job->spec.cycle);
+    } else {
+        return true;
+    }
+    if (!*cycle) return false;
+    ev_cycle_set_repeat(*cycle, (job->spec.flags & EV_JOB_CYCLE_REPEAT) != 0);
+    return true;
+}
+
+static void run_job(const Job *job, EVServerResult *result) {
+    const EVServerJob *spec = &job->spec;
+    EVCycle *cycle;
+    if (!open_job_cycle(job, &cycle)) {
+        invalid_result(spec, EV_JOB_INVALID, result);
+        return;
+    }
+    EVSimulation sim;
+    job_simulation(spec, &sim);
+    EVPack *pack = NULL;
+    EVThermal *thermal = NULL;
+    if (spec->pack_series > 0) {
+        EVPackParams params;
+        ev_pack_params_default(&params, spec->pack_series, spec->pack_parallel, spec->capacity);
+        sim.pack = pack = ev_pack_new(&params);
+    }
+    if (spec->flags & EV_JOB_THERMAL) {
+        EVThermalParams params;
+        ev_thermal_params_default(&params);
+        sim.thermal = thermal = ev_thermal_new(&params, pack);
+    }
+    if ((spec->pack_series > 0 && !pack) || ((spec->flags & EV_JOB_THERMAL) && !thermal)) {
+        invalid_result(spec, EV_JOB_FAILED, result);
+    } else {
+        ev_sim_reset(&sim);
+        sim.is_running = true;
+        EVIntegrator integrator;
+        ev_integrator_init(&integrator, (EVSolver)spec->solver);
+        EVRunSummary summary;
+        ev_integrator_run(&integrator, &sim, &ev_default_profile, cycle, spec->dt, job_max_time(spec, cycle != NULL),
+                          (spec->flags & EV_JOB_UNTIL_EMPTY) != 0, &summary);
+        *result = (EVServerResult){
+            .job_id = spec->job_id,
+            .status = EV_JOB_OK,
+            .steps = summary.steps,
+            .sim_time = summary.sim_time,
+            .distance = summary.distance,
+            .energy_consumed = summary.energy_consumed,
+            .soc = summary.soc,
+            .energy_efficiency = summary.energy_efficiency,
+            .peak_battery_temp = summary.peak_battery_temp,
+            .max_speed = summary.max_speed
+        };
+    }
+    ev_thermal_free(thermal);
+    ev_pack_free(pack);
+    ev_cycle_close(cycle);
+}
+
+/// One vectorized run for the whole group; every job shares the cycle, step and duration. A
+/// fleet parks a vehicle whose battery runs empty where ev_sim_step() keeps driving it, so those
+/// jobs are run again on their own
+static void run_fleet(Job **group, int count, EVServerResult *results) {
+    const EVServerJob *first = &group[0]->spec;
+    EVCycle *cycle;
+    EVFleet *fleet = NULL;
+    EVServerJobStatus status = EV_JOB_INVALID;
+    if (open_job_cycle(group[0], &cycle)) {
+        status = EV_JOB_FAILED;
+        fleet = ev_fleet_new(count);
+    }
+    if (!fleet) {
+        for (int i = 0; i < count; i++) invalid_result(&group[i]->spec, status, &results[i]);
+        ev_cycle_close(cycle);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        EVSimulation sim;
+        job_simulation(&group[i]->spec, &sim);
+        ev_fleet_set_vehicle(fleet, i, &sim);
+    }
+    ev_fleet_set_kernel(fleet, EV_FLEET_KERNEL_AUTO);
+    long max_steps = (long)(job_max_time(first, cycle != NULL) / first->dt + 0.5);
+    long steps = ev_fleet_run(fleet, cycle, &ev_default_profile, first->dt, max_steps, false);
+    for (int i = 0; i < count; i++) {
+        if (fleet->soc[i] <= 0) {
+            run_job(group[i], &results[i]);
+            continue;
+        }
+        results[i] = (EVServerResult){
+            .job_id = group[i]->spec.job_id,
+            .status = EV_JOB_OK,
+            .flags = EV_RESULT_COALESCED,
+            .steps = steps,
+            .sim_time = steps * first->dt,
+            .distance = fleet->distance[i],
+            .energy_consumed = fleet->energy_consumed[i],
+            .soc = fleet->soc[i],
+            .energy_efficiency = fleet->energy_efficiency[i],
+            .peak_battery_temp = fleet->peak_battery_temp[i],
+            .max_speed = NAN
+        };
+    }
+    ev_fleet_free(fleet);
+    ev_cycle_close(cycle);
+}
+
+static void *worker_main(void *arg) {
+    Server *server = arg;
+    int limit = server->options->fleet_batch;
+    Job **group = malloc(sizeof(Job *) * limit);
+    EVServerResult *results = malloc(sizeof(EVServerResult) * limit);
+    pthread_mutex_lock(&server->lock);
+    while (group && results) {
+        while (!server->stop && !server->head) pthread_cond_wait(&server->work, &server->lock);
+        if (server->stop) break;
+        int count = take_jobs(server, group);
+        pthread_mutex_unlock(&server->lock);
+        if (count == 1) run_job(group[0], &results[0]);
+        else run_fleet(group, count, results);
+        pthread_mutex_lock(&server->lock);
+        if (count > 1) {
+            server->coalesced += count;
+            server->fleet_runs++;
+        }
+        for (int i = 0; i < count; i++) finish_job(server, group[i], &results[i]);
+        wake_io(server);
+    }
+    pthread_mutex_unlock(&server->lock);
+    free(group);
+    free(results);
+    return NULL;
+}
+
+/// Checks the whole frame before queueing any of it. false on a malformed frame. Under the lock
+static bool accept_batch(Server *server, Client *client, const uint8_t *frame, uint32_t length) {
+    EVServerBatchHeader header;
+    memcpy(&header, frame, sizeof(header));
+    if (header.message != EV_MSG_BATCH || header.version != EV_SERVER_VERSION) return false;
+    size_t offset = sizeof(header);
+    for (uint32_t j = 0; j < header.count; j++) {
+        if (length - offset < sizeof(EVServerJob)) return false;
+        EVServerJob spec;
+        memcpy(&spec, frame + offset, sizeof(spec));
+        offset += sizeof(spec);
+        if (spec.cycle_points > (length - offset) / sizeof(EVCyclePoint)) return false;
+        offset += spec.cycle_points * sizeof(EVCyclePoint);
+    }
+    if (offset != length) return false;
+    server->batches++;
+    if (header.count == 0) {
+        append_frame(client, EV_MSG_BATCH_DONE, header.batch_id, 0, NULL, 0);
+        return true;
+    }
+    Batch *batch = malloc(sizeof(Batch));
+    if (!batch) return false;
+    *batch = (Batch){ .client = client, .id = header.batch_id, .count = header.count, .remaining = header.count };
+    offset = sizeof(header);
+    for (uint32_t j = 0; j < header.count; j++) {
+        EVServerJob spec;
+        memcpy(&spec, frame + offset, sizeof(spec));
+        offset += sizeof(spec);
+        const uint8_t *points = frame + offset;
+        size_t points_size = spec.cycle_points * sizeof(EVCyclePoint);
+        offset += points_size;
+        client->refs++;
+        client->inflight++;
+        if (!job_valid(&spec)) {
+            EVServerResult result;
+            invalid_result(&spec, EV_JOB_INVALID, &result);
+            answer(server, batch, &result);
+            continue;
+        }
+        Job *job = calloc(1, sizeof(Job));
+        if (job && points_size && (job->points = malloc(points_size))) memcpy(job->points, points, points_size);
+        if (!job || (points_size && !job->points)) {
+            EVServerResult result;
+            invalid_result(&spec, EV_JOB_FAILED, &result);
+            free(job);
+            answer(server, batch, &result);
+            continue;
+        }
+        job->spec = spec;
+        job->batch = batch;
+        job->prev = server->tail;
+        if (server->tail) server->tail->next = job;
+        else server->head = job;
+        server->tail = job;
+        server->queued++;
+    }
+    pthread_cond_broadcast(&server->work);
+    return true;
+}
+
+/// More input is taken only while the client and the server have room; otherwise the socket
+/// is left unread and the kernel's buffers push back on the client
+static bool admissible(const Server *server, const Client *client) {
+    const EVServerOptions *options = server->options;
+    return client->inflight < options->max_inflight && server->queued < options->queue_limit &&
+           (long)(client->out_length - client->out_sent) < options->output_limit;
+}
+
+/// Queues the complete frames in the input buffer while there is room. Under the lock
+static void parse_frames(Server *server, Client *client) {
+    if (client->error_sent) return;
+    size_t offset = 0;
+    while (!client->failed && admissible(server, client) && client->in_length - offset >= sizeof(uint32_t)) {
+        uint32_t length;
+        memcpy(&length, client->in + offset, sizeof(length));
+        if (length < sizeof(EVServerBatchHeader) || length > EV_SERVER_MAX_FRAME) {
+            client->failed = true;
+            break;
+        }
+        if (client->in_length - offset - sizeof(length) < length) break;
+        if (!accept_batch(server, client, client->in + offset + sizeof(length), length)) {
+            client->failed = true;
+            break;
+        }
+        offset += sizeof(length) + length;
+    }
+    if (client->failed) {
+        append_frame(client, EV_MSG_ERROR, 0, 0, NULL, 0);
+        client->error_sent = true;
+        client->in_length = 0;
+        return;
+    }
+    if (offset == 0) return;
+    memmove(client->in, client->in + offset, client->in_length - offset);
+    client->in_length -= offset;
+}
+
+/// Reads what the socket has, up to READ_CHUNK. I/O thread only; the lock is taken just to
+/// set the flags
+static void read_client(Server *server, Client *client) {
+    if (client->in_capacity - client->in_length < READ_CHUNK) {
+        size_t capacity = client->in_length + READ_CHUNK;
+        uint8_t *grown = realloc(client->in, capacity);
+        if (!grown) {
+            pthread_mutex_lock(&server->lock);
+            client->failed = true;
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+        client->in = grown;
+        client->in_capacity = capacity;
+    }
+    ssize_t n = recv(client->fd, client->in + client->in_length, READ_CHUNK, 0);
+    if (n > 0) {
+        client->in_length += n;
+        return;
+    }
+    bool lost = n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+    if (n < 0 && !lost) return;
+    pthread_mutex_lock(&server->lock);
+    if (n == 0) client->eof = true;
+    else client->closed = true;
+    pthread_mutex_unlock(&server->lock);
+}
+
+/// Under the lock
+static void flush_client(Client *client) {
+    while (!client->closed && client->out_sent < client->out_length) {
+        ssize_t n = send(client->fd, client->out + client->out_sent, client->out_length - client->out_sent, 0);
+        if (n > 0) {
+            client->out_sent += n;
+        } else {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0 && errno == EINTR) continue;
+            client->closed = true;
+        }
+    }
+}
+
+/// Drops the client's queued jobs and its socket. Under the lock
+static void close_client(Server *server, Client *client) {
+    client->closed = true;
+    for (Job *job = server->head; job;) {
+        Job *next = job->next;
+        if (job->batch->client == client) {
+            unlink_job(server, job);
+            finish_job(server, job, NULL);
+        }
+        job = next;
+    }
+    close(client->fd);
+    client->fd = -1;
+    release_client(client);
+}
+
+static bool finished(const Client *client) {
+    if (client->closed) return true;
+    bool drained = client->out_sent == client->out_length;
+    if (client->failed) return drained;
+    return client->eof && client->inflight == 0 && drained;
+}
+
+static int open_listener(const EVServerOptions *options) {
+    int fd;
+    if (options->socket_path) {
+        struct sockaddr_un address = { .sun_family = AF_UNIX };
+        if (strlen(options->socket_path) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", options->socket_path);
+            return -1;
+        }
+        strcpy(address.sun_path, options->socket_path);
+        /// A socket left behind by an earlier server is replaced, any other file is not
+        struct stat st;
+        if (stat(options->socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(options->socket_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            fprintf(stderr, "Failed to bind %s: %s\n", options->socket_path, strerror(errno));
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        fprintf(stderr, "serve: listening on %s\n", options->socket_path);
+    } else {
+        struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons((uint16_t)options->port) };
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            fprintf(stderr, "Failed to bind 127.0.0.1:%d: %s\n", options->port, strerror(errno));
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        socklen_t size = sizeof(address);
+        getsockname(fd, (struct sockaddr *)&address, &size);
+        fprintf(stderr, "serve: listening on 127.0.0.1:%d\n", ntohs(address.sin_port));
+    }
+    if (listen(fd, SOMAXCONN) != 0 || !set_nonblocking(fd)) {
+        fprintf(stderr, "Failed to listen: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void accept_clients(int listener, bool tcp, Client **clients, int *count) {
+    while (*count < MAX_CLIENTS) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) return;
+        Client *client = calloc(1, sizeof(Client));
+        if (!client || !set_nonblocking(fd)) {
+            free(client);
+            close(fd);
+            continue;
+        }
+        if (tcp) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        client->fd = fd;
+        client->refs = 1;
+        clients[(*count)++] = client;
+    }
+}
+
+int ev_server_run(const EVServerOptions *options) {
+    int listener = open_listener(options);
+    if (listener < 0) return 1;
+    Server server = { .options = options };
+    if (pipe(server.wake) != 0 || !set_nonblocking(server.wake[0]) || !set_nonblocking(server.wake[1])) {
+        fprintf(stderr, "Failed to create the wakeup pipe\n");
+        close(listener);
+        return 1;
+    }
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.work, NULL);
+    signal_wake = server.wake[1];
+    stop_requested = 0;
+    struct sigaction action = { .sa_handler = handle_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int workers = options->threads > 0 ? options->threads : ev_cpu_count();
+    pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+    int started = 0;
+    while (threads && started < workers && pthread_create(&threads[started], NULL, worker_main, &server) == 0) {
+        started++;
+    }
+    Client **clients = malloc(sizeof(Client *) * MAX_CLIENTS);
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (MAX_CLIENTS + 2));
+    int rc = 0;
+    if (started == 0 || !clients || !fds) {
+        fprintf(stderr, "Failed to start the server\n");
+        rc = 1;
+    }
+    fprintf(stderr, "serve: %d worker thread%s, up to %d jobs per fleet run\n", started, started == 1 ? "" : "s", options->fleet_batch);
+    int count = 0;
+    while (rc == 0 && !stop_requested) {
+        pthread_mutex_lock(&server.lock);
+        int live = 0;
+        for (int i = 0; i < count; i++) {
+            Client *client = clients[i];
+            parse_frames(&server, client);
+            flush_client(client);
+            if (finished(client)) close_client(&server, client);
+            else clients[live++] = client;
+        }
+        count = live;
+        fds[0] = (struct pollfd){ .fd = server.wake[0], .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = listener, .events = count < MAX_CLIENTS ? POLLIN : 0 };
+        for (int i = 0; i < count; i++) {
+            Client *client = clients[i];
+            short events = 0;
+            if (!client->eof && !client->failed && admissible(&server, client)) events |= POLLIN;
+            if (client->out_sent < client->out_length) events |= POLLOUT;
+            fds[i + 2] = (struct pollfd){ .fd = client->fd, .events = events };
+        }
+        pthread_mutex_unlock(&server.lock);
+        if (poll(fds, count + 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            rc = 1;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char drain[256];
+            while (read(server.wake[0], drain, sizeof(drain)) > 0) {}
+        }
+        for (int i = 0; i < count; i++) {
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) read_client(&server, clients[i]);
+        }
+        if (fds[1].revents & POLLIN) accept_clients(listener, options->socket_path == NULL, clients, &count);
+    }
+
+    pthread_mutex_lock(&server.lock);
+    server.stop = true;
+    pthread_cond_broadcast(&server.work);
+    pthread_mutex_unlock(&server.lock);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    for (int i = 0; i < count; i++) close_client(&server, clients[i]);
+    fprintf(stderr, "serve: %ld jobs in %ld batches, %ld coalesced into %ld fleet runs\n", server.jobs,
+            server.batches, server.coalesced, server.fleet_runs);
+    signal_wake = -1;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(server.wake[0]);
+    close(server.wake[1]);
+    close(listener);
+    if (options->socket_path) unlink(options->socket_path);
+    pthread_cond_destroy(&server.work);
+    pthread_mutex_destroy(&server.lock);
+    free(fds);
+    free(clients);
+    free(threads);
+    return rc;
+}
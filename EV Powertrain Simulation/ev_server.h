@@ -0,0 +1,102 @@
+#ifndef EV_SERVER_H
+#define EV_SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Local simulation service. Every message is a frame: a uint32 payload length, then the
+/// payload, which starts with a uint32 EVServerMessage. Integers and doubles are in host byte
+/// order; the server only listens on a Unix socket or on 127.0.0.1.
+///
+/// Client to server, EV_MSG_BATCH: EVServerBatchHeader, then count jobs, each an EVServerJob
+/// followed by its cycle_points EVCyclePoint knots (16 bytes each).
+/// Server to client: one EV_MSG_RESULT frame (EVServerBatchHeader with count 1, then an
+/// EVServerResult) per job as soon as it finishes, in completion order, then EV_MSG_BATCH_DONE
+/// (EVServerBatchHeader, count = jobs in the batch) once all of them are sent. A malformed
+/// frame gets EV_MSG_ERROR (EVServerBatchHeader, count = 0) and the connection is closed.
+
+#define EV_SERVER_VERSION 1
+#define EV_SERVER_MAX_FRAME (64u << 20)    // bytes
+#define EV_SERVER_CYCLE_NAME 16
+
+typedef enum {
+    EV_MSG_BATCH = 1,
+    EV_MSG_RESULT = 2,
+    EV_MSG_BATCH_DONE = 3,
+    EV_MSG_ERROR = 4
+} EVServerMessage;
+
+typedef enum {
+    EV_JOB_REGEN = 1 << 0,             // regenerative braking on
+    EV_JOB_UNTIL_EMPTY = 1 << 1,       // stop when SOC reaches 0
+    EV_JOB_CYCLE_REPEAT = 1 << 2,      // restart the drive cycle when it ends
+    EV_JOB_THERMAL = 1 << 3            // lumped thermal network
+} EVServerJobFlags;
+
+typedef enum {
+    EV_JOB_OK = 0,
+    EV_JOB_INVALID = 1,                // out-of-range field or unknown cycle
+    EV_JOB_FAILED = 2                  // out of memory
+} EVServerJobStatus;
+
+typedef enum {
+    EV_RESULT_COALESCED = 1 << 0       // ran in a fleet batch; max_speed is not tracked (NaN)
+} EVServerResultFlags;
+
+typedef struct {
+    uint32_t message;                  // EVServerMessage
+    uint32_t version;                  // EV_SERVER_VERSION
+    uint32_t batch_id;                 // chosen by the client, echoed back
+    uint32_t count;
+} EVServerBatchHeader;
+
+typedef struct {
+    uint32_t job_id;                   // chosen by the client, echoed back
+    uint8_t drive_mode;                // DriveMode
+    uint8_t solver;                    // EVSolver
+    uint8_t flags;                     // EVServerJobFlags
+    uint8_t reserved;
+    double voltage;                    // V, 100-1000
+    double capacity;                   // kWh, 10-200
+    double motor_power;                // kW, 50-500
+    double regen_efficiency;           // 0.0 to 1.0
+    double dt;                         // s
+    double duration;                   // s, 0 is one pass of the cycle (3600 s without one)
+    char cycle[EV_SERVER_CYCLE_NAME];  // built-in cycle, "" follows the default profile
+    uint16_t pack_series;              // > 0 gives the job a cell-level pack
+    uint16_t pack_parallel;
+    uint32_t cycle_points;             // > 0: that many knots follow and replace cycle
+} EVServerJob;
+
+typedef struct {
+    uint32_t job_id;
+    uint32_t status;                   // EVServerJobStatus
+    uint32_t flags;                    // EVServerResultFlags
+    uint32_t reserved;
+    int64_t steps;
+    double sim_time;                   // s
+    double distance;                   // km
+    double energy_consumed;            // kWh
+    double soc;                        // %
+    double energy_efficiency;          // Wh/km
+    double peak_battery_temp;          // °C
+    double max_speed;                  // km/h
+} EVServerResult;
+
+typedef struct {
+    const char *socket_path;           // Unix socket; NULL listens on TCP
+    int port;                          // 127.0.0.1:port when there is no socket_path
+    int threads;                       // workers, 0 uses every online CPU
+    int max_inflight;                  // jobs queued or running per client before its socket
+                                       // is no longer read
+    int queue_limit;                   // jobs queued over all clients, likewise
+    int fleet_batch;                   // most jobs coalesced into one fleet run
+    long output_limit;                 // bytes of unsent results per client, likewise
+} EVServerOptions;
+
+void ev_server_options_init(EVServerOptions *options);
+
+/// Serves until SIGINT or SIGTERM; 0 on a clean shutdown
+int ev_server_run(const EVServerOptions *options);
+
+#endif
@@ -0,0 +1,274 @@
+#include "ev_sim.h"
+#include "ev_step.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+const DriveModeParams drive_mode_params[DRIVE_MODE_COUNT] = {
+    [DRIVE_MODE_ECO]    = { .max_accel = 0.5, .power_factor = 0.7 },
+    [DRIVE_MODE_NORMAL] = { .max_accel = 1.0, .power_factor = 1.0 },
+    [DRIVE_MODE_SPORT]  = { .max_accel = 1.5, .power_factor = 1.3 }
+};
+
+static const char *const drive_mode_names[DRIVE_MODE_COUNT] = { "eco", "normal", "sport" };
+
+/// Urban-style loop: pull away, cruise, brake, stand
+static const EVProfileSegment default_segments[] = {
+    { 10.0,  1.0 },
+    { 20.0,  0.3 },
+    { 30.0,  0.1 },
+    {  8.0, -1.0 },
+    {  4.0,  0.0 }
+};
+
+const EVProfile ev_default_profile = {
+    .segments = default_segments,
+    .count = sizeof(default_segments) / sizeof(default_segments[0])
+};
+
+double parse_input(const char *text, double min, double max, double default_val) {
+    double val = atof(text);
+    return (isnan(val) || val < min || val > max) ? default_val : val;
+}
+
+const char *drive_mode_name(DriveMode mode) {
+    return (mode >= 0 && mode < DRIVE_MODE_COUNT) ? drive_mode_names[mode] : "unknown";
+}
+
+bool drive_mode_from_name(const char *name, DriveMode *mode) {
+    for (int i = 0; i < DRIVE_MODE_COUNT; i++) {
+        if (strcmp(name, drive_mode_names[i]) == 0) {
+            *mode = (DriveMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+DriveMode drive_mode_from_index(unsigned long index) {
+    return index < DRIVE_MODE_COUNT ? (DriveMode)index : DRIVE_MODE_NORMAL;
+}
+
+void ev_vehicle_params_default(EVVehicleParams *params) {
+    params->mass = EV_VEHICLE_MASS;
+    params->drag_coeff = EV_DRAG_COEFF;
+    params->frontal_area = EV_FRONTAL_AREA;
+    params->air_density = EV_AIR_DENSITY;
+    params->rolling_resistance = EV_ROLLING_RESISTANCE;
+    params->aggressiveness = 1.0;
+}
+
+void ev_sim_init(EVSimulation *sim) {
+    sim->battery_voltage = 400;
+    sim->battery_capacity = 60;
+    sim->motor_power = 150;
+    sim->regen_efficiency = 0.5;
+    sim->drive_mode = DRIVE_MODE_NORMAL;
+    sim->motor_map = NULL;
+    sim->pack = NULL;
+    sim->thermal = NULL;
+    sim->inverter = NULL;
+    sim->route = NULL;
+    ev_drivetrain_direct(&sim->drivetrain);
+    ev_vehicle_params_default(&sim->vehicle);
+    sim->is_running = false;
+    sim->regen_braking = false;
+    sim->acceleration = 0;
+    ev_sim_reset(sim);
+}
+
+void ev_sim_reset(EVSimulation *sim) {
+    sim->vehicle_speed = 0;
+    sim->motor_rpm = 0;
+    sim->motor_torque = 0;
+    sim->distance = 0;
+    sim->energy_consumed = 0;
+    sim->soc = 100;
+    sim->battery_temp = 25.0;
+    sim->energy_efficiency = 0;
+    sim->battery_current = 0;
+    if (sim->pack) {
+        ev_pack_reset(sim->pack);
+        sim->battery_voltage = sim->pack->terminal_voltage;
+        sim->soc = sim->pack->soc_min * 100;
+        sim->battery_temp = sim->pack->temp_max;
+    }
+    if (sim->thermal) ev_thermal_reset(sim->thermal, sim->pack);
+    if (sim->inverter) ev_inverter_reset(sim->inverter);
+}
+
+#define STEP_KERNEL(id, name, topology, strategy)                                  \
+    static void step_##name(EVSimulation *sim, const EVInput *input, double dt) {  \
+        ev_step_kernel(sim, input, dt, topology, strategy);                        \
+    }
+EV_DRIVETRAIN_KERNELS(STEP_KERNEL)
+
+#define STEP_KERNEL_ENTRY(id, name, topology, strategy) [EV_DRIVETRAIN_KERNEL_##id] = step_##name,
+static const EVStepKernel step_kernels[EV_DRIVETRAIN_KERNEL_COUNT] = {
+    EV_DRIVETRAIN_KERNELS(STEP_KERNEL_ENTRY)
+};
+
+EVStepKernel ev_sim_step_kernel(const EVSimulation *sim) {
+    return step_kernels[ev_drivetrain_kernel(&sim->drivetrain)];
+}
+
+void ev_sim_step(EVSimulation *sim, const EVInput *input, double dt) {
+    step_kernels[ev_drivetrain_kernel(&sim->drivetrain)](sim, input, dt);
+}
+
+void ev_sim_battery_step(EVSimulation *sim, double power, double dt) {
+    EVPack *pack = sim->pack;
+    if (!pack) {
+        sim->battery_current = power * 1000 / sim->battery_voltage;
+        return;
+    }
+    ev_pack_step(pack, ev_pack_current_for_power(pack, power), dt);
+    sim->battery_current = pack->current_total;
+    sim->battery_voltage = pack->terminal_voltage;
+    sim->soc = pack->soc_min * 100;
+    sim->battery_temp = pack->temp_max;
+    if (sim->battery_temp < 10) sim->battery_temp = 10;
+    if (sim->battery_temp > 70) sim->battery_temp = 70;
+}
+
+void ev_sim_thermal_step(EVSimulation *sim, double shaft_power, double motor_efficiency, double dt) {
+    EVThermal *thermal = sim->thermal;
+    if (!thermal) return;
+    double input = shaft_power / motor_efficiency * 1000;      // W into the motor
+    double motor_loss = input - shaft_power * 1000;
+    double inverter_loss = input * thermal->params.inverter_loss;
+    if (sim->inverter) {   /// Conduction and switching from the inverter model, copper in the motor
+        inverter_loss = sim->inverter->conduction_loss + sim->inverter->switching_loss;
+        motor_loss = input - shaft_power * 1000 - inverter_loss;
+        if (motor_loss < 0) motor_loss = 0;
+    }
+    ev_thermal_step(thermal, sim->pack, sim->battery_current, motor_loss, inverter_loss, dt);
+    sim->battery_temp = sim->pack ? sim->pack->temp_max : ev_thermal_module_max(thermal);
+    if (sim->battery_temp < 10) sim->battery_temp = 10;
+    if (sim->battery_temp > 70) sim->battery_temp = 70;
+}
+
+void ev_sim_inverter_step(EVSimulation *sim, double shaft_power, double dt) {
+    if (!sim->inverter) return;
+    ev_inverter_advance(sim->inverter, shaft_power, sim->motor_rpm, sim->battery_voltage, dt);
+}
+
+double ev_sim_temp_efficiency(const EVSimulation *sim) {
+    if (sim->thermal) return sim->thermal->derating;
+    return 1.0 - (sim->battery_temp > 40 ? (sim->battery_temp - 40) * 0.01 : 0);
+}
+
+uint64_t ev_random_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+double ev_random_uniform(uint64_t *state) {
+    return ev_random_unit(ev_random_next(state));
+}
+
+void ev_philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+        uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += 0x9E3779B9u;     // Weyl key schedule
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+double ev_profile_accel(const EVProfile *profile, double t) {
+    double period = 0;
+    for (int i = 0; i < profile->count; i++) period += profile->segments[i].duration;
+    if (period <= 0) return 0;
+    t = fmod(t, period);
+    for (int i = 0; i < profile->count; i++) {
+        if (t < profile->segments[i].duration) return profile->segments[i].acceleration;
+        t -= profile->segments[i].duration;
+    }
+    return profile->segments[profile->count - 1].acceleration;
+}
+
+double ev_profile_next_change(const EVProfile *profile, double t) {
+    double period = 0;
+    for (int i = 0; i < profile->count; i++) period += profile->segments[i].duration;
+    if (period <= 0) return INFINITY;
+    double edge = floor(t / period) * period;
+    for (int lap = 0; lap < 2; lap++) {
+        for (int i = 0; i < profile->count; i++) {
+            edge += profile->segments[i].duration;
+            if (edge > t + 1e-9) return edge;
+        }
+    }
+    return t + period;
+}
+
+void ev_run_summary_begin(EVRunSummary *summary, const EVSimulation *sim) {
+    memset(summary, 0, sizeof(*summary));
+    summary->peak_battery_temp = sim->battery_temp;
+}
+
+void ev_run_summary_sample(EVRunSummary *summary, const EVSimulation *sim) {
+    summary->steps++;
+    if (sim->battery_temp > summary->peak_battery_temp) summary->peak_battery_temp = sim->battery_temp;
+    if (sim->vehicle_speed > summary->max_speed) summary->max_speed = sim->vehicle_speed;
+}
+
+void ev_run_summary_end(EVRunSummary *summary, const EVSimulation *sim, double sim_time) {
+    summary->sim_time = sim_time;
+    summary->distance = sim->distance;
+    summary->energy_consumed = sim->energy_consumed;
+    summary->soc = sim->soc;
+    summary->energy_efficiency = sim->energy_efficiency;
+}
+
+/// The fixed-step loop with the step inlined, instantiated per drivetrain kernel like the step
+static EV_ALWAYS_INLINE void run_loop(EVSimulation *sim, const EVProfile *profile, double dt, double max_time,
+                                      bool until_empty, EVRunSummary *summary, EVDrivetrainTopology topology,
+                                      EVSplitStrategy strategy) {
+    ev_run_summary_begin(summary, sim);
+    EVInput input = { 0 };
+    long max_steps = (long)(max_time / dt + 0.5);
+    double t = 0;
+    while (summary->steps < max_steps) {
+        input.acceleration = ev_profile_accel(profile, t) * sim->vehicle.aggressiveness;
+        ev_step_kernel(sim, &input, dt, topology, strategy);
+        ev_run_summary_sample(summary, sim);
+        t = summary->steps * dt;
+        if (until_empty && sim->soc <= 0) break;
+    }
+    ev_run_summary_end(summary, sim, t);
+}
+
+typedef void (*RunKernel)(EVSimulation *sim, const EVProfile *profile, double dt, double max_time,
+                          bool until_empty, EVRunSummary *summary);
+
+#define RUN_KERNEL(id, name, topology, strategy)                                                  \
+    static void run_##name(EVSimulation *sim, const EVProfile *profile, double dt, double max_time, \
+                           bool until_empty, EVRunSummary *summary) {                              \
+        run_loop(sim, profile, dt, max_time, until_empty, summary, topology, strategy);            \
+    }
+EV_DRIVETRAIN_KERNELS(RUN_KERNEL)
+
+#define RUN_KERNEL_ENTRY(id, name, topology, strategy) [EV_DRIVETRAIN_KERNEL_##id] = run_##name,
+static const RunKernel run_kernels[EV_DRIVETRAIN_KERNEL_COUNT] = {
+    EV_DRIVETRAIN_KERNELS(RUN_KERNEL_ENTRY)
+};
+
+void ev_sim_run(EVSimulation *sim, const EVProfile *profile, double dt, double max_time,
+                bool until_empty, EVRunSummary *summary) {
+    run_kernels[ev_drivetrain_kernel(&sim->drivetrain)](sim, profile, dt, max_time, until_empty, summary);
+}
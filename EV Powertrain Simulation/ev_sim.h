@@ -0,0 +1,165 @@
+#ifndef EV_SIM_H
+#define EV_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ev_motor.h"
+#include "ev_battery.h"
+#include "ev_thermal.h"
+#include "ev_inverter.h"
+#include "ev_route.h"
+#include "ev_drivetrain.h"
+
+typedef enum {
+    DRIVE_MODE_ECO,
+    DRIVE_MODE_NORMAL,
+    DRIVE_MODE_SPORT
+} DriveMode;
+
+#define DRIVE_MODE_COUNT 3
+
+/// Vehicle constants shared by the scalar and fleet kernels
+#define EV_VEHICLE_MASS 1500.0         // kg
+#define EV_DRAG_COEFF 0.3
+#define EV_FRONTAL_AREA 2.5            // m²
+#define EV_AIR_DENSITY 1.225           // kg/m³
+#define EV_ROLLING_RESISTANCE 0.01
+#define EV_GRAVITY 9.81                // m/s²
+#define EV_MAX_SPEED 180.0             // km/h
+
+/// The constants above plus the driver, per simulation so Monte Carlo runs can sample them.
+/// Route tables precompute their own drag and mass and take precedence
+typedef struct {
+    double mass;               // kg
+    double drag_coeff;
+    double frontal_area;       // m²
+    double air_density;        // kg/m³
+    double rolling_resistance;
+    double aggressiveness;     // driver: scales profile accelerations, and closes the speed gap
+                               // to a drive cycle that much faster; 1 drives as given
+} EVVehicleParams;
+
+typedef struct {
+    double battery_voltage;      // V
+    double battery_current;     // A, discharge positive
+    double battery_capacity;    // kWh
+    double motor_power;         // kW
+    double motor_torque;        // Nm
+    double motor_rpm;           // RPM
+    double vehicle_speed;       // km/h
+    double acceleration;        // m/s²
+    double soc;                // State of Charge (%)
+    double distance;           // km
+    double energy_consumed;    // kWh
+    double regen_efficiency;   // 0.0 to 1.0
+    double battery_temp;       // °C
+    double energy_efficiency;  // Wh/km
+    DriveMode drive_mode;
+    const EVMotorMap *motor_map; // shared, read-only; NULL uses EV_MOTOR_FLAT_EFFICIENCY
+    EVPack *pack;              // cell-level battery owned by the caller; NULL keeps the
+                               // constant-voltage Coulomb counter
+    EVThermal *thermal;        // lumped thermal network owned by the caller; NULL keeps the
+                               // scalar battery temperature model
+    EVInverter *inverter;      // switching-level inverter and motor owned by the caller, its
+                               // efficiency held over each step; NULL keeps the drivetrain's
+    const EVRoute *route;      // shared, read-only; NULL is a level road in still air at
+                               // EV_AIR_DENSITY with no payload
+    EVDrivetrain drivetrain;   // ev_drivetrain_direct() unless set
+    EVVehicleParams vehicle;   // ev_vehicle_params_default() unless set
+    bool is_running;
+    bool regen_braking;
+} EVSimulation;
+
+/// Driver input for one step, everything the GUI used to read from widgets
+typedef struct {
+    double acceleration;       // m/s², requested (clamped by drive mode)
+} EVInput;
+
+typedef struct {
+    double max_accel;          // m/s²
+    double power_factor;
+} DriveModeParams;
+
+/// Piecewise-constant acceleration schedule, repeated until the run ends
+typedef struct {
+    double duration;           // s
+    double acceleration;       // m/s²
+} EVProfileSegment;
+
+typedef struct {
+    const EVProfileSegment *segments;
+    int count;
+} EVProfile;
+
+typedef struct {
+    long steps;
+    double sim_time;           // s
+    double distance;           // km
+    double energy_consumed;    // kWh
+    double soc;                // %
+    double energy_efficiency;  // Wh/km
+    double peak_battery_temp;  // °C
+    double max_speed;          // km/h
+} EVRunSummary;
+
+extern const DriveModeParams drive_mode_params[DRIVE_MODE_COUNT];
+extern const EVProfile ev_default_profile;
+
+double parse_input(const char *text, double min, double max, double default_val);
+const char *drive_mode_name(DriveMode mode);
+bool drive_mode_from_name(const char *name, DriveMode *mode);
+/// The mode at a list position, DRIVE_MODE_NORMAL for one out of range (such as a drop-down
+/// with nothing selected), so drive_mode_params is always indexed in bounds
+DriveMode drive_mode_from_index(unsigned long index);
+
+/// m/s² the grade adds to the road load where sim is (negative downhill), 0 without a route.
+/// Drive modes limit the acceleration the driver feels, so their clamp is shifted by this
+static inline double ev_sim_climb(const EVSimulation *sim) {
+    if (!sim->route) return 0;
+    return ev_route_at(sim->route, sim->distance)->resistance - EV_ROLLING_RESISTANCE * EV_GRAVITY;
+}
+
+void ev_vehicle_params_default(EVVehicleParams *params);
+void ev_sim_init(EVSimulation *sim);
+void ev_sim_reset(EVSimulation *sim);
+/// Looks up the drivetrain's kernel on every call; loops take ev_sim_step_kernel() once
+void ev_sim_step(EVSimulation *sim, const EVInput *input, double dt);
+typedef void (*EVStepKernel)(EVSimulation *sim, const EVInput *input, double dt);
+/// ev_sim_step() specialized for sim's drivetrain; valid until the drivetrain changes
+EVStepKernel ev_sim_step_kernel(const EVSimulation *sim);
+/// Draws power (kW, net of regen) from the battery for dt. With a pack this steps every cell
+/// and takes voltage, SOC (weakest cell) and temperature (hottest cell) from it
+void ev_sim_battery_step(EVSimulation *sim, double power, double dt);
+/// Heats the thermal network, when there is one, with the losses of shaft_power (kW) delivered
+/// at motor_efficiency and the battery current of the last battery step
+void ev_sim_thermal_step(EVSimulation *sim, double shaft_power, double motor_efficiency, double dt);
+/// Power derating, 0.0 to 1.0: the network's hottest component against its limit, otherwise
+/// 1 % per °C of battery temperature above 40 °C
+double ev_sim_temp_efficiency(const EVSimulation *sim);
+/// Co-simulates the inverter, when there is one, over the step just taken at the new motor
+/// speed and battery voltage. The mechanics and thermal network of the next step see the
+/// efficiency and losses it leaves, one macro step behind
+void ev_sim_inverter_step(EVSimulation *sim, double shaft_power, double dt);
+
+/// splitmix64, for reproducible sampling of configurations
+uint64_t ev_random_next(uint64_t *state);
+double ev_random_uniform(uint64_t *state);
+/// Philox4x32-10, counter-based: out depends on (counter, key) alone, so a sample drawn from
+/// its own counter is the same whichever thread draws it and in whatever order
+void ev_philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+/// [0, 1) from the 53 high bits
+static inline double ev_random_unit(uint64_t bits) {
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double ev_profile_accel(const EVProfile *profile, double t);
+/// Time of the first segment boundary after t (INFINITY for an empty profile)
+double ev_profile_next_change(const EVProfile *profile, double t);
+void ev_run_summary_begin(EVRunSummary *summary, const EVSimulation *sim);
+void ev_run_summary_sample(EVRunSummary *summary, const EVSimulation *sim);
+void ev_run_summary_end(EVRunSummary *summary, const EVSimulation *sim, double sim_time);
+
+void ev_sim_run(EVSimulation *sim, const EVProfile *profile, double dt, double max_time,
+                bool until_empty, EVRunSummary *summary);
+
+#endif
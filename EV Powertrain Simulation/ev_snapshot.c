@@ -0,0 +1,340 @@
+#include "ev_snapshot.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Values are stored in host byte order and layout, like the telemetry and motor map files
+#define FILE_MAGIC "EVSNAP01"
+#define FILE_VERSION 1
+
+#define HAS_PACK 1u
+#define HAS_THERMAL 2u
+#define HAS_HISTORY 4u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    double time;               // s
+    int64_t steps;
+    int64_t samples;           // waveform samples per channel
+} FileHeader;
+
+struct EVSnapshot {
+    EVSimulation sim;          // sim.pack and sim.thermal are the snapshot's own copies; no inverter
+    EVIntegrator integrator;
+    double time;               // s
+    long steps;
+    bool has_history;
+    EVWaveHistory history;
+};
+
+/// EVSimulation's numeric state; drive mode and the regen switch follow as two more values
+static const size_t sim_values[] = {
+    offsetof(EVSimulation, battery_voltage), offsetof(EVSimulation, battery_current),
+    offsetof(EVSimulation, battery_capacity), offsetof(EVSimulation, motor_power),
+    offsetof(EVSimulation, motor_torque), offsetof(EVSimulation, motor_rpm),
+    offsetof(EVSimulation, vehicle_speed), offsetof(EVSimulation, acceleration),
+    offsetof(EVSimulation, soc), offsetof(EVSimulation, distance),
+    offsetof(EVSimulation, energy_consumed), offsetof(EVSimulation, regen_efficiency),
+    offsetof(EVSimulation, battery_temp), offsetof(EVSimulation, energy_efficiency)
+};
+
+#define SIM_VALUES (sizeof(sim_values) / sizeof(sim_values[0]))
+
+/// Pack outputs of the last step, read back without re-solving the cells
+static const size_t pack_values[] = {
+    offsetof(EVPack, current_total), offsetof(EVPack, terminal_voltage), offsetof(EVPack, open_voltage),
+    offsetof(EVPack, resistance), offsetof(EVPack, soc_mean), offsetof(EVPack, soc_min),
+    offsetof(EVPack, soc_max), offsetof(EVPack, temp_mean), offsetof(EVPack, temp_min),
+    offsetof(EVPack, temp_max), offsetof(EVPack, heat)
+};
+
+#define PACK_VALUES (sizeof(pack_values) / sizeof(pack_values[0]))
+
+static const size_t thermal_values[] = {
+    offsetof(EVThermal, pending_time), offsetof(EVThermal, pending_motor),
+    offsetof(EVThermal, pending_inverter), offsetof(EVThermal, pending_joule), offsetof(EVThermal, flow),
+    offsetof(EVThermal, derating), offsetof(EVThermal, min_derating)
+};
+
+#define THERMAL_VALUES (sizeof(thermal_values) / sizeof(thermal_values[0]))
+
+/// Per-cell state; the other arrays follow from the parameters or are scratch
+static const size_t cell_arrays[] = {
+    offsetof(EVPack, soc), offsetof(EVPack, v1), offsetof(EVPack, v2), offsetof(EVPack, temp),
+    offsetof(EVPack, current), offsetof(EVPack, sink)
+};
+
+#define CELL_ARRAYS (sizeof(cell_arrays) / sizeof(cell_arrays[0]))
+
+#define FIELD(base, offset) (*(double *)((char *)(base) + (offset)))
+#define ARRAY(base, offset) (*(double **)((char *)(base) + (offset)))
+
+EVSnapshot *ev_snapshot_take(const EVSimulation *sim, const EVIntegrator *integrator, double time, long steps,
+                             const EVWaveHistory *history) {
+    EVSnapshot *snapshot = calloc(1, sizeof(EVSnapshot));
+    if (!snapshot) return NULL;
+    snapshot->sim = *sim;
+    snapshot->sim.pack = NULL;
+    snapshot->sim.thermal = NULL;
+    snapshot->sim.inverter = NULL;
+    if (integrator) snapshot->integrator = *integrator;
+    else ev_integrator_init(&snapshot->integrator, EV_SOLVER_EULER);
+    snapshot->time = time;
+    snapshot->steps = steps;
+    ev_wave_history_init(&snapshot->history);
+    bool ok = true;
+    if (sim->pack) ok = (snapshot->sim.pack = ev_pack_clone(sim->pack)) != NULL;
+    if (ok && sim->thermal) ok = (snapshot->sim.thermal = ev_thermal_clone(sim->thermal, snapshot->sim.pack)) != NULL;
+    if (ok && history) ok = snapshot->has_history = ev_wave_history_clone(&snapshot->history, history);
+    if (!ok) {
+        ev_snapshot_free(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+void ev_snapshot_free(EVSnapshot *snapshot) {
+    if (!snapshot) return;
+    ev_thermal_free(snapshot->sim.thermal);
+    ev_pack_free(snapshot->sim.pack);
+    ev_wave_history_free(&snapshot->history);
+    free(snapshot);
+}
+
+const EVSimulation *ev_snapshot_sim(const EVSnapshot *snapshot) {
+    return &snapshot->sim;
+}
+
+double ev_snapshot_time(const EVSnapshot *snapshot) {
+    return snapshot->time;
+}
+
+long ev_snapshot_steps(const EVSnapshot *snapshot) {
+    return snapshot->steps;
+}
+
+bool ev_snapshot_has_history(const EVSnapshot *snapshot) {
+    return snapshot->has_history;
+}
+
+bool ev_snapshot_restore(const EVSnapshot *snapshot, EVSimulation *sim, EVIntegrator *integrator,
+                         double *time, long *steps, EVWaveHistory *history) {
+    const EVSimulation *from = &snapshot->sim;
+    if (!from->pack != !sim->pack || !from->thermal != !sim->thermal) return false;
+    if (from->pack && (sim->pack->params.series != from->pack->params.series ||
+                       sim->pack->params.parallel != from->pack->params.parallel)) {
+        return false;
+    }
+    if (from->thermal && sim->thermal->nodes != from->thermal->nodes) return false;
+    EVWaveHistory copy;
+    if (history && !ev_wave_history_clone(&copy, &snapshot->history)) return false;
+    if (sim->pack) ev_pack_copy_state(sim->pack, from->pack);
+    if (sim->thermal) ev_thermal_copy_state(sim->thermal, from->thermal);
+    EVSimulation restored = *from;
+    restored.motor_map = sim->motor_map;
+    restored.route = sim->route;
+    restored.drivetrain = sim->drivetrain;
+    restored.vehicle = sim->vehicle;
+    restored.pack = sim->pack;
+    restored.thermal = sim->thermal;
+    restored.inverter = sim->inverter;
+    restored.is_running = sim->is_running;
+    *sim = restored;
+    if (integrator) *integrator = snapshot->integrator;
+    if (time) *time = snapshot->time;
+    if (steps) *steps = snapshot->steps;
+    if (history) {
+        ev_wave_history_free(history);
+        *history = copy;
+    }
+    return true;
+}
+
+bool ev_snapshot_fork(const EVSnapshot *snapshot, EVBranch *branches, int count) {
+    for (int b = 0; b < count; b++) {
+        EVBranch *branch = &branches[b];
+        branch->sim = snapshot->sim;
+        branch->sim.pack = NULL;
+        branch->sim.thermal = NULL;
+        branch->sim.inverter = NULL;
+        branch->integrator = snapshot->integrator;
+        branch->time = snapshot->time;
+        branch->steps = snapshot->steps;
+        ev_wave_history_init(&branch->history);
+        const EVSimulation *from = &snapshot->sim;
+        bool ok = true;
+        if (from->pack) ok = (branch->sim.pack = ev_pack_clone(from->pack)) != NULL;
+        if (ok && from->thermal) {
+            ok = (branch->sim.thermal = ev_thermal_clone(from->thermal, branch->sim.pack)) != NULL;
+        }
+        if (ok) ok = ev_wave_history_clone(&branch->history, &snapshot->history);
+        if (!ok) {
+            for (int k = 0; k <= b; k++) ev_branch_free(&branches[k]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void ev_branch_free(EVBranch *branch) {
+    ev_thermal_free(branch->sim.thermal);
+    ev_pack_free(branch->sim.pack);
+    branch->sim.thermal = NULL;
+    branch->sim.pack = NULL;
+    ev_wave_history_free(&branch->history);
+}
+
+static bool write_values(FILE *file, const void *values, size_t size, size_t count) {
+    return fwrite(values, size, count, file) == count;
+}
+
+static bool read_values(FILE *file, void *values, size_t size, size_t count) {
+    return fread(values, size, count, file) == count;
+}
+
+/// File order: header, vehicle, solver, pack parameters, thermal network, pack cells, history.
+/// The network comes before the cells because creating it resets the cells' sinks
+bool ev_snapshot_save(const EVSnapshot *snapshot, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    const EVSimulation *sim = &snapshot->sim;
+    EVPack *pack = sim->pack;
+    const EVThermal *thermal = sim->thermal;
+    FileHeader header = {
+        .version = FILE_VERSION,
+        .flags = (pack ? HAS_PACK : 0) | (thermal ? HAS_THERMAL : 0) | (snapshot->has_history ? HAS_HISTORY : 0),
+        .time = snapshot->time,
+        .steps = snapshot->steps,
+        .samples = snapshot->has_history ? snapshot->history.samples : 0
+    };
+    memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    double values[SIM_VALUES + 2];
+    for (size_t v = 0; v < SIM_VALUES; v++) values[v] = FIELD(sim, sim_values[v]);
+    values[SIM_VALUES] = sim->drive_mode;
+    values[SIM_VALUES + 1] = sim->regen_braking;
+    bool ok = write_values(file, &header, sizeof(header), 1) &&
+              write_values(file, values, sizeof(double), SIM_VALUES + 2) &&
+              write_values(file, &snapshot->integrator, sizeof(EVIntegrator), 1);
+    if (ok && pack) ok = write_values(file, &pack->params, sizeof(EVPackParams), 1);
+    if (ok && thermal) {
+        double state[THERMAL_VALUES];
+        for (size_t v = 0; v < THERMAL_VALUES; v++) state[v] = FIELD(thermal, thermal_values[v]);
+        int32_t counts[2] = { thermal->nodes, thermal->flow_level };
+        ok = write_values(file, &thermal->params, sizeof(EVThermalParams), 1) &&
+             write_values(file, counts, sizeof(int32_t), 2) &&
+             write_values(file, thermal->temp, sizeof(double), thermal->nodes) &&
+             write_values(file, thermal->heat, sizeof(double), thermal->nodes) &&
+             write_values(file, state, sizeof(double), THERMAL_VALUES);
+    }
+    if (ok && pack) {
+        for (size_t a = 0; ok && a < CELL_ARRAYS; a++) {
+            ok = write_values(file, ARRAY(pack, cell_arrays[a]), sizeof(double), pack->cells);
+        }
+        double outputs[PACK_VALUES];
+        for (size_t v = 0; v < PACK_VALUES; v++) outputs[v] = FIELD(pack, pack_values[v]);
+        if (ok) ok = write_values(file, outputs, sizeof(double), PACK_VALUES);
+    }
+    /// The samples only, channel by channel
+    for (int c = 0; ok && snapshot->has_history && c < EV_WAVE_CHANNELS; c++) {
+        long count;
+        for (long i = 0; ok && i < snapshot->history.samples; i += count) {
+            const double *run = ev_wave_samples(&snapshot->history, (EVWaveChannelId)c, i, &count);
+            ok = write_values(file, run, sizeof(double), count);
+        }
+    }
+    return fclose(file) == 0 && ok;
+}
+
+/// samples comes from the file, so it is held to what the rest of the file can hold before
+/// anything is sized by it
+static bool load_history(FILE *file, EVWaveHistory *history, long samples) {
+    long here = ftell(file);
+    if (here < 0 || fseek(file, 0, SEEK_END) != 0) return false;
+    long size = ftell(file);
+    if (size < here || fseek(file, here, SEEK_SET) != 0) return false;
+    if ((unsigned long)samples > (unsigned long)(size - here) / (sizeof(double) * EV_WAVE_CHANNELS)) return false;
+    double *channels = malloc(sizeof(double) * EV_WAVE_CHANNELS * (samples > 0 ? samples : 1));
+    if (!channels) return false;
+    bool ok = read_values(file, channels, sizeof(double), (size_t)samples * EV_WAVE_CHANNELS);
+    for (long i = 0; ok && i < samples; i++) {
+        double values[EV_WAVE_CHANNELS];
+        for (int c = 0; c < EV_WAVE_CHANNELS; c++) values[c] = channels[c * samples + i];
+        ok = ev_wave_history_append(history, values);
+    }
+    free(channels);
+    return ok;
+}
+
+EVSnapshot *ev_snapshot_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    EVSnapshot *snapshot = calloc(1, sizeof(EVSnapshot));
+    FileHeader header;
+    double values[SIM_VALUES + 2];
+    bool ok = snapshot && read_values(file, &header, sizeof(header), 1) &&
+              memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) == 0 && header.version == FILE_VERSION &&
+              header.samples >= 0 && read_values(file, values, sizeof(double), SIM_VALUES + 2) &&
+              read_values(file, &snapshot->integrator, sizeof(EVIntegrator), 1);
+    if (!ok) {
+        free(snapshot);
+        fclose(file);
+        return NULL;
+    }
+    EVSimulation *sim = &snapshot->sim;
+    ev_sim_init(sim);
+    for (size_t v = 0; v < SIM_VALUES; v++) FIELD(sim, sim_values[v]) = values[v];
+    double mode = values[SIM_VALUES];
+    /// Checked before the cast, which is undefined for NaN and out of range values
+    bool mode_ok = isfinite(mode) && mode == floor(mode) && mode >= 0 && mode < DRIVE_MODE_COUNT;
+    if (mode_ok) sim->drive_mode = (DriveMode)mode;
+    sim->regen_braking = values[SIM_VALUES + 1] != 0;
+    snapshot->time = header.time;
+    snapshot->steps = (long)header.steps;
+    ev_wave_history_init(&snapshot->history);
+    ok = mode_ok && snapshot->integrator.solver >= 0 && snapshot->integrator.solver < EV_SOLVER_COUNT;
+    if (ok && (header.flags & HAS_PACK)) {
+        EVPackParams params;
+        ok = read_values(file, &params, sizeof(params), 1) && params.series >= 1 &&
+             params.series <= EV_PACK_MAX_SERIES && params.parallel >= 1 && params.parallel <= EV_PACK_MAX_PARALLEL &&
+             (sim->pack = ev_pack_new(&params)) != NULL;
+    }
+    EVThermal *thermal = NULL;
+    if (ok && (header.flags & HAS_THERMAL)) {
+        EVThermalParams params;
+        int32_t counts[2];
+        ok = read_values(file, &params, sizeof(params), 1) && read_values(file, counts, sizeof(int32_t), 2) &&
+             (thermal = sim->thermal = ev_thermal_new(&params, sim->pack)) != NULL &&
+             thermal->nodes == counts[0] && counts[1] >= 0 && counts[1] < EV_THERMAL_FLOW_LEVELS;
+        if (ok) {
+            double state[THERMAL_VALUES];
+            ok = read_values(file, thermal->temp, sizeof(double), thermal->nodes) &&
+                 read_values(file, thermal->heat, sizeof(double), thermal->nodes) &&
+                 read_values(file, state, sizeof(double), THERMAL_VALUES);
+            for (size_t v = 0; ok && v < THERMAL_VALUES; v++) FIELD(thermal, thermal_values[v]) = state[v];
+            thermal->flow_level = counts[1];
+        }
+    }
+    if (ok && sim->pack) {
+        EVPack *pack = sim->pack;
+        for (size_t a = 0; ok && a < CELL_ARRAYS; a++) {
+            ok = read_values(file, ARRAY(pack, cell_arrays[a]), sizeof(double), pack->cells);
+        }
+        double outputs[PACK_VALUES];
+        if (ok) ok = read_values(file, outputs, sizeof(double), PACK_VALUES);
+        for (size_t v = 0; ok && v < PACK_VALUES; v++) FIELD(pack, pack_values[v]) = outputs[v];
+    }
+    if (ok && (header.flags & HAS_HISTORY)) {
+        ok = snapshot->has_history = load_history(file, &snapshot->history, (long)header.samples);
+    }
+    fclose(file);
+    if (!ok) {
+        ev_snapshot_free(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
@@ -0,0 +1,57 @@
+#ifndef EV_SNAPSHOT_H
+#define EV_SNAPSHOT_H
+
+#include <stdbool.h>
+#include "ev_sim.h"
+#include "ev_integrator.h"
+#include "ev_waveform.h"
+
+/// A run frozen at one instant: the vehicle with its pack and thermal network, the solver
+/// state, the clock and, when given, the waveform history. Immutable once taken, so any
+/// number of threads may restore or fork it at the same time. Drive cycles are not part of
+/// it: a rewound cycle catches up at its next ev_cycle_target() call
+typedef struct EVSnapshot EVSnapshot;
+
+/// One live continuation of a snapshot, owning its pack, thermal network and history
+typedef struct {
+    EVSimulation sim;          // sim.pack and sim.thermal are this branch's own
+    EVIntegrator integrator;
+    double time;               // s since the start of the run
+    long steps;
+    EVWaveHistory history;     // shares the snapshot's samples until the branch appends
+} EVBranch;
+
+/// integrator and history may be NULL; the pack and thermal network are copied, the
+/// history shares its samples copy-on-write. NULL when out of memory
+EVSnapshot *ev_snapshot_take(const EVSimulation *sim, const EVIntegrator *integrator, double time, long steps,
+                             const EVWaveHistory *history);
+void ev_snapshot_free(EVSnapshot *snapshot);
+
+const EVSimulation *ev_snapshot_sim(const EVSnapshot *snapshot);
+double ev_snapshot_time(const EVSnapshot *snapshot);
+long ev_snapshot_steps(const EVSnapshot *snapshot);
+bool ev_snapshot_has_history(const EVSnapshot *snapshot);
+
+/// Puts sim (and whichever of the other outputs are not NULL) back to the snapshot. sim keeps
+/// its own motor map, route, drivetrain, vehicle constants, pack and thermal network, the last
+/// two of which must have the snapshot's layout; false, with nothing changed, when they do
+/// not. history is freed and replaced. An inverter model is not part of the snapshot: sim
+/// keeps its own, carrying on from its current electrical state
+bool ev_snapshot_restore(const EVSnapshot *snapshot, EVSimulation *sim, EVIntegrator *integrator,
+                         double *time, long *steps, EVWaveHistory *history);
+
+/// count independent branches, each with private copies of the per-step state (pack cells,
+/// thermal nodes) and the history shared copy-on-write, so only the chunk a branch appends
+/// to is ever duplicated. Change a branch's inputs (drive mode, regen, ...) in branch->sim
+/// before running it; branches start without an inverter model. false when out of memory, with no branch left allocated
+bool ev_snapshot_fork(const EVSnapshot *snapshot, EVBranch *branches, int count);
+void ev_branch_free(EVBranch *branch);
+
+/// Compact binary file: the pack's per-cell state and the waveform samples only; per-cell
+/// parameters and the min/max pyramid are rebuilt on load. The motor map and route pointers
+/// are not stored, a loaded snapshot has neither, and its drivetrain and vehicle constants
+/// are the defaults
+bool ev_snapshot_save(const EVSnapshot *snapshot, const char *path);
+EVSnapshot *ev_snapshot_load(const char *path);
+
+#endif
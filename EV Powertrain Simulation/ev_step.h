@@ -0,0 +1,78 @@
+#ifndef EV_STEP_H
+#define EV_STEP_H
+
+#include "ev_sim.h"
+#include <math.h>
+
+/// The explicit vehicle step behind ev_sim_step(). ev_sim.c and ev_integrator.c instantiate it
+/// once per EV_DRIVETRAIN_KERNELS entry with constant topology and strategy, so no step
+/// tests the drivetrain layout at run time
+static EV_ALWAYS_INLINE void ev_step_kernel(EVSimulation *sim, const EVInput *input, double dt,
+                                            EVDrivetrainTopology topology, EVSplitStrategy strategy) {
+    const EVVehicleParams *vehicle = &sim->vehicle;
+    double mass = vehicle->mass;
+    double drag_coeff = vehicle->drag_coeff;
+    double frontal_area = vehicle->frontal_area;
+    double air_density = vehicle->air_density;
+    double rolling_resistance = vehicle->rolling_resistance;
+    const DriveModeParams *mode = &drive_mode_params[sim->drive_mode];
+    double max_accel = mode->max_accel;
+    double power_factor = mode->power_factor;
+    double climb = ev_sim_climb(sim);
+    sim->acceleration = input->acceleration;
+    if (sim->acceleration > max_accel + climb) sim->acceleration = max_accel + climb;
+    if (sim->acceleration < -max_accel + climb) sim->acceleration = -max_accel + climb;
+    double speed_ms = sim->vehicle_speed / 3.6;
+    double load = 1.0;
+    if (sim->route) {   /// Grade, wind, air density and mass from the route table, per unit mass
+        const EVRouteSample *road = ev_route_at(sim->route, sim->distance);
+        double air = speed_ms + road->headwind;
+        speed_ms += (sim->acceleration - road->drag_k * air * fabs(air) - road->resistance) * dt;
+        load = road->load;
+    } else {
+        double force = mass * sim->acceleration;
+        double drag = 0.5 * drag_coeff * frontal_area * air_density * speed_ms * speed_ms;
+        double rolling = rolling_resistance * mass * EV_GRAVITY;
+        double total_force = force - drag - rolling;
+        speed_ms += (total_force / mass) * dt;
+    }
+    sim->vehicle_speed = speed_ms * 3.6;
+    if (sim->vehicle_speed < 0) sim->vehicle_speed = 0;
+    if (sim->vehicle_speed > EV_MAX_SPEED) sim->vehicle_speed = EV_MAX_SPEED;
+    const EVDrivetrain *drivetrain = &sim->drivetrain;
+    sim->motor_rpm = ev_drivetrain_rpm(drivetrain, topology, sim->vehicle_speed);
+    sim->motor_torque = ev_drivetrain_torque(drivetrain, topology, sim->motor_power * power_factor,
+                                             sim->vehicle_speed);
+    sim->distance += sim->vehicle_speed / 3600 * dt;
+    double temp_efficiency = ev_sim_temp_efficiency(sim);
+    double shaft_power = sim->motor_power * power_factor * (0.5 + 0.5 * fabs(sim->acceleration) * load);
+    double motor_efficiency = sim->inverter ? sim->inverter->efficiency :
+                              ev_drivetrain_efficiency(drivetrain, topology, strategy, sim->motor_map,
+                                                       sim->motor_power, sim->vehicle_speed, shaft_power);
+    double power_use = shaft_power / (motor_efficiency * temp_efficiency);
+    double battery_power = power_use;
+    sim->energy_consumed += power_use / 3600 * dt;
+    sim->soc = 100 - (sim->energy_consumed / sim->battery_capacity * 100);
+    if (sim->soc < 0) sim->soc = 0;
+    if (sim->acceleration < 0 && sim->regen_braking) {   /// Regenerative braking
+        double regen_energy = sim->regen_efficiency * power_use * 0.5;
+        sim->energy_consumed -= regen_energy / 3600 * dt;
+        battery_power -= regen_energy;
+        sim->soc = 100 - (sim->energy_consumed / sim->battery_capacity * 100);
+        if (sim->soc > 100) sim->soc = 100;
+    }
+    sim->battery_temp += (power_use / sim->motor_power) * 0.1 * dt;
+    sim->battery_temp -= 0.05 * dt; /// Cooling effect
+    if (sim->battery_temp < 10) sim->battery_temp = 10;
+    if (sim->battery_temp > 70) sim->battery_temp = 70;
+    ev_sim_battery_step(sim, battery_power, dt);
+    if (sim->thermal) ev_sim_thermal_step(sim, shaft_power, motor_efficiency, dt);
+    if (sim->inverter) ev_sim_inverter_step(sim, shaft_power, dt);
+    if (sim->distance > 0) {  /// Calculate energy efficiency
+        sim->energy_efficiency = (sim->energy_consumed * 1000) / sim->distance;
+    } else {
+        sim->energy_efficiency = 0;
+    }
+}
+
+#endif
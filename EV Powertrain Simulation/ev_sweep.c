@@ -0,0 +1,333 @@
+#include "ev_sweep.h"
+#include "ev_cycle.h"
+#include <pthread.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/// Each worker owns a contiguous range of run indices; thieves take the upper half
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+    char pad[64];
+} WorkQueue;
+
+typedef struct {
+    const EVSimulation *configs;
+    const EVSweepRunOptions *options;
+    EVSweepCallback callback;
+    void *user_data;
+    pthread_mutex_t callback_lock;
+    WorkQueue *queues;
+    int workers;
+} SweepPool;
+
+typedef struct {
+    SweepPool *pool;
+    int id;
+    int failed;                // runs whose pack, thermal network or cycle could not be set up
+} SweepWorker;
+
+int ev_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+void ev_sweep_spec_init(EVSweepSpec *spec) {
+    spec->method = EV_SWEEP_GRID;
+    spec->voltage = (EVSweepAxis){ 100, 1000, 4 };
+    spec->capacity = (EVSweepAxis){ 10, 200, 4 };
+    spec->power = (EVSweepAxis){ 50, 500, 4 };
+    spec->regen = (EVSweepAxis){ 0, 100, 3 };
+    spec->mode_mask = (1u << DRIVE_MODE_COUNT) - 1;
+    spec->split = (EVSweepAxis){ 0, 100, 0 };
+    spec->split_mask = 0;
+    spec->samples = 256;
+    spec->seed = 1;
+}
+
+static double axis_level(const EVSweepAxis *axis, int i) {
+    if (axis->levels <= 1) return axis->min;
+    return axis->min + (axis->max - axis->min) * i / (axis->levels - 1);
+}
+
+static void apply_sample(EVSimulation *sim, double voltage, double capacity, double power,
+                         double regen, DriveMode mode) {
+    sim->battery_voltage = voltage;
+    sim->battery_capacity = capacity;
+    sim->motor_power = power;
+    sim->regen_efficiency = regen / 100.0;
+    sim->regen_braking = regen > 0;
+    sim->drive_mode = mode;
+}
+
+static void shuffle(int *perm, int n, uint64_t *state) {
+    for (int i = 0; i < n; i++) perm[i] = i;
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)(ev_random_next(state) % (uint64_t)(i + 1));
+        int tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+}
+
+/// One stratum per sample on every axis, each axis permuted independently
+static double lhs_value(const EVSweepAxis *axis, int stratum, int n, uint64_t *state) {
+    return axis->min + (axis->max - axis->min) * (stratum + ev_random_uniform(state)) / n;
+}
+
+/// Torque-split strategies to sweep: the spec's for a two-axle drivetrain, else the base's
+static int split_strategies(const EVSweepSpec *spec, const EVSimulation *base, EVSplitStrategy *strategies) {
+    int count = 0;
+    if (ev_drivetrain_two_axle(&base->drivetrain) && spec->split_mask) {
+        for (int s = 0; s < EV_SPLIT_COUNT; s++) {
+            if (spec->split_mask & (1u << s)) strategies[count++] = (EVSplitStrategy)s;
+        }
+    } else {
+        strategies[count++] = base->drivetrain.strategy;
+    }
+    return count;
+}
+
+/// Only a fixed split has a front share to vary
+static int split_levels(const EVSweepSpec *spec, const EVSimulation *base, EVSplitStrategy strategy) {
+    if (strategy != EV_SPLIT_FIXED || !ev_drivetrain_two_axle(&base->drivetrain)) return 1;
+    return spec->split.levels > 0 ? spec->split.levels : 1;
+}
+
+static void apply_split(EVSimulation *sim, const EVSweepSpec *spec, EVSplitStrategy strategy, double split) {
+    sim->drivetrain.strategy = strategy;
+    if (strategy == EV_SPLIT_FIXED && spec->split.levels > 0) sim->drivetrain.split = split / 100.0;
+}
+
+int ev_sweep_build(const EVSweepSpec *spec, const EVSimulation *base, EVSimulation **configs) {
+    DriveMode modes[DRIVE_MODE_COUNT];
+    int mode_count = 0;
+    for (int m = 0; m < DRIVE_MODE_COUNT; m++) {
+        if (spec->mode_mask & (1u << m)) modes[mode_count++] = (DriveMode)m;
+    }
+    if (mode_count == 0) return -1;
+    EVSplitStrategy strategies[EV_SPLIT_COUNT];
+    int strategy_count = split_strategies(spec, base, strategies);
+    if (spec->method == EV_SWEEP_GRID) {
+        int lv = spec->voltage.levels > 0 ? spec->voltage.levels : 1;
+        int lc = spec->capacity.levels > 0 ? spec->capacity.levels : 1;
+        int lp = spec->power.levels > 0 ? spec->power.levels : 1;
+        int lr = spec->regen.levels > 0 ? spec->regen.levels : 1;
+        long splits = 0;
+        for (int s = 0; s < strategy_count; s++) splits += split_levels(spec, base, strategies[s]);
+        long total = (long)lv * lc * lp * lr * mode_count * splits;
+        if (total > 100000000) return -1;
+        EVSimulation *out = malloc(sizeof(EVSimulation) * total);
+        if (!out) return -1;
+        int n = 0;
+        for (int s = 0; s < strategy_count; s++)
+            for (int l = 0; l < split_levels(spec, base, strategies[s]); l++)
+                for (int m = 0; m < mode_count; m++)
+                    for (int v = 0; v < lv; v++)
+                        for (int c = 0; c < lc; c++)
+                            for (int p = 0; p < lp; p++)
+                                for (int r = 0; r < lr; r++) {
+                                    out[n] = *base;
+                                    apply_sample(&out[n], axis_level(&spec->voltage, v),
+                                                 axis_level(&spec->capacity, c), axis_level(&spec->power, p),
+                                                 axis_level(&spec->regen, r), modes[m]);
+                                    apply_split(&out[n], spec, strategies[s], axis_level(&spec->split, l));
+                                    n++;
+                                }
+        *configs = out;
+        return n;
+    }
+    int n = spec->samples;
+    if (n <= 0) return -1;
+    EVSimulation *out = malloc(sizeof(EVSimulation) * n);
+    /// Two more dimensions only when they vary, so other sweeps keep their samples for a seed
+    bool vary_split = ev_drivetrain_two_axle(&base->drivetrain) && (spec->split_mask || spec->split.levels > 0);
+    int dims = vary_split ? 7 : 5;
+    int *perm = malloc(sizeof(int) * n * dims);
+    if (!out || !perm) {
+        free(out);
+        free(perm);
+        return -1;
+    }
+    uint64_t state = spec->seed;
+    for (int d = 0; d < dims; d++) shuffle(perm + d * n, n, &state);
+    for (int i = 0; i < n; i++) {
+        out[i] = *base;
+        apply_sample(&out[i],
+                     lhs_value(&spec->voltage, perm[i], n, &state),
+                     lhs_value(&spec->capacity, perm[n + i], n, &state),
+                     lhs_value(&spec->power, perm[2 * n + i], n, &state),
+                     lhs_value(&spec->regen, perm[3 * n + i], n, &state),
+                     modes[(long)perm[4 * n + i] * mode_count / n]);
+        if (vary_split) {
+            apply_split(&out[i], spec, strategies[(long)perm[5 * n + i] * strategy_count / n],
+                        lhs_value(&spec->split, perm[6 * n + i], n, &state));
+        }
+    }
+    free(perm);
+    *configs = out;
+    return n;
+}
+
+static bool take_local(WorkQueue *queue, int *run) {
+    bool ok = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->next < queue->end) {
+        *run = queue->next++;
+        ok = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ok;
+}
+
+/// Moves the upper half of a victim's remaining range into our own queue
+static bool steal(SweepPool *pool, int thief) {
+    for (int k = 1; k < pool->workers; k++) {
+        WorkQueue *victim = &pool->queues[(thief + k) % pool->workers];
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->end - victim->next;
+        if (remaining <= 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        int mid = victim->end - (remaining + 1) / 2;
+        int end = victim->end;
+        victim->end = mid;
+        pthread_mutex_unlock(&victim->lock);
+        WorkQueue *own = &pool->queues[thief];
+        pthread_mutex_lock(&own->lock);
+        own->next = mid;
+        own->end = end;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    return false;
+}
+
+static void *sweep_worker(void *arg) {
+    SweepWorker *worker = arg;
+    SweepPool *pool = worker->pool;
+    const EVSweepRunOptions *options = pool->options;
+    /// The network's factorization only depends on dt and flow, so reusing it across runs
+    /// leaves one or two factorizations per worker rather than per run
+    EVThermal *thermal = NULL;
+    int run;
+    for (;;) {
+        if (!take_local(&pool->queues[worker->id], &run)) {
+            if (!steal(pool, worker->id)) break;
+            continue;
+        }
+        EVSweepResult result = { .run = run, .worker = worker->id, .config = pool->configs[run] };
+        EVSimulation sim = pool->configs[run];
+        /// Packs carry per-cell state, so each run builds one sized to its own capacity
+        EVPack *pack = NULL;
+        if (options->pack_series > 0) {
+            EVPackParams params;
+            ev_pack_params_default(&params, options->pack_series, options->pack_parallel, sim.battery_capacity);
+            pack = ev_pack_new(&params);
+        }
+        sim.pack = pack;
+        if (options->thermal && !thermal) {
+            EVThermalParams params;
+            ev_thermal_params_default(&params);
+            params.coolant_flow = options->coolant_flow;
+            thermal = ev_thermal_new(&params, pack);
+        }
+        sim.thermal = thermal;
+        /// Each worker streams its own cursor so CSV traces are never shared or loaded whole
+        EVCycle *cycle = NULL;
+        if (options->cycle_path) cycle = ev_cycle_open_csv(options->cycle_path);
+        else if (options->cycle_name) cycle = ev_cycle_open_builtin(options->cycle_name);
+        if ((options->pack_series > 0 && !pack) || (options->thermal && !thermal) ||
+            ((options->cycle_name || options->cycle_path) && !cycle)) {
+            /// Running the simple model instead, or writing a zeroed row, would pass for a result
+            worker->failed++;
+            ev_cycle_close(cycle);
+            ev_pack_free(pack);
+            continue;
+        }
+        ev_sim_reset(&sim);
+        sim.is_running = true;
+        EVIntegrator integrator;
+        ev_integrator_init(&integrator, options->solver);
+        integrator.rtol = options->rtol;
+        if (cycle) {
+            ev_cycle_set_repeat(cycle, true);
+            ev_integrator_run(&integrator, &sim, NULL, cycle, options->dt, options->max_time, true,
+                              &result.summary);
+            ev_cycle_close(cycle);
+        } else {
+            ev_integrator_run(&integrator, &sim, &options->profile, NULL, options->dt, options->max_time,
+                              true, &result.summary);
+        }
+        if (pack) result.config.battery_voltage = pack->params.series * EV_CELL_NOMINAL_VOLTAGE;
+        ev_pack_free(pack);
+        if (pool->callback) {
+            pthread_mutex_lock(&pool->callback_lock);
+            pool->callback(&result, pool->user_data);
+            pthread_mutex_unlock(&pool->callback_lock);
+        }
+    }
+    ev_thermal_free(thermal);
+    return NULL;
+}
+
+int ev_sweep_run(const EVSimulation *configs, int count, const EVSweepRunOptions *options,
+                 EVSweepCallback callback, void *user_data) {
+    int workers = options->threads > 0 ? options->threads : ev_cpu_count();
+    if (workers > count) workers = count;
+    if (workers < 1) return 0;
+    SweepPool pool = {
+        .configs = configs,
+        .options = options,
+        .callback = callback,
+        .user_data = user_data,
+        .workers = workers
+    };
+    pool.queues = calloc(workers, sizeof(WorkQueue));
+    SweepWorker *args = calloc(workers, sizeof(SweepWorker));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    if (!pool.queues || !args || !threads) {
+        free(pool.queues);
+        free(args);
+        free(threads);
+        return -1;
+    }
+    pthread_mutex_init(&pool.callback_lock, NULL);
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_init(&pool.queues[w].lock, NULL);
+        pool.queues[w].next = (int)((long)count * w / workers);
+        pool.queues[w].end = (int)((long)count * (w + 1) / workers);
+        args[w].pool = &pool;
+        args[w].id = w;
+    }
+    int started = 0;
+    for (int w = 1; w < workers; w++) {
+        if (pthread_create(&threads[w], NULL, sweep_worker, &args[w]) != 0) break;
+        started = w;
+    }
+    /// The calling thread is worker 0; anything a failed thread owned gets stolen
+    sweep_worker(&args[0]);
+    for (int w = 1; w <= started; w++) pthread_join(threads[w], NULL);
+    int failed = 0;
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_destroy(&pool.queues[w].lock);
+        failed += args[w].failed;
+    }
+    pthread_mutex_destroy(&pool.callback_lock);
+    free(pool.queues);
+    free(args);
+    free(threads);
+    return failed;
+}
@@ -0,0 +1,71 @@
+#ifndef EV_SWEEP_H
+#define EV_SWEEP_H
+
+#include <stdint.h>
+#include "ev_sim.h"
+#include "ev_integrator.h"
+
+typedef enum {
+    EV_SWEEP_GRID,
+    EV_SWEEP_LHS               // Latin hypercube
+} EVSweepMethod;
+
+typedef struct {
+    double min;
+    double max;
+    int levels;                // grid points, ignored by LHS
+} EVSweepAxis;
+
+typedef struct {
+    EVSweepMethod method;
+    EVSweepAxis voltage;       // V
+    EVSweepAxis capacity;      // kWh
+    EVSweepAxis power;         // kW
+    EVSweepAxis regen;         // %
+    unsigned mode_mask;        // bit (1 << DriveMode) per mode to include
+    /// Two-axle drivetrains only, ignored for the others
+    EVSweepAxis split;         // % of the shaft power on the front axle for EV_SPLIT_FIXED;
+                               // 0 levels keeps the base's
+    unsigned split_mask;       // bit (1 << EVSplitStrategy) per strategy; 0 keeps the base's
+    int samples;               // LHS sample count
+    uint64_t seed;
+} EVSweepSpec;
+
+typedef struct {
+    EVProfile profile;
+    const char *cycle_name;    // built-in drive cycle, repeated; overrides profile
+    const char *cycle_path;    // CSV drive cycle, repeated; overrides profile
+    double dt;                 // s
+    double max_time;           // s, cap for runs that never empty the battery
+    EVSolver solver;
+    double rtol;               // RK45 relative tolerance
+    int pack_series;           // > 0 gives every run its own cell-level pack
+    int pack_parallel;
+    bool thermal;              // each worker keeps one thermal network, reset between runs
+    double coolant_flow;       // relative to nominal; < 0 leaves the pump to the thermostat
+    int threads;               // 0 uses every online CPU
+} EVSweepRunOptions;
+
+typedef struct {
+    int run;
+    int worker;
+    EVSimulation config;
+    EVRunSummary summary;
+} EVSweepResult;
+
+/// Called once per finished run, failed ones excepted, serialized across workers
+typedef void (*EVSweepCallback)(const EVSweepResult *result, void *user_data);
+
+int ev_cpu_count(void);
+void ev_sweep_spec_init(EVSweepSpec *spec);
+
+/// Expands the spec into *configs (malloc'd), returns the count or -1
+int ev_sweep_build(const EVSweepSpec *spec, const EVSimulation *base, EVSimulation **configs);
+
+/// Runs every config to empty on a work-stealing pool. A run whose pack, thermal network or
+/// cycle cannot be set up is skipped without a callback. Returns the number of such runs, or
+/// -1 if the pool could not be started
+int ev_sweep_run(const EVSimulation *configs, int count, const EVSweepRunOptions *options,
+                 EVSweepCallback callback, void *user_data);
+
+#endif
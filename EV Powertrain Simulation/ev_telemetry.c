@@ -0,0 +1,412 @@
+#include "ev_telemetry.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// Values are stored in host byte order (little-endian on every supported target)
+#define FILE_MAGIC "EVTELEM1"
+#define FILE_VERSION 1
+#define CHUNK_MAGIC 0x4b4e4843u    // "CHNK"
+
+#define ENCODING_RAW 0
+#define ENCODING_XOR 1
+#define ENCODING_MISSING 2         // reader only: column absent from an older file
+
+#define FIRST_RELEASE_COLUMNS 16   // columns written before battery_current was added
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t columns;
+    uint32_t chunk_rows;
+    uint32_t reserved;
+} FileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t rows;
+    uint32_t bytes;            // payload after the column directory
+    uint32_t reserved;
+} ChunkHeader;
+
+typedef struct {
+    uint32_t encoding;
+    uint32_t bytes;
+} ColumnEntry;
+
+const char *const ev_telemetry_column_names[EV_TLM_COLUMN_COUNT] = {
+    "time_s", "battery_voltage_v", "battery_capacity_kwh", "motor_power_kw",
+    "motor_torque_nm", "motor_rpm", "vehicle_speed_kmh", "acceleration_ms2",
+    "soc_pct", "distance_km", "energy_consumed_kwh", "regen_efficiency",
+    "battery_temp_c", "energy_efficiency_whkm", "drive_mode", "flags", "battery_current_a"
+};
+
+struct EVTelemetryWriter {
+    FILE *file;
+    bool compress;
+    bool failed;
+    int rows;
+    double columns[EV_TLM_COLUMN_COUNT][EV_TELEMETRY_CHUNK_ROWS];
+    unsigned char scratch[EV_TLM_COLUMN_COUNT][EV_TELEMETRY_CHUNK_ROWS * 9];
+};
+
+typedef struct {
+    long first_row;
+    int rows;
+    uint32_t encoding[EV_TLM_COLUMN_COUNT];
+    uint32_t bytes[EV_TLM_COLUMN_COUNT];
+    const unsigned char *column[EV_TLM_COLUMN_COUNT];
+} ChunkIndex;
+
+struct EVTelemetryReader {
+    unsigned char *data;
+    size_t size;
+    bool mapped;
+    long rows;
+    ChunkIndex *chunks;
+    int chunk_count;
+    int cached[EV_TLM_COLUMN_COUNT];    // chunk decoded into cache, -1 for none
+    double cache[EV_TLM_COLUMN_COUNT][EV_TELEMETRY_CHUNK_ROWS];
+};
+
+static uint64_t double_bits(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+/// XOR against the previous value, then keep only the bytes between the zero runs:
+/// one control byte (leading << 4 | trailing zero bytes, 0x80 for a repeat) plus the rest
+static size_t encode_xor(const double *values, int count, unsigned char *out) {
+    unsigned char *p = out;
+    uint64_t prev = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t bits = double_bits(values[i]);
+        uint64_t x = bits ^ prev;
+        prev = bits;
+        if (x == 0) {
+            *p++ = 0x80;
+            continue;
+        }
+        int lz = __builtin_clzll(x) / 8;
+        int tz = __builtin_ctzll(x) / 8;
+        *p++ = (unsigned char)(lz << 4 | tz);
+        for (int b = tz; b < 8 - lz; b++) *p++ = (unsigned char)(x >> (8 * b));
+    }
+    return (size_t)(p - out);
+}
+
+static bool decode_xor(const unsigned char *in, size_t size, int count, double *out) {
+    const unsigned char *p = in, *end = in + size;
+    uint64_t prev = 0;
+    for (int i = 0; i < count; i++) {
+        if (p >= end) return false;
+        unsigned c = *p++;
+        uint64_t x = 0;
+        if (c != 0x80) {
+            int lz = c >> 4, tz = c & 15;
+            if (lz + tz > 7 || end - p < 8 - lz - tz) return false;
+            for (int b = tz; b < 8 - lz; b++) x |= (uint64_t)*p++ << (8 * b);
+        }
+        prev ^= x;
+        out[i] = bits_double(prev);
+    }
+    return true;
+}
+
+static void flush_chunk(EVTelemetryWriter *writer) {
+    if (writer->rows == 0) return;
+    ColumnEntry entries[EV_TLM_COLUMN_COUNT];
+    ChunkHeader header = { CHUNK_MAGIC, (uint32_t)writer->rows, 0, 0 };
+    size_t raw_bytes = sizeof(double) * writer->rows;
+    for (int c = 0; c < EV_TLM_COLUMN_COUNT; c++) {
+        entries[c] = (ColumnEntry){ ENCODING_RAW, (uint32_t)raw_bytes };
+        if (writer->compress) {
+            size_t n = encode_xor(writer->columns[c], writer->rows, writer->scratch[c]);
+            if (n < raw_bytes) entries[c] = (ColumnEntry){ ENCODING_XOR, (uint32_t)n };
+        }
+        header.bytes += entries[c].bytes;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, writer->file) == 1 &&
+              fwrite(entries, sizeof(entries), 1, writer->file) == 1;
+    for (int c = 0; ok && c < EV_TLM_COLUMN_COUNT; c++) {
+        const void *src = entries[c].encoding == ENCODING_XOR ? (const void *)writer->scratch[c]
+                                                              : (const void *)writer->columns[c];
+        ok = fwrite(src, entries[c].bytes, 1, writer->file) == 1;
+    }
+    if (!ok) writer->failed = true;
+    writer->rows = 0;
+}
+
+EVTelemetryWriter *ev_telemetry_create(const char *path, bool compress) {
+    EVTelemetryWriter *writer = malloc(sizeof(EVTelemetryWriter));
+    if (!writer) return NULL;
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        free(writer);
+        return NULL;
+    }
+    writer->compress = compress;
+    writer->failed = false;
+    writer->rows = 0;
+    FileHeader header = { FILE_MAGIC, FILE_VERSION, EV_TLM_COLUMN_COUNT, EV_TELEMETRY_CHUNK_ROWS, 0 };
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1) writer->failed = true;
+    return writer;
+}
+
+bool ev_telemetry_append(EVTelemetryWriter *writer, double time, const EVSimulation *sim) {
+    int r = writer->rows;
+    writer->columns[EV_TLM_TIME][r] = time;
+    writer->columns[EV_TLM_BATTERY_VOLTAGE][r] = sim->battery_voltage;
+    writer->columns[EV_TLM_BATTERY_CAPACITY][r] = sim->battery_capacity;
+    writer->columns[EV_TLM_MOTOR_POWER][r] = sim->motor_power;
+    writer->columns[EV_TLM_MOTOR_TORQUE][r] = sim->motor_torque;
+    writer->columns[EV_TLM_MOTOR_RPM][r] = sim->motor_rpm;
+    writer->columns[EV_TLM_VEHICLE_SPEED][r] = sim->vehicle_speed;
+    writer->columns[EV_TLM_ACCELERATION][r] = sim->acceleration;
+    writer->columns[EV_TLM_SOC][r] = sim->soc;
+    writer->columns[EV_TLM_DISTANCE][r] = sim->distance;
+    writer->columns[EV_TLM_ENERGY_CONSUMED][r] = sim->energy_consumed;
+    writer->columns[EV_TLM_REGEN_EFFICIENCY][r] = sim->regen_efficiency;
+    writer->columns[EV_TLM_BATTERY_TEMP][r] = sim->battery_temp;
+    writer->columns[EV_TLM_ENERGY_EFFICIENCY][r] = sim->energy_efficiency;
+    writer->columns[EV_TLM_DRIVE_MODE][r] = sim->drive_mode;
+    writer->columns[EV_TLM_FLAGS][r] = (sim->is_running ? 1 : 0) | (sim->regen_braking ? 2 : 0);
+    writer->columns[EV_TLM_BATTERY_CURRENT][r] = sim->battery_current;
+    if (++writer->rows == EV_TELEMETRY_CHUNK_ROWS) flush_chunk(writer);
+    return !writer->failed;
+}
+
+bool ev_telemetry_close(EVTelemetryWriter *writer) {
+    if (!writer) return true;
+    flush_chunk(writer);
+    bool ok = !writer->failed;
+    if (fclose(writer->file) != 0) ok = false;
+    free(writer);
+    return ok;
+}
+
+static bool map_file(EVTelemetryReader *reader, const char *path) {
+#ifdef _WIN32
+    /// No mmap here; read the whole recording instead
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    reader->data = size > 0 ? malloc(size) : NULL;
+    bool ok = reader->data && fread(reader->data, size, 1, file) == 1;
+    fclose(file);
+    if (!ok) free(reader->data);
+    reader->size = ok ? (size_t)size : 0;
+    reader->mapped = false;
+    return ok;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    reader->data = data;
+    reader->size = (size_t)st.st_size;
+    reader->mapped = true;
+    return true;
+#endif
+}
+
+static void unmap_file(EVTelemetryReader *reader) {
+#ifndef _WIN32
+    if (reader->mapped) {
+        munmap(reader->data, reader->size);
+        return;
+    }
+#endif
+    free(reader->data);
+}
+
+/// Walks the chunk headers once; stops at the first short or damaged chunk
+static bool index_chunks(EVTelemetryReader *reader, size_t offset, uint32_t columns) {
+    int allocated = 0;
+    size_t directory = sizeof(ColumnEntry) * columns;
+    while (reader->size - offset >= sizeof(ChunkHeader) + directory) {
+        ChunkHeader header;
+        memcpy(&header, reader->data + offset, sizeof(header));
+        if (header.magic != CHUNK_MAGIC || header.rows == 0 || header.rows > EV_TELEMETRY_CHUNK_ROWS) break;
+        size_t payload = offset + sizeof(header) + directory;
+        if (reader->size - payload < header.bytes) break;
+        if (reader->chunk_count == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            ChunkIndex *grown = realloc(reader->chunks, sizeof(ChunkIndex) * allocated);
+            if (!grown) return false;
+            reader->chunks = grown;
+        }
+        ChunkIndex *chunk = &reader->chunks[reader->chunk_count];
+        chunk->first_row = reader->rows;
+        chunk->rows = (int)header.rows;
+        size_t at = payload;
+        bool valid = true;
+        for (uint32_t c = 0; c < columns; c++) {
+            ColumnEntry entry;
+            memcpy(&entry, reader->data + offset + sizeof(header) + sizeof(entry) * c, sizeof(entry));
+            if (at + entry.bytes > payload + header.bytes ||
+                (entry.encoding == ENCODING_RAW && entry.bytes != sizeof(double) * header.rows) ||
+                entry.encoding > ENCODING_XOR) {
+                valid = false;
+                break;
+            }
+            if (c < EV_TLM_COLUMN_COUNT) {
+                chunk->encoding[c] = entry.encoding;
+                chunk->bytes[c] = entry.bytes;
+                chunk->column[c] = reader->data + at;
+            }
+            at += entry.bytes;
+        }
+        if (!valid) break;
+        for (int c = (int)columns; c < EV_TLM_COLUMN_COUNT; c++) chunk->encoding[c] = ENCODING_MISSING;
+        reader->chunk_count++;
+        reader->rows += header.rows;
+        offset = payload + header.bytes;
+    }
+    return true;
+}
+
+EVTelemetryReader *ev_telemetry_open(const char *path) {
+    EVTelemetryReader *reader = calloc(1, sizeof(EVTelemetryReader));
+    if (!reader) return NULL;
+    if (!map_file(reader, path)) {
+        free(reader);
+        return NULL;
+    }
+    FileHeader header;
+    if (reader->size < sizeof(header)) goto fail;
+    memcpy(&header, reader->data, sizeof(header));
+    /// Newer writers may append columns; older ones lack the ones added since
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != FILE_VERSION || header.columns < FIRST_RELEASE_COLUMNS) goto fail;
+    if (!index_chunks(reader, sizeof(header), header.columns)) goto fail;
+    for (int c = 0; c < EV_TLM_COLUMN_COUNT; c++) reader->cached[c] = -1;
+    return reader;
+fail:
+    unmap_file(reader);
+    free(reader->chunks);
+    free(reader);
+    return NULL;
+}
+
+void ev_telemetry_free(EVTelemetryReader *reader) {
+    if (!reader) return;
+    unmap_file(reader);
+    free(reader->chunks);
+    free(reader);
+}
+
+long ev_telemetry_rows(const EVTelemetryReader *reader) {
+    return reader->rows;
+}
+
+static int find_chunk(const EVTelemetryReader *reader, long row) {
+    int lo = 0, hi = reader->chunk_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (reader->chunks[mid].first_row <= row) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/// XOR columns are decoded once per chunk; raw ones are read straight out of the mapping
+static const double *decoded_column(EVTelemetryReader *reader, int chunk_id, int column) {
+    const ChunkIndex *chunk = &reader->chunks[chunk_id];
+    if (reader->cached[column] != chunk_id) {
+        if (!decode_xor(chunk->column[column], chunk->bytes[column], chunk->rows,
+                        reader->cache[column])) {
+            memset(reader->cache[column], 0, sizeof(reader->cache[column]));
+        }
+        reader->cached[column] = chunk_id;
+    }
+    return reader->cache[column];
+}
+
+static double column_value(EVTelemetryReader *reader, int chunk_id, int column, int offset) {
+    const ChunkIndex *chunk = &reader->chunks[chunk_id];
+    if (chunk->encoding[column] == ENCODING_MISSING) return 0;
+    if (chunk->encoding[column] == ENCODING_RAW) {
+        double v;
+        memcpy(&v, chunk->column[column] + sizeof(double) * offset, sizeof(v));
+        return v;
+    }
+    return decoded_column(reader, chunk_id, column)[offset];
+}
+
+bool ev_telemetry_read_row(EVTelemetryReader *reader, long row, double *time, EVSimulation *sim) {
+    if (row < 0 || row >= reader->rows) return false;
+    int chunk_id = find_chunk(reader, row);
+    int r = (int)(row - reader->chunks[chunk_id].first_row);
+    double v[EV_TLM_COLUMN_COUNT];
+    for (int c = 0; c < EV_TLM_COLUMN_COUNT; c++) v[c] = column_value(reader, chunk_id, c, r);
+    if (time) *time = v[EV_TLM_TIME];
+    sim->battery_voltage = v[EV_TLM_BATTERY_VOLTAGE];
+    sim->battery_capacity = v[EV_TLM_BATTERY_CAPACITY];
+    sim->motor_power = v[EV_TLM_MOTOR_POWER];
+    sim->motor_torque = v[EV_TLM_MOTOR_TORQUE];
+    sim->motor_rpm = v[EV_TLM_MOTOR_RPM];
+    sim->vehicle_speed = v[EV_TLM_VEHICLE_SPEED];
+    sim->acceleration = v[EV_TLM_ACCELERATION];
+    sim->soc = v[EV_TLM_SOC];
+    sim->distance = v[EV_TLM_DISTANCE];
+    sim->energy_consumed = v[EV_TLM_ENERGY_CONSUMED];
+    sim->regen_efficiency = v[EV_TLM_REGEN_EFFICIENCY];
+    sim->battery_temp = v[EV_TLM_BATTERY_TEMP];
+    sim->energy_efficiency = v[EV_TLM_ENERGY_EFFICIENCY];
+    double mode = v[EV_TLM_DRIVE_MODE];   /// Compared before the cast, false for NaN
+    sim->drive_mode = mode >= 0 && mode < DRIVE_MODE_COUNT ? drive_mode_from_index((unsigned long)mode)
+                                                           : DRIVE_MODE_NORMAL;
+    int flags = (int)v[EV_TLM_FLAGS];
+    sim->is_running = flags & 1;
+    sim->regen_braking = (flags & 2) != 0;
+    sim->battery_current = v[EV_TLM_BATTERY_CURRENT];
+    return true;
+}
+
+long ev_telemetry_read_column(EVTelemetryReader *reader, EVTelemetryColumn column,
+                              long first, long count, double *out) {
+    if (column < 0 || column >= EV_TLM_COLUMN_COUNT || first < 0 || count <= 0 || first >= reader->rows) {
+        return 0;
+    }
+    if (count > reader->rows - first) count = reader->rows - first;
+    long done = 0;
+    for (int chunk_id = find_chunk(reader, first); done < count; chunk_id++) {
+        const ChunkIndex *chunk = &reader->chunks[chunk_id];
+        int offset = (int)(first + done - chunk->first_row);
+        int n = chunk->rows - offset;
+        if (n > count - done) n = (int)(count - done);
+        if (chunk->encoding[column] == ENCODING_MISSING) {
+            memset(out + done, 0, sizeof(double) * n);
+        } else if (chunk->encoding[column] == ENCODING_RAW) {
+            memcpy(out + done, chunk->column[column] + sizeof(double) * offset, sizeof(double) * n);
+        } else {
+            memcpy(out + done, decoded_column(reader, chunk_id, column) + offset, sizeof(double) * n);
+        }
+        done += n;
+    }
+    return done;
+}
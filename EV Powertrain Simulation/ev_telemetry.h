@@ -0,0 +1,54 @@
+#ifndef EV_TELEMETRY_H
+#define EV_TELEMETRY_H
+
+#include <stdbool.h>
+#include "ev_sim.h"
+
+/// Append-only columnar recording of EVSimulation, one row per step.
+/// Layout: file header, then self-contained chunks of up to EV_TELEMETRY_CHUNK_ROWS rows,
+/// each holding every column back to back (raw doubles or XOR-delta byte packed).
+/// A truncated trailing chunk from an interrupted run is ignored by the reader.
+
+#define EV_TELEMETRY_CHUNK_ROWS 4096
+
+typedef enum {
+    EV_TLM_TIME,               // s
+    EV_TLM_BATTERY_VOLTAGE,
+    EV_TLM_BATTERY_CAPACITY,
+    EV_TLM_MOTOR_POWER,
+    EV_TLM_MOTOR_TORQUE,
+    EV_TLM_MOTOR_RPM,
+    EV_TLM_VEHICLE_SPEED,
+    EV_TLM_ACCELERATION,
+    EV_TLM_SOC,
+    EV_TLM_DISTANCE,
+    EV_TLM_ENERGY_CONSUMED,
+    EV_TLM_REGEN_EFFICIENCY,
+    EV_TLM_BATTERY_TEMP,
+    EV_TLM_ENERGY_EFFICIENCY,
+    EV_TLM_DRIVE_MODE,
+    EV_TLM_FLAGS,              // bit 0 is_running, bit 1 regen_braking
+    EV_TLM_BATTERY_CURRENT,    // A; reads as 0 from recordings made before it existed
+    EV_TLM_COLUMN_COUNT
+} EVTelemetryColumn;
+
+typedef struct EVTelemetryWriter EVTelemetryWriter;
+typedef struct EVTelemetryReader EVTelemetryReader;
+
+extern const char *const ev_telemetry_column_names[EV_TLM_COLUMN_COUNT];
+
+EVTelemetryWriter *ev_telemetry_create(const char *path, bool compress);
+bool ev_telemetry_append(EVTelemetryWriter *writer, double time, const EVSimulation *sim);
+/// Flushes the partial chunk and closes; returns false if any write failed
+bool ev_telemetry_close(EVTelemetryWriter *writer);
+
+/// Memory-maps a recording for replay
+EVTelemetryReader *ev_telemetry_open(const char *path);
+void ev_telemetry_free(EVTelemetryReader *reader);
+long ev_telemetry_rows(const EVTelemetryReader *reader);
+bool ev_telemetry_read_row(EVTelemetryReader *reader, long row, double *time, EVSimulation *sim);
+/// Copies count values of one column starting at first into out; returns rows copied
+long ev_telemetry_read_column(EVTelemetryReader *reader, EVTelemetryColumn column,
+                              long first, long count, double *out);
+
+#endif
@@ -0,0 +1,368 @@
+#include "ev_thermal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLOW_HYSTERESIS 2.0        // °C below a level's threshold before the pump slows again
+
+/// Thermostat pump speeds and the coolant temperature (°C) that selects each one
+static const double flow_levels[EV_THERMAL_FLOW_LEVELS] = { 0.25, 0.5, 1.0, 1.5 };
+static const double flow_thresholds[EV_THERMAL_FLOW_LEVELS] = { -INFINITY, 30, 35, 45 };
+
+/// Derating starts at the first temperature and reaches its floor share at the second
+#define BATTERY_DERATE_START 40.0      // °C, 1 % per °C as in the scalar model
+#define WINDING_DERATE_START 150.0     // °C
+#define WINDING_DERATE_END 180.0       // °C, half power
+#define JUNCTION_DERATE_START 125.0    // °C
+#define JUNCTION_DERATE_END 150.0      // °C, half power
+#define MIN_DERATING 0.3
+
+#define FACTOR_DT_TOLERANCE 1e-9       // relative
+
+void ev_thermal_params_default(EVThermalParams *params) {
+    /// ~350 kg pack in 8 modules on a cold plate, a 150 kW oil-cooled motor, SiC inverter
+    params->modules = 8;
+    params->module_capacity = 44000;
+    params->module_link = 20;
+    params->module_to_coolant = 60;
+    params->pack_resistance = 0.04;
+    params->coolant_capacity = 36000;
+    params->winding_capacity = 6000;
+    params->housing_capacity = 25000;
+    params->winding_to_housing = 400;
+    params->housing_to_coolant = 500;
+    params->housing_to_ambient = 10;
+    params->junction_capacity = 60;
+    params->heatsink_capacity = 1500;
+    params->junction_to_heatsink = 200;
+    params->heatsink_to_coolant = 300;
+    params->radiator = 900;
+    params->min_flow = 0.1;
+    params->inverter_loss = 0.02;
+    params->ambient_temp = 25;
+    params->coolant_flow = -1;
+    params->solve_interval = 0.1;
+}
+
+static int component_node(const EVThermal *thermal, EVThermalComponent component) {
+    return thermal->params.modules + component;
+}
+
+static void add_link(EVThermal *thermal, int a, int b, double conductance, bool convective) {
+    thermal->links[thermal->link_count++] = (EVThermalLink){ a, b, conductance, convective };
+}
+
+EVThermal *ev_thermal_new(const EVThermalParams *params, EVPack *pack) {
+    EVThermal *thermal = calloc(1, sizeof(EVThermal));
+    if (!thermal) return NULL;
+    thermal->params = *params;
+    int modules = params->modules;
+    if (pack && modules > pack->params.series) modules = pack->params.series;
+    if (modules < 1) modules = 1;
+    if (modules > EV_THERMAL_MAX_MODULES) modules = EV_THERMAL_MAX_MODULES;
+    thermal->params.modules = modules;
+    int n = thermal->nodes = modules + EV_THERMAL_COMPONENTS;
+    int max_links = 2 * modules + 8;
+    thermal->temp = calloc(n, sizeof(double));
+    thermal->capacity = calloc(n, sizeof(double));
+    thermal->heat = calloc(n, sizeof(double));
+    thermal->rhs = calloc(n, sizeof(double));
+    thermal->ambient = calloc(n, sizeof(double));
+    thermal->inertia = calloc(n, sizeof(double));
+    thermal->first = calloc(n, sizeof(int));
+    thermal->row_start = calloc(n + 1, sizeof(int));
+    thermal->links = calloc(max_links, sizeof(EVThermalLink));
+    if (!thermal->temp || !thermal->capacity || !thermal->heat || !thermal->rhs || !thermal->ambient || !thermal->inertia || !thermal->first ||
+        !thermal->row_start || !thermal->links) {
+        ev_thermal_free(thermal);
+        return NULL;
+    }
+    int winding = component_node(thermal, EV_THERMAL_WINDING);
+    int housing = component_node(thermal, EV_THERMAL_HOUSING);
+    int junction = component_node(thermal, EV_THERMAL_JUNCTION);
+    int heatsink = component_node(thermal, EV_THERMAL_HEATSINK);
+    int coolant = component_node(thermal, EV_THERMAL_COOLANT);
+    /// The network's heat capacity stays the same whatever the module count
+    for (int m = 0; m < modules; m++) {
+        thermal->capacity[m] = params->module_capacity * params->modules / modules;
+        if (m > 0) add_link(thermal, m, m - 1, params->module_link, false);
+        add_link(thermal, m, coolant, params->module_to_coolant * params->modules / modules, true);
+    }
+    thermal->capacity[winding] = params->winding_capacity;
+    thermal->capacity[housing] = params->housing_capacity;
+    thermal->capacity[junction] = params->junction_capacity;
+    thermal->capacity[heatsink] = params->heatsink_capacity;
+    thermal->capacity[coolant] = params->coolant_capacity;
+    add_link(thermal, winding, housing, params->winding_to_housing, false);
+    add_link(thermal, housing, coolant, params->housing_to_coolant, true);
+    add_link(thermal, housing, -1, params->housing_to_ambient, false);
+    add_link(thermal, junction, heatsink, params->junction_to_heatsink, false);
+    add_link(thermal, heatsink, coolant, params->heatsink_to_coolant, true);
+    add_link(thermal, coolant, -1, params->radiator, true);
+    /// Envelope: each row starts at its lowest-numbered neighbour
+    for (int i = 0; i < n; i++) thermal->first[i] = i;
+    for (int l = 0; l < thermal->link_count; l++) {
+        int a = thermal->links[l].a, b = thermal->links[l].b;
+        if (b < 0) continue;
+        int hi = a > b ? a : b, lo = a > b ? b : a;
+        if (lo < thermal->first[hi]) thermal->first[hi] = lo;
+    }
+    for (int i = 0; i < n; i++) thermal->row_start[i + 1] = thermal->row_start[i] + i - thermal->first[i] + 1;
+    thermal->factor = calloc(thermal->row_start[n], sizeof(double));
+    if (!thermal->factor) {
+        ev_thermal_free(thermal);
+        return NULL;
+    }
+    ev_thermal_reset(thermal, pack);
+    return thermal;
+}
+
+void ev_thermal_free(EVThermal *thermal) {
+    if (!thermal) return;
+    free(thermal->temp);
+    free(thermal->capacity);
+    free(thermal->heat);
+    free(thermal->rhs);
+    free(thermal->ambient);
+    free(thermal->inertia);
+    free(thermal->first);
+    free(thermal->row_start);
+    free(thermal->links);
+    free(thermal->factor);
+    free(thermal);
+}
+
+/// Module m holds series groups [m·S/M, (m+1)·S/M)
+static void module_cells(const EVThermal *thermal, const EVPack *pack, int m, int *begin, int *end) {
+    int series = pack->params.series, modules = thermal->params.modules;
+    *begin = m * series / modules * pack->params.parallel;
+    *end = (m + 1) * series / modules * pack->params.parallel;
+}
+
+static void write_sinks(const EVThermal *thermal, EVPack *pack) {
+    for (int m = 0; m < thermal->params.modules; m++) {
+        int begin, end;
+        module_cells(thermal, pack, m, &begin, &end);
+        for (int k = begin; k < end; k++) pack->sink[k] = thermal->temp[m];
+    }
+}
+
+void ev_thermal_reset(EVThermal *thermal, EVPack *pack) {
+    for (int i = 0; i < thermal->nodes; i++) thermal->temp[i] = thermal->params.ambient_temp;
+    thermal->pending_time = 0;
+    thermal->pending_motor = 0;
+    thermal->pending_inverter = 0;
+    thermal->pending_joule = 0;
+    thermal->flow_level = 0;
+    thermal->flow = thermal->params.coolant_flow >= 0 ? thermal->params.coolant_flow : flow_levels[0];
+    thermal->derating = 1;
+    thermal->min_derating = 1;
+    if (pack) write_sinks(thermal, pack);
+}
+
+EVThermal *ev_thermal_clone(const EVThermal *src, EVPack *pack) {
+    EVThermal *thermal = ev_thermal_new(&src->params, pack);
+    if (thermal && !ev_thermal_copy_state(thermal, src)) {
+        ev_thermal_free(thermal);
+        return NULL;
+    }
+    /// Creating the network reset the sinks to ambient
+    if (thermal && pack) write_sinks(thermal, pack);
+    return thermal;
+}
+
+bool ev_thermal_copy_state(EVThermal *dst, const EVThermal *src) {
+    if (dst->nodes != src->nodes) return false;
+    if (dst == src) return true;
+    memcpy(dst->temp, src->temp, sizeof(double) * src->nodes);
+    memcpy(dst->heat, src->heat, sizeof(double) * src->nodes);
+    dst->params.coolant_flow = src->params.coolant_flow;
+    dst->pending_time = src->pending_time;
+    dst->pending_motor = src->pending_motor;
+    dst->pending_inverter = src->pending_inverter;
+    dst->pending_joule = src->pending_joule;
+    dst->flow = src->flow;
+    dst->flow_level = src->flow_level;
+    dst->derating = src->derating;
+    dst->min_derating = src->min_derating;
+    return true;
+}
+
+void ev_thermal_set_flow(EVThermal *thermal, double flow) {
+    thermal->params.coolant_flow = flow;
+}
+
+static double *entry(EVThermal *thermal, int row, int col) {
+    return &thermal->factor[thermal->row_start[row] + col - thermal->first[row]];
+}
+
+static double link_conductance(const EVThermal *thermal, const EVThermalLink *link) {
+    if (!link->convective) return link->conductance;
+    double scale = pow(thermal->flow, 0.8);
+    return link->conductance * (scale > thermal->params.min_flow ? scale : thermal->params.min_flow);
+}
+
+/// Assembles C/dt + G into the envelope and factors it in place. Row-oriented LDLᵀ: only
+/// columns inside each row's envelope are touched, and the ordering keeps fill inside it.
+/// The diagonal ends up inverted so the per-step solve has no divisions
+static void factorize(EVThermal *thermal, double dt) {
+    int n = thermal->nodes;
+    memset(thermal->factor, 0, sizeof(double) * thermal->row_start[n]);
+    memset(thermal->ambient, 0, sizeof(double) * n);
+    for (int i = 0; i < n; i++) *entry(thermal, i, i) = thermal->inertia[i] = thermal->capacity[i] / dt;
+    for (int l = 0; l < thermal->link_count; l++) {
+        const EVThermalLink *link = &thermal->links[l];
+        double g = link_conductance(thermal, link);
+        *entry(thermal, link->a, link->a) += g;
+        if (link->b < 0) {
+            thermal->ambient[link->a] += g;
+            continue;
+        }
+        *entry(thermal, link->b, link->b) += g;
+        int hi = link->a > link->b ? link->a : link->b, lo = link->a > link->b ? link->b : link->a;
+        *entry(thermal, hi, lo) -= g;
+    }
+    for (int i = 0; i < n; i++) {
+        int fi = thermal->first[i];
+        double *row = entry(thermal, i, fi) - fi;      // row[j] is L(i, j)
+        for (int j = fi; j < i; j++) {
+            int fj = thermal->first[j];
+            const double *other = entry(thermal, j, fj) - fj;
+            double sum = row[j];
+            for (int k = fi > fj ? fi : fj; k < j; k++) sum -= row[k] * other[k] * *entry(thermal, k, k);
+            row[j] = sum / *entry(thermal, j, j);
+        }
+        double d = row[i];
+        for (int k = fi; k < i; k++) d -= row[k] * row[k] * *entry(thermal, k, k);
+        row[i] = d;
+    }
+    for (int i = 0; i < n; i++) *entry(thermal, i, i) = 1 / *entry(thermal, i, i);
+    thermal->factor_dt = dt;
+    thermal->factor_flow = thermal->flow;
+    thermal->factorizations++;
+}
+
+static void solve(EVThermal *thermal, double *restrict x) {
+    int n = thermal->nodes;
+    for (int i = 0; i < n; i++) {
+        int fi = thermal->first[i];
+        const double *row = entry(thermal, i, fi) - fi;
+        double sum = x[i];
+        for (int k = fi; k < i; k++) sum -= row[k] * x[k];
+        x[i] = sum;
+    }
+    for (int i = 0; i < n; i++) x[i] *= *entry(thermal, i, i);
+    for (int i = n - 1; i >= 0; i--) {
+        int fi = thermal->first[i];
+        const double *row = entry(thermal, i, fi) - fi;
+        double xi = x[i];
+        for (int k = fi; k < i; k++) x[k] -= row[k] * xi;
+    }
+}
+
+static void run_thermostat(EVThermal *thermal) {
+    if (thermal->params.coolant_flow >= 0) {
+        thermal->flow = thermal->params.coolant_flow;
+        return;
+    }
+    double coolant = thermal->temp[component_node(thermal, EV_THERMAL_COOLANT)];
+    int level = thermal->flow_level;
+    while (level + 1 < EV_THERMAL_FLOW_LEVELS && coolant >= flow_thresholds[level + 1]) level++;
+    while (level > 0 && coolant < flow_thresholds[level] - FLOW_HYSTERESIS) level--;
+    thermal->flow_level = level;
+    thermal->flow = flow_levels[level];
+}
+
+static double derate(double temp, double start, double end) {
+    if (temp <= start) return 1;
+    double share = 1 - 0.5 * (temp - start) / (end - start);
+    return share > MIN_DERATING ? share : MIN_DERATING;
+}
+
+/// One backward-Euler solve over dt with the losses held at the given powers (W, A² for joule)
+static void solve_step(EVThermal *thermal, EVPack *pack, double joule, double motor_loss, double inverter_loss,
+                       double dt) {
+    const EVThermalParams *params = &thermal->params;
+    int modules = params->modules;
+    run_thermostat(thermal);
+    if (fabs(dt - thermal->factor_dt) > dt * FACTOR_DT_TOLERANCE || thermal->flow != thermal->factor_flow) {
+        factorize(thermal, dt);
+    }
+    double *heat = thermal->heat;
+    memset(heat, 0, sizeof(double) * thermal->nodes);
+    if (pack) {
+        double cooling = pack->params.cooling;
+        for (int m = 0; m < modules; m++) {
+            int begin, end;
+            module_cells(thermal, pack, m, &begin, &end);
+            double q = 0;
+            for (int k = begin; k < end; k++) q += cooling * (pack->temp[k] - pack->sink[k]);
+            heat[m] = q;
+        }
+    } else {
+        double q = joule * params->pack_resistance / modules;
+        for (int m = 0; m < modules; m++) heat[m] = q;
+    }
+    heat[component_node(thermal, EV_THERMAL_WINDING)] += motor_loss;
+    heat[component_node(thermal, EV_THERMAL_JUNCTION)] += inverter_loss;
+    double *x = thermal->rhs;
+    for (int i = 0; i < thermal->nodes; i++) {
+        x[i] = thermal->inertia[i] * thermal->temp[i] + heat[i] + thermal->ambient[i] * params->ambient_temp;
+    }
+    solve(thermal, x);
+    memcpy(thermal->temp, x, sizeof(double) * thermal->nodes);
+    if (pack) write_sinks(thermal, pack);
+    double battery = pack ? pack->temp_max : ev_thermal_module_max(thermal);
+    double factor = derate(battery, BATTERY_DERATE_START, BATTERY_DERATE_START + 50);
+    double winding = derate(ev_thermal_temp(thermal, EV_THERMAL_WINDING), WINDING_DERATE_START,
+                            WINDING_DERATE_END);
+    double junction = derate(ev_thermal_temp(thermal, EV_THERMAL_JUNCTION), JUNCTION_DERATE_START,
+                             JUNCTION_DERATE_END);
+    if (winding < factor) factor = winding;
+    if (junction < factor) factor = junction;
+    thermal->derating = factor;
+    if (factor < thermal->min_derating) thermal->min_derating = factor;
+}
+
+void ev_thermal_step(EVThermal *thermal, EVPack *pack, double battery_current, double motor_loss,
+                     double inverter_loss, double dt) {
+    double interval = thermal->params.solve_interval;
+    thermal->pending_time += dt;
+    thermal->pending_motor += motor_loss * dt;
+    thermal->pending_inverter += inverter_loss * dt;
+    thermal->pending_joule += battery_current * battery_current * dt;
+    if (thermal->pending_time < interval * (1 - FACTOR_DT_TOLERANCE)) return;
+    double pending = thermal->pending_time;
+    double joule = thermal->pending_joule / pending;
+    double motor = thermal->pending_motor / pending;
+    double inverter = thermal->pending_inverter / pending;
+    /// Whole intervals only, so adaptive steps of any length reuse the one factorization;
+    /// summed steps drift in the last bits, which must not cost an interval
+    long solves = 1;
+    double h = pending;
+    if (interval > 0) {
+        solves = (long)(pending / interval + FACTOR_DT_TOLERANCE);
+        if (solves < 1) solves = 1;
+        h = interval;
+    }
+    for (long k = 0; k < solves; k++) solve_step(thermal, pack, joule, motor, inverter, h);
+    /// The remainder carries over at the same average losses
+    double left = pending - solves * h;
+    if (left < 0) left = 0;
+    thermal->pending_time = left;
+    thermal->pending_joule = joule * left;
+    thermal->pending_motor = motor * left;
+    thermal->pending_inverter = inverter * left;
+}
+
+double ev_thermal_module_max(const EVThermal *thermal) {
+    double max = thermal->temp[0];
+    for (int m = 1; m < thermal->params.modules; m++) {
+        if (thermal->temp[m] > max) max = thermal->temp[m];
+    }
+    return max;
+}
+
+double ev_thermal_temp(const EVThermal *thermal, EVThermalComponent component) {
+    return thermal->temp[component_node(thermal, component)];
+}
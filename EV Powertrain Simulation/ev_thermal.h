@@ -0,0 +1,112 @@
+#ifndef EV_THERMAL_H
+#define EV_THERMAL_H
+
+#include <stdbool.h>
+#include "ev_battery.h"
+
+#define EV_THERMAL_MAX_MODULES 64
+#define EV_THERMAL_FLOW_LEVELS 4       // pump speeds the thermostat switches between
+
+/// Lumped-parameter network: battery modules in a chain, a shared coolant loop, motor winding
+/// and housing, inverter junction and heatsink, and a radiator to ambient. Conductances on
+/// the coolant side scale with flow^0.8
+typedef struct {
+    int modules;               // battery module nodes
+    double module_capacity;    // J/K per module
+    double module_link;        // W/K between neighbouring modules
+    double module_to_coolant;  // W/K per module at nominal flow
+    double pack_resistance;    // Ω, heats the modules when no cell-level pack is attached
+    double coolant_capacity;   // J/K, coolant and plates
+    double winding_capacity;   // J/K
+    double housing_capacity;   // J/K, stator and housing
+    double winding_to_housing; // W/K
+    double housing_to_coolant; // W/K at nominal flow
+    double housing_to_ambient; // W/K, natural convection
+    double junction_capacity;  // J/K, inverter die
+    double heatsink_capacity;  // J/K
+    double junction_to_heatsink; // W/K
+    double heatsink_to_coolant;  // W/K at nominal flow
+    double radiator;           // W/K coolant to ambient at nominal flow
+    double min_flow;           // share of the flow-dependent conductances left with the pump off
+    double inverter_loss;      // share of the motor's electrical input lost in the inverter
+    double ambient_temp;       // °C
+    double coolant_flow;       // relative to nominal; < 0 lets the thermostat choose
+    double solve_interval;     // s; losses are averaged and the network solved once per
+                               // interval (0 solves every step)
+} EVThermalParams;
+
+typedef enum {
+    EV_THERMAL_WINDING,
+    EV_THERMAL_HOUSING,
+    EV_THERMAL_JUNCTION,
+    EV_THERMAL_HEATSINK,
+    EV_THERMAL_COOLANT,        // last: it touches every other component, so no fill-in after it
+    EV_THERMAL_COMPONENTS
+} EVThermalComponent;
+
+typedef struct {
+    int a;
+    int b;                     // -1 for ambient
+    double conductance;        // W/K at nominal flow
+    bool convective;           // scales with coolant flow
+} EVThermalLink;
+
+typedef struct {
+    EVThermalParams params;
+    int nodes;                 // modules, then the EVThermalComponent nodes
+    double *temp;              // °C per node
+    double *capacity;          // J/K per node
+    double *heat;              // W per node over the current step
+    EVThermalLink *links;
+    int link_count;
+    /// LDLᵀ of C/dt + G in envelope (skyline) storage: row i holds columns first[i]..i, the
+    /// diagonal entry holding 1/D. Cached until dt, coolant flow or the topology changes
+    int *first;
+    int *row_start;
+    double *factor;
+    double *rhs;
+    double *ambient;           // W/K from each node to ambient at the factored flow
+    double *inertia;           // W/K, C/dt at the factored dt
+    double factor_dt;          // s, 0 when stale
+    double factor_flow;
+    long factorizations;
+    /// Losses accumulated since the last solve
+    double pending_time;       // s
+    double pending_motor;      // J
+    double pending_inverter;   // J
+    double pending_joule;      // A²·s, battery current squared
+    double flow;               // relative coolant flow in use
+    int flow_level;            // thermostat state
+    double derating;           // 0.0 to 1.0, from the hottest component against its limit
+    double min_derating;       // since reset
+} EVThermal;
+
+void ev_thermal_params_default(EVThermalParams *params);
+
+/// A pack, when given, couples cell by cell: each cell is cooled toward its module node and
+/// the module gets that heat. Module count is capped by the pack's series groups
+EVThermal *ev_thermal_new(const EVThermalParams *params, EVPack *pack);
+void ev_thermal_free(EVThermal *thermal);
+/// Everything back to ambient; keeps the factorization
+void ev_thermal_reset(EVThermal *thermal, EVPack *pack);
+/// New network with src's parameters and state, coupled to pack (src's pack or a clone of it)
+EVThermal *ev_thermal_clone(const EVThermal *src, EVPack *pack);
+/// Node temperatures, pending losses and thermostat state from src; false unless both have
+/// the same nodes. A factorization for another flow is redone at the next solve
+bool ev_thermal_copy_state(EVThermal *dst, const EVThermal *src);
+
+/// Overrides the thermostat (flow >= 0) or hands control back to it (flow < 0)
+void ev_thermal_set_flow(EVThermal *thermal, double flow);
+
+/// Advances by dt with the given losses (W), solving with backward Euler once solve_interval
+/// has built up. A longer dt is solved as whole intervals at its average losses, the rest
+/// carried over, so every solve reuses one factorization. Without a pack the modules share battery_current² · pack_resistance; with
+/// one, the cells' heat reaches the modules through their sinks, and the new module
+/// temperatures are written back into them
+void ev_thermal_step(EVThermal *thermal, EVPack *pack, double battery_current, double motor_loss,
+                     double inverter_loss, double dt);
+
+double ev_thermal_module_max(const EVThermal *thermal);
+double ev_thermal_temp(const EVThermal *thermal, EVThermalComponent component);
+
+#endif
@@ -0,0 +1,179 @@
+#include "ev_waveform.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void ev_wave_history_init(EVWaveHistory *history) {
+    memset(history, 0, sizeof(*history));
+}
+
+static inline double *level_min(const EVWaveLevel *level, long i) {
+    return level->chunks[i >> EV_WAVE_CHUNK_SHIFT]->values + (i & (EV_WAVE_CHUNK - 1));
+}
+
+static inline double *level_max(const EVWaveLevel *level, long i) {
+    return level_min(level, i) + level->max_offset;
+}
+
+static EVWaveChunk *chunk_new(long capacity, bool pairs) {
+    EVWaveChunk *chunk = malloc(sizeof(EVWaveChunk) + sizeof(double) * capacity * (pairs ? 2 : 1));
+    if (chunk) atomic_init(&chunk->refs, 1);
+    return chunk;
+}
+
+static void chunk_release(EVWaveChunk *chunk) {
+    if (atomic_fetch_sub_explicit(&chunk->refs, 1, memory_order_acq_rel) == 1) free(chunk);
+}
+
+void ev_wave_history_free(EVWaveHistory *history) {
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) {
+        for (int l = 0; l < EV_WAVE_MAX_LEVELS; l++) {
+            EVWaveLevel *level = &history->channels[c].levels[l];
+            for (long k = 0; k < level->chunk_count; k++) chunk_release(level->chunks[k]);
+            free(level->chunks);
+        }
+    }
+    ev_wave_history_init(history);
+}
+
+bool ev_wave_history_clone(EVWaveHistory *dst, const EVWaveHistory *src) {
+    ev_wave_history_init(dst);
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) {
+        for (int l = 0; l < EV_WAVE_MAX_LEVELS; l++) {
+            const EVWaveLevel *from = &src->channels[c].levels[l];
+            EVWaveLevel *to = &dst->channels[c].levels[l];
+            if (from->chunk_count == 0) continue;
+            if (!(to->chunks = malloc(sizeof(EVWaveChunk *) * from->chunk_count))) {
+                ev_wave_history_free(dst);
+                return false;
+            }
+            for (long k = 0; k < from->chunk_count; k++) {
+                to->chunks[k] = from->chunks[k];
+                atomic_fetch_add_explicit(&to->chunks[k]->refs, 1, memory_order_relaxed);
+            }
+            to->count = from->count;
+            to->chunk_count = to->chunk_slots = from->chunk_count;
+            to->capacity = from->capacity;
+            to->max_offset = from->max_offset;
+        }
+    }
+    dst->samples = src->samples;
+    return true;
+}
+
+/// Makes the slot at level->count writable: a new chunk at a chunk boundary, a bigger first
+/// chunk while the level is small, or a private copy of a chunk still shared with a clone
+static bool level_reserve(EVWaveLevel *level, bool pairs) {
+    long index = level->count >> EV_WAVE_CHUNK_SHIFT;
+    long offset = level->count & (EV_WAVE_CHUNK - 1);
+    if (index == level->chunk_count) {
+        if (index == level->chunk_slots) {
+            long slots = level->chunk_slots ? level->chunk_slots * 2 : 8;
+            EVWaveChunk **chunks = realloc(level->chunks, sizeof(EVWaveChunk *) * slots);
+            if (!chunks) return false;
+            level->chunks = chunks;
+            level->chunk_slots = slots;
+        }
+        long capacity = index == 0 ? EV_WAVE_FIRST_CHUNK : EV_WAVE_CHUNK;
+        EVWaveChunk *chunk = chunk_new(capacity, pairs);
+        if (!chunk) return false;
+        level->chunks[level->chunk_count++] = chunk;
+        level->capacity = capacity;
+        level->max_offset = pairs ? capacity : 0;
+        return true;
+    }
+    EVWaveChunk *chunk = level->chunks[index];
+    long capacity = offset < level->capacity ? level->capacity : level->capacity * 2;
+    if (capacity == level->capacity && atomic_load_explicit(&chunk->refs, memory_order_acquire) == 1) {
+        return true;
+    }
+    EVWaveChunk *copy = chunk_new(capacity, pairs);
+    if (!copy) return false;
+    memcpy(copy->values, chunk->values, sizeof(double) * offset);
+    if (pairs) memcpy(copy->values + capacity, chunk->values + level->capacity, sizeof(double) * offset);
+    chunk_release(chunk);
+    level->chunks[index] = copy;
+    level->capacity = capacity;
+    level->max_offset = pairs ? capacity : 0;
+    return true;
+}
+
+/// Reserves the whole carry chain first so a failed append leaves every level consistent
+static bool channel_reserve(EVWaveChannel *channel, long samples) {
+    if (!level_reserve(&channel->levels[0], false)) return false;
+    for (int l = 1; l < EV_WAVE_MAX_LEVELS && ((samples + 1) & ((1L << l) - 1)) == 0; l++) {
+        if (!level_reserve(&channel->levels[l], true)) return false;
+    }
+    return true;
+}
+
+static void channel_append(EVWaveChannel *channel, double value) {
+    EVWaveLevel *level = &channel->levels[0];
+    *level_min(level, level->count++) = value;
+    for (int l = 1; l < EV_WAVE_MAX_LEVELS && (level->count & 1) == 0; l++) {
+        EVWaveLevel *up = &channel->levels[l];
+        long i = level->count - 2;
+        *level_min(up, up->count) = fmin(*level_min(level, i), *level_min(level, i + 1));
+        *level_max(up, up->count) = fmax(*level_max(level, i), *level_max(level, i + 1));
+        up->count++;
+        level = up;
+    }
+}
+
+bool ev_wave_history_append(EVWaveHistory *history, const double values[EV_WAVE_CHANNELS]) {
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) {
+        if (!channel_reserve(&history->channels[c], history->samples)) return false;
+    }
+    for (int c = 0; c < EV_WAVE_CHANNELS; c++) channel_append(&history->channels[c], values[c]);
+    history->samples++;
+    return true;
+}
+
+double ev_wave_sample(const EVWaveHistory *history, EVWaveChannelId channel, long i) {
+    return *level_min(&history->channels[channel].levels[0], i);
+}
+
+const double *ev_wave_samples(const EVWaveHistory *history, EVWaveChannelId channel, long first, long *count) {
+    const EVWaveLevel *level = &history->channels[channel].levels[0];
+    long end = (first | (EV_WAVE_CHUNK - 1)) + 1;
+    *count = (end < level->count ? end : level->count) - first;
+    return level_min(level, first);
+}
+
+bool ev_wave_range(const EVWaveHistory *history, EVWaveChannelId channel, long first, long last,
+                   double *min, double *max) {
+    if (first < 0) first = 0;
+    if (last > history->samples) last = history->samples;
+    if (first >= last) return false;
+    const EVWaveChannel *ch = &history->channels[channel];
+    double lo = INFINITY, hi = -INFINITY;
+    /// Greedy walk: take the largest aligned bin that starts at first and fits the range
+    while (first < last) {
+        int l = 0;
+        while (l + 1 < EV_WAVE_MAX_LEVELS && (first & ((1L << (l + 1)) - 1)) == 0 &&
+               first + (1L << (l + 1)) <= last && (first >> (l + 1)) < ch->levels[l + 1].count) {
+            l++;
+        }
+        long bin = first >> l;
+        double bin_min = *level_min(&ch->levels[l], bin), bin_max = *level_max(&ch->levels[l], bin);
+        if (bin_min < lo) lo = bin_min;
+        if (bin_max > hi) hi = bin_max;
+        first += 1L << l;
+    }
+    *min = lo;
+    *max = hi;
+    return true;
+}
+
+void ev_wave_decimate(const EVWaveHistory *history, EVWaveChannelId channel, double first, double span,
+                      int columns, double *min, double *max) {
+    for (int c = 0; c < columns; c++) {
+        long a = (long)floor(first + span * c / columns);
+        long b = (long)floor(first + span * (c + 1) / columns);
+        if (b <= a) b = a + 1;
+        if (!ev_wave_range(history, channel, a, b, &min[c], &max[c])) {
+            min[c] = NAN;
+            max[c] = NAN;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef EV_WAVEFORM_H
+#define EV_WAVEFORM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define EV_WAVE_MAX_LEVELS 48
+#define EV_WAVE_CHUNK_SHIFT 12
+#define EV_WAVE_CHUNK (1L << EV_WAVE_CHUNK_SHIFT)  // entries per full chunk
+#define EV_WAVE_FIRST_CHUNK 16         // entries a level starts with, doubled up to EV_WAVE_CHUNK
+
+typedef enum {
+    EV_WAVE_VOLTAGE,           // V
+    EV_WAVE_CURRENT,           // A
+    EV_WAVE_SPEED,             // km/h
+    EV_WAVE_TEMP,              // °C
+    EV_WAVE_CHANNELS
+} EVWaveChannelId;
+
+/// Storage block shared by histories cloned from one another. Only the chunk being appended
+/// to ever changes, so a clone copies that one chunk on its first write and shares the rest
+typedef struct {
+    atomic_int refs;
+    double values[];           // capacity minima, then capacity maxima above level 0
+} EVWaveChunk;
+
+/// Level k holds the min/max of each aligned run of 2^k samples; level 0 is the samples.
+/// Entry i lives in chunks[i >> EV_WAVE_CHUNK_SHIFT]; every chunk holds capacity entries
+typedef struct {
+    EVWaveChunk **chunks;
+    long count;
+    long chunk_count;
+    long chunk_slots;          // allocated length of chunks
+    long capacity;             // entries per chunk, below EV_WAVE_CHUNK only while there is one
+    long max_offset;           // where the maxima start in a chunk; 0 on level 0, min is max
+} EVWaveLevel;
+
+typedef struct {
+    EVWaveLevel levels[EV_WAVE_MAX_LEVELS];
+} EVWaveChannel;
+
+/// Whole-run history of every waveform, appended one sample per channel at a time
+typedef struct {
+    EVWaveChannel channels[EV_WAVE_CHANNELS];
+    long samples;
+} EVWaveHistory;
+
+void ev_wave_history_init(EVWaveHistory *history);
+void ev_wave_history_free(EVWaveHistory *history);
+/// dst (uninitialized) shares src's samples; either side copies a chunk before changing it,
+/// so the two can be appended to independently, also from different threads
+bool ev_wave_history_clone(EVWaveHistory *dst, const EVWaveHistory *src);
+
+/// Adds one sample per channel and folds completed pairs up the pyramid; false when out of memory
+bool ev_wave_history_append(EVWaveHistory *history, const double values[EV_WAVE_CHANNELS]);
+
+double ev_wave_sample(const EVWaveHistory *history, EVWaveChannelId channel, long i);
+/// Samples first.. as stored, up to the end of their chunk; *count gets how many
+const double *ev_wave_samples(const EVWaveHistory *history, EVWaveChannelId channel, long first, long *count);
+
+/// Min/max over samples [first, last), O(log n) pyramid bins; false for an empty range
+bool ev_wave_range(const EVWaveHistory *history, EVWaveChannelId channel, long first, long last,
+                   double *min, double *max);
+
+/// Splits samples [first, first + span) into columns equal buckets; empty buckets get NAN
+void ev_wave_decimate(const EVWaveHistory *history, EVWaveChannelId channel, double first, double span,
+                      int columns, double *min, double *max);
+
+#endif
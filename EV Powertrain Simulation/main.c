@@ -3,31 +3,17 @@
 #include <cairo.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-typedef enum {
-    DRIVE_MODE_ECO,
-    DRIVE_MODE_NORMAL,
-    DRIVE_MODE_SPORT
-} DriveMode;
-
-typedef struct {
-    double battery_voltage;      // V
-    double battery_capacity;    // kWh
-    double motor_power;         // kW
-    double motor_torque;        // Nm
-    double motor_rpm;           // RPM
-    double vehicle_speed;       // km/h
-    double acceleration;        // m/s²
-    double soc;                // State of Charge (%)
-    double distance;           // km
-    double energy_consumed;    // kWh
-    double regen_efficiency;   // 0.0 to 1.0
-    double battery_temp;       // °C
-    double energy_efficiency;  // Wh/km
-    DriveMode drive_mode;
-    gboolean is_running;
-    gboolean regen_braking;
-} EVSimulation;
+#include <string.h>
+#include "ev_sim.h"
+#include "ev_drivetrain.h"
+#include "ev_cli.h"
+#include "ev_cycle.h"
+#include "ev_telemetry.h"
+#include "ev_waveform.h"
+#include "ev_runner.h"
+#include "ev_render.h"
+#include "ev_perf.h"
+#include "ev_snapshot.h"
 
 typedef struct {
     GtkWidget *window;
@@ -41,6 +27,7 @@ typedef struct {
     GtkWidget *regen_braking_switch;
     GtkWidget *regen_efficiency_scale;
     GtkWidget *drive_mode_dropdown;
+    GtkWidget *drive_cycle_dropdown;
     GtkWidget *speed_label;
     GtkWidget *soc_label;
     GtkWidget *distance_label;
@@ -71,218 +58,331 @@ EVSimulation sim_data = {
     .regen_braking = FALSE
 };
 
-#define WAVE_POINTS 200
-double voltage_wave[WAVE_POINTS];
-double current_wave[WAVE_POINTS];
-double speed_wave[WAVE_POINTS];
-double temp_wave[WAVE_POINTS];
-int wave_index = 0;
-guint32 last_time = 0;
+#define WAVE_POINTS 200           // samples shown before any zoom
+#define WAVE_MIN_SPAN 16
+EVWaveHistory wave_history;       // every sample of the run, min/max pyramid per channel
+double wave_span = WAVE_POINTS;   // samples across the view
+double wave_end = -1;             // sample at the right edge, < 0 follows the newest
+double wave_drag_end = 0;
+EVWaveLayers wave_layers;         // grid, legend and scrolled traces kept between frames
+EVStatusText status_shown;        // label texts last set, so unchanged labels are left alone
+#define WAVE_SAMPLE_PERIOD 0.2    // s of simulated time per waveform sample
+EVCycle *drive_cycle = NULL;      // NULL while the acceleration spin button drives
+EVRunner *sim_runner = NULL;      // steps sim_data's model on its own thread while running
+double sim_rate = EV_RUNNER_DEFAULT_RATE;     // Hz, --rate HZ
+EVSolver sim_solver = EV_SOLVER_EULER;        // --solver NAME
+EVMotorMap *motor_map = NULL;                 // --motor-map MAP, shared with the runner thread
+EVRoute *road_route = NULL;                   // --route ROUTE, shared with the runner thread
+int pack_series = 0;                          // --pack SxP, 0 keeps the constant-voltage battery
+int pack_parallel = 0;
+EVPack *battery_pack = NULL;                  // rebuilt on Start, stepped by the runner thread
+bool use_thermal = false;                     // --thermal
+EVThermal *thermal_network = NULL;            // rebuilt on Start with the pack it cools
+bool use_electrical = false;                  // --electrical
+EVInverter *electrical_model = NULL;          // built on the first Start, stepped by the runner thread
+EVPhaseScope phase_scope;                     // last consistent copy of its phase currents, drawn
+bool perf_overlay = false;                    // --perf or F12: p50/p99 per stage over the waveforms
+const char *perf_trace_path = NULL;           // --perf-trace FILE, written at exit and on Ctrl+F12
+uint64_t draw_queued = 0;                     // perf ticks of the oldest queue_draw not drawn yet
+const char *snapshot_path = NULL;             // --snapshot FILE: loaded at startup, F5 writes it
+EVSnapshot *checkpoint = NULL;                // F5 takes it, F9 goes back to it
+double run_time = 0;                          // s, clock of the stopped run
+long run_steps = 0;
+bool resume_pending = false;                  // Start continues a restored checkpoint
+EVIntegrator resume_integrator;
+long shown_steps = -1;            // runner step count currently on screen
+EVTelemetryWriter *telemetry_record = NULL;   // --record FILE: every physics step is appended
+EVTelemetryReader *telemetry_replay = NULL;   // --replay FILE: the view plays the recording back
+long replay_row = 0;
+double replay_time = 0;           // s
+double replay_next_sample = 0;    // s
+gint64 replay_clock = 0;          // frame time of the previous tick, 0 after Start
+
+void update_waveforms(const EVSimulation *state) {
+    uint64_t perf = ev_perf_begin();
+    double values[EV_WAVE_CHANNELS];
+    values[EV_WAVE_VOLTAGE] = state->battery_voltage;
+    values[EV_WAVE_CURRENT] = state->battery_current;
+    values[EV_WAVE_SPEED] = state->vehicle_speed;
+    values[EV_WAVE_TEMP] = state->battery_temp;
+    ev_wave_history_append(&wave_history, values);
+    ev_perf_end(EV_PERF_WAVE_UPDATE, perf);
+}
+
+static EVWaveView wave_view(void) {
+    EVWaveView view = { .history = &wave_history, .span = wave_span, .end = wave_end };
+    ev_wave_view_fit(&view, &sim_data);
+    return view;
+}
 
-double parse_input(const char *text, double min, double max, double default_val) {
-    double val = atof(text);
-    return (isnan(val) || val < min || val > max) ? default_val : val;
+static double wave_view_end(void) {
+    return wave_end < 0 ? wave_history.samples : wave_end;
+}
+
+/// Draws coalesce, so latency runs from the first request since the last draw
+static void queue_waveform_draw(AppWidgets *widgets) {
+    if (!draw_queued) draw_queued = ev_perf_begin();
+    gtk_widget_queue_draw(widgets->drawing_area);
 }
 
-void update_waveforms() {
-    if (last_time == 0) {
-        last_time = g_get_monotonic_time();
+static void draw_waveforms(GtkDrawingArea *drawing_area, cairo_t *cr, int width, int height,
+                           gpointer user_data G_GNUC_UNUSED) {
+    ev_perf_end(EV_PERF_DRAW_LATENCY, draw_queued);
+    draw_queued = 0;
+    uint64_t perf = ev_perf_begin();
+    EVWaveView view = wave_view();
+    int scope_height = electrical_model ? height / 3 : 0;   /// Phase currents under the waveforms
+    ev_render_waveforms_retained(cr, &wave_layers, &view, width, height - scope_height,
+                                 gtk_widget_get_scale_factor(GTK_WIDGET(drawing_area)));
+    if (scope_height > 0) {
+        /// A read a writer kept busy is torn; the last good copy is drawn instead
+        static EVPhaseScope read;
+        if (ev_inverter_scope(electrical_model, &read)) phase_scope = read;
+        cairo_save(cr);
+        cairo_translate(cr, 0, height - scope_height);
+        ev_render_phase_currents(cr, &phase_scope, width, scope_height);
+        cairo_restore(cr);
     }
-    guint32 current_time = g_get_monotonic_time();
-    double time_diff = (current_time - last_time) / 1000000.0; // seconds    
-    voltage_wave[wave_index] = sim_data.battery_voltage * (0.95 + 0.05 * sin(time_diff * 0.01));
-    current_wave[wave_index] = (sim_data.motor_power * 1000 / sim_data.battery_voltage) * 
-                              (0.9 + 0.1 * sin(time_diff * 0.02));
-    speed_wave[wave_index] = sim_data.vehicle_speed;
-    temp_wave[wave_index] = sim_data.battery_temp;
-    wave_index = (wave_index + 1) % WAVE_POINTS;
+    ev_perf_end(EV_PERF_DRAW, perf);
+    if (perf_overlay) ev_render_perf_overlay(cr, width, height);
 }
 
-static void draw_waveforms(GtkDrawingArea *drawing_area, cairo_t *cr, int width, int height, gpointer user_data) {
-    cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
-    cairo_paint(cr);    
-    cairo_set_source_rgb(cr, 0.3, 0.3, 0.3);
-    cairo_set_line_width(cr, 0.5);
-    for (int i = 0; i <= 10; i++) {
-        cairo_move_to(cr, 0, i * height / 10);
-        cairo_line_to(cr, width, i * height / 10);
-        cairo_move_to(cr, i * width / 10, 0);
-        cairo_line_to(cr, i * width / 10, height);
+static void write_perf_trace(const char *path) {
+    if (ev_perf_write_trace(path)) fprintf(stderr, "Wrote profiling trace %s\n", path);
+    else fprintf(stderr, "Failed to write %s\n", path);
+}
+
+static void take_checkpoint(AppWidgets *widgets);
+static void restore_checkpoint(AppWidgets *widgets);
+
+/// F12 shows or hides the profiling overlay, Ctrl+F12 exports a Chrome trace; F5 takes a
+/// checkpoint, F9 restores it
+static gboolean key_pressed(GtkEventControllerKey *controller G_GNUC_UNUSED, guint keyval,
+                            guint keycode G_GNUC_UNUSED, GdkModifierType state, gpointer user_data) {
+    AppWidgets *widgets = (AppWidgets *)user_data;
+    if (keyval == GDK_KEY_F5) {
+        take_checkpoint(widgets);
+        return TRUE;
     }
-    cairo_stroke(cr);
-    
-    /// Voltage waveform (red)
-    cairo_set_source_rgb(cr, 1.0, 0.2, 0.2);
-    cairo_set_line_width(cr, 2.0);
-    for (int i = 0; i < WAVE_POINTS; i++) {
-        int idx = (wave_index + i) % WAVE_POINTS;
-        double x = (double)i / WAVE_POINTS * width;
-        double y = height - (voltage_wave[idx] / (sim_data.battery_voltage * 1.2) * height * 0.8);
-        if (i == 0) cairo_move_to(cr, x, y);
-        else cairo_line_to(cr, x, y);
+    if (keyval == GDK_KEY_F9) {
+        restore_checkpoint(widgets);
+        return TRUE;
     }
-    cairo_stroke(cr);
-    
-	/// Current waveform (green)
-    double max_current = (sim_data.motor_power * 1000 / sim_data.battery_voltage) * 1.2;
-    cairo_set_source_rgb(cr, 0.2, 1.0, 0.2);
-    cairo_set_line_width(cr, 2.0);
-    for (int i = 0; i < WAVE_POINTS; i++) {
-        int idx = (wave_index + i) % WAVE_POINTS;
-        double x = (double)i / WAVE_POINTS * width;
-        double y = height - (current_wave[idx] / max_current * height * 0.8);
-        if (i == 0) cairo_move_to(cr, x, y);
-        else cairo_line_to(cr, x, y);
+    if (keyval != GDK_KEY_F12) return FALSE;
+    if (state & GDK_CONTROL_MASK) {
+        write_perf_trace(perf_trace_path ? perf_trace_path : "evsim-trace.json");
+        return TRUE;
+    }
+    perf_overlay = !perf_overlay;
+    ev_perf_enable(perf_overlay || perf_trace_path);
+    queue_waveform_draw(widgets);
+    return TRUE;
+}
+
+static double wave_max_span(void) {
+    return wave_history.samples > WAVE_POINTS ? (double)wave_history.samples : WAVE_POINTS;
+}
+
+/// Keeps the view inside the history; reaching the newest sample resumes following
+static void clamp_wave_view(double end) {
+    if (wave_span < WAVE_MIN_SPAN) wave_span = WAVE_MIN_SPAN;
+    if (wave_span > wave_max_span()) wave_span = wave_max_span();
+    double min_end = wave_span < wave_history.samples ? wave_span : wave_history.samples;
+    if (end < min_end) end = min_end;
+    wave_end = end >= wave_history.samples ? -1 : end;
+}
+
+/// Scroll zooms around the view centre, or around the newest sample while following
+static gboolean zoom_waveforms(GtkEventControllerScroll *controller G_GNUC_UNUSED, double dx G_GNUC_UNUSED,
+                               double dy, gpointer user_data) {
+    AppWidgets *widgets = (AppWidgets *)user_data;
+    double end = wave_view_end();
+    double factor = dy > 0 ? 1.25 : 0.8;
+    double old_span = wave_span;
+    wave_span *= factor;
+    clamp_wave_view(wave_end < 0 ? end : end + (wave_span - old_span) / 2);
+    queue_waveform_draw(widgets);
+    return TRUE;
+}
+
+static void pan_waveforms_begin(GtkGestureDrag *gesture G_GNUC_UNUSED, double x G_GNUC_UNUSED,
+                                double y G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED) {
+    wave_drag_end = wave_view_end();
+}
+
+static void pan_waveforms_update(GtkGestureDrag *gesture G_GNUC_UNUSED, double offset_x,
+                                 double offset_y G_GNUC_UNUSED, gpointer user_data) {
+    AppWidgets *widgets = (AppWidgets *)user_data;
+    int width = gtk_widget_get_width(widgets->drawing_area);
+    if (width <= 0) return;
+    clamp_wave_view(wave_drag_end - offset_x / width * wave_span);
+    queue_waveform_draw(widgets);
+}
+
+static void stop_simulation(GtkButton *button, gpointer user_data);
+
+/// Setting a label's text relayouts it even when the text is the same, so compare first
+static void set_label_if_changed(GtkWidget *label, char *shown, const char *text) {
+    if (strcmp(shown, text) == 0) return;
+    strcpy(shown, text);
+    gtk_label_set_text(GTK_LABEL(label), text);
+}
+
+static void update_status_labels(AppWidgets *widgets) {
+    EVStatusText text;
+    uint64_t perf = ev_perf_begin();
+    ev_status_text_format(&text, &sim_data);
+    ev_perf_end(EV_PERF_LABEL_FORMAT, perf);
+    perf = ev_perf_begin();
+    set_label_if_changed(widgets->speed_label, status_shown.speed, text.speed);
+    set_label_if_changed(widgets->soc_label, status_shown.soc, text.soc);
+    set_label_if_changed(widgets->distance_label, status_shown.distance, text.distance);
+    set_label_if_changed(widgets->energy_label, status_shown.energy, text.energy);
+    set_label_if_changed(widgets->torque_label, status_shown.torque, text.torque);
+    set_label_if_changed(widgets->rpm_label, status_shown.rpm, text.rpm);
+    set_label_if_changed(widgets->temp_label, status_shown.temp, text.temp);
+    set_label_if_changed(widgets->efficiency_label, status_shown.efficiency, text.efficiency);
+    ev_perf_end(EV_PERF_LABEL_SET, perf);
+}
+
+/// Moves the replay cursor to the last recorded row at or before replay_time
+static gboolean replay_step(double dt) {
+    long rows = ev_telemetry_rows(telemetry_replay);
+    replay_time += dt;
+    double t;
+    while (replay_row + 1 < rows &&
+           ev_telemetry_read_column(telemetry_replay, EV_TLM_TIME, replay_row + 1, 1, &t) == 1 &&
+           t <= replay_time) {
+        replay_row++;
     }
-    cairo_stroke(cr);
-    
-    /// Speed waveform (blue)
-    cairo_set_source_rgb(cr, 0.2, 0.2, 1.0);
-    cairo_set_line_width(cr, 2.0);
-    for (int i = 0; i < WAVE_POINTS; i++) {
-        int idx = (wave_index + i) % WAVE_POINTS;
-        double x = (double)i / WAVE_POINTS * width;
-        double y = height - (speed_wave[idx] / 200 * height * 0.8);
-        if (i == 0) cairo_move_to(cr, x, y);
-        else cairo_line_to(cr, x, y);
+    gboolean running = sim_data.is_running;
+    if (!ev_telemetry_read_row(telemetry_replay, replay_row, NULL, &sim_data)) return FALSE;
+    sim_data.is_running = running;
+    if (replay_time >= replay_next_sample) {
+        update_waveforms(&sim_data);
+        replay_next_sample = replay_time + WAVE_SAMPLE_PERIOD;
     }
-    cairo_stroke(cr);
-    
-    /// Temperature waveform (yellow)
-    cairo_set_source_rgb(cr, 1.0, 1.0, 0.2);
-    cairo_set_line_width(cr, 2.0);
-    for (int i = 0; i < WAVE_POINTS; i++) {
-        int idx = (wave_index + i) % WAVE_POINTS;
-        double x = (double)i / WAVE_POINTS * width;
-        double y = height - ((temp_wave[idx] - 10) / 60 * height * 0.8); // Scale 10°C to 70°C
-        if (i == 0) cairo_move_to(cr, x, y);
-        else cairo_line_to(cr, x, y);
+    return replay_row + 1 < rows;
+}
+
+/// Moves the runner's sampled states into the waveform history
+static void drain_runner_samples(void) {
+    EVRunnerState samples[64];
+    int n;
+    while ((n = ev_runner_drain(sim_runner, samples, 64)) > 0) {
+        for (int i = 0; i < n; i++) update_waveforms(&samples[i].sim);
     }
-    cairo_stroke(cr);    
-    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    cairo_set_font_size(cr, 14);
-    cairo_set_source_rgb(cr, 1.0, 0.2, 0.2);
-    cairo_move_to(cr, 10, 20);
-    cairo_show_text(cr, "Voltage (V)");
-    cairo_set_source_rgb(cr, 0.2, 1.0, 0.2);
-    cairo_move_to(cr, 10, 40);
-    cairo_show_text(cr, "Current (A)");
-    cairo_set_source_rgb(cr, 0.2, 0.2, 1.0);
-    cairo_move_to(cr, 10, 60);
-    cairo_show_text(cr, "Speed (km/h)");
-    cairo_set_source_rgb(cr, 1.0, 1.0, 0.2);
-    cairo_move_to(cr, 10, 80);
-    cairo_show_text(cr, "Temp (°C)");
 }
 
-static gboolean update_simulation(gpointer user_data) {
+/// Runs once per displayed frame; the physics itself runs on sim_runner at a fixed rate
+static gboolean update_simulation(GtkWidget *widget G_GNUC_UNUSED, GdkFrameClock *frame_clock, gpointer user_data) {
     AppWidgets *widgets = (AppWidgets *)user_data;    
-    if (sim_data.is_running) {
-        static guint32 last_update = 0;
-        guint32 now = g_get_monotonic_time();
-        double dt = (last_update == 0) ? 0.2 : (now - last_update) / 1000000.0;
-        last_update = now;
-        double mass = 1500;
-        double drag_coeff = 0.3;
-        double frontal_area = 2.5;
-        double air_density = 1.225;
-        double rolling_resistance = 0.01;
-        double max_accel;
-        double power_factor;
-        switch (sim_data.drive_mode) {
-            case DRIVE_MODE_ECO:
-                max_accel = 0.5;
-                power_factor = 0.7;
-                break;
-            case DRIVE_MODE_NORMAL:
-                max_accel = 1.0;
-                power_factor = 1.0;
-                break;
-            case DRIVE_MODE_SPORT:
-                max_accel = 1.5;
-                power_factor = 1.3;
-                break;
-        }
-        sim_data.acceleration = gtk_spin_button_get_value(GTK_SPIN_BUTTON(widgets->accel_spin));
-        if (sim_data.acceleration > max_accel) sim_data.acceleration = max_accel;
-        if (sim_data.acceleration < -max_accel) sim_data.acceleration = -max_accel;
-        double speed_ms = sim_data.vehicle_speed / 3.6;
-        double force = mass * sim_data.acceleration;
-        double drag = 0.5 * drag_coeff * frontal_area * air_density * speed_ms * speed_ms;
-        double rolling = rolling_resistance * mass * 9.81;
-        double total_force = force - drag - rolling;
-        speed_ms += (total_force / mass) * dt;
-        sim_data.vehicle_speed = speed_ms * 3.6;
-        if (sim_data.vehicle_speed < 0) sim_data.vehicle_speed = 0;
-        if (sim_data.vehicle_speed > 180) sim_data.vehicle_speed = 180;
-        sim_data.motor_rpm = sim_data.vehicle_speed * 50;
-        sim_data.motor_torque = sim_data.motor_power * power_factor * 1000 / 
-                              (sim_data.motor_rpm / 60 * 2 * M_PI + 0.1);
-        sim_data.distance += sim_data.vehicle_speed / 3600 * dt;
-        double temp_efficiency = 1.0 - (sim_data.battery_temp > 40 ? (sim_data.battery_temp - 40) * 0.01 : 0);
-        double power_use = sim_data.motor_power * power_factor * 
-                          (0.5 + 0.5 * fabs(sim_data.acceleration)) / (0.85 * temp_efficiency);
-        sim_data.energy_consumed += power_use / 3600 * dt;
-        sim_data.soc = 100 - (sim_data.energy_consumed / sim_data.battery_capacity * 100);
-        if (sim_data.soc < 0) sim_data.soc = 0;
-        if (sim_data.acceleration < 0 && sim_data.regen_braking) {   /// Regenerative braking
-            double regen_energy = sim_data.regen_efficiency * power_use * 0.5;
-            sim_data.energy_consumed -= regen_energy / 3600 * dt;
-            sim_data.soc = 100 - (sim_data.energy_consumed / sim_data.battery_capacity * 100);
-            if (sim_data.soc > 100) sim_data.soc = 100;
+    static uint64_t last_frame = 0;
+    uint64_t frame = ev_perf_begin();
+    if (last_frame && frame) ev_perf_record(EV_PERF_FRAME_INTERVAL, last_frame, frame);
+    last_frame = frame;
+    if (sim_data.is_running && telemetry_replay) {
+        gint64 now = gdk_frame_clock_get_frame_time(frame_clock);
+        double dt = (replay_clock == 0) ? 0 : (now - replay_clock) / 1000000.0;
+        replay_clock = now;
+        gboolean more = replay_step(dt);
+        update_status_labels(widgets);
+        queue_waveform_draw(widgets);
+        if (!more) stop_simulation(NULL, widgets);
+    } else if (sim_data.is_running) {
+        drain_runner_samples();
+        EVRunnerState state;
+        ev_runner_snapshot(sim_runner, &state);
+        if (state.steps == shown_steps && !state.finished) return G_SOURCE_CONTINUE;
+        shown_steps = state.steps;
+        sim_data = state.sim;
+        sim_data.is_running = TRUE;
+        if (drive_cycle) {
+            gtk_spin_button_set_value(GTK_SPIN_BUTTON(widgets->accel_spin), state.accel_request);
         }
-        sim_data.battery_temp += (power_use / sim_data.motor_power) * 0.1 * dt;
-        sim_data.battery_temp -= 0.05 * dt; /// Cooling effect
-        if (sim_data.battery_temp < 10) sim_data.battery_temp = 10;
-        if (sim_data.battery_temp > 70) sim_data.battery_temp = 70;
-        if (sim_data.distance > 0) {  /// Calculate energy efficiency
-            sim_data.energy_efficiency = (sim_data.energy_consumed * 1000) / sim_data.distance;
-        } else {
-            sim_data.energy_efficiency = 0;
-        }
-        update_waveforms();
-        char buffer[32];
-        snprintf(buffer, sizeof(buffer), "%.1f km/h", sim_data.vehicle_speed);
-        gtk_label_set_text(GTK_LABEL(widgets->speed_label), buffer);
-        snprintf(buffer, sizeof(buffer), "%.1f %%", sim_data.soc);
-        gtk_label_set_text(GTK_LABEL(widgets->soc_label), buffer);
-        snprintf(buffer, sizeof(buffer), "%.2f km", sim_data.distance);
-        gtk_label_set_text(GTK_LABEL(widgets->distance_label), buffer);
-        snprintf(buffer, sizeof(buffer), "%.2f kWh", sim_data.energy_consumed);
-        gtk_label_set_text(GTK_LABEL(widgets->energy_label), buffer);
-        snprintf(buffer, sizeof(buffer), "%.1f Nm", sim_data.motor_torque);
-        gtk_label_set_text(GTK_LABEL(widgets->torque_label), buffer);
-        snprintf(buffer, sizeof(buffer), "%.0f RPM", sim_data.motor_rpm);
-        gtk_label_set_text(GTK_LABEL(widgets->rpm_label), buffer);
-        snprintf(buffer, sizeof(buffer), "%.1f °C", sim_data.battery_temp);
-        gtk_label_set_text(GTK_LABEL(widgets->temp_label), buffer);
-        snprintf(buffer, sizeof(buffer), "%.0f Wh/km", sim_data.energy_efficiency);
-        gtk_label_set_text(GTK_LABEL(widgets->efficiency_label), buffer);
-        gtk_widget_queue_draw(widgets->drawing_area);
+        update_status_labels(widgets);
+        queue_waveform_draw(widgets);
+        if (state.finished) stop_simulation(NULL, widgets);
     }
     return G_SOURCE_CONTINUE;
 }
 
-static void start_simulation(GtkButton *button, gpointer user_data) {
+static void accel_changed(GtkSpinButton *spin, gpointer user_data G_GNUC_UNUSED) {
+    ev_runner_set_accel(sim_runner, gtk_spin_button_get_value(spin));
+}
+
+static void start_simulation(GtkButton *button G_GNUC_UNUSED, gpointer user_data) {
     AppWidgets *widgets = (AppWidgets *)user_data;    
+    if (telemetry_replay) {
+        /// Start resumes playback; the recorded configuration replaces the inputs
+        if (replay_row + 1 >= ev_telemetry_rows(telemetry_replay)) {
+            replay_row = 0;
+            replay_time = 0;
+        }
+        replay_clock = 0;
+        replay_next_sample = replay_time;
+        sim_data.is_running = TRUE;
+        gtk_widget_set_sensitive(widgets->start_button, FALSE);
+        gtk_widget_set_sensitive(widgets->stop_button, TRUE);
+        gtk_widget_set_sensitive(widgets->reset_button, TRUE);
+        return;
+    }
     const char *voltage_text = gtk_editable_get_text(GTK_EDITABLE(widgets->battery_voltage_entry));
     const char *capacity_text = gtk_editable_get_text(GTK_EDITABLE(widgets->battery_capacity_entry));
     const char *power_text = gtk_editable_get_text(GTK_EDITABLE(widgets->motor_power_entry));
-    sim_data.battery_voltage = parse_input(voltage_text, 100, 1000, 400);
-    sim_data.battery_capacity = parse_input(capacity_text, 10, 200, 60);
+    /// A restored checkpoint keeps its battery; the driving inputs may differ from the original run
+    if (!resume_pending) {
+        sim_data.battery_voltage = parse_input(voltage_text, 100, 1000, 400);
+        sim_data.battery_capacity = parse_input(capacity_text, 10, 200, 60);
+    }
     sim_data.motor_power = parse_input(power_text, 50, 500, 150);
     sim_data.regen_braking = gtk_switch_get_active(GTK_SWITCH(widgets->regen_braking_switch));
     sim_data.regen_efficiency = gtk_range_get_value(GTK_RANGE(widgets->regen_efficiency_scale)) / 100.0;
-    sim_data.drive_mode = gtk_drop_down_get_selected(GTK_DROP_DOWN(widgets->drive_mode_dropdown));
-    sim_data.vehicle_speed = 0;
-    sim_data.motor_rpm = 0;
-    sim_data.motor_torque = 0;
-    sim_data.distance = 0;
-    sim_data.energy_consumed = 0;
-    sim_data.soc = 100;
-    sim_data.battery_temp = 25.0;
-    sim_data.energy_efficiency = 0;
-    last_time = 0;
+    guint mode_index = gtk_drop_down_get_selected(GTK_DROP_DOWN(widgets->drive_mode_dropdown));
+    sim_data.drive_mode = drive_mode_from_index(mode_index);
+    if (resume_pending) {
+        /// Nothing to rebuild or reset
+    } else if (pack_series > 0) {
+        /// Sized to the capacity entry; the runner is stopped, so nothing else holds the old one
+        EVPackParams params;
+        ev_pack_params_default(&params, pack_series, pack_parallel, sim_data.battery_capacity);
+        ev_pack_free(battery_pack);
+        battery_pack = ev_pack_new(&params);
+        sim_data.pack = battery_pack;
+    }
+    if (use_thermal && !resume_pending) {
+        EVThermalParams params;
+        ev_thermal_params_default(&params);
+        ev_thermal_free(thermal_network);
+        thermal_network = ev_thermal_new(&params, battery_pack);
+        sim_data.thermal = thermal_network;
+    }
+    if (use_electrical && !electrical_model) {
+        EVPmsmParams motor;
+        EVInverterParams params;
+        ev_pmsm_params_default(&motor);
+        ev_inverter_params_default(&params);
+        electrical_model = ev_inverter_new(&motor, &params);
+        if (!electrical_model) g_warning("Failed to allocate the inverter model");
+    }
+    sim_data.inverter = electrical_model;   /// A restored checkpoint carries on from its state
+    if (!resume_pending) ev_sim_reset(&sim_data);
+    ev_cycle_close(drive_cycle);
+    drive_cycle = NULL;
+    guint cycle_index = gtk_drop_down_get_selected(GTK_DROP_DOWN(widgets->drive_cycle_dropdown));
+    if (cycle_index > 0 && cycle_index <= (guint)ev_cycle_builtin_count) {  /// 0 is manual control
+        drive_cycle = ev_cycle_open_builtin(ev_cycle_builtins[cycle_index - 1].name);
+    }
+    ev_runner_set_accel(sim_runner, gtk_spin_button_get_value(GTK_SPIN_BUTTON(widgets->accel_spin)));
+    bool started = resume_pending
+        ? ev_runner_resume(sim_runner, &sim_data, run_time, run_steps, &resume_integrator, drive_cycle, telemetry_record)
+        : ev_runner_start(sim_runner, &sim_data, drive_cycle, telemetry_record);
+    if (!started) {
+        g_warning("Failed to start the simulation thread");
+        return;
+    }
+    resume_pending = false;
+    shown_steps = -1;
     sim_data.is_running = TRUE;
     gtk_widget_set_sensitive(widgets->start_button, FALSE);
     gtk_widget_set_sensitive(widgets->stop_button, TRUE);
@@ -293,60 +393,150 @@ static void start_simulation(GtkButton *button, gpointer user_data) {
     gtk_widget_set_sensitive(widgets->regen_braking_switch, FALSE);
     gtk_widget_set_sensitive(widgets->regen_efficiency_scale, FALSE);
     gtk_widget_set_sensitive(widgets->drive_mode_dropdown, FALSE);
-    gtk_widget_set_sensitive(widgets->accel_spin, TRUE);
+    gtk_widget_set_sensitive(widgets->drive_cycle_dropdown, FALSE);
+    gtk_widget_set_sensitive(widgets->accel_spin, drive_cycle == NULL);
 }
 
-static void stop_simulation(GtkButton *button, gpointer user_data) {
+static void stop_simulation(GtkButton *button G_GNUC_UNUSED, gpointer user_data) {
     AppWidgets *widgets = (AppWidgets *)user_data;    
+    if (ev_runner_is_running(sim_runner)) {
+        EVRunnerState state;
+        ev_runner_stop(sim_runner, &state);
+        drain_runner_samples();
+        sim_data = state.sim;
+        run_time = state.time;
+        run_steps = state.steps;
+        update_status_labels(widgets);
+        queue_waveform_draw(widgets);
+    }
     sim_data.is_running = FALSE;
     gtk_widget_set_sensitive(widgets->start_button, TRUE);
     gtk_widget_set_sensitive(widgets->stop_button, FALSE);
     gtk_widget_set_sensitive(widgets->reset_button, FALSE);
+    if (telemetry_replay) {
+        gtk_widget_set_sensitive(widgets->reset_button, TRUE);
+        return;
+    }
     gtk_widget_set_sensitive(widgets->battery_voltage_entry, TRUE);
     gtk_widget_set_sensitive(widgets->battery_capacity_entry, TRUE);
     gtk_widget_set_sensitive(widgets->motor_power_entry, TRUE);
     gtk_widget_set_sensitive(widgets->regen_braking_switch, TRUE);
     gtk_widget_set_sensitive(widgets->regen_efficiency_scale, TRUE);
     gtk_widget_set_sensitive(widgets->drive_mode_dropdown, TRUE);
+    gtk_widget_set_sensitive(widgets->drive_cycle_dropdown, TRUE);
     gtk_widget_set_sensitive(widgets->accel_spin, FALSE);
 }
 
-static void reset_simulation(GtkButton *button, gpointer user_data) {
+static void reset_simulation(GtkButton *button G_GNUC_UNUSED, gpointer user_data) {
     AppWidgets *widgets = (AppWidgets *)user_data;    
-    sim_data.vehicle_speed = 0;
-    sim_data.motor_rpm = 0;
-    sim_data.motor_torque = 0;
-    sim_data.distance = 0;
-    sim_data.energy_consumed = 0;
-    sim_data.soc = 100;
-    sim_data.battery_temp = 25.0;
-    sim_data.energy_efficiency = 0;
-    last_time = 0;
-    char buffer[32];
-    snprintf(buffer, sizeof(buffer), "%.1f km/h", sim_data.vehicle_speed);
-    gtk_label_set_text(GTK_LABEL(widgets->speed_label), buffer);
-    snprintf(buffer, sizeof(buffer), "%.1f %%", sim_data.soc);
-    gtk_label_set_text(GTK_LABEL(widgets->soc_label), buffer);
-    snprintf(buffer, sizeof(buffer), "%.2f km", sim_data.distance);
-    gtk_label_set_text(GTK_LABEL(widgets->distance_label), buffer);
-    snprintf(buffer, sizeof(buffer), "%.2f kWh", sim_data.energy_consumed);
-    gtk_label_set_text(GTK_LABEL(widgets->energy_label), buffer);
-    snprintf(buffer, sizeof(buffer), "%.1f Nm", sim_data.motor_torque);
-    gtk_label_set_text(GTK_LABEL(widgets->torque_label), buffer);
-    snprintf(buffer, sizeof(buffer), "%.0f RPM", sim_data.motor_rpm);
-    gtk_label_set_text(GTK_LABEL(widgets->rpm_label), buffer);
-    snprintf(buffer, sizeof(buffer), "%.1f °C", sim_data.battery_temp);
-    gtk_label_set_text(GTK_LABEL(widgets->temp_label), buffer);
-    snprintf(buffer, sizeof(buffer), "%.0f Wh/km", sim_data.energy_efficiency);
-    gtk_label_set_text(GTK_LABEL(widgets->efficiency_label), buffer);
-    gtk_widget_queue_draw(widgets->drawing_area);
+    if (telemetry_replay) {
+        replay_row = 0;
+        replay_time = 0;
+        gboolean running = sim_data.is_running;
+        ev_telemetry_read_row(telemetry_replay, 0, NULL, &sim_data);
+        sim_data.is_running = running;
+    } else if (ev_runner_is_running(sim_runner)) {
+        /// Applied by the simulation thread at its next step; the next frame shows it
+        ev_runner_request_reset(sim_runner);
+        return;
+    } else {
+        ev_sim_reset(&sim_data);
+        if (drive_cycle) ev_cycle_rewind(drive_cycle);
+        resume_pending = false;
+    }
+    update_status_labels(widgets);
+    queue_waveform_draw(widgets);
 }
 
-static void cleanup(GtkWidget *widget, gpointer data) {
+/// The whole state including the waveform history; a running simulation pauses for the copy
+static void take_checkpoint(AppWidgets *widgets) {
+    if (telemetry_replay) return;
+    bool running = ev_runner_is_running(sim_runner);
+    if (running) {
+        EVRunnerState state;
+        ev_runner_stop(sim_runner, &state);
+        drain_runner_samples();
+        sim_data = state.sim;
+        run_time = state.time;
+        run_steps = state.steps;
+    }
+    EVSnapshot *snapshot = ev_snapshot_take(&sim_data, resume_pending ? &resume_integrator : ev_runner_integrator(sim_runner),
+                                            run_time, run_steps, &wave_history);
+    if (running) {
+        if (!ev_runner_resume(sim_runner, &sim_data, run_time, run_steps, NULL, drive_cycle, telemetry_record)) {
+            g_warning("Failed to restart the simulation thread");
+            stop_simulation(NULL, widgets);
+        }
+        sim_data.is_running = running;
+    }
+    if (!snapshot) {
+        g_warning("Failed to take a checkpoint");
+        return;
+    }
+    ev_snapshot_free(checkpoint);
+    checkpoint = snapshot;
+    fprintf(stderr, "Checkpoint at %.2f km, %.1f s\n", sim_data.distance, run_time);
+    if (snapshot_path && !ev_snapshot_save(checkpoint, snapshot_path)) fprintf(stderr, "Failed to write %s\n", snapshot_path);
+}
+
+/// Stops the run and puts everything back as it was at the checkpoint; Start continues from
+/// there with whatever drive mode, regen and cycle are selected by then
+static void restore_checkpoint(AppWidgets *widgets) {
+    if (!checkpoint || telemetry_replay) return;
+    if (ev_runner_is_running(sim_runner)) stop_simulation(NULL, widgets);
+    EVBranch branch;
+    if (!ev_snapshot_fork(checkpoint, &branch, 1)) {
+        g_warning("Failed to restore the checkpoint");
+        return;
+    }
+    /// The runner is stopped, so nothing else holds the old pack and network
+    ev_thermal_free(thermal_network);
+    ev_pack_free(battery_pack);
+    battery_pack = branch.sim.pack;
+    thermal_network = branch.sim.thermal;
+    ev_wave_history_free(&wave_history);
+    wave_history = branch.history;
+    ev_wave_layers_invalidate(&wave_layers);
+    wave_end = -1;
+    sim_data = branch.sim;
+    sim_data.motor_map = motor_map;
+    sim_data.route = road_route;
+    sim_data.is_running = FALSE;
+    resume_integrator = branch.integrator;
+    run_time = branch.time;
+    run_steps = branch.steps;
+    resume_pending = true;
+    char text[32];
+    snprintf(text, sizeof(text), "%g", sim_data.battery_voltage);
+    gtk_editable_set_text(GTK_EDITABLE(widgets->battery_voltage_entry), text);
+    snprintf(text, sizeof(text), "%g", sim_data.battery_capacity);
+    gtk_editable_set_text(GTK_EDITABLE(widgets->battery_capacity_entry), text);
+    snprintf(text, sizeof(text), "%g", sim_data.motor_power);
+    gtk_editable_set_text(GTK_EDITABLE(widgets->motor_power_entry), text);
+    gtk_switch_set_active(GTK_SWITCH(widgets->regen_braking_switch), sim_data.regen_braking);
+    gtk_range_set_value(GTK_RANGE(widgets->regen_efficiency_scale), sim_data.regen_efficiency * 100);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(widgets->drive_mode_dropdown), sim_data.drive_mode);
+    update_status_labels(widgets);
+    queue_waveform_draw(widgets);
+}
+
+static void cleanup(GtkWidget *widget G_GNUC_UNUSED, gpointer data) {
+    ev_runner_free(sim_runner);
+    sim_runner = NULL;
+    ev_cycle_close(drive_cycle);
+    drive_cycle = NULL;
+    if (!ev_telemetry_close(telemetry_record)) fprintf(stderr, "Failed to write telemetry recording\n");
+    telemetry_record = NULL;
+    ev_telemetry_free(telemetry_replay);
+    telemetry_replay = NULL;
+    ev_wave_history_free(&wave_history);
+    ev_wave_layers_free(&wave_layers);
+    ev_snapshot_free(checkpoint);
+    checkpoint = NULL;
     g_free(data);
 }
 
-static void activate(GtkApplication *app, gpointer user_data) {
+static void activate(GtkApplication *app, gpointer user_data G_GNUC_UNUSED) {
     AppWidgets *widgets = g_new0(AppWidgets, 1);
     if (!widgets) {
         g_error("Failed to allocate AppWidgets");
@@ -431,6 +621,20 @@ static void activate(GtkApplication *app, gpointer user_data) {
     gtk_box_append(GTK_BOX(drive_mode_box), drive_mode_label);
     gtk_box_append(GTK_BOX(drive_mode_box), widgets->drive_mode_dropdown);
     gtk_box_append(GTK_BOX(control_box), drive_mode_box);
+    GtkWidget *drive_cycle_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    GtkWidget *drive_cycle_label = gtk_label_new("Drive Cycle:");
+    gtk_label_set_xalign(GTK_LABEL(drive_cycle_label), 0);
+    GtkStringList *drive_cycles = gtk_string_list_new(NULL);
+    gtk_string_list_append(drive_cycles, "Manual");
+    for (int i = 0; i < ev_cycle_builtin_count; i++) {
+        gtk_string_list_append(drive_cycles, ev_cycle_builtins[i].description);
+    }
+    widgets->drive_cycle_dropdown = gtk_drop_down_new(G_LIST_MODEL(drive_cycles), NULL);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(widgets->drive_cycle_dropdown), 0);
+    gtk_widget_set_size_request(widgets->drive_cycle_dropdown, 100, 40);
+    gtk_box_append(GTK_BOX(drive_cycle_box), drive_cycle_label);
+    gtk_box_append(GTK_BOX(drive_cycle_box), widgets->drive_cycle_dropdown);
+    gtk_box_append(GTK_BOX(control_box), drive_cycle_box);
     GtkWidget *accel_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
     GtkWidget *accel_label = gtk_label_new("Acceleration (m/s²):");
     gtk_label_set_xalign(GTK_LABEL(accel_label), 0);
@@ -438,6 +642,7 @@ static void activate(GtkApplication *app, gpointer user_data) {
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(widgets->accel_spin), 0.0);
     gtk_widget_set_size_request(widgets->accel_spin, 100, 40);
     gtk_widget_set_sensitive(widgets->accel_spin, FALSE);
+    g_signal_connect(widgets->accel_spin, "value-changed", G_CALLBACK(accel_changed), NULL);
     gtk_box_append(GTK_BOX(accel_box), accel_label);
     gtk_box_append(GTK_BOX(accel_box), widgets->accel_spin);
     gtk_box_append(GTK_BOX(control_box), accel_box);
@@ -527,13 +732,41 @@ static void activate(GtkApplication *app, gpointer user_data) {
     gtk_widget_set_size_request(widgets->drawing_area, 380, 300);
     gtk_drawing_area_set_draw_func(GTK_DRAWING_AREA(widgets->drawing_area), draw_waveforms, NULL, NULL);
     gtk_frame_set_child(GTK_FRAME(waveform_frame), widgets->drawing_area);
-    for (int i = 0; i < WAVE_POINTS; i++) {
-        voltage_wave[i] = 0;
-        current_wave[i] = 0;
-        speed_wave[i] = 0;
-        temp_wave[i] = 0;
+    ev_wave_history_init(&wave_history);
+    ev_wave_layers_init(&wave_layers);
+    /// Scroll to zoom, drag to pan across the whole run
+    GtkEventController *scroll = gtk_event_controller_scroll_new(GTK_EVENT_CONTROLLER_SCROLL_VERTICAL);
+    g_signal_connect(scroll, "scroll", G_CALLBACK(zoom_waveforms), widgets);
+    gtk_widget_add_controller(widgets->drawing_area, scroll);
+    GtkGesture *drag = gtk_gesture_drag_new();
+    g_signal_connect(drag, "drag-begin", G_CALLBACK(pan_waveforms_begin), widgets);
+    g_signal_connect(drag, "drag-update", G_CALLBACK(pan_waveforms_update), widgets);
+    gtk_widget_add_controller(widgets->drawing_area, GTK_EVENT_CONTROLLER(drag));
+    GtkEventController *keys = gtk_event_controller_key_new();
+    g_signal_connect(keys, "key-pressed", G_CALLBACK(key_pressed), widgets);
+    gtk_widget_add_controller(widgets->window, keys);
+    if (telemetry_replay) {
+        /// Replay shows the recorded configuration, so the inputs stay locked
+        gtk_window_set_title(GTK_WINDOW(widgets->window), "EV Powertrain Simulation (replay)");
+        gtk_widget_set_sensitive(widgets->battery_voltage_entry, FALSE);
+        gtk_widget_set_sensitive(widgets->battery_capacity_entry, FALSE);
+        gtk_widget_set_sensitive(widgets->motor_power_entry, FALSE);
+        gtk_widget_set_sensitive(widgets->regen_braking_switch, FALSE);
+        gtk_widget_set_sensitive(widgets->regen_efficiency_scale, FALSE);
+        gtk_widget_set_sensitive(widgets->drive_mode_dropdown, FALSE);
+        gtk_widget_set_sensitive(widgets->drive_cycle_dropdown, FALSE);
+        gtk_widget_set_sensitive(widgets->reset_button, TRUE);
+        ev_telemetry_read_row(telemetry_replay, 0, NULL, &sim_data);
+        sim_data.is_running = FALSE;
+        update_status_labels(widgets);
+    }
+    sim_runner = ev_runner_new(sim_rate, WAVE_SAMPLE_PERIOD);
+    if (!sim_runner) {
+        g_error("Failed to allocate the simulation runner");
+        return;
     }
-    g_timeout_add(200, update_simulation, widgets);
+    ev_runner_set_solver(sim_runner, sim_solver);
+    gtk_widget_add_tick_callback(widgets->drawing_area, update_simulation, widgets, NULL);
     g_signal_connect(widgets->window, "destroy", G_CALLBACK(cleanup), widgets);
     GtkCssProvider *provider = gtk_css_provider_new();
     gtk_css_provider_load_from_string(provider, 
@@ -547,6 +780,89 @@ static void activate(GtkApplication *app, gpointer user_data) {
 }
 
 int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0) {
+        return ev_cli_main(argc - 1, argv + 1);
+    }
+    ev_drivetrain_direct(&sim_data.drivetrain);
+    ev_vehicle_params_default(&sim_data.vehicle);
+    /// --record FILE, --replay FILE, --rate HZ, --solver NAME, --motor-map MAP, --pack SxP,
+    /// --thermal, --electrical, --route ROUTE, --drivetrain SPEC, --perf, --perf-trace FILE and
+    /// --snapshot FILE are ours; everything else goes to GTK
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--record") == 0) {
+            telemetry_record = ev_telemetry_create(argv[++i], true);
+            if (!telemetry_record) {
+                fprintf(stderr, "Failed to open %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i + 1 < argc && strcmp(argv[i], "--rate") == 0) {
+            sim_rate = parse_input(argv[++i], 1, 100000, EV_RUNNER_DEFAULT_RATE);
+        } else if (i + 1 < argc && strcmp(argv[i], "--solver") == 0) {
+            if (!ev_solver_from_name(argv[++i], &sim_solver)) {
+                fprintf(stderr, "Unknown solver: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i + 1 < argc && strcmp(argv[i], "--motor-map") == 0) {
+            ev_motor_map_free(motor_map);
+            motor_map = ev_motor_map_open(argv[++i]);
+            if (!motor_map) {
+                fprintf(stderr, "Failed to load motor map %s\n", argv[i]);
+                return 1;
+            }
+            sim_data.motor_map = motor_map;
+        } else if (i + 1 < argc && strcmp(argv[i], "--pack") == 0) {
+            if (!ev_pack_parse_layout(argv[++i], &pack_series, &pack_parallel)) {
+                fprintf(stderr, "Invalid pack layout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--thermal") == 0) {
+            use_thermal = true;
+        } else if (strcmp(argv[i], "--electrical") == 0) {
+            use_electrical = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "--route") == 0) {
+            EVRouteParams route_params;
+            ev_route_params_default(&route_params);
+            ev_route_free(road_route);
+            road_route = ev_route_open(argv[++i], &route_params);
+            if (!road_route) {
+                fprintf(stderr, "Failed to load route %s\n", argv[i]);
+                return 1;
+            }
+            sim_data.route = road_route;
+        } else if (i + 1 < argc && strcmp(argv[i], "--drivetrain") == 0) {
+            if (!ev_drivetrain_parse(argv[++i], &sim_data.drivetrain)) {
+                fprintf(stderr, "Invalid drivetrain: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf_overlay = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "--perf-trace") == 0) {
+            perf_trace_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--snapshot") == 0) {
+            snapshot_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--replay") == 0) {
+            telemetry_replay = ev_telemetry_open(argv[++i]);
+            if (!telemetry_replay || ev_telemetry_rows(telemetry_replay) == 0) {
+                fprintf(stderr, "Failed to open telemetry file %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    /// A missing file is fine, F5 creates it
+    if (snapshot_path && !(checkpoint = ev_snapshot_load(snapshot_path))) {
+        FILE *existing = fopen(snapshot_path, "rb");
+        if (existing) {
+            fclose(existing);
+            fprintf(stderr, "Failed to load snapshot %s\n", snapshot_path);
+            return 1;
+        }
+    }
+    if (perf_overlay || perf_trace_path) ev_perf_enable(true);
+    ev_perf_name_thread("gui");     // cheap: the per-thread buffers only appear on first use
     GtkApplication *app = gtk_application_new("org.example.evsimulator", G_APPLICATION_DEFAULT_FLAGS);
     if (!app) {
         fprintf(stderr, "Failed to create GTK application\n");
@@ -555,5 +871,11 @@ int main(int argc, char **argv) {
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     int status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
+    if (perf_trace_path) write_perf_trace(perf_trace_path);
+    ev_motor_map_free(motor_map);
+    ev_route_free(road_route);
+    ev_inverter_free(electrical_model);
+    ev_thermal_free(thermal_network);
+    ev_pack_free(battery_pack);
     return status;
 }
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Checks that jobs the server coalesces into one fleet run answer exactly as they do alone.
+
+Usage: tests/server_coalesce.py ./evsim
+
+Two servers run the same jobs: one with --fleet-batch 1, so every job steps on its own, and
+one that coalesces. Step counts and status must be equal, and every other result field but
+max_speed (not tracked by fleets) equal to rounding: the vectorized kernels order a few sums
+differently. That includes jobs whose battery runs empty part way and until-empty jobs.
+"""
+import math
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+HEADER = struct.Struct('<IIII')
+JOB = struct.Struct('<IBBBBdddddd16sHHI')
+RESULT = struct.Struct('<IIIIqddddddd')
+MSG_BATCH, MSG_RESULT, MSG_BATCH_DONE = 1, 2, 3
+JOB_REGEN, JOB_UNTIL_EMPTY, JOB_CYCLE_REPEAT = 1, 2, 4
+RESULT_COALESCED = 1
+ECO, NORMAL, SPORT = 0, 1, 2
+
+
+def job(job_id, mode, capacity, power=150, regen=0.5, flags=JOB_REGEN | JOB_CYCLE_REPEAT, cycle=b'udds',
+        duration=3000.0):
+    return JOB.pack(job_id, mode, 0, flags, 0, 400, capacity, power, regen, 0.01, duration, cycle, 0, 0, 0)
+
+
+def receive(sock, size):
+    data = b''
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise EOFError('server closed the connection')
+        data += chunk
+    return data
+
+
+def run_batch(path, jobs):
+    with socket.socket(socket.AF_UNIX) as sock:
+        sock.connect(path)
+        payload = HEADER.pack(MSG_BATCH, 1, 1, len(jobs)) + b''.join(jobs)
+        sock.sendall(struct.pack('<I', len(payload)) + payload)
+        results = {}
+        while True:
+            length, = struct.unpack('<I', receive(sock, 4))
+            frame = receive(sock, length)
+            message = HEADER.unpack_from(frame)[0]
+            if message == MSG_RESULT:
+                result = RESULT.unpack_from(frame, HEADER.size)
+                results[result[0]] = result
+            elif message == MSG_BATCH_DONE:
+                return results
+            else:
+                raise RuntimeError(f'unexpected message {message}')
+
+
+def start(binary, path, *options):
+    server = subprocess.Popen([binary, '--headless', 'serve', '--socket', path, '--threads', '1', *options],
+                              stderr=subprocess.DEVNULL)
+    for _ in range(200):
+        if os.path.exists(path):
+            return server
+        time.sleep(0.05)
+    server.kill()
+    raise RuntimeError('server did not start')
+
+
+def main():
+    binary = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else './evsim')
+    jobs = [
+        job(1, NORMAL, 200),
+        job(2, SPORT, 200, power=300),
+        job(3, ECO, 200, regen=0.0, flags=JOB_CYCLE_REPEAT),
+        job(4, SPORT, 10),                                      # runs empty part way
+        job(5, ECO, 60),                                        # runs empty near the end
+        job(6, SPORT, 10, flags=JOB_REGEN | JOB_UNTIL_EMPTY | JOB_CYCLE_REPEAT, duration=0),
+        job(7, NORMAL, 20, flags=JOB_REGEN | JOB_UNTIL_EMPTY | JOB_CYCLE_REPEAT, duration=0),
+        job(8, NORMAL, 100, cycle=b'wltc3', flags=JOB_REGEN, duration=0),
+        job(9, SPORT, 100, cycle=b'wltc3', flags=JOB_REGEN, duration=0),
+    ]
+    with tempfile.TemporaryDirectory() as directory:
+        single_path = os.path.join(directory, 'single.sock')
+        fleet_path = os.path.join(directory, 'fleet.sock')
+        servers = [start(binary, single_path, '--fleet-batch', '1'), start(binary, fleet_path)]
+        try:
+            single = run_batch(single_path, jobs)
+            fleet = run_batch(fleet_path, jobs)
+        finally:
+            for server in servers:
+                server.terminate()
+                server.wait()
+    coalesced = 0
+    for job_id in sorted(single):
+        alone, batched = single[job_id], fleet[job_id]
+        coalesced += bool(batched[2] & RESULT_COALESCED)
+        # job_id, status, steps, sim_time; then distance, energy, soc, efficiency, peak temperature
+        mismatch = [(f, alone[f], batched[f]) for f in (0, 1, 4, 5) if alone[f] != batched[f]]
+        mismatch += [(f, alone[f], batched[f]) for f in (6, 7, 8, 9, 10)
+                     if not math.isclose(alone[f], batched[f], rel_tol=1e-9, abs_tol=1e-9)]
+        assert not mismatch, f'job {job_id}: {mismatch}'
+        print(f'ok   job {job_id}{" (coalesced)" if batched[2] & RESULT_COALESCED else ""}')
+    assert coalesced >= 3, 'the fleet server coalesced too few jobs to test anything'
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Feeds ev_snapshot_load() truncated and oversized snapshot files through `fork --from`.
+
+Usage: tests/snapshot_load.py ./evsim
+
+Every damaged file must be refused with "Failed to load snapshot" and a clean exit status,
+never a crash or an allocation sized by the file.
+"""
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+HEADER = struct.Struct('<8sIIdqq')     # magic, version, flags, time, steps, samples
+HAS_PACK = 1
+HAS_HISTORY = 4
+SIM_VALUES = 16                        # doubles after the header, drive mode and regen included
+INTEGRATOR = 88                        # sizeof(EVIntegrator)
+
+
+def evsim(binary, *args):
+    return subprocess.run([binary, '--headless', *args], capture_output=True, text=True, timeout=120)
+
+
+def save(binary, directory, name, *args):
+    path = os.path.join(directory, name)
+    result = evsim(binary, 'fork', '--at-km', '5', '--save', path, *args)
+    assert result.returncode == 0, result.stderr
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def expect_refused(binary, directory, name, data):
+    path = os.path.join(directory, name)
+    with open(path, 'wb') as f:
+        f.write(data)
+    result = evsim(binary, 'fork', '--from', path)
+    assert result.returncode in (0, 1), f'{name}: exit status {result.returncode}\n{result.stderr}'
+    assert 'Failed to load snapshot' in result.stderr, f'{name}: loaded\n{result.stderr}'
+    print(f'ok   {name}')
+
+
+def main():
+    binary = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else './evsim')
+    with tempfile.TemporaryDirectory() as directory:
+        plain = save(binary, directory, 'plain.snap')
+        packed = save(binary, directory, 'pack.snap', '--pack', '96s4p')
+        result = evsim(binary, 'fork', '--from', os.path.join(directory, 'plain.snap'))
+        assert result.returncode == 0 and 'Failed' not in result.stderr, result.stderr
+        print('ok   intact file loads')
+
+        for length in (0, 4, HEADER.size - 1, HEADER.size, HEADER.size + 8 * SIM_VALUES - 1, len(plain) - 1):
+            expect_refused(binary, directory, f'truncated_{length}', plain[:length])
+
+        magic, version, flags, time, steps, _ = HEADER.unpack_from(plain)
+        for samples in (2 ** 61 + 1, 2 ** 62, 2 ** 63 - 1, 1000):
+            header = HEADER.pack(magic, version, flags | HAS_HISTORY, time, steps, samples)
+            expect_refused(binary, directory, f'samples_{samples}', header + plain[HEADER.size:] + bytes(32))
+
+        pack_offset = HEADER.size + 8 * SIM_VALUES + INTEGRATOR
+        for series, parallel in ((2 ** 31 - 1, 2), (65536, 65536), (1001, 1), (96, 101), (0, 4), (-96, 4)):
+            data = bytearray(packed)
+            struct.pack_into('<ii', data, pack_offset, series, parallel)
+            expect_refused(binary, directory, f'pack_{series}x{parallel}', bytes(data))
+        assert struct.unpack_from('<I', packed, 12)[0] & HAS_PACK
+
+
+if __name__ == '__main__':
+    main()